@@ -0,0 +1,147 @@
+##############################################
+## Packs UI images and animations into a read-only asset image for the
+## spiffs partition. The firmware maps it with AssetStore (src/AssetStore.cpp)
+## and blits assets straight from flash.
+##
+## Flash the result with:
+##   esptool.py --chip esp32 write_flash 0x290000 assets.bin
+##############################################
+
+import os
+import re
+import sys
+import struct
+import argparse
+
+import numpy as np
+
+# Reuse the colour conversion (and dithering) from the bitmap converter
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "BitmapGen"))
+
+ASSET_MAGIC = b"SOSA"
+ASSET_VERSION = 1
+ASSET_NAME_LENGTH = 32
+# Size of the spiffs partition in partitions.csv
+PARTITION_SIZE = 0x170000
+
+FORMAT_RAW = 0
+FORMAT_RGB565 = 1
+FORMAT_RGB332 = 2
+
+HEADER_STRUCT = struct.Struct("<4sHHII")          # asset_image_header_t
+ENTRY_STRUCT = struct.Struct("<32sIIHHB3x")        # asset_entry_t
+
+
+def image_asset(image_path, name, fmt="rgb565", dither=False):
+    """
+    Load an image file and convert it to an RGB565 or RGB332 asset.
+
+    Args:
+        image_path: Path to any image PIL can open
+        name: Asset name used for lookups on the device
+        fmt: 'rgb565' or 'rgb332'
+        dither: Ordered-dither the colour reduction
+    """
+    from PIL import Image
+    from convertIMGtoCarray import rgb888_to_rgb332, rgb888_to_rgb565
+
+    img = np.array(Image.open(image_path).convert("RGB"))
+    height, width, _ = img.shape
+    if fmt == "rgb332":
+        data = rgb888_to_rgb332(img, dither).astype(np.uint8).tobytes()
+        return dict(name=name, data=data, width=width, height=height, format=FORMAT_RGB332)
+    data = rgb888_to_rgb565(img, dither).astype("<u2").tobytes()
+    return dict(name=name, data=data, width=width, height=height, format=FORMAT_RGB565)
+
+
+def frame_dir_assets(folder, prefix):
+    """
+    Turn a converter output folder (info.txt plus frame%d.bin) into one asset
+    per frame, named <prefix>/frame<N>.
+    """
+    info = {}
+    with open(os.path.join(folder, "info.txt")) as info_file:
+        for line in info_file:
+            if ":" in line:
+                key, value = line.split(":", 1)
+                info[key.strip().lower()] = value.strip()
+    width = int(info["width"])
+    height = int(info["height"])
+
+    assets = []
+    frames = sorted((int(m.group(1)), f) for f in os.listdir(folder)
+                    for m in [re.match(r"frame(\d+)\.bin$", f)] if m)
+    for index, filename in frames:
+        with open(os.path.join(folder, filename), "rb") as bin_file:
+            data = bin_file.read()
+        # The converters write either 8-bit or 16-bit frames
+        fmt = FORMAT_RGB565 if len(data) == width * height * 2 else FORMAT_RGB332
+        assets.append(dict(name=f"{prefix}/frame{index}", data=data, width=width, height=height, format=fmt))
+    return assets
+
+
+def raw_asset(path, name):
+    """Store any file unchanged."""
+    with open(path, "rb") as raw_file:
+        return dict(name=name, data=raw_file.read(), width=0, height=0, format=FORMAT_RAW)
+
+
+def pack_assets(assets, output_path, partition_size=PARTITION_SIZE):
+    """
+    Write the asset image: header, entry table sorted by name, then the
+    asset data, each aligned to 4 bytes.
+    """
+    assets = sorted(assets, key=lambda a: a["name"].encode())
+    names = [a["name"] for a in assets]
+    if len(set(names)) != len(names):
+        raise ValueError("Duplicate asset names")
+    for asset in assets:
+        if len(asset["name"].encode()) >= ASSET_NAME_LENGTH:
+            raise ValueError(f"Asset name too long: {asset['name']}")
+
+    table_offset = HEADER_STRUCT.size
+    offset = table_offset + ENTRY_STRUCT.size * len(assets)
+    table = b""
+    blobs = b""
+    for asset in assets:
+        pad = (-offset) % 4
+        blobs += b"\0" * pad
+        offset += pad
+        table += ENTRY_STRUCT.pack(asset["name"].encode(), offset, len(asset["data"]),
+                                   asset["width"], asset["height"], asset["format"])
+        blobs += asset["data"]
+        offset += len(asset["data"])
+
+    image_size = offset
+    if image_size > partition_size:
+        raise ValueError(f"Asset image is {image_size} bytes, partition holds {partition_size}")
+
+    header = HEADER_STRUCT.pack(ASSET_MAGIC, ASSET_VERSION, len(assets), table_offset, image_size)
+    with open(output_path, "wb") as out:
+        out.write(header + table + blobs)
+
+    print(f"Packed {len(assets)} assets into {output_path}: {image_size} bytes "
+          f"({image_size * 100 // partition_size}% of partition)")
+    return image_size
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Pack assets for the flash asset partition")
+    parser.add_argument("output", help="Output image, e.g. assets.bin")
+    parser.add_argument("inputs", nargs="+",
+                        help="Image files, frame folders (with info.txt) or raw files")
+    parser.add_argument("--rgb332", action="store_true", help="Convert images to RGB332 instead of RGB565")
+    parser.add_argument("--dither", action="store_true", help="Ordered-dither image colour reduction")
+    args = parser.parse_args()
+
+    assets = []
+    for path in args.inputs:
+        base = os.path.basename(os.path.normpath(path))
+        if os.path.isdir(path):
+            assets.extend(frame_dir_assets(path, base))
+        elif os.path.splitext(path)[1].lower() in (".png", ".jpg", ".jpeg", ".bmp", ".gif"):
+            name = os.path.splitext(base)[0]
+            assets.append(image_asset(path, name, "rgb332" if args.rgb332 else "rgb565", args.dither))
+        else:
+            assets.append(raw_asset(path, base))
+    pack_assets(assets, args.output)
@@ -0,0 +1,126 @@
+##############################################
+## Records and compares results from the bench firmware (pio run -e bench,
+## src/bench/). Save the serial monitor output of a run, then either store
+## it as the baseline:
+##   python bench_compare.py run.log --save baselines/esp32dev.json
+## or check a later run against it:
+##   python bench_compare.py run.log --baseline baselines/esp32dev.json
+## The exit code is 1 when any case regressed past the threshold.
+## The native build's bench (pio run -e native -t exec) prints the same
+## lines, so CI can keep a host baseline the same way:
+##   .pio/build/native/program > host.log
+##   python bench_compare.py host.log --baseline baselines/native.json
+##############################################
+
+import sys
+import json
+import argparse
+
+BENCH_PREFIX = "BENCH "
+
+
+def parse_run(lines):
+    """
+    Collect the BENCH lines of one run.
+
+    Returns:
+        (config, results): the build description and a dict of case name
+        to result, failed cases have an 'error' entry
+    """
+    config = {}
+    results = {}
+    for line in lines:
+        start = line.find(BENCH_PREFIX)
+        if start < 0:
+            continue
+        try:
+            record = json.loads(line[start + len(BENCH_PREFIX):])
+        except ValueError:
+            # Cut off or interleaved with other output
+            continue
+        if "config" in record:
+            # A new run in the same log starts over
+            config = record
+            results = {}
+        elif "name" in record:
+            results[record["name"]] = record
+    return config, results
+
+
+def compare(baseline, current, threshold):
+    """
+    Compare median latency case by case. A case regresses when its p50 is
+    more than threshold percent slower than the baseline; p99 is shown but
+    only warned about, it is too noisy with the default iteration count.
+
+    Returns:
+        Number of regressions
+    """
+    regressions = 0
+    print("%-32s %10s %10s %8s %10s %10s" % ("case", "base p50", "p50", "change", "base p99", "p99"))
+    for name in sorted(set(baseline) | set(current)):
+        base = baseline.get(name)
+        cur = current.get(name)
+        if cur is None:
+            print("%-32s missing from this run" % name)
+            regressions += 1
+            continue
+        if "error" in cur:
+            print("%-32s failed: %s" % (name, cur["error"]))
+            regressions += 1
+            continue
+        if base is None or "error" in base:
+            print("%-32s %10s %10d %8s %10s %10d  new" % (name, "-", cur["p50_us"], "-", "-", cur["p99_us"]))
+            continue
+
+        change = 100.0 * (cur["p50_us"] - base["p50_us"]) / max(base["p50_us"], 1)
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSED"
+            regressions += 1
+        elif change < -threshold:
+            flag = "  faster"
+        elif cur["p99_us"] > base["p99_us"] * (1 + 2 * threshold / 100.0):
+            flag = "  p99 up"
+        print("%-32s %10d %10d %+7.1f%% %10d %10d%s" %
+              (name, base["p50_us"], cur["p50_us"], change, base["p99_us"], cur["p99_us"], flag))
+    return regressions
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Record or compare bench firmware results")
+    parser.add_argument("log", help="Serial monitor output of a bench run")
+    parser.add_argument("--save", help="Write this run as a baseline JSON file")
+    parser.add_argument("--baseline", help="Baseline JSON file to compare against")
+    parser.add_argument("--threshold", type=float, default=10.0, help="Allowed p50 slowdown in percent")
+    args = parser.parse_args()
+
+    with open(args.log, "r", errors="replace") as f:
+        config, results = parse_run(f)
+    if not results:
+        print("No BENCH results in %s" % args.log)
+        sys.exit(1)
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump({"config": config, "results": results}, f, indent=2, sort_keys=True)
+        print("Saved %d cases to %s" % (len(results), args.save))
+
+    if args.baseline:
+        with open(args.baseline, "r") as f:
+            baseline = json.load(f)
+        if baseline.get("config", {}).get("config") != config.get("config"):
+            print("Baseline was recorded with %s, this run is %s; sizes differ so results do not compare" %
+                  (baseline.get("config", {}).get("config"), config.get("config")))
+            sys.exit(1)
+        regressions = compare(baseline["results"], results, args.threshold)
+        print("%d regression(s)" % regressions)
+        sys.exit(1 if regressions else 0)
+
+    if not args.save:
+        for name in sorted(results):
+            r = results[name]
+            if "error" in r:
+                print("%-32s failed: %s" % (name, r["error"]))
+            else:
+                print("%-32s p50 %8d us  p99 %8d us  %8.3f MB/s" % (name, r["p50_us"], r["p99_us"], r["mbps"]))
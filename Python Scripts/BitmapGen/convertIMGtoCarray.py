@@ -12,6 +12,54 @@ import cv2
 import struct
 
 
+# 4x4 Bayer threshold matrix, matches BAYER_4X4 in src/FrameUtils.cpp
+BAYER_4X4 = np.array([[ 0,  8,  2, 10],
+                      [12,  4, 14,  6],
+                      [ 3, 11,  1,  9],
+                      [15,  7, 13,  5]], dtype=np.uint16)
+
+def _dither_channel(channel, bits):
+    """
+    Add an ordered-dither bias of up to one quantisation step to a channel
+    and return the top `bits` bits. Same arithmetic as the firmware kernels.
+    """
+    height, width = channel.shape
+    step = 256 >> bits
+    tiles = np.tile(BAYER_4X4, (height // 4 + 1, width // 4 + 1))[:height, :width]
+    biased = channel.astype(np.uint16) + (tiles * step) // 16
+    return (np.minimum(biased, 255) >> (8 - bits)).astype(np.uint16)
+
+def rgb888_to_rgb332(img_array, dither=False):
+    """
+    Convert an (H, W, 3) RGB888 array to packed RGB332 (RRRGGGBB).
+    With dither=True a 4x4 Bayer pattern replaces plain truncation.
+    """
+    if dither:
+        r = _dither_channel(img_array[:,:,0], 3)
+        g = _dither_channel(img_array[:,:,1], 3)
+        b = _dither_channel(img_array[:,:,2], 2)
+    else:
+        r = (img_array[:,:,0] >> 5) & 0x07  # Extract top 3 bits for R
+        g = (img_array[:,:,1] >> 5) & 0x07  # Extract top 3 bits for G
+        b = (img_array[:,:,2] >> 6) & 0x03  # Extract top 2 bits for B
+    return ((r << 5) | (g << 2) | b).astype(np.uint8)
+
+def rgb888_to_rgb565(img_array, dither=False):
+    """
+    Convert an (H, W, 3) RGB888 array to RGB565 values (uint16).
+    With dither=True a 4x4 Bayer pattern replaces plain truncation.
+    """
+    if dither:
+        r = _dither_channel(img_array[:,:,0], 5)
+        g = _dither_channel(img_array[:,:,1], 6)
+        b = _dither_channel(img_array[:,:,2], 5)
+    else:
+        r = (img_array[:,:,0] >> 3).astype(np.uint16)
+        g = (img_array[:,:,1] >> 2).astype(np.uint16)
+        b = (img_array[:,:,2] >> 3).astype(np.uint16)
+    return (r << 11) | (g << 5) | b
+
+
 ## Convert video to RGB332 format with all frames stacked vertically
 # Process each frame of an animated video into RGB332 format
 # Generate a C header file with frames stacked in a single array
@@ -21,7 +69,9 @@ import struct
 # @param output_name Name for the output header file (without extension)
 # @param max_frames Maximum number of frames to process (None for all)
 # @param rotate_k Number of 90 degree rotations to apply to each frame (0, 1, 2, or 3)
-def convert_video_to_rgb332_frames(video_path, output_name, max_frames=None, rotate_k = 0):
+# @param dither Use ordered dithering instead of truncating to RGB332
+# @param frame_rate Playback rate stored in the header
+def convert_video_to_rgb332_frames(video_path, output_name, max_frames=None, rotate_k = 0, dither=False, frame_rate=15):
     """
     Convert a video file to a C header file with each frame as a separate array.
     Frames are stacked vertically in the data structure.
@@ -29,6 +79,7 @@ def convert_video_to_rgb332_frames(video_path, output_name, max_frames=None, rot
     Args:
         video_path (str): Path to the video file
         output_name (str): Name for the output header file (without extension)
+        frame_rate (int): Playback rate written to the header for FlashAnimation
     """
     import numpy as np
     from wand.image import Image
@@ -69,12 +120,7 @@ def convert_video_to_rgb332_frames(video_path, output_name, max_frames=None, rot
             img_array = np.rot90(img_array, k=rotate_k)
             
             # Convert to RGB332 (8-bit, RRRGGGBB)
-            r = (img_array[:,:,0] >> 5) & 0x07  # Extract top 3 bits for R
-            g = (img_array[:,:,1] >> 5) & 0x07  # Extract top 3 bits for G
-            b = (img_array[:,:,2] >> 6) & 0x03  # Extract top 2 bits for B
-            
-            # Pack into a single byte per pixel: RRRGGGBB
-            rgb332 = (r << 5) | (g << 2) | b
+            rgb332 = rgb888_to_rgb332(img_array, dither)
             
             # Flatten the array and add to collection
             all_frames_data.append(rgb332.flatten())
@@ -97,9 +143,11 @@ def convert_video_to_rgb332_frames(video_path, output_name, max_frames=None, rot
             f.write(f"#define {output_name.upper()}_WIDTH {width}\n")
             f.write(f"#define {output_name.upper()}_HEIGHT {height}\n")
             f.write(f"#define {output_name.upper()}_FRAMES {num_frames}\n")
-            f.write(f"#define {output_name.upper()}_FRAME_SIZE ({width}*{height})\n\n")
+            f.write(f"#define {output_name.upper()}_FRAME_SIZE ({width}*{height})\n")
+            f.write(f"#define {output_name.upper()}_FRAME_RATE {frame_rate}\n\n")
             
-            f.write(f"const uint8_t {output_name}[] = {{\n")
+            # Kept in flash and played with FlashAnimation (include/FlashAnimation.h)
+            f.write(f"const uint8_t {output_name}[] PROGMEM = {{\n")
             
             # Write data in rows of 12 values
             for i in range(0, len(stacked_data), 12):
@@ -115,6 +163,9 @@ def convert_video_to_rgb332_frames(video_path, output_name, max_frames=None, rot
             f.write("// Helper macro to access a specific frame\n")
             f.write(f"#define {output_name.upper()}_FRAME(n) ")
             f.write(f"(&{output_name}[(n) * {output_name.upper()}_FRAME_SIZE])\n\n")
+            f.write("// Compile-time accessor for a specific frame\n")
+            f.write(f"constexpr const uint8_t *{output_name}_frame(int n) {{ ")
+            f.write(f"return {output_name} + n * {output_name.upper()}_FRAME_SIZE; }}\n\n")
             
             f.write("#endif\n")
                 
@@ -130,6 +181,35 @@ def convert_video_to_rgb332_frames(video_path, output_name, max_frames=None, rot
         print(f"Successfully created header file: {header_file}")
         print(f"Total size: {len(stacked_data)} bytes")
 
+def rgb888_to_indexed4(img_array, dither=False):
+    """
+    Quantise an (H, W, 3) RGB888 frame to 16 colours. Returns the frame file
+    for VARIANT_INDEXED4: a 16 byte RGB332 palette followed by 4 bit
+    indices, two pixels per byte with the first in the high nibble.
+    """
+    from PIL import Image as PILImage
+    height, width, _ = img_array.shape
+    quantised = PILImage.fromarray(img_array.astype(np.uint8), 'RGB').quantize(
+        colors=16, dither=PILImage.Dither.FLOYDSTEINBERG if dither else PILImage.Dither.NONE)
+    palette = np.array(quantised.getpalette()[:48], dtype=np.uint8).reshape(-1, 3)
+    palette = np.vstack([palette, np.zeros((16 - len(palette), 3), dtype=np.uint8)])
+    palette332 = rgb888_to_rgb332(palette.reshape(1, 16, 3)).flatten()
+    indices = np.array(quantised, dtype=np.uint8).flatten()
+    if len(indices) % 2:
+        indices = np.append(indices, 0)
+    packed = (indices[0::2] << 4) | indices[1::2]
+    return np.concatenate([palette332, packed.astype(np.uint8)])
+
+def rgb888_to_half_rgb332(img_array, dither=False):
+    """
+    Downscale an (H, W, 3) RGB888 frame by two in each direction (box
+    filter) and convert it to RGB332, the VARIANT_RGB332_HALF frame file.
+    """
+    height, width, _ = img_array.shape
+    cropped = img_array[:height - height % 2, :width - width % 2].astype(np.uint16)
+    half = (cropped[0::2, 0::2] + cropped[1::2, 0::2] + cropped[0::2, 1::2] + cropped[1::2, 1::2] + 2) // 4
+    return rgb888_to_rgb332(half.astype(np.uint8), dither).flatten()
+
 ## Convert video to RGB332 format and save each frame as a binary file
 # Process each frame of an animated video into RGB332 format
 # Save each frame as a binary file in the specified output folder
@@ -137,8 +217,13 @@ def convert_video_to_rgb332_frames(video_path, output_name, max_frames=None, rot
 # @param video_path Path to the video file
 # @param output_folder Path to the output folder where binary files will be stored
 # @param max_frames Maximum number of frames to process (None for all)
-# @param rotate_k Number of 90 degree rotations to apply to each frame (0, 1, 2, or 3)
-def convert_video_to_rgb332_bin_frames(video_path, output_folder, max_frames=None, rotate_k=0):
+# @param rotate_k Number of 90 degree rotations to apply to each frame (0, 1, 2, or 3).
+#                 Prefer 0 and setSDVideoRotation() on the device so one asset
+#                 set serves every orientation.
+# @param dither Use ordered dithering instead of truncating to RGB332
+# @param variants Also write the cheaper idx4/ and half/ variants used for
+#                 adaptive playback (see setSDVideoVariants)
+def convert_video_to_rgb332_bin_frames(video_path, output_folder, max_frames=None, rotate_k=0, dither=False, variants=False):
     """
     Convert a video file to a series of binary files, each containing a frame in RGB332 format.
     
@@ -147,6 +232,8 @@ def convert_video_to_rgb332_bin_frames(video_path, output_folder, max_frames=Non
         output_folder (str): Path to the output folder where binary files will be stored
         max_frames (int, optional): Maximum number of frames to process. Defaults to None (all frames).
         rotate_k (int, optional): Number of 90 degree rotations to apply. Defaults to 0.
+        dither (bool, optional): Ordered-dither to RGB332 instead of truncating. Defaults to False.
+        variants (bool, optional): Also write the idx4/ and half/ variants. Defaults to False.
     """
     import numpy as np
     from wand.image import Image
@@ -159,6 +246,9 @@ def convert_video_to_rgb332_bin_frames(video_path, output_folder, max_frames=Non
     if os.path.exists(output_folder):
         shutil.rmtree(output_folder)
     os.makedirs(output_folder)
+    if variants:
+        os.makedirs(os.path.join(output_folder, "idx4"))
+        os.makedirs(os.path.join(output_folder, "half"))
     
     # Open the video and coalesce frames
     with Image(filename=video_path) as img:
@@ -194,18 +284,17 @@ def convert_video_to_rgb332_bin_frames(video_path, output_folder, max_frames=Non
             frame_height, frame_width, _ = img_array.shape
             
             # Convert to RGB332 (8-bit, RRRGGGBB)
-            r = (img_array[:,:,0] >> 5) & 0x07  # Extract top 3 bits for R
-            g = (img_array[:,:,1] >> 5) & 0x07  # Extract top 3 bits for G
-            b = (img_array[:,:,2] >> 6) & 0x03  # Extract top 2 bits for B
-            
-            # Pack into a single byte per pixel: RRRGGGBB
-            rgb332 = (r << 5) | (g << 2) | b
+            rgb332 = rgb888_to_rgb332(img_array, dither)
             
             # Save to binary file
             bin_filename = os.path.join(output_folder, f"frame{i+1}.bin")
             with open(bin_filename, "wb") as bin_file:
                 # Convert to bytes and write
                 rgb332.astype(np.uint8).tofile(bin_file)
+
+            if variants:
+                rgb888_to_indexed4(img_array, dither).tofile(os.path.join(output_folder, "idx4", f"frame{i+1}.bin"))
+                rgb888_to_half_rgb332(img_array, dither).tofile(os.path.join(output_folder, "half", f"frame{i+1}.bin"))
             
             print(f"Saved frame {i+1}/{num_frames} to {bin_filename} - Dimensions: {frame_width}x{frame_height}")
         
@@ -228,7 +317,8 @@ def convert_video_to_rgb332_bin_frames(video_path, output_folder, max_frames=Non
 # @param image_path Path to the image file
 # @param image_name Name of the image file
 # @param rotate_k Number of 90 degree rotations to apply to the image
-def convert_bmp_to_rgb332(image_path, image_name, rotate_k):
+# @param dither Use ordered dithering instead of truncating to RGB332
+def convert_bmp_to_rgb332(image_path, image_name, rotate_k, dither=False):
     """Convert BMP to RGB332 format and verify the conversion."""
     # Load the image
     img = Image.open(image_path)
@@ -245,12 +335,7 @@ def convert_bmp_to_rgb332(image_path, image_name, rotate_k):
     
     # Convert to RGB332 (1 byte per pixel)
     # 3 bits for R (0-7), 3 bits for G (0-7), 2 bits for B (0-3)
-    r = (img_array[:,:,0] >> 5) & 0x07  # Extract top 3 bits
-    g = (img_array[:,:,1] >> 5) & 0x07  # Extract top 3 bits
-    b = (img_array[:,:,2] >> 6) & 0x03  # Extract top 2 bits
-    
-    # Pack into a single byte per pixel: RRRGGGBB
-    rgb332 = (r << 5) | (g << 2) | b
+    rgb332 = rgb888_to_rgb332(img_array, dither)
     
     # Flatten the array for C export
     flat_rgb332 = rgb332.flatten()
@@ -457,24 +542,22 @@ def convert_frame_to_bitmap(frame, format='1bit'):
     
     return bitmap_array
 
-def save_rgb565_bin(frame, filename):
+def save_rgb565_bin(frame, filename, dither=False):
     """
     Save a numpy RGB frame as a raw RGB565 binary file.
     Args:
         frame: numpy array (H, W, 3), dtype=uint8, RGB order
         filename: output .bin file path
+        dither: ordered-dither to RGB565 instead of truncating
     """
     # Convert to RGB565
-    r = (frame[:,:,0] >> 3).astype(np.uint16)
-    g = (frame[:,:,1] >> 2).astype(np.uint16)
-    b = (frame[:,:,2] >> 3).astype(np.uint16)
-    rgb565 = (r << 11) | (g << 5) | b
+    rgb565 = rgb888_to_rgb565(frame, dither)
     # Write as little-endian bytes
     with open(filename, "wb") as f:
         for val in rgb565.flatten():
             f.write(struct.pack('<H', val))
 
-def process_video(video_path, display_width, display_height, output_folder=None, max_frames=None, rotate_k=0, save_rgb565=True):
+def process_video(video_path, display_width, display_height, output_folder=None, max_frames=None, rotate_k=0, save_rgb565=True, dither=False):
     """
     Process video file, resizing frames and converting to RGB332, saving each as a .bin file.
     Also saves 16-bit RGB565 .bin files if save_rgb565 is True.
@@ -486,6 +569,7 @@ def process_video(video_path, display_width, display_height, output_folder=None,
         max_frames: Maximum number of frames to process
         rotate_k: Number of 90-degree rotations to apply
         save_rgb565: Whether to save 16-bit RGB565 .bin files
+        dither: Ordered-dither colour reduction instead of truncating
     """
     import os
     import shutil
@@ -514,10 +598,7 @@ def process_video(video_path, display_width, display_height, output_folder=None,
         if rotate_k:
             resized_frame = np.rot90(resized_frame, k=rotate_k)
         # Convert to RGB332
-        r = (resized_frame[:,:,0] >> 5) & 0x07
-        g = (resized_frame[:,:,1] >> 5) & 0x07
-        b = (resized_frame[:,:,2] >> 6) & 0x03
-        rgb332 = (r << 5) | (g << 2) | b
+        rgb332 = rgb888_to_rgb332(resized_frame, dither)
         # Save to .bin file (8-bit)
         if (not save_rgb565):
             bin_filename = os.path.join(output_folder, f"frame{frame_number+1}.bin")
@@ -525,7 +606,7 @@ def process_video(video_path, display_width, display_height, output_folder=None,
         # Save as 16-bit RGB565 if requested
         if save_rgb565:
             rgb565_filename = os.path.join(output_folder, f"frame{frame_number+1}.bin")
-            save_rgb565_bin(resized_frame, rgb565_filename)
+            save_rgb565_bin(resized_frame, rgb565_filename, dither)
         frame_number += 1
         if frame_number % 30 == 0:
             print(f"Processing frame {frame_number}/{num_frames}")
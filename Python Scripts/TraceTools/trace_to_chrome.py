@@ -0,0 +1,102 @@
+##############################################
+## Converts a trace captured with the "trace dump" serial command
+## (Tracer::dumpBinary, src/Tracer.cpp) into Chrome trace JSON for
+## chrome://tracing or https://ui.perfetto.dev.
+##
+## Save the serial monitor output to a file, log lines and all, then:
+##   python trace_to_chrome.py monitor.log trace.json
+##############################################
+
+import sys
+import json
+import struct
+import argparse
+
+# trace_event_t
+EVENT_STRUCT = struct.Struct("<IIIBBBx")
+
+# Same order as TraceEvent in include/Tracer.h
+EVENT_NAMES = ["load", "handoff", "draw", "mutex_wait", "audio_batch", "sd_read", "wdt_feed"]
+PHASES = "BEi"
+
+
+def parse_dump(lines):
+    """
+    Pull the task names and events out of serial output. Lines that are not
+    part of a dump are skipped; when the output holds several dumps the
+    last one wins.
+
+    Returns:
+        (tasks, events): task handle to name, and a list of event dicts
+    """
+    tasks = {}
+    events = []
+    for line in lines:
+        line = line.strip()
+        if line.startswith("trace: begin"):
+            tasks = {}
+            events = []
+        elif line.startswith("trace: task "):
+            parts = line.split(" ", 3)
+            tasks[int(parts[2], 16)] = parts[3] if len(parts) > 3 else "?"
+        elif line.startswith("T ") and len(line) == 2 + 2 * EVENT_STRUCT.size:
+            time_us, task, arg, event, phase, core = EVENT_STRUCT.unpack(bytes.fromhex(line[2:]))
+            events.append(dict(time_us=time_us, task=task, arg=arg, event=event, phase=phase, core=core))
+    return tasks, events
+
+
+def to_chrome(tasks, events):
+    """
+    Build the Chrome trace object. Each FreeRTOS task becomes a thread; the
+    core an event ran on is kept in its args.
+    """
+    trace = []
+    for task, name in tasks.items():
+        trace.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": task, "args": {"name": name}})
+    for e in events:
+        name = EVENT_NAMES[e["event"]] if e["event"] < len(EVENT_NAMES) else "event%d" % e["event"]
+        entry = {"name": name, "ph": PHASES[min(e["phase"], 2)], "ts": e["time_us"], "pid": 1, "tid": e["task"],
+                 "args": {"arg": e["arg"], "core": e["core"]}}
+        if entry["ph"] == "i":
+            entry["s"] = "t"
+        trace.append(entry)
+    return {"displayTimeUnit": "ms", "traceEvents": trace}
+
+
+def summarize(tasks, events):
+    """Print the time each task spent in each span, a quick look without a viewer."""
+    open_spans = {}
+    totals = {}
+    for e in events:
+        key = (e["task"], e["event"])
+        if e["phase"] == 0:
+            open_spans.setdefault(key, []).append(e["time_us"])
+        elif e["phase"] == 1 and open_spans.get(key):
+            started = open_spans[key].pop()
+            count, total, longest = totals.get(key, (0, 0, 0))
+            duration = e["time_us"] - started
+            totals[key] = (count + 1, total + duration, max(longest, duration))
+    for (task, event), (count, total, longest) in sorted(totals.items()):
+        name = EVENT_NAMES[event] if event < len(EVENT_NAMES) else "event%d" % event
+        print("%-16s %-12s %6d spans, avg %8.1f us, max %8d us" %
+              (tasks.get(task, "%08x" % task), name, count, total / count, longest))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Convert a serial trace dump to Chrome trace JSON")
+    parser.add_argument("input", help="Serial monitor output containing a 'trace dump'")
+    parser.add_argument("output", help="JSON file to write")
+    parser.add_argument("--summary", action="store_true", help="Also print span totals per task")
+    args = parser.parse_args()
+
+    with open(args.input, "r", errors="replace") as f:
+        tasks, events = parse_dump(f)
+    if not events:
+        print("No trace records found in %s" % args.input)
+        sys.exit(1)
+
+    with open(args.output, "w") as f:
+        json.dump(to_chrome(tasks, events), f)
+    print("Wrote %d events from %d tasks to %s" % (len(events), len(tasks), args.output))
+    if args.summary:
+        summarize(tasks, events)
@@ -57,6 +57,7 @@ class AVIFileReader : public FrameSource
 {
 private:
     int m_frame_rate;
+    uint32_t m_frame_interval_us;
     int m_frame_width;
     int m_frame_height;
     uint32_t m_total_frames;
@@ -75,6 +76,7 @@ public:
     AVIFileReader(const char *file_name);
     ~AVIFileReader();
     int frameRate() { return m_frame_rate; }
+    uint32_t frameIntervalUs() { return m_frame_interval_us; }
     int frameWidth() { return m_frame_width; }
     int frameHeight() { return m_frame_height; }
     bool getNextFrame(VideoFrame_t *frame);
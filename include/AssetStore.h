@@ -0,0 +1,105 @@
+#ifndef __asset_store_h__
+#define __asset_store_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+#endif
+
+// Partition the packed asset image is flashed to (see partitions.csv)
+#ifndef ASSET_PARTITION_LABEL
+#define ASSET_PARTITION_LABEL "spiffs"
+#endif
+
+#define ASSET_MAGIC "SOSA"
+#define ASSET_VERSION 1
+#define ASSET_NAME_LENGTH 32
+
+// Pixel layout of an asset's data
+enum AssetFormat
+{
+    ASSET_FORMAT_RAW = 0,
+    ASSET_FORMAT_RGB565 = 1,   // little-endian 16-bit pixels
+    ASSET_FORMAT_RGB332 = 2
+};
+
+// On-flash layout, written by Python Scripts/AssetPack/pack_assets.py
+typedef struct
+{
+    char magic[4];            // Contains "SOSA"
+    uint16_t version;
+    uint16_t count;           // Number of entries in the table
+    uint32_t table_offset;    // Offset of the entry table from the image start
+    uint32_t image_size;      // Total bytes used in the partition
+} asset_image_header_t;
+
+typedef struct
+{
+    char name[ASSET_NAME_LENGTH]; // NUL terminated, entries sorted by name
+    uint32_t offset;              // 4-byte aligned, from the image start
+    uint32_t size;
+    uint16_t width;
+    uint16_t height;
+    uint8_t format;
+    uint8_t reserved[3];
+} asset_entry_t;
+
+typedef struct
+{
+    const char *name;
+    const uint8_t *data;      // points into mapped flash, never copied
+    uint32_t size;
+    uint16_t width;
+    uint16_t height;
+    uint8_t format;
+} asset_t;
+
+/**
+ * Read-only asset store packed into a flash partition and accessed
+ * through esp_partition_mmap, so assets are used in place without being
+ * copied to RAM. On the host the same image is read from an mmap'd file.
+ **/
+class AssetStore
+{
+private:
+    const uint8_t *m_base;
+    uint32_t m_size;
+    const asset_entry_t *m_entries;
+    int m_count;
+#ifdef ARDUINO
+    uint32_t m_mmap_handle;
+#else
+    int m_fd;
+#endif
+
+    bool validate();
+
+public:
+    AssetStore();
+    ~AssetStore();
+
+#ifdef ARDUINO
+    // Map the asset partition into the data address space
+    bool begin(const char *partition_label = ASSET_PARTITION_LABEL);
+#else
+    // Host stand-in: map a packed image file
+    bool begin(const char *image_path);
+#endif
+    void end();
+
+    bool isOpen() { return m_entries != nullptr; }
+    int count() { return m_count; }
+    bool at(int index, asset_t *asset);
+    // Binary search by name
+    bool find(const char *name, asset_t *asset);
+
+#ifdef ARDUINO
+    // Blit an image asset straight from mapped flash
+    bool pushImage(TFT_eSPI *tft, int x, int y, const char *name);
+#endif
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef __block_cache_h__
+#define __block_cache_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLOCK_CACHE_SECTOR_SIZE 512
+
+// Defaults used by installSDBlockCache()
+#ifndef BLOCK_CACHE_BLOCKS
+#define BLOCK_CACHE_BLOCKS 32
+#endif
+#ifndef BLOCK_CACHE_READ_AHEAD
+#define BLOCK_CACHE_READ_AHEAD 4
+#endif
+
+/**
+ * Raw 512-byte block access underneath the file system
+ **/
+class BlockDevice
+{
+public:
+    virtual ~BlockDevice() {}
+    virtual bool readBlocks(uint32_t lba, uint8_t *buffer, uint32_t count) = 0;
+    virtual bool writeBlocks(uint32_t lba, const uint8_t *buffer, uint32_t count) = 0;
+};
+
+typedef struct
+{
+    uint32_t hits;             // blocks served from the cache
+    uint32_t misses;           // blocks that had to be read from the device
+    uint32_t read_ahead;       // blocks fetched speculatively
+    uint32_t read_ahead_hits;  // speculative blocks that were later used
+    uint32_t bypassed;         // blocks in large reads that skipped the cache
+    uint32_t device_reads;     // read transactions issued to the device
+    uint32_t writes;           // blocks written through
+} block_cache_stats_t;
+
+/**
+ * Write-through LRU cache of device blocks. Blocks inside the pinned range
+ * (normally the FAT) are kept in preference to everything else, single
+ * block reads that follow on from the last one fetch a few blocks ahead in
+ * the same transaction, and large multi-block reads go straight to the
+ * device so streaming data does not flush the metadata out.
+ *
+ * Not locked itself; on the device the SD glue serialises all callers.
+ **/
+class BlockCache
+{
+private:
+    typedef struct
+    {
+        uint32_t lba;
+        uint32_t last_use;
+        bool valid;
+        bool pinned;
+        bool read_ahead;  // filled speculatively and not used yet
+    } cache_slot_t;
+
+    BlockDevice *m_device;
+    uint8_t *m_data;
+    uint8_t *m_staging;
+    cache_slot_t *m_slots;
+    int m_slot_count;
+    int m_read_ahead;
+    int m_max_pinned;
+    int m_pinned;
+    uint32_t m_bypass_blocks;
+    uint32_t m_pin_first;
+    uint32_t m_pin_count;
+    uint32_t m_clock;
+    uint32_t m_next_lba;
+    block_cache_stats_t m_stats;
+
+    int findSlot(uint32_t lba);
+    int victimSlot();
+    uint8_t *slotData(int slot) { return m_data + (uint32_t)slot * BLOCK_CACHE_SECTOR_SIZE; }
+    void install(uint32_t lba, const uint8_t *data, bool speculative);
+
+public:
+    BlockCache();
+    ~BlockCache();
+
+    bool begin(BlockDevice *device, int blocks = BLOCK_CACHE_BLOCKS, int read_ahead = BLOCK_CACHE_READ_AHEAD);
+    void end();
+
+    // Keep blocks in [first_lba, first_lba + count) resident, using at most
+    // half of the cache
+    void pinRange(uint32_t first_lba, uint32_t count);
+    // Read the boot sector (behind an MBR if present) and pin the FAT
+    bool pinFatMetadata();
+    // Reads of this many blocks or more go straight to the device
+    void setBypassThreshold(uint32_t blocks) { m_bypass_blocks = blocks; }
+
+    bool read(uint32_t lba, uint8_t *buffer, uint32_t count);
+    bool write(uint32_t lba, const uint8_t *buffer, uint32_t count);
+    void invalidate();
+
+    block_cache_stats_t getStats() { return m_stats; }
+    void resetStats();
+    float hitRate();
+    void printStats();
+};
+
+#ifdef ARDUINO
+// Put a block cache under the SD card's FatFs drive (0 unless another
+// FatFs volume was mounted first). Needs the ff_disk_read/ff_disk_write
+// --wrap flags from platformio.ini.
+BlockCache *installSDBlockCache(uint8_t pdrv = 0, int blocks = BLOCK_CACHE_BLOCKS,
+                                int read_ahead = BLOCK_CACHE_READ_AHEAD);
+BlockCache *getSDBlockCache();
+// The card for readers outside FatFs (raw streaming, FatVolume). Goes
+// through the cache once installed and shares FatFs's lock.
+BlockDevice *getSDBlockDevice(uint8_t pdrv = 0);
+#else
+/**
+ * Host stand-in device over a disk image file, for exercising the cache
+ * against real FAT layouts
+ **/
+class ImageBlockDevice : public BlockDevice
+{
+private:
+    int m_fd;
+
+public:
+    ImageBlockDevice();
+    ~ImageBlockDevice();
+    bool open(const char *path, bool writable = false);
+    void close();
+    bool readBlocks(uint32_t lba, uint8_t *buffer, uint32_t count);
+    bool writeBlocks(uint32_t lba, const uint8_t *buffer, uint32_t count);
+    // Read transactions seen by the device
+    uint32_t reads;
+};
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __boot_sequencer_h__
+#define __boot_sequencer_h__
+
+#include <Arduino.h>
+
+// Set to 0 for the old one-step-at-a-time start up with full diagnostics
+#ifndef FAST_BOOT
+#define FAST_BOOT 1
+#endif
+
+// Image asset shown while the card comes up, see AssetStore
+#ifndef BOOT_SPLASH_ASSET
+#define BOOT_SPLASH_ASSET "splash"
+#endif
+// Smooth font (.vlw packed as a raw asset) for boot and UI text
+#ifndef BOOT_FONT_ASSET
+#define BOOT_FONT_ASSET "font.vlw"
+#endif
+
+/**
+ * Start-up ordering for the display and the card. The panel is initialised
+ * and a splash drawn straight from flash on the calling task while the
+ * card is mounted by a task on the other core; the file catalog, directory
+ * listings and test reads come later at low priority. Boot milestones are timed from
+ * app start and logged once the first frame of playback is on screen.
+ **/
+class BootSequencer
+{
+public:
+    // Returns once both the panel and the card are up, false if the card is not
+    static bool bringUp(const char *splash_asset = BOOT_SPLASH_ASSET);
+    // Call when playback has started to load the file catalog and run the
+    // diagnostics; a no-op when they already ran
+    static void deferDiagnostics();
+    // Called by the players for every frame, only the first one counts
+    static void markPlayback();
+
+    // Load the UI font from the asset partition, which stays mapped so the
+    // font is read from flash as a C array; false leaves the built-in font
+    static bool loadFont(const char *font_asset = BOOT_FONT_ASSET);
+    // One line of text centred along the bottom of the splash
+    static void showStatus(const char *text);
+
+    static uint32_t firstPixelMs();
+    static uint32_t sdReadyMs();
+    static uint32_t playbackMs();
+};
+
+#endif
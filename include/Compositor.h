@@ -0,0 +1,102 @@
+#ifndef __compositor_h__
+#define __compositor_h__
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+
+#ifndef COMPOSITOR_MAX_LAYERS
+#define COMPOSITOR_MAX_LAYERS 8
+#endif
+// Disjoint screen rectangles waiting to be pushed; more are merged
+#ifndef COMPOSITOR_MAX_DAMAGE
+#define COMPOSITOR_MAX_DAMAGE 8
+#endif
+// Rectangles each layer can have marked before they are merged
+#ifndef COMPOSITOR_LAYER_DAMAGE
+#define COMPOSITOR_LAYER_DAMAGE 4
+#endif
+// Rows composed and pushed at a time
+#ifndef COMPOSITOR_BAND_ROWS
+#define COMPOSITOR_BAND_ROWS 16
+#endif
+
+// Usual stacking, higher z is drawn on top
+#define LAYER_Z_VIDEO 0
+#define LAYER_Z_UI 10
+#define LAYER_Z_OVERLAY 20
+
+// Pixel layout of a layer's buffer, which is width x height with no padding
+enum LayerFormat
+{
+    LAYER_FORMAT_FILL,          // no buffer, one colour
+    LAYER_FORMAT_RGB565,        // as returned by tft.color565()
+    LAYER_FORMAT_RGB565_SWAPPED, // panel byte order, as in a 16-bit TFT_eSprite
+    LAYER_FORMAT_RGB332         // video frames
+};
+
+typedef struct
+{
+    int16_t x;
+    int16_t y;
+    int16_t width;
+    int16_t height;
+} comp_rect_t;
+
+typedef struct
+{
+    uint32_t flushes;
+    uint32_t rects;
+    uint64_t pixels_pushed;
+    uint64_t pixels_composed;   // layer pixels written into bands
+} compositor_stats_t;
+
+/**
+ * Z-ordered layers over the panel (a video plane, UI sprites, overlays)
+ * with damage tracking. Layers mark the parts that changed; flush()
+ * merges the marks into a few disjoint screen rectangles, composes each
+ * one a band of rows at a time into a strip, bottom layer first but
+ * starting from the highest opaque layer that covers the band, and pushes
+ * only those rectangles. A status bar redrawn over still content costs
+ * its own area in SPI traffic, not the whole panel.
+ *
+ * Layer buffers are read during flush() and must stay valid until the
+ * next setPixels(). flush() pushes to the panel, so it must be called by
+ * whoever currently owns it; while SD video plays its draw tasks flush
+ * with every frame.
+ **/
+class Compositor
+{
+public:
+    // Allocates the band strip, background is shown where no layer is
+    static bool begin(int width, int height, uint16_t background = TFT_BLACK);
+    static bool isReady();
+
+    // Layer id, or -1 when all are in use. A new layer is visible and has
+    // no pixels (drawn as transparent) until setPixels() or setFill().
+    static int addLayer(int x, int y, int width, int height, LayerFormat format, int z);
+    static void removeLayer(int layer);
+
+    // Point the layer at new pixels, damaging all of it unless told otherwise
+    static void setPixels(int layer, const void *pixels, bool damage = true);
+    static void setFill(int layer, uint16_t color);
+    // Pixels of this RGB565 colour let lower layers show through
+    static void setColorKey(int layer, uint16_t color);
+    static void clearColorKey(int layer);
+    static void move(int layer, int x, int y);
+    static void setVisible(int layer, bool visible);
+    static void setZ(int layer, int z);
+
+    // Mark part of a layer changed, in the layer's own coordinates
+    static void damage(int layer, int x, int y, int width, int height);
+    static void damageAll();
+    // True when a visible layer with content overlaps this one from above
+    static bool isCovered(int layer);
+
+    // Compose and push the damaged rectangles, returns pixels pushed
+    static uint32_t flush(TFT_eSPI *tft);
+
+    static void getStats(compositor_stats_t *stats);
+    static void printStats();
+};
+
+#endif
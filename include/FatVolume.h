@@ -0,0 +1,135 @@
+#ifndef __fat_volume_h__
+#define __fat_volume_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "BlockCache.h"
+
+#ifdef ARDUINO
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#endif
+
+enum FatType
+{
+    FAT_TYPE_NONE,
+    FAT_TYPE_FAT16,
+    FAT_TYPE_FAT32,
+    FAT_TYPE_EXFAT
+};
+
+typedef struct
+{
+    uint32_t first_cluster;   // 0 for an empty file (or the FAT16 root)
+    uint32_t size;            // bytes, files over 4 GB are not supported
+    bool directory;
+    bool no_fat_chain;        // exFAT: clusters are known to be consecutive
+    uint32_t modified;        // last write as FAT date << 16 | time, exFAT timestamp
+} fat_file_t;
+
+// Called for each directory entry with its long name (or 8.3 name when it
+// has none) and its 8.3 name (nullptr on exFAT). Return false to stop.
+typedef bool (*fat_dir_callback_t)(const char *name, const char *short_name, const fat_file_t *file, void *arg);
+
+/**
+ * Minimal read-only view of a FAT16, FAT32 or exFAT volume, parsed
+ * straight from the block device. It only resolves paths to their
+ * clusters and walks cluster chains; reading data is left to
+ * ContiguousFile. Long file names are matched ASCII case-insensitively.
+ *
+ * Each call holds the volume's lock while it uses the shared sector and
+ * name buffers, and list() holds it across its callbacks, so a mounted
+ * volume can be shared between tasks.
+ **/
+class FatVolume
+{
+private:
+    BlockDevice *m_device;
+    FatType m_type;
+    uint32_t m_fat_start;       // first sector of the FAT
+    uint32_t m_data_start;      // sector of cluster 2
+    uint32_t m_root_start;      // FAT16 fixed root directory
+    uint32_t m_root_sectors;
+    uint32_t m_root_cluster;    // FAT32 and exFAT root directory
+    uint32_t m_cluster_count;
+    uint8_t m_cluster_shift;    // log2 of sectors per cluster
+    uint32_t m_serial;          // volume serial number, 0 if the boot sector has none
+    uint32_t m_fsinfo_sector;   // FAT32 free cluster hint, 0 elsewhere
+    uint8_t m_sector[BLOCK_CACHE_SECTOR_SIZE];
+    uint32_t m_sector_lba;
+    char m_name[256];
+#ifdef ARDUINO
+    SemaphoreHandle_t m_lock;   // recursive: list() callbacks may use the volume
+#endif
+
+    friend class VolumeLock;
+
+    bool readSector(uint32_t lba);
+    bool parseBootSector(uint32_t volume_start);
+    bool walkDirectory(const fat_file_t *dir, fat_dir_callback_t callback, void *arg);
+    bool findInDirectory(const fat_file_t *dir, const char *name, size_t name_length, fat_file_t *file);
+
+public:
+    FatVolume();
+    ~FatVolume();
+
+    bool mount(BlockDevice *device);
+    FatType type() { return m_type; }
+    BlockDevice *device() { return m_device; }
+    uint32_t bytesPerCluster() { return (uint32_t)BLOCK_CACHE_SECTOR_SIZE << m_cluster_shift; }
+    uint32_t clusterToSector(uint32_t cluster) { return m_data_start + ((cluster - 2) << m_cluster_shift); }
+    uint32_t serialNumber() { return m_serial; }
+    // FAT32 FSInfo free cluster count, false when the volume does not keep one
+    bool freeClusters(uint32_t *count);
+    // Forget the buffered sector after the card was written through FatFs
+    void invalidate();
+
+    // Resolve an absolute path such as "/output_frame/frame1.bin"
+    bool stat(const char *path, fat_file_t *file);
+    // Visit every entry of a directory in one pass. The callback may use
+    // the volume (e.g. open a ContiguousFile) but must not resolve paths.
+    bool list(const char *path, fat_dir_callback_t callback, void *arg);
+    // Same for a directory already found, without resolving its path again
+    bool list(const fat_file_t *dir, fat_dir_callback_t callback, void *arg);
+    // Next cluster in a chain, false at the end of the chain
+    bool nextCluster(uint32_t cluster, uint32_t *next);
+    // True when every cluster of the file follows the one before it
+    bool isContiguous(const fat_file_t *file);
+};
+
+/**
+ * A file known to occupy consecutive sectors. Reads go straight to the
+ * block device as one multi-block transfer (CMD18 on SD) with no FAT
+ * lookups; only a partial first or last sector needs a bounce buffer.
+ **/
+class ContiguousFile
+{
+private:
+    BlockDevice *m_device;
+    uint32_t m_start_sector;
+    uint32_t m_size;
+
+public:
+    ContiguousFile();
+
+    // Fails if the file is missing, a directory or fragmented
+    bool open(FatVolume *volume, const char *path);
+    bool open(FatVolume *volume, const fat_file_t *file);
+    void close() { m_device = nullptr; }
+    bool isOpen() { return m_device != nullptr; }
+    uint32_t size() { return m_size; }
+    uint32_t startSector() { return m_start_sector; }
+
+    // Returns bytes read (short at the end of the file) or -1
+    int32_t read(uint32_t offset, uint8_t *buffer, uint32_t length);
+};
+
+#ifdef ARDUINO
+// Mount the SD card's volume over the raw SD block device. Called once
+// during setup() once the card is up, before any task resolves paths.
+bool mountSDVolume();
+// The mounted volume, nullptr if mountSDVolume() found none
+FatVolume *getSDVolume();
+#endif
+
+#endif
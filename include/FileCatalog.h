@@ -0,0 +1,112 @@
+#ifndef __file_catalog_h__
+#define __file_catalog_h__
+
+#include <Arduino.h>
+#include "FatVolume.h"
+
+// Where the catalog is kept between boots
+#define CATALOG_PATH "/.catalog"
+#define CATALOG_MAGIC "SOSC"
+#define CATALOG_VERSION 2
+
+// Entries are indexed with 16 bits, cards with more are not catalogued
+#ifndef CATALOG_MAX_ENTRIES
+#define CATALOG_MAX_ENTRIES 8192
+#endif
+// Directories with more files than this are summarised by print()
+#ifndef CATALOG_PRINT_MAX_FILES
+#define CATALOG_PRINT_MAX_FILES 32
+#endif
+
+// What a file holds, from its extension
+enum MediaKind
+{
+    MEDIA_KIND_OTHER,
+    MEDIA_KIND_DIRECTORY,
+    MEDIA_KIND_FRAME,       // .bin raw frame
+    MEDIA_KIND_VIDEO,       // .avi
+    MEDIA_KIND_AUDIO,       // .wav
+    MEDIA_KIND_TEXT         // .txt
+};
+
+#define CATALOG_FLAG_DIRECTORY 0x01
+#define CATALOG_FLAG_CONTIGUOUS 0x02
+#define CATALOG_FLAG_NO_FAT_CHAIN 0x04
+
+// On-card layout: header, entries, then the NUL terminated names
+typedef struct
+{
+    char magic[4];            // Contains "SOSC"
+    uint16_t version;
+    uint16_t count;           // Entries, the root directory first
+    uint32_t names_size;
+    uint32_t volume_key;      // see FileCatalog, 0 while being written
+    uint32_t checksum;        // of the entries and names
+} catalog_header_t;
+
+// Each directory's entries are consecutive and sorted by name, case-insensitively
+typedef struct
+{
+    uint32_t name_offset;     // leaf name in the name table
+    uint32_t size;
+    uint32_t first_cluster;
+    uint16_t first_child;     // directories: index of their first entry
+    uint16_t child_count;
+    uint8_t kind;
+    uint8_t flags;
+    uint16_t reserved;
+} catalog_entry_t;
+
+typedef struct
+{
+    const char *name;         // leaf name, points into the catalog
+    fat_file_t file;          // ready for ContiguousFile::open
+    MediaKind kind;
+    bool contiguous;
+} catalog_file_t;
+
+// Return false to stop listing
+typedef bool (*catalog_callback_t)(const catalog_file_t *file, void *arg);
+
+/**
+ * Sorted index of every path on the card with its size, clusters and
+ * media kind, built in one walk of the FAT directories and kept in
+ * /.catalog so later boots only read it back. The stored copy is used
+ * while the volume key still matches: the volume serial number, the
+ * FAT32 free cluster count and the names, sizes, first clusters and
+ * modification times in every catalogued directory. Checking it reads
+ * the directories again but skips the FAT walks that decide contiguity,
+ * so a stale entry never sends a ContiguousFile to the wrong sectors.
+ *
+ * begin() reads the card directly, so once the SD scheduler has started
+ * it must run as a scheduler operation; BootSequencer does that behind
+ * playback. The catalog is read-only afterwards and lookups from any task
+ * are safe and never touch the card. Until it is loaded, exists() asks
+ * the card through the scheduler and find() and list() find nothing.
+ **/
+class FileCatalog
+{
+public:
+    // Load the stored catalog or rebuild it, false if neither worked
+    static bool begin();
+    static bool isLoaded();
+    static int count();
+
+    // Lookup of an absolute path, file may be nullptr to test existence
+    static bool find(const char *path, catalog_file_t *file);
+    // Catalog lookup once loaded, a look at the card before that
+    static bool exists(const char *path);
+    // Entries of one directory whose path starts with prefix, in name order:
+    // "/output_frame/frame" lists frame files, "/output_frame/" all of them
+    static int list(const char *prefix, catalog_callback_t callback, void *arg);
+
+    // Restarts, the card is indexed again on the next boot
+    static void requestRebuild();
+    // True once after requestRebuild()
+    static bool takeRebuildRequest();
+
+    // Indented tree of the card, like printDirectory() without the card reads
+    static void print();
+};
+
+#endif
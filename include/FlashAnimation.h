@@ -0,0 +1,82 @@
+#ifndef __flash_animation_h__
+#define __flash_animation_h__
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+#include "FrameSource.h"
+
+/**
+ * FrameSource over an RGB332 sprite sheet compiled into flash, as written
+ * by convert_video_to_rgb332_frames (all frames stacked vertically in one
+ * const array). Frames are handed out as pointers into the table, so
+ * playback needs no heap buffers and no SD access.
+ *
+ *   #include "boot_anim.h"
+ *   FlashAnimation<boot_anim, BOOT_ANIM_WIDTH, BOOT_ANIM_HEIGHT, BOOT_ANIM_FRAMES> boot(BOOT_ANIM_FRAME_RATE);
+ *   tftOutput.start(&tft, &boot, 0, 0, BOOT_ANIM_WIDTH, BOOT_ANIM_HEIGHT);
+ **/
+template <const uint8_t *Table, int Width, int Height, int Frames>
+class FlashAnimation : public FrameSource
+{
+private:
+    int m_frame_rate;
+    int m_current_frame;
+    bool m_loop;
+
+public:
+    static const uint32_t frame_bytes = (uint32_t)Width * Height;
+    static const int frame_count = Frames;
+
+    // Address of frame Index, resolved at compile time
+    template <int Index>
+    static constexpr const uint8_t *frame()
+    {
+        static_assert(Index >= 0 && Index < Frames, "frame index out of range");
+        return Table + Index * frame_bytes;
+    }
+
+    static const uint8_t *frame(int index)
+    {
+        return Table + (uint32_t)(index % Frames) * frame_bytes;
+    }
+
+    FlashAnimation(int frame_rate, bool loop = true)
+    {
+        m_frame_rate = frame_rate;
+        m_current_frame = 0;
+        m_loop = loop;
+    }
+
+    int frameRate() { return m_frame_rate; }
+    int frameWidth() { return Width; }
+    int frameHeight() { return Height; }
+    int currentFrame() { return m_current_frame; }
+
+    bool getNextFrame(VideoFrame_t *frame)
+    {
+        if (m_current_frame >= Frames) {
+            if (!m_loop) {
+                return false;
+            }
+            m_current_frame = 0;
+        }
+        // Points straight into flash; the frame is never written to
+        frame->data = (uint8_t *)FlashAnimation::frame(m_current_frame);
+        frame->size = frame_bytes;
+        frame->width = Width;
+        frame->height = Height;
+        frame->format = FRAME_FORMAT_RGB332;
+        m_current_frame++;
+        return true;
+    }
+
+    void rewind() { m_current_frame = 0; }
+
+    // Draw one frame without going through TFT_Output, e.g. from setup()
+    static void pushFrame(TFT_eSPI *tft, int x, int y, int index)
+    {
+        tft->pushImage(x, y, Width, Height, frame(index), true);
+    }
+};
+
+#endif
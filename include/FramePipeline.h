@@ -0,0 +1,148 @@
+#ifndef __frame_pipeline_h__
+#define __frame_pipeline_h__
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+#include "FrameSource.h"
+#include "PipelineStats.h"
+
+/**
+ * Compile-time specialised frame pipeline for deployments where the pixel
+ * format and window size are fixed at build time. Strides and loop bounds
+ * are constants, so the conversion and copy loops inline and unroll.
+ * Dynamic sources keep using FrameSource and TFT_Output.
+ **/
+
+// Pixel format tags
+struct PixelRGB565
+{
+    typedef uint16_t pixel_t;
+    static const int bytes_per_pixel = 2;
+};
+
+struct PixelRGB332
+{
+    typedef uint8_t pixel_t;
+    static const int bytes_per_pixel = 1;
+};
+
+// Per-pixel conversion between formats, specialised for each supported pair
+template <class SrcFormat, class DstFormat>
+struct PixelConvert;
+
+template <class Format>
+struct PixelConvert<Format, Format>
+{
+    static inline typename Format::pixel_t convert(typename Format::pixel_t p) { return p; }
+};
+
+template <>
+struct PixelConvert<PixelRGB332, PixelRGB565>
+{
+    // Same expansion as TFT_eSPI::color8to16 so frames look identical
+    // whichever path draws them
+    static inline uint16_t convert(uint8_t c)
+    {
+        static const uint8_t blue[] = {0, 11, 21, 31};
+        return ((c & 0xE0) << 8) | ((c & 0xC0) << 5) |
+               ((c & 0x1C) << 6) | ((c & 0x1C) << 3) | blue[c & 0x03];
+    }
+};
+
+template <>
+struct PixelConvert<PixelRGB565, PixelRGB332>
+{
+    static inline uint8_t convert(uint16_t c)
+    {
+        return ((c >> 8) & 0xE0) | ((c >> 6) & 0x1C) | ((c >> 3) & 0x03);
+    }
+};
+
+template <class A, class B>
+struct SamePixelFormat
+{
+    static const bool value = false;
+};
+
+template <class A>
+struct SamePixelFormat<A, A>
+{
+    static const bool value = true;
+};
+
+template <class SrcFormat, class DstFormat, int Width, int Height, int StripRows = 16>
+class StaticFramePipeline
+{
+public:
+    typedef typename SrcFormat::pixel_t src_pixel_t;
+    typedef typename DstFormat::pixel_t dst_pixel_t;
+
+    static const int width = Width;
+    static const int height = Height;
+    static const int strip_rows = StripRows < Height ? StripRows : Height;
+    static const uint32_t frame_bytes = (uint32_t)Width * Height * SrcFormat::bytes_per_pixel;
+    static const uint32_t strip_pixels = (uint32_t)Width * strip_rows;
+
+    // Convert rows strip_rows at a time; the final partial strip is handled
+    // by the Rows parameter so every loop bound is a constant
+    template <int Rows>
+    static inline void convertRows(const src_pixel_t *src, dst_pixel_t *dst)
+    {
+        for (int i = 0; i < Width * Rows; i++) {
+            dst[i] = PixelConvert<SrcFormat, DstFormat>::convert(src[i]);
+        }
+    }
+
+    // Push a whole frame of SrcFormat pixels at (x, y) through a strip of
+    // strip_pixels DstFormat pixels (unused when the formats match)
+    static void push(TFT_eSPI *tft, int x, int y, const uint8_t *frame, dst_pixel_t *strip)
+    {
+        // Matching formats go straight from the frame buffer to the panel
+        if (SamePixelFormat<SrcFormat, DstFormat>::value) {
+            PIPELINE_TIME(STAGE_SPI_PUSH);
+            pushStrip(tft, x, y, Height, (dst_pixel_t *)frame);
+            return;
+        }
+
+        const src_pixel_t *src = (const src_pixel_t *)frame;
+        const int full_strips = Height / strip_rows;
+        const int tail_rows = Height % strip_rows;
+        // Conversion and push alternate strip by strip, each is reported
+        // once per frame
+        uint32_t convert_us = 0;
+        uint32_t push_us = 0;
+
+        for (int s = 0; s < full_strips; s++) {
+            uint32_t started = PIPELINE_NOW();
+            convertRows<strip_rows>(src + s * strip_pixels, strip);
+            uint32_t converted = PIPELINE_NOW();
+            pushStrip(tft, x, y + s * strip_rows, strip_rows, strip);
+            convert_us += converted - started;
+            push_us += PIPELINE_NOW() - converted;
+        }
+        if (tail_rows > 0) {
+            uint32_t started = PIPELINE_NOW();
+            convertRows<tail_rows>(src + full_strips * strip_pixels, strip);
+            uint32_t converted = PIPELINE_NOW();
+            pushStrip(tft, x, y + full_strips * strip_rows, tail_rows, strip);
+            convert_us += converted - started;
+            push_us += PIPELINE_NOW() - converted;
+        }
+        PIPELINE_RECORD(STAGE_CONVERT, convert_us);
+        PIPELINE_RECORD(STAGE_SPI_PUSH, push_us);
+    }
+
+private:
+    static inline void pushStrip(TFT_eSPI *tft, int x, int y, int rows, uint16_t *strip)
+    {
+        tft->setAddrWindow(x, y, Width, rows);
+        tft->pushColors(strip, Width * rows);
+    }
+
+    static inline void pushStrip(TFT_eSPI *tft, int x, int y, int rows, uint8_t *strip)
+    {
+        tft->pushImage(x, y, Width, rows, strip);
+    }
+};
+
+#endif
@@ -3,12 +3,20 @@
 
 #include <Arduino.h>
 
+// Pixel layout of VideoFrame_t::data
+enum FrameFormat
+{
+    FRAME_FORMAT_RGB565 = 0,
+    FRAME_FORMAT_RGB332 = 1
+};
+
 typedef struct
 {
     uint16_t width;
     uint16_t height;
-    uint8_t *data;  // RGB565 pixel data
+    uint8_t *data;  // Pixel data, RGB565 unless format says otherwise
     uint32_t size;  // Size of data in bytes
+    uint8_t format; // FrameFormat of data
 } VideoFrame_t;
 
 /**
@@ -18,10 +26,14 @@ class FrameSource
 {
 public:
     virtual int frameRate() = 0;
+    // Exact frame period, for rates that are not a whole number of frames
+    // per second (e.g. 29.97)
+    virtual uint32_t frameIntervalUs() { return frameRate() > 0 ? 1000000 / frameRate() : 0; }
     virtual int frameWidth() = 0;
     virtual int frameHeight() = 0;
     // This should fill the frame buffer with the next video frame
-    // Frame data should be in RGB565 format (16 bits per pixel)
+    // Frame data should be in RGB565 format (16 bits per pixel), or RGB332
+    // with format set to FRAME_FORMAT_RGB332
     virtual bool getNextFrame(VideoFrame_t *frame) = 0;
     virtual void rewind() = 0;
 };
@@ -4,6 +4,22 @@
 #include <Arduino.h>
 #include "FrameSource.h"
 
+// Sampling used when resizing frames
+enum ScaleMode
+{
+    SCALE_NEAREST,
+    SCALE_BILINEAR
+};
+
+// Clockwise rotation applied to a frame before it is pushed
+enum FrameRotation
+{
+    ROTATE_0,
+    ROTATE_90,
+    ROTATE_180,
+    ROTATE_270
+};
+
 /**
  * Utility functions for video frame processing
  **/
@@ -15,12 +31,73 @@ public:
     
     // Convert entire frame from RGB888 to RGB565
     static bool convertRgb888ToRgb565(uint8_t* rgb888_data, uint16_t* rgb565_data, uint32_t pixel_count);
+
+    // Convert rows of RGB888 with 4x4 ordered (Bayer) dithering instead of
+    // truncation. first_row is the strip's position in the whole image so
+    // the pattern lines up when a frame is converted strip by strip.
+    static bool ditherRgb888ToRgb565(const uint8_t* rgb888_data, uint16_t* rgb565_data, int width, int rows, int first_row = 0);
+    static bool ditherRgb888ToRgb332(const uint8_t* rgb888_data, uint8_t* rgb332_data, int width, int rows, int first_row = 0);
     
     // Scale frame to fit display dimensions (simple nearest neighbor)
     static bool scaleFrame(VideoFrame_t* source, VideoFrame_t* dest, int target_width, int target_height);
     
+    // Size of a width x height image once rotated
+    static void rotatedSize(int width, int height, FrameRotation rotation, int* out_width, int* out_height);
+
+    // Produce rows [first_row, first_row + rows) of the source image rotated
+    // clockwise and then optionally mirrored left to right. The source is
+    // walked in small tiles so column reads stay within cached lines, and
+    // only a strip of the rotated image is ever materialised.
+    static bool rotateStrip8(const uint8_t* src, int src_width, int src_height, FrameRotation rotation, bool mirror,
+                             uint8_t* strip, int first_row, int rows);
+    static bool rotateStrip16(const uint16_t* src, int src_width, int src_height, FrameRotation rotation, bool mirror,
+                              uint16_t* strip, int first_row, int rows);
+    
     // Create a test pattern frame (useful for debugging)
     static void createTestPattern(VideoFrame_t* frame, int width, int height, uint16_t color1, uint16_t color2);
 };
 
+/**
+ * Integer-only frame scaler. The source column tables are built once per
+ * geometry, after which any band of destination rows can be produced into
+ * a caller supplied strip buffer without touching the heap.
+ **/
+class FrameScaler
+{
+private:
+    int m_src_width;
+    int m_src_height;
+    int m_dst_width;
+    int m_dst_height;
+    ScaleMode m_mode;
+    // Source column (and right-hand neighbour) for every destination column
+    uint16_t *m_x0;
+    uint16_t *m_x1;
+    // Weight of the right-hand neighbour in 1/32 steps (bilinear only)
+    uint8_t *m_wx;
+    int m_table_capacity;
+    // Source rows per destination row in 16.16 fixed point
+    uint32_t m_y_step;
+
+    void sourceRow(int dst_y, int *y0, int *y1, int *wy);
+
+public:
+    FrameScaler();
+    ~FrameScaler();
+
+    // Build the lookup tables, returns false if they could not be allocated
+    bool configure(int src_width, int src_height, int dst_width, int dst_height, ScaleMode mode = SCALE_NEAREST);
+
+    // Produce destination rows [first_row, first_row + rows) into strip,
+    // which must hold rows * dstWidth() pixels
+    bool scaleStrip(const uint16_t *src, uint16_t *strip, int first_row, int rows);
+    // RGB332 variant, always nearest neighbour
+    bool scaleStrip(const uint8_t *src, uint8_t *strip, int first_row, int rows);
+
+    bool isConfigured(int src_width, int src_height, int dst_width, int dst_height, ScaleMode mode);
+    int dstWidth() { return m_dst_width; }
+    int dstHeight() { return m_dst_height; }
+    ScaleMode mode() { return m_mode; }
+};
+
 #endif
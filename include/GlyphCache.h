@@ -0,0 +1,69 @@
+#ifndef __glyph_cache_h__
+#define __glyph_cache_h__
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+
+// Memory for rasterised glyphs, split into equal slots
+#ifndef GLYPH_CACHE_BYTES
+#define GLYPH_CACHE_BYTES (24 * 1024)
+#endif
+// Pixels per slot; bigger glyph cells are drawn without being cached
+#ifndef GLYPH_CACHE_SLOT_PIXELS
+#define GLYPH_CACHE_SLOT_PIXELS 384
+#endif
+#define GLYPH_CACHE_MAX_SLOTS 254
+#define GLYPH_CACHE_BUCKETS 64
+// Strip a line of text is composed in before it is pushed
+#ifndef GLYPH_CACHE_RUN_PIXELS
+#define GLYPH_CACHE_RUN_PIXELS (160 * 16)
+#endif
+
+typedef struct
+{
+    uint32_t hits;
+    uint32_t misses;            // glyphs rasterised into the cache
+    uint32_t evictions;
+    uint32_t uncached;          // glyphs too big for a slot, rasterised every time
+    uint32_t fallbacks;         // strings handed to TFT_eSPI, font not in an array
+} glyph_cache_stats_t;
+
+/**
+ * Smooth font glyphs rasterised once per font and colour pair into RGB565
+ * cells the size of the glyph's advance and the font's line height, with
+ * the background already blended in. A line of text is then a copy of
+ * cached cells into a strip and one push, instead of TFT_eSPI reading the
+ * glyph and alpha blending every pixel on every draw. Cells live in
+ * fixed-size slots of one atlas allocation and the least recently used
+ * one is replaced when the atlas is full.
+ *
+ * Glyphs are read from the font loaded into the TFT_eSPI passed in, which
+ * must have come from a C array (tft.loadFont(array)); fonts loaded from a
+ * file system are drawn by TFT_eSPI as before. Not locked: use from the
+ * task that draws the UI.
+ **/
+class GlyphCache
+{
+public:
+    static bool begin(uint32_t budget_bytes = GLYPH_CACHE_BYTES);
+    static bool isReady();
+
+    // One line of text with its top left corner at (x, y), on a solid
+    // background. Returns the width of the text.
+    static int drawString(TFT_eSPI *tft, const char *text, int x, int y, uint16_t fg, uint16_t bg);
+    // Same into an RGB565 buffer such as a compositor layer, clipped to it;
+    // -1 when the font cannot be cached
+    static int renderString(TFT_eSPI *tft, const char *text, uint16_t *buffer, int buffer_width, int buffer_height,
+                            int x, int y, uint16_t fg, uint16_t bg);
+    // Width drawString() would use, from the font's metrics only
+    static int textWidth(TFT_eSPI *tft, const char *text);
+
+    // Forget every glyph, call before unloading a font that is in the cache
+    static void clear();
+
+    static void getStats(glyph_cache_stats_t *stats);
+    static void resetStats();
+    static void printStats();
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef __image_cache_h__
+#define __image_cache_h__
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+#include "FrameSource.h"
+
+// Decoded pixels kept at once, plus the scratch buffer of a load that
+// converts or scales; least recently used images make room
+#ifndef IMAGE_CACHE_BYTES
+#define IMAGE_CACHE_BYTES (32 * 1024)
+#endif
+#ifndef IMAGE_CACHE_MAX_ENTRIES
+#define IMAGE_CACHE_MAX_ENTRIES 24
+#endif
+#define IMAGE_CACHE_PATH_LENGTH 48
+// Prefetches that can be waiting for the loader task
+#ifndef IMAGE_CACHE_QUEUE_LENGTH
+#define IMAGE_CACHE_QUEUE_LENGTH 8
+#endif
+// Loader task placement, below the video and job tasks
+#ifndef IMAGE_CACHE_TASK_PRIORITY
+#define IMAGE_CACHE_TASK_PRIORITY 1
+#endif
+#ifndef IMAGE_CACHE_TASK_CORE
+#define IMAGE_CACHE_TASK_CORE 0
+#endif
+// The loader keeps an ImageDecoder (palette, QOI index and file state, over
+// 1 KB) on its stack and calls into SD, FAT and the decoder below that
+#ifndef IMAGE_CACHE_TASK_STACK
+#define IMAGE_CACHE_TASK_STACK 8192
+#endif
+
+// Runs on the loader task once a prefetch is done, image is nullptr if it
+// could not be loaded. The image is only pinned during the call.
+typedef void (*image_callback_t)(const VideoFrame_t *image, void *arg);
+
+typedef struct
+{
+    uint32_t hits;
+    uint32_t misses;            // images read and decoded
+    uint32_t evictions;
+    uint32_t failures;          // missing, wrong size or out of memory
+    uint32_t rejected;          // did not fit the budget beside pinned images
+    uint64_t load_us;           // time spent reading and decoding misses
+} image_cache_stats_t;
+
+/**
+ * Decoded, display-ready images from the card, kept within a byte budget.
+ * An image is keyed by its path and the size and FrameFormat it is wanted
+ * in. The stored file is a .qoi or .bmp image, or raw RGB332 or RGB565
+ * (told apart by its size) at the wanted size or, when given, its own
+ * size; it is decoded, converted and scaled once when it is loaded.
+ * Icons and backgrounds the UI comes back to are then drawn without
+ * touching the card.
+ *
+ * acquire() returns a pinned image, loading it first on a miss, and every
+ * acquire must be matched by a release(); pinned images are never evicted.
+ * prefetch() loads on a background task and reports through a callback.
+ * Reads go through SDScheduler as background traffic.
+ **/
+class ImageCache
+{
+public:
+    static bool begin(uint32_t budget_bytes = IMAGE_CACHE_BYTES, int task_priority = IMAGE_CACHE_TASK_PRIORITY,
+                      int core = IMAGE_CACHE_TASK_CORE);
+
+    // Blocking; nullptr if the image cannot be loaded. src_width and
+    // src_height are a raw file's stored size, 0 when it is already width x
+    // height; QOI and BMP files carry their own.
+    static const VideoFrame_t *acquire(const char *path, int width, int height,
+                                       FrameFormat format = FRAME_FORMAT_RGB565, int src_width = 0,
+                                       int src_height = 0);
+    // Only if it is already decoded, never reads the card
+    static const VideoFrame_t *tryAcquire(const char *path, int width, int height,
+                                          FrameFormat format = FRAME_FORMAT_RGB565);
+    static void release(const VideoFrame_t *image);
+
+    // Queue a load; false if it could not be queued, in which case the
+    // callback is not called
+    static bool prefetch(const char *path, int width, int height, FrameFormat format = FRAME_FORMAT_RGB565,
+                         image_callback_t callback = nullptr, void *arg = nullptr, int src_width = 0,
+                         int src_height = 0);
+
+    static void draw(TFT_eSPI *tft, const VideoFrame_t *image, int x, int y);
+
+    // Drop the unpinned copies of a file that changed, or of everything
+    static void invalidate(const char *path);
+    static void clear();
+
+    static void getStats(image_cache_stats_t *stats);
+    static void resetStats();
+    static void printStats();
+};
+
+#endif
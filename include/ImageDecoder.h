@@ -0,0 +1,109 @@
+#ifndef __image_decoder_h__
+#define __image_decoder_h__
+
+#include <Arduino.h>
+#include <SD.h>
+#include <FS.h>
+#include <TFT_eSPI.h>
+#include "FatVolume.h"
+
+// Bytes read from the card at a time; uncompressed BMP rows must fit
+#ifndef IMAGE_DECODER_CHUNK
+#define IMAGE_DECODER_CHUNK 2048
+#endif
+// Pixels decoded per strip pushed by draw()
+#ifndef IMAGE_DECODER_STRIP_PIXELS
+#define IMAGE_DECODER_STRIP_PIXELS (160 * 16)
+#endif
+#define IMAGE_DECODER_MAX_SIZE 4096
+
+enum ImageType
+{
+    IMAGE_TYPE_NONE,
+    IMAGE_TYPE_QOI,
+    IMAGE_TYPE_BMP
+};
+
+/**
+ * Still image decoder for QOI and BMP (1, 4, 8, 16, 24 and 32 bits per
+ * pixel, uncompressed, bitfields or RLE4/RLE8). The image is read in
+ * chunks, from the card through SDScheduler or from memory such as a
+ * mapped flash asset, and produced as RGB565 strips, so drawing it never
+ * needs the whole image in RAM. Alpha is ignored.
+ *
+ * Strips come out in file order: top first for QOI and top-down BMPs,
+ * bottom first for the usual bottom-up BMPs, with decodeStrip() saying
+ * where each one goes.
+ **/
+class ImageDecoder
+{
+private:
+    // Input: a file on the card or a block of memory
+    File m_file;
+    ContiguousFile m_stream;
+    const uint8_t *m_memory;
+    uint8_t *m_chunk;
+    const uint8_t *m_data;
+    uint32_t m_pos;
+    uint32_t m_len;
+    uint32_t m_offset;          // of the next byte to read from the card
+    uint32_t m_size;
+    bool m_error;
+
+    ImageType m_type;
+    int m_width;
+    int m_height;
+    bool m_top_down;
+    int m_rows_done;
+
+    // BMP
+    uint16_t m_bpp;
+    uint32_t m_compression;
+    uint32_t m_stride;
+    bool m_rgb565;
+    uint16_t m_palette[256];
+    int m_rle_x;
+    int m_rle_row;
+    bool m_rle_end;
+
+    // QOI
+    uint32_t m_qoi_index[64];
+    uint32_t m_qoi_pixel;
+    int m_qoi_run;
+
+    bool refill(uint32_t wanted);
+    inline const uint8_t *take(uint32_t length);
+    inline uint8_t nextByte();
+    void seek(uint32_t offset);
+    bool readHeader();
+    bool readBmpHeader(uint32_t pixel_offset);
+    bool decodeQoi(uint16_t *strip, int rows);
+    bool decodeBmpRows(uint16_t *strip, int rows);
+    bool decodeRle(uint16_t *strip, int rows);
+
+public:
+    ImageDecoder();
+    ~ImageDecoder();
+
+    bool open(const char *path);
+    // An image already in memory, e.g. an AssetStore asset in mapped flash
+    bool open(const uint8_t *data, uint32_t size);
+    void close();
+
+    bool isOpen() { return m_type != IMAGE_TYPE_NONE; }
+    ImageType type() { return m_type; }
+    int width() { return m_width; }
+    int height() { return m_height; }
+
+    // Decode up to max_rows more rows into strip (max_rows * width()
+    // pixels). Returns the rows decoded, 0 once the image is done or -1 on
+    // a read or format error; first_row is where the strip's top row is in
+    // the image.
+    int decodeStrip(uint16_t *strip, int max_rows, int *first_row);
+    // The rest of the image into a width() x height() buffer
+    bool decodeImage(uint16_t *pixels);
+    // Decode the whole image onto the panel with its top left at (x, y)
+    bool draw(TFT_eSPI *tft, int x, int y);
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __job_system_h__
+#define __job_system_h__
+
+#include <Arduino.h>
+
+// Default band height frames are split into
+#ifndef JOB_BAND_ROWS
+#define JOB_BAND_ROWS 8
+#endif
+// Worker placement: one per core at this priority. Audio preempting a
+// worker is fine, the other core steals its remaining bands.
+#ifndef JOB_WORKER_PRIORITY
+#define JOB_WORKER_PRIORITY 2
+#endif
+#define JOB_CORES 2
+
+// Processes rows [first_row, first_row + rows) of a job. Bands of one job
+// run concurrently, so they must only write their own rows.
+typedef void (*job_band_fn_t)(int first_row, int rows, void *arg);
+
+typedef struct
+{
+    uint32_t jobs;              // jobs split across the cores
+    uint32_t inline_jobs;       // run directly by the caller (small, nested, or before begin)
+    uint32_t bands[JOB_CORES];  // bands run on each core
+    uint32_t stolen;            // bands taken from the other core's share
+} job_stats_t;
+
+/**
+ * Splits one frame's CPU work into horizontal bands and runs them on both
+ * cores. Each core starts on its own half of the bands, the caller working
+ * through its core's half while a worker task takes the other; a core
+ * that runs dry steals from the far end of the other's half, so a core
+ * busy with audio or I/O just ends up doing fewer bands.
+ *
+ * parallelRows() blocks until every band is done. One job runs at a time,
+ * and calls made from inside a band run inline.
+ **/
+class JobSystem
+{
+public:
+    static bool begin(int priority = JOB_WORKER_PRIORITY);
+
+    static void parallelRows(int rows, job_band_fn_t fn, void *arg, int band_rows = JOB_BAND_ROWS);
+
+    static void getStats(job_stats_t *stats);
+    static void resetStats();
+    static void printStats();
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __logger_h__
+#define __logger_h__
+
+#include <Arduino.h>
+
+// Levels, a message is kept when its level is at or below LOG_LEVEL
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_VERBOSE 5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Categories, one bit each; LOG_CATEGORIES selects the ones built in
+#define LOG_CAT_SYSTEM (1 << 0)
+#define LOG_CAT_VIDEO (1 << 1)
+#define LOG_CAT_AUDIO (1 << 2)
+#define LOG_CAT_SD (1 << 3)
+#define LOG_CAT_DISPLAY (1 << 4)
+#define LOG_CAT_ALL 0xFF
+
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES LOG_CAT_ALL
+#endif
+
+// Ring of fixed size records, statically allocated
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 64
+#endif
+#ifndef LOG_TEXT_BYTES
+#define LOG_TEXT_BYTES 96
+#endif
+#define LOG_MAX_ARGS 4
+
+// Both tests are constant, so disabled messages and their format strings
+// are removed by the compiler
+#define LOG_ENABLED(level, category) ((level) <= LOG_LEVEL && ((category) & LOG_CATEGORIES))
+
+// Text messages, formatted by the caller into the ring
+#define LOG_E(category, ...) do { if (LOG_ENABLED(LOG_LEVEL_ERROR, category)) Logger::write(LOG_LEVEL_ERROR, category, __VA_ARGS__); } while (0)
+#define LOG_W(category, ...) do { if (LOG_ENABLED(LOG_LEVEL_WARN, category)) Logger::write(LOG_LEVEL_WARN, category, __VA_ARGS__); } while (0)
+#define LOG_I(category, ...) do { if (LOG_ENABLED(LOG_LEVEL_INFO, category)) Logger::write(LOG_LEVEL_INFO, category, __VA_ARGS__); } while (0)
+#define LOG_D(category, ...) do { if (LOG_ENABLED(LOG_LEVEL_DEBUG, category)) Logger::write(LOG_LEVEL_DEBUG, category, __VA_ARGS__); } while (0)
+#define LOG_V(category, ...) do { if (LOG_ENABLED(LOG_LEVEL_VERBOSE, category)) Logger::write(LOG_LEVEL_VERBOSE, category, __VA_ARGS__); } while (0)
+
+// Binary messages for hot paths: only the format pointer and up to four
+// 32-bit arguments are stored, formatting happens in the drain task. The
+// format must be a string literal and arguments integers (no %s or %f).
+#define LOGB_W(category, ...) do { if (LOG_ENABLED(LOG_LEVEL_WARN, category)) Logger::binary(LOG_LEVEL_WARN, category, __VA_ARGS__); } while (0)
+#define LOGB_I(category, ...) do { if (LOG_ENABLED(LOG_LEVEL_INFO, category)) Logger::binary(LOG_LEVEL_INFO, category, __VA_ARGS__); } while (0)
+#define LOGB_D(category, ...) do { if (LOG_ENABLED(LOG_LEVEL_DEBUG, category)) Logger::binary(LOG_LEVEL_DEBUG, category, __VA_ARGS__); } while (0)
+#define LOGB_V(category, ...) do { if (LOG_ENABLED(LOG_LEVEL_VERBOSE, category)) Logger::binary(LOG_LEVEL_VERBOSE, category, __VA_ARGS__); } while (0)
+
+/**
+ * Asynchronous logger. Messages are put in a lock-free ring of fixed size
+ * records, reserved with a compare-and-swap so any task on either core can
+ * log without blocking, and a low priority task drains the ring to Serial.
+ * Nothing is allocated; when the ring is full messages are dropped and
+ * counted instead of stalling the caller.
+ *
+ * Before begin() messages are printed directly.
+ **/
+class Logger
+{
+public:
+    static bool begin(int task_priority = 1, int core = 0);
+
+    static void write(uint8_t level, uint8_t category, const char *format, ...)
+        __attribute__((format(printf, 3, 4)));
+    static void writeBinary(uint8_t level, uint8_t category, const char *format, const uint32_t *args, int count);
+
+    template <typename... Args>
+    static inline void binary(uint8_t level, uint8_t category, const char *format, Args... args)
+    {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "at most LOG_MAX_ARGS binary log arguments");
+        const uint32_t packed[] = {0, (uint32_t)args...};
+        writeBinary(level, category, format, packed + 1, sizeof...(Args));
+    }
+
+    // Print whatever is queued from the calling task, e.g. before a restart
+    static void flush();
+    static uint32_t dropped();
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef __loop_cache_h__
+#define __loop_cache_h__
+
+#include <Arduino.h>
+
+/**
+ * RAM copy of a short looping clip. The first pass over the clip stores
+ * each frame (PackBits compressed when that is smaller), and once every
+ * frame is present later passes are served from RAM without touching SD.
+ * If the clip does not fit the byte budget the cache gives up and frees
+ * everything, and playback carries on from SD as before.
+ **/
+class LoopCache
+{
+private:
+    typedef struct
+    {
+        uint8_t *data;
+        uint32_t length;
+        bool compressed;
+    } cached_frame_t;
+
+    cached_frame_t *m_frames;
+    uint8_t *m_scratch;         // one frame, where frames are compressed
+    int m_frame_count;
+    int m_frames_stored;
+    uint32_t m_frame_bytes;
+    uint32_t m_budget;
+    uint32_t m_bytes_used;
+    bool m_overflowed;
+    SemaphoreHandle_t m_mutex;
+
+    void releaseFrames();
+    void releaseScratch();
+
+public:
+    LoopCache();
+    ~LoopCache();
+
+    // Frames are numbered 1..frame_count, matching the frame%d.bin files
+    bool begin(int frame_count, uint32_t frame_bytes, uint32_t budget_bytes);
+    void clear();
+    // Bulk memory a cache could take now without crowding out other users
+    static uint32_t availableBytes();
+
+    // Keep a copy of a frame read from SD, returns false once over budget
+    bool store(int frame_index, const uint8_t *data, uint32_t length);
+    // Fill out with a cached frame, only once the whole clip is cached so a
+    // pass never mixes RAM and SD timing
+    bool load(int frame_index, uint8_t *out, uint32_t length);
+
+    bool isComplete() { return m_frame_count > 0 && m_frames_stored == m_frame_count; }
+    bool isEnabled() { return m_frames != nullptr && !m_overflowed; }
+    uint32_t bytesUsed() { return m_bytes_used; }
+
+    // PackBits run-length coding, also usable on its own
+    static uint32_t packBits(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t capacity);
+    static bool unpackBits(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t capacity);
+};
+
+#endif
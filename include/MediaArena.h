@@ -0,0 +1,91 @@
+#ifndef __media_arena_h__
+#define __media_arena_h__
+
+#include <Arduino.h>
+
+// Largest region reserved for each pool by MediaArena::begin()
+#ifndef MEDIA_ARENA_DMA_BYTES
+#define MEDIA_ARENA_DMA_BYTES (64 * 1024)
+#endif
+#ifndef MEDIA_ARENA_BULK_BYTES
+#define MEDIA_ARENA_BULK_BYTES (48 * 1024)
+#endif
+#ifndef MEDIA_ARENA_PSRAM_BYTES
+#define MEDIA_ARENA_PSRAM_BYTES (1024 * 1024)
+#endif
+// Internal RAM begin() leaves free for WiFi, the SD driver and task
+// stacks; regions in internal RAM shrink rather than eat into it
+#ifndef MEDIA_ARENA_HEAP_RESERVE
+#define MEDIA_ARENA_HEAP_RESERVE (160 * 1024)
+#endif
+
+// Memory a media buffer should live in
+enum MediaPool
+{
+    // DMA-capable internal RAM: line buffers, SPI and I2S transfer buffers
+    MEDIA_POOL_DMA,
+    // PSRAM when fitted, otherwise internal RAM: whole frames and caches
+    MEDIA_POOL_BULK,
+    MEDIA_POOL_COUNT
+};
+
+// Owners of media buffers, each with its own budget and statistics
+enum MediaSubsystem
+{
+    MEDIA_SUB_VIDEO,
+    MEDIA_SUB_AUDIO,
+    MEDIA_SUB_DISPLAY,
+    MEDIA_SUB_CACHE,
+    MEDIA_SUB_UI,
+    MEDIA_SUB_COUNT
+};
+
+typedef struct
+{
+    uint32_t bytes_in_use;
+    uint32_t high_water;
+    uint32_t budget;        // 0 means unlimited
+    uint32_t allocations;
+    uint32_t failures;
+} media_usage_t;
+
+typedef struct
+{
+    uint32_t region_bytes;  // size of the reserved region
+    uint32_t free_bytes;
+    uint32_t largest_free;
+    uint32_t free_blocks;
+    uint32_t heap_fallbacks; // allocations that did not fit the region
+} media_pool_stats_t;
+
+/**
+ * Region-aware allocator for media buffers. Each pool reserves one block
+ * of the right memory type at boot and hands out pieces of it first-fit
+ * with coalescing on free, so long-lived media buffers never interleave
+ * with general heap allocations and fragment it.
+ **/
+class MediaArena
+{
+public:
+    // Reserve the pool regions, call once from setup() before starting tasks.
+    // The sizes are upper bounds: internal RAM regions are cut down to what
+    // is free above MEDIA_ARENA_HEAP_RESERVE, and allocations that no longer
+    // fit fall back to the heap.
+    static bool begin(uint32_t dma_bytes = MEDIA_ARENA_DMA_BYTES, uint32_t bulk_bytes = MEDIA_ARENA_BULK_BYTES);
+
+    static void setBudget(MediaSubsystem subsystem, uint32_t bytes);
+
+    // Returns nullptr if the subsystem is over budget or memory is exhausted.
+    // Falls back to the system heap when the pool region is full.
+    static void *alloc(MediaPool pool, MediaSubsystem subsystem, size_t size);
+    static void free(void *ptr);
+
+    static void getUsage(MediaSubsystem subsystem, media_usage_t *usage);
+    static void getPoolStats(MediaPool pool, media_pool_stats_t *stats);
+    // 0 when all free space is one block, approaching 1 as it splinters
+    static float fragmentation(MediaPool pool);
+
+    static void printStats();
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef __pipeline_stats_h__
+#define __pipeline_stats_h__
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// Set to 0 to compile all instrumentation out
+#ifndef PIPELINE_STATS
+#define PIPELINE_STATS 1
+#endif
+
+// Log2 buckets: bucket n holds durations of [2^(n-1), 2^n) microseconds
+#define PIPELINE_BUCKETS 32
+
+enum PipelineStage
+{
+    STAGE_SD_OPEN,      // opening a file for a one-off read
+    STAGE_SD_READ,      // card transfer, any client
+    STAGE_DECODE,       // expanding reduced variants
+    STAGE_CONVERT,      // pixel conversion and rotation, per frame
+    STAGE_SPI_PUSH,     // sending to the panel, per frame
+    STAGE_FRAME_WAIT,   // draw task waiting for its buffer to be loaded
+    STAGE_I2S_WRITE,    // i2s_write, including waiting for DMA space
+    STAGE_AUDIO_FILL,   // SampleSource::getFrames
+    STAGE_COUNT
+};
+
+enum PipelineCounter
+{
+    COUNTER_FRAME_DROPS,        // frames that could not be loaded
+    COUNTER_DISPLAY_UNDERRUNS,  // frame clock ticks with no frame ready
+    COUNTER_AUDIO_UNDERRUNS,    // audio buffers padded with silence
+    COUNTER_COUNT
+};
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[PIPELINE_BUCKETS];
+} stage_histogram_t;
+
+/**
+ * Always-on timing of the playback stages. Each stage has a fixed log2
+ * histogram of durations in microseconds, read from esp_timer so that tasks
+ * moving between cores are timed on one clock. Updates are relaxed atomics,
+ * so a sample costs two timer reads and a few increments. Percentiles are
+ * read back from the buckets, accurate to a factor of two.
+ **/
+class PipelineStats
+{
+public:
+    // Wraps after 71 minutes; only differences are used
+    static inline uint32_t now() { return (uint32_t)esp_timer_get_time(); }
+
+    static void record(PipelineStage stage, uint32_t us);
+    static void recordSince(PipelineStage stage, uint32_t start_us) { record(stage, now() - start_us); }
+    static void count(PipelineCounter counter);
+
+    static void getHistogram(PipelineStage stage, stage_histogram_t *histogram);
+    // Upper bound of the bucket holding the given percentile, in microseconds
+    static uint32_t percentile(const stage_histogram_t *histogram, int percent);
+    static uint32_t counter(PipelineCounter counter);
+
+    static void reset();
+    // One line per stage that has samples, then the counters
+    static void print();
+};
+
+// Times the rest of the enclosing scope as one stage sample
+class StageTimer
+{
+private:
+    PipelineStage m_stage;
+    uint32_t m_start;
+
+public:
+    StageTimer(PipelineStage stage) : m_stage(stage), m_start(PipelineStats::now()) {}
+    ~StageTimer() { PipelineStats::recordSince(m_stage, m_start); }
+};
+
+#if PIPELINE_STATS
+#define PIPELINE_TIME_CONCAT(a, b) a##b
+#define PIPELINE_TIME_NAME(line) PIPELINE_TIME_CONCAT(stage_timer_, line)
+#define PIPELINE_TIME(stage) StageTimer PIPELINE_TIME_NAME(__LINE__)(stage)
+#define PIPELINE_RECORD(stage, us) PipelineStats::record(stage, us)
+#define PIPELINE_COUNT(counter) PipelineStats::count(counter)
+#define PIPELINE_NOW() PipelineStats::now()
+#else
+#define PIPELINE_TIME(stage) do {} while (0)
+#define PIPELINE_RECORD(stage, us) do { (void)(us); } while (0)
+#define PIPELINE_COUNT(counter) do {} while (0)
+#define PIPELINE_NOW() 0
+#endif
+
+#endif
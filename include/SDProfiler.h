@@ -0,0 +1,60 @@
+#ifndef __sd_profiler_h__
+#define __sd_profiler_h__
+
+#include <Arduino.h>
+#include <SPI.h>
+
+// Clock the card is mounted at when nothing has been measured
+#define SD_DEFAULT_CLOCK_HZ 4000000
+
+// Set to 1 to profile the card on every boot instead of on request
+#ifndef SD_PROFILE_ON_BOOT
+#define SD_PROFILE_ON_BOOT 0
+#endif
+
+// Scratch file read by the sweep, written once
+#define SD_PROFILE_PATH "/sdprobe.bin"
+#define SD_PROFILE_FILE_BYTES (1024 * 1024)
+
+// Latencies kept per measurement for the percentiles
+#define SD_PROFILE_SAMPLES 256
+
+typedef struct
+{
+    uint32_t clock_hz;
+    uint32_t knee_bytes;    // smallest read reaching 90% of the best sequential rate
+    float seq_mbps;         // sequential rate at the knee
+    float random_mbps;      // 4 KB random reads
+    uint32_t open_p99_us;
+} sd_profile_t;
+
+/**
+ * Measures the card through the same SD and HSPI setup playback uses.
+ * For each clock in the sweep the card is remounted, then open/close cost,
+ * sequential reads of several sizes, misaligned reads and random reads are
+ * timed and every byte read is checked, so a clock that corrupts data is
+ * rejected rather than reported as fast. The fastest clean clock and its
+ * knee read size can be stored in NVS and picked up by initDisplay().
+ *
+ * The card must be otherwise idle, so run() belongs in setup() before the
+ * SD scheduler starts; requestOnNextBoot() arranges that from a running
+ * system by restarting.
+ **/
+class SDProfiler
+{
+public:
+    // Leaves the card mounted at the best clock found, false if none worked
+    static bool run(SPIClass &spi, int cs_pin, sd_profile_t *best);
+
+    static bool load(sd_profile_t *profile);
+    static bool store(const sd_profile_t *profile);
+    static void clear();
+
+    static void requestOnNextBoot();
+    // True once after requestOnNextBoot()
+    static bool takeRequest();
+
+    static void print(const sd_profile_t *profile);
+};
+
+#endif
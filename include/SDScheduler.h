@@ -0,0 +1,118 @@
+#ifndef __sd_scheduler_h__
+#define __sd_scheduler_h__
+
+#include <Arduino.h>
+#include <SD.h>
+#include <FS.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "FatVolume.h"
+
+// Requests that can be waiting in the scheduler at once
+#ifndef SD_SCHED_MAX_PENDING
+#define SD_SCHED_MAX_PENDING 16
+#endif
+// Largest transfer adjacent reads are merged into
+#ifndef SD_SCHED_MERGE_BYTES
+#define SD_SCHED_MERGE_BYTES (8 * 1024)
+#endif
+// Service task placement, on the core the video loaders use
+#ifndef SD_SCHED_TASK_PRIORITY
+#define SD_SCHED_TASK_PRIORITY 3
+#endif
+#ifndef SD_SCHED_TASK_CORE
+#define SD_SCHED_TASK_CORE 1
+#endif
+
+// Clients of the card, in priority order (lower value is served first)
+enum SDClient
+{
+    SD_CLIENT_AUDIO,
+    SD_CLIENT_VIDEO,
+    SD_CLIENT_BACKGROUND,
+    SD_CLIENT_COUNT
+};
+
+struct sd_request_t;
+// Runs on the scheduler task once the request has completed
+typedef void (*sd_callback_t)(sd_request_t *request, void *arg);
+// Card work other than a read, such as opening a file, run on the
+// scheduler task; returns the request's result
+typedef int32_t (*sd_operation_t)(void *arg);
+
+typedef struct sd_request_t
+{
+    SDClient client;
+    // One of: an open file (kept open across requests), a contiguous file
+    // streamed from raw sectors, a path opened and closed for this request,
+    // or an operation run in place of a read
+    File *file;
+    ContiguousFile *stream;
+    const char *path;
+    sd_operation_t operation;
+    void *operation_arg;
+    uint32_t offset;
+    uint8_t *buffer;
+    uint32_t length;
+    int64_t deadline_us;        // esp_timer time the data is needed by, 0 for none
+
+    // Completion, any combination may be used
+    sd_callback_t callback;
+    void *callback_arg;
+    SemaphoreHandle_t done_sem; // given when complete
+
+    // Filled in by the scheduler
+    volatile bool done;
+    int32_t result;             // bytes read, -1 on error
+    int64_t submit_us;
+} sd_request_t;
+
+typedef struct
+{
+    uint32_t requests;
+    uint32_t bytes;
+    uint32_t coalesced;         // requests served as part of another's transfer
+    uint32_t deadline_misses;
+    uint32_t errors;
+    uint64_t total_latency_us;  // submit to completion
+    uint32_t max_latency_us;
+    uint64_t service_us;        // time the card spent on this client
+} sd_client_stats_t;
+
+/**
+ * Single owner of the SD card. Clients submit reads with a priority class
+ * and deadline, and one service task performs them in order: highest
+ * class first, earliest deadline within a class. Pending reads on the
+ * same file that continue on from each other are merged into one
+ * multi-block transfer of up to SD_SCHED_MERGE_BYTES, and the data is
+ * copied out to each caller's buffer.
+ *
+ * Before begin() the blocking calls read the card directly, so code that
+ * uses them works with or without the service task.
+ **/
+class SDScheduler
+{
+public:
+    static bool begin(int task_priority = SD_SCHED_TASK_PRIORITY, int core = SD_SCHED_TASK_CORE);
+
+    // Queue a read; completion is signalled through the request. The
+    // request and buffer must stay valid until done.
+    static bool submit(sd_request_t *request);
+
+    // Blocking helpers, returning bytes read or -1
+    static int32_t read(SDClient client, File *file, uint32_t offset, uint8_t *buffer, uint32_t length,
+                        uint32_t deadline_ms = 0);
+    static int32_t readFile(SDClient client, const char *path, uint32_t offset, uint8_t *buffer, uint32_t length,
+                            uint32_t deadline_ms = 0);
+    static int32_t readStream(SDClient client, ContiguousFile *stream, uint32_t offset, uint8_t *buffer,
+                              uint32_t length, uint32_t deadline_ms = 0);
+    // Run operation on the scheduler task, e.g. to open a file that is
+    // then read with read() or readStream(); returns what it returned
+    static int32_t call(SDClient client, sd_operation_t operation, void *arg, uint32_t deadline_ms = 0);
+
+    static void getStats(SDClient client, sd_client_stats_t *stats);
+    static void resetStats();
+    static void printStats();
+};
+
+#endif
@@ -12,10 +12,42 @@
 #include <SD.h>
 #include <FS.h>
 
+#include "FrameUtils.h"
+#include "VariantController.h"
+#include "FatVolume.h"
+
+// Frame geometry the SD video player is specialised for. Frames of this size
+// are converted and pushed by a compile-time pipeline, anything else falls
+// back to TFT_eSPI's generic pushImage.
+#ifndef SD_VIDEO_WIDTH
+#define SD_VIDEO_WIDTH 160
+#endif
+#ifndef SD_VIDEO_HEIGHT
+#define SD_VIDEO_HEIGHT 128
+#endif
+
+// RAM budget for caching a looping clip. SD_VIDEO_LOOP_CACHE_AUTO sizes it
+// from the bulk memory free when playback starts, 0 disables the cache.
+#define SD_VIDEO_LOOP_CACHE_AUTO 0xFFFFFFFFu
+#ifndef SD_VIDEO_LOOP_CACHE_BYTES
+#define SD_VIDEO_LOOP_CACHE_BYTES SD_VIDEO_LOOP_CACHE_AUTO
+#endif
+
 extern TFT_eSPI tft;
 
 void startSDVideo(const char *file_name, int x, int y, int width, int height);
+void setSDVideoRotation(FrameRotation rotation, bool mirror = false);
+void setSDVideoLoopCache(uint32_t budget_bytes);
+// Cheaper copies of the clip to fall back to when the card cannot keep up,
+// richest first. Call before startSDVideo; patterns must stay valid.
+void setSDVideoVariants(const stream_variant_t *variants, int count);
+// Compositor layer holding the clip, -1 when frames go straight to the panel
+int getSDVideoLayer();
+int countFrames(const char *FRAME_FILE_PATTERN, int limit);
 void countAvailableFrames(const char *FRAME_FILE_PATTERN);
+ContiguousFile *openFrameStreams(const char *FRAME_FILE_PATTERN);
+void startVideoVariants();
+int readVideoFrame(int frameIndex, char *fileName, uint8_t *buffer);
 
 void initializeWatchdog();
 void addTaskToWatchdog(TaskHandle_t taskHandle, const char* taskName);
@@ -3,19 +3,36 @@
 
 #include <Arduino.h>
 #include <TFT_eSPI.h>
+#include "esp_timer.h"
+#include "FrameUtils.h"
+
+// Frames the decode task can get ahead of the display by
+#ifndef TFT_FRAME_SLOTS
+#define TFT_FRAME_SLOTS 3
+#endif
 
 class FrameSource;
 
 /**
  * TFT Display Output for video frames using FreeRTOS
+ *
+ * A decode task pulls frames from the source into a few frame slots and
+ * queues them; the display task sleeps until a periodic esp_timer frame
+ * clock ticks and then shows the next queued frame. When no frame is
+ * ready the previous one stays on screen and the tick is counted as late.
  **/
 class TFT_Output
 {
 private:
-    // TFT display task
+    // TFT display task and the task filling frames for it
     TaskHandle_t m_tftDisplayTaskHandle;
-    // TFT display queue
+    TaskHandle_t m_decodeTaskHandle;
+    // Decoded frames waiting to be shown, and slots free to decode into
     QueueHandle_t m_tftQueue;
+    QueueHandle_t m_freeQueue;
+    VideoFrame_t m_frames[TFT_FRAME_SLOTS];
+    // Given by each task as it exits
+    SemaphoreHandle_t m_stoppedSem;
     // TFT display instance
     TFT_eSPI *m_tft;
     // Source of video frames for us to display
@@ -26,14 +43,43 @@ private:
     int m_display_width;
     int m_display_height;
     // Frame timing
-    unsigned long m_last_frame_time;
-    unsigned long m_frame_interval_ms;
+    esp_timer_handle_t m_frame_timer;
+    uint32_t m_frame_interval_us;
+    volatile bool m_running;
+    volatile bool m_paused;
+    volatile uint32_t m_frames_shown;
+    volatile uint32_t m_late_ticks;
+    // Scaling for frames that do not match the display window
+    FrameScaler m_scaler;
+    ScaleMode m_scale_mode;
+    uint16_t *m_strip;
+    int m_strip_rows;
+
+    void displayFrame(VideoFrame_t *frame);
+    bool pushScaledFrame(VideoFrame_t *frame);
+    void startClock();
 
 public:
+    TFT_Output();
     void start(TFT_eSPI *tft, FrameSource *frame_generator, int x = 0, int y = 0, int width = 160, int height = 128);
     void stop();
-    
+    // Freeze on the current frame; decoding stops once the slots are full
+    void pause();
+    void resume();
+    bool isPaused() { return m_paused; }
+    // Change the frame clock, fractional rates such as 29.97 are fine
+    void setFrameRate(float fps);
+    void setFrameInterval(uint32_t interval_us);
+    uint32_t frameIntervalUs() { return m_frame_interval_us; }
+    // Sampling used when a frame has to be resized to fit the window
+    void setScaleMode(ScaleMode mode) { m_scale_mode = mode; }
+    uint32_t framesShown() { return m_frames_shown; }
+    // Clock ticks where no decoded frame was ready
+    uint32_t lateFrames() { return m_late_ticks; }
+
     friend void tftDisplayTask(void *param);
+    friend void tftDecodeTask(void *param);
+    friend void tftFrameClock(void *arg);
 };
 
 #endif
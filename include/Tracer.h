@@ -0,0 +1,101 @@
+#ifndef __tracer_h__
+#define __tracer_h__
+
+#include <Arduino.h>
+
+// Set to 0 to compile all trace points out
+#ifndef PIPELINE_TRACE
+#define PIPELINE_TRACE 1
+#endif
+
+// Events kept per capture, 16 bytes each, statically allocated
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY 1024
+#endif
+
+enum TraceEvent
+{
+    TRACE_FRAME_LOAD,       // load task filling a buffer, arg is the frame
+    TRACE_FRAME_HANDOFF,    // buffer passed to its draw task
+    TRACE_FRAME_DRAW,       // draw task pushing a buffer
+    TRACE_MUTEX_WAIT,       // waiting for the display mutex
+    TRACE_AUDIO_BATCH,      // i2s writer refilling DMA buffers
+    TRACE_SD_READ,          // scheduler serving a read, arg is the length
+    TRACE_WATCHDOG_FEED,
+    TRACE_EVENT_COUNT
+};
+
+enum TracePhase
+{
+    TRACE_PHASE_BEGIN,
+    TRACE_PHASE_END,
+    TRACE_PHASE_INSTANT
+};
+
+typedef struct
+{
+    uint32_t time_us;       // since start()
+    uint32_t task;          // TaskHandle_t of the recording task
+    uint32_t arg;
+    uint8_t event;
+    uint8_t phase;
+    uint8_t core;
+    uint8_t reserved;
+} trace_event_t;
+
+/**
+ * Captures begin/end events from the playback tasks into a fixed buffer.
+ * Recording is off until start() and stops by itself when the buffer is
+ * full, so a capture is one contiguous window. A disarmed trace point costs
+ * one atomic load; an armed one a fetch-and-add, a scan of the task names
+ * copied so far and a 16 byte store.
+ *
+ * Captures are printed over Serial either as Chrome trace JSON, to load in
+ * chrome://tracing or Perfetto, or as compact hex records for
+ * Python Scripts/TraceTools/trace_to_chrome.py.
+ **/
+class Tracer
+{
+public:
+    static void start();
+    static void stop();
+    static bool recording();
+
+    static void record(TraceEvent event, TracePhase phase, uint32_t arg);
+
+    // Both stop the capture first
+    static void dumpJson(Print &out);
+    static void dumpBinary(Print &out);
+    static const char *eventName(TraceEvent event);
+};
+
+// Records a begin now and the matching end when the scope closes
+class TraceScope
+{
+private:
+    TraceEvent m_event;
+    uint32_t m_arg;
+
+public:
+    TraceScope(TraceEvent event, uint32_t arg) : m_event(event), m_arg(arg)
+    {
+        Tracer::record(m_event, TRACE_PHASE_BEGIN, m_arg);
+    }
+    ~TraceScope() { Tracer::record(m_event, TRACE_PHASE_END, m_arg); }
+};
+
+#if PIPELINE_TRACE
+#define TRACE_CONCAT(a, b) a##b
+#define TRACE_SCOPE_NAME(line) TRACE_CONCAT(trace_scope_, line)
+#define TRACE_SCOPE(event, arg) TraceScope TRACE_SCOPE_NAME(__LINE__)(event, arg)
+#define TRACE_BEGIN(event, arg) Tracer::record(event, TRACE_PHASE_BEGIN, arg)
+#define TRACE_END(event, arg) Tracer::record(event, TRACE_PHASE_END, arg)
+#define TRACE_INSTANT(event, arg) Tracer::record(event, TRACE_PHASE_INSTANT, arg)
+#else
+#define TRACE_SCOPE(event, arg) do {} while (0)
+#define TRACE_BEGIN(event, arg) do {} while (0)
+#define TRACE_END(event, arg) do {} while (0)
+#define TRACE_INSTANT(event, arg) do {} while (0)
+#endif
+
+#endif
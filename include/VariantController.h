@@ -0,0 +1,95 @@
+#ifndef __variant_controller_h__
+#define __variant_controller_h__
+
+#include <Arduino.h>
+
+// Most variants a clip can carry, variant 0 being full quality
+#ifndef VARIANT_MAX
+#define VARIANT_MAX 4
+#endif
+// Weight of a new load time sample, 1 / 2^shift
+#ifndef VARIANT_EWMA_SHIFT
+#define VARIANT_EWMA_SHIFT 3
+#endif
+// Hysteresis: frames a slow (or fast) estimate must persist before the
+// controller steps down (or back up). Stepping up is deliberately slower.
+#ifndef VARIANT_DOWN_FRAMES
+#define VARIANT_DOWN_FRAMES 3
+#endif
+#ifndef VARIANT_UP_FRAMES
+#define VARIANT_UP_FRAMES 16
+#endif
+// Fractions of the frame budget, in percent, that trigger a switch
+#ifndef VARIANT_DOWN_PERCENT
+#define VARIANT_DOWN_PERCENT 85
+#endif
+#ifndef VARIANT_UP_PERCENT
+#define VARIANT_UP_PERCENT 60
+#endif
+
+// How a variant's frame file is laid out. All of them expand in place to a
+// full size RGB332 frame.
+enum VariantFormat
+{
+    VARIANT_RGB332,         // width * height bytes, as produced for SD video
+    VARIANT_INDEXED4,       // 16 byte RGB332 palette, then 4 bit indices, high nibble first
+    VARIANT_RGB332_HALF     // (width / 2) * (height / 2) bytes, doubled on load
+};
+
+typedef struct
+{
+    const char *pattern;    // printf pattern of the variant's frame files
+    VariantFormat format;
+} stream_variant_t;
+
+/**
+ * Chooses which variant of a clip to load next so loading keeps up with
+ * the frame rate. Every load feeds an EWMA of the card's cost per byte;
+ * from it the controller predicts each variant's load time and steps to a
+ * cheaper variant when the current one would overrun the frame budget,
+ * and back up once the next richer one fits comfortably. Switches take
+ * effect at the next frame requested.
+ *
+ * Safe to use from several loader tasks.
+ **/
+class VariantController
+{
+private:
+    uint32_t m_frame_bytes[VARIANT_MAX];
+    int m_count;
+    int m_current;
+    uint32_t m_budget_us;
+    // EWMA of load time per byte, in nanoseconds, 0 before the first sample
+    uint32_t m_ns_per_byte;
+    int m_down_votes;
+    int m_up_votes;
+    uint32_t m_switches;
+    portMUX_TYPE m_mux;
+
+    uint32_t predictLocked(int variant);
+
+public:
+    VariantController();
+
+    // frame_bytes[i] is what variant i reads from the card per frame,
+    // ordered from richest to cheapest
+    bool begin(const uint32_t *frame_bytes, int count, uint32_t budget_us);
+    void setBudget(uint32_t budget_us) { m_budget_us = budget_us; }
+
+    int current();
+    int count() { return m_count; }
+    uint32_t switches() { return m_switches; }
+    // Expected load time of a variant at the measured throughput
+    uint32_t predictedUs(int variant);
+
+    // Report a completed load, returns the variant to use next
+    int recordLoad(uint32_t bytes, uint32_t elapsed_us);
+
+    // Bytes a variant's frame file holds for a width x height frame
+    static uint32_t frameBytes(VariantFormat format, int width, int height);
+    // Read a variant frame to buffer + (width * height - frameBytes()) and
+    // this expands it to a full RGB332 frame filling the buffer
+    static bool expandInPlace(VariantFormat format, uint8_t *buffer, int width, int height);
+};
+
+#endif
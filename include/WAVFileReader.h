@@ -4,6 +4,7 @@
 #include <SD.h>
 #include <FS.h>
 #include "SampleSource.h"
+#include "FatVolume.h"
 #include <Arduino.h>
 
 typedef struct
@@ -35,6 +36,12 @@ private:
     int m_num_channels;
     int m_sample_rate;
     File m_file;
+    // Byte range of the sample data and the next byte to read
+    uint32_t m_data_start;
+    uint32_t m_data_end;
+    uint32_t m_position;
+    // Raw sector access when the file is stored contiguously
+    ContiguousFile m_stream;
     void DumpWAVHeader(wav_header_t* Wav);
     void PrintData(const char* Data,uint8_t NumBytes);
     bool ValidWavData(wav_header_t* Wav);
@@ -8,7 +8,17 @@
 #include <SD.h>
 #include <FS.h>
 
+#include "BlockCache.h"
+#include "FatVolume.h"
+
+// Bring up the panel and the card one after the other, then print the
+// card's contents; BootSequencer overlaps the steps instead
 void initDisplay();
+void resetPanel();
+void initTFT();
+bool initSD();
+// Directory listing and test file reads, slow on a full card
+void runSDDiagnostics();
 void printDirectory(File dir, int numTabs);
 void rotateColors();
 
@@ -1,6 +1,7 @@
 #include <SD.h>
 #include <FS.h>
 #include "AVIFileReader.h"
+#include "MediaArena.h"
 
 void AVIFileReader::PrintData(const char* Data, uint8_t NumBytes)
 {
@@ -128,9 +129,13 @@ bool AVIFileReader::ReadFrameData(VideoFrame_t *frame)
         // Allocate buffer for frame data if needed
         if(frame->data == nullptr || frame->size < chunk_size) {
             if(frame->data != nullptr) {
-                free(frame->data);
+                MediaArena::free(frame->data);
+            }
+            frame->data = (uint8_t*)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_VIDEO, chunk_size);
+            if(frame->data == nullptr) {
+                frame->size = 0;
+                return false;
             }
-            frame->data = (uint8_t*)malloc(chunk_size);
             frame->size = chunk_size;
         }
         
@@ -138,6 +143,7 @@ bool AVIFileReader::ReadFrameData(VideoFrame_t *frame)
         if(m_file.read(frame->data, chunk_size) == chunk_size) {
             frame->width = m_frame_width;
             frame->height = m_frame_height;
+            frame->format = FRAME_FORMAT_RGB565;
             return true;
         }
     } else {
@@ -152,6 +158,7 @@ bool AVIFileReader::ReadFrameData(VideoFrame_t *frame)
 AVIFileReader::AVIFileReader(const char *file_name)
 {
     m_frame_rate = 0;
+    m_frame_interval_us = 0;
     m_frame_width = 0;
     m_frame_height = 0;
     m_total_frames = 0;
@@ -197,8 +204,10 @@ AVIFileReader::AVIFileReader(const char *file_name)
     // Calculate frame rate (frames per second)
     if(avi_header.micro_sec_per_frame > 0) {
         m_frame_rate = 1000000 / avi_header.micro_sec_per_frame;
+        m_frame_interval_us = avi_header.micro_sec_per_frame; // exact, 29.97 FPS stays 29.97
     } else {
         m_frame_rate = 25; // Default to 25 FPS
+        m_frame_interval_us = 1000000 / 25;
     }
     
     // Find the data chunk containing video frames
@@ -214,7 +223,7 @@ AVIFileReader::AVIFileReader(const char *file_name)
 AVIFileReader::~AVIFileReader()
 {
     if(m_current_video_frame.data != nullptr) {
-        free(m_current_video_frame.data);
+        MediaArena::free(m_current_video_frame.data);
     }
     m_file.close();
 }
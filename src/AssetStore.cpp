@@ -0,0 +1,218 @@
+#include <string.h>
+#include "AssetStore.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#define ASSET_LOG(...) Serial.printf(__VA_ARGS__)
+#else
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define ASSET_LOG(...) printf(__VA_ARGS__)
+#endif
+
+AssetStore::AssetStore()
+{
+    m_base = nullptr;
+    m_size = 0;
+    m_entries = nullptr;
+    m_count = 0;
+#ifdef ARDUINO
+    m_mmap_handle = 0;
+#else
+    m_fd = -1;
+#endif
+}
+
+AssetStore::~AssetStore()
+{
+    end();
+}
+
+bool AssetStore::validate()
+{
+    if (m_size < sizeof(asset_image_header_t)) {
+        ASSET_LOG("Asset store: image too small\n");
+        return false;
+    }
+    const asset_image_header_t *header = (const asset_image_header_t *)m_base;
+    if (memcmp(header->magic, ASSET_MAGIC, 4) != 0) {
+        ASSET_LOG("Asset store: no asset image found (bad magic)\n");
+        return false;
+    }
+    if (header->version != ASSET_VERSION) {
+        ASSET_LOG("Asset store: unsupported image version %d\n", header->version);
+        return false;
+    }
+    // Bounds are checked by subtraction so a corrupt offset or size cannot
+    // wrap around and pass
+    uint32_t image_size = header->image_size;
+    if (image_size > m_size || header->table_offset > image_size || header->table_offset % 4 != 0 ||
+        header->count > (image_size - header->table_offset) / sizeof(asset_entry_t)) {
+        ASSET_LOG("Asset store: entry table out of bounds\n");
+        return false;
+    }
+
+    const asset_entry_t *entries = (const asset_entry_t *)(m_base + header->table_offset);
+    for (int i = 0; i < header->count; i++) {
+        if (entries[i].offset > image_size || entries[i].size > image_size - entries[i].offset ||
+            entries[i].name[ASSET_NAME_LENGTH - 1] != '\0') {
+            ASSET_LOG("Asset store: entry %d is corrupt\n", i);
+            return false;
+        }
+    }
+
+    m_entries = entries;
+    m_count = header->count;
+    ASSET_LOG("Asset store: %d assets, %u bytes\n", m_count, (unsigned)image_size);
+    return true;
+}
+
+#ifdef ARDUINO
+bool AssetStore::begin(const char *partition_label)
+{
+    end();
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_ANY, partition_label);
+    if (partition == nullptr) {
+        ASSET_LOG("Asset store: partition '%s' not found\n", partition_label);
+        return false;
+    }
+
+    const void *mapped = nullptr;
+    spi_flash_mmap_handle_t handle;
+    if (esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &handle) != ESP_OK) {
+        ASSET_LOG("Asset store: failed to map partition '%s'\n", partition_label);
+        return false;
+    }
+    m_base = (const uint8_t *)mapped;
+    m_size = partition->size;
+    m_mmap_handle = handle;
+
+    if (!validate()) {
+        end();
+        return false;
+    }
+    return true;
+}
+
+void AssetStore::end()
+{
+    if (m_base != nullptr) {
+        spi_flash_munmap(m_mmap_handle);
+    }
+    m_base = nullptr;
+    m_size = 0;
+    m_entries = nullptr;
+    m_count = 0;
+}
+#else
+bool AssetStore::begin(const char *image_path)
+{
+    end();
+    m_fd = open(image_path, O_RDONLY);
+    if (m_fd < 0) {
+        ASSET_LOG("Asset store: cannot open %s\n", image_path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) != 0 || st.st_size == 0) {
+        end();
+        return false;
+    }
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (mapped == MAP_FAILED) {
+        ASSET_LOG("Asset store: cannot map %s\n", image_path);
+        end();
+        return false;
+    }
+    m_base = (const uint8_t *)mapped;
+    m_size = st.st_size;
+
+    if (!validate()) {
+        end();
+        return false;
+    }
+    return true;
+}
+
+void AssetStore::end()
+{
+    if (m_base != nullptr) {
+        munmap((void *)m_base, m_size);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    m_fd = -1;
+    m_base = nullptr;
+    m_size = 0;
+    m_entries = nullptr;
+    m_count = 0;
+}
+#endif
+
+bool AssetStore::at(int index, asset_t *asset)
+{
+    if (index < 0 || index >= m_count) {
+        return false;
+    }
+    const asset_entry_t *entry = &m_entries[index];
+    asset->name = entry->name;
+    asset->data = m_base + entry->offset;
+    asset->size = entry->size;
+    asset->width = entry->width;
+    asset->height = entry->height;
+    asset->format = entry->format;
+    return true;
+}
+
+bool AssetStore::find(const char *name, asset_t *asset)
+{
+    int low = 0;
+    int high = m_count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = strncmp(name, m_entries[mid].name, ASSET_NAME_LENGTH);
+        if (cmp == 0) {
+            return at(mid, asset);
+        }
+        if (cmp < 0) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return false;
+}
+
+#ifdef ARDUINO
+bool AssetStore::pushImage(TFT_eSPI *tft, int x, int y, const char *name)
+{
+    asset_t asset;
+    if (!find(name, &asset)) {
+        ASSET_LOG("Asset store: no asset named %s\n", name);
+        return false;
+    }
+    uint32_t pixels = (uint32_t)asset.width * asset.height;
+
+    if (asset.format == ASSET_FORMAT_RGB565 && asset.size >= pixels * 2) {
+        // Stored little-endian like the SD frames, so have TFT_eSPI swap
+        bool swap = tft->getSwapBytes();
+        tft->setSwapBytes(true);
+        tft->pushImage(x, y, asset.width, asset.height, (const uint16_t *)asset.data);
+        tft->setSwapBytes(swap);
+        return true;
+    }
+    if (asset.format == ASSET_FORMAT_RGB332 && asset.size >= pixels) {
+        tft->pushImage(x, y, asset.width, asset.height, asset.data, true);
+        return true;
+    }
+    ASSET_LOG("Asset store: %s is not a drawable image\n", name);
+    return false;
+}
+#endif
@@ -0,0 +1,501 @@
+#include <string.h>
+#include <stdlib.h>
+#include "BlockCache.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "MediaArena.h"
+#define CACHE_LOG(...) Serial.printf(__VA_ARGS__)
+#else
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define CACHE_LOG(...) printf(__VA_ARGS__)
+#endif
+
+static inline uint16_t readLE16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t readLE32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+static inline bool inRange(uint32_t lba, uint32_t first, uint32_t count)
+{
+    return lba >= first && lba - first < count;
+}
+
+BlockCache::BlockCache()
+{
+    m_device = nullptr;
+    m_data = nullptr;
+    m_staging = nullptr;
+    m_slots = nullptr;
+    m_slot_count = 0;
+    m_read_ahead = 0;
+    m_max_pinned = 0;
+    m_pinned = 0;
+    m_bypass_blocks = 8;
+    m_pin_first = 0;
+    m_pin_count = 0;
+    m_clock = 0;
+    m_next_lba = UINT32_MAX;
+    resetStats();
+}
+
+BlockCache::~BlockCache()
+{
+    end();
+}
+
+bool BlockCache::begin(BlockDevice *device, int blocks, int read_ahead)
+{
+    end();
+    if (device == nullptr || blocks < 2) {
+        return false;
+    }
+    // A read-ahead fetch has to fit in the cache alongside the pinned half
+    if (read_ahead > blocks / 2 - 1) {
+        read_ahead = blocks / 2 - 1;
+    }
+
+    // The staging run sits after the cached blocks in the same allocation
+    uint32_t bytes = (uint32_t)(blocks + read_ahead + 1) * BLOCK_CACHE_SECTOR_SIZE;
+    m_slots = (cache_slot_t *)calloc(blocks, sizeof(cache_slot_t));
+#ifdef ARDUINO
+    m_data = (uint8_t *)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_CACHE, bytes);
+#else
+    m_data = (uint8_t *)malloc(bytes);
+#endif
+    if (m_slots == nullptr || m_data == nullptr) {
+        CACHE_LOG("Block cache: failed to allocate %d blocks\n", blocks);
+        end();
+        return false;
+    }
+    m_device = device;
+    m_staging = m_data + (uint32_t)blocks * BLOCK_CACHE_SECTOR_SIZE;
+    m_slot_count = blocks;
+    m_read_ahead = read_ahead;
+    m_max_pinned = blocks / 2;
+    m_pinned = 0;
+    m_next_lba = UINT32_MAX;
+    resetStats();
+    CACHE_LOG("Block cache: %d blocks (%d bytes), read-ahead %d\n", blocks, blocks * BLOCK_CACHE_SECTOR_SIZE,
+              read_ahead);
+    return true;
+}
+
+void BlockCache::end()
+{
+    free(m_slots);
+#ifdef ARDUINO
+    MediaArena::free(m_data);
+#else
+    free(m_data);
+#endif
+    m_slots = nullptr;
+    m_data = nullptr;
+    m_staging = nullptr;
+    m_device = nullptr;
+    m_slot_count = 0;
+    m_pinned = 0;
+}
+
+void BlockCache::invalidate()
+{
+    for (int i = 0; i < m_slot_count; i++) {
+        m_slots[i].valid = false;
+        m_slots[i].pinned = false;
+    }
+    m_pinned = 0;
+    m_next_lba = UINT32_MAX;
+}
+
+void BlockCache::resetStats()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+float BlockCache::hitRate()
+{
+    uint32_t lookups = m_stats.hits + m_stats.misses;
+    return lookups ? (float)m_stats.hits / lookups : 0.0f;
+}
+
+void BlockCache::printStats()
+{
+    CACHE_LOG("Block cache: %u hits, %u misses (%.1f%% hit rate), %u device reads\n",
+              (unsigned)m_stats.hits, (unsigned)m_stats.misses, hitRate() * 100.0f, (unsigned)m_stats.device_reads);
+    CACHE_LOG("  read-ahead %u blocks (%u used), bypassed %u, written %u, pinned %d/%d\n",
+              (unsigned)m_stats.read_ahead, (unsigned)m_stats.read_ahead_hits, (unsigned)m_stats.bypassed,
+              (unsigned)m_stats.writes, m_pinned, m_max_pinned);
+}
+
+void BlockCache::pinRange(uint32_t first_lba, uint32_t count)
+{
+    m_pin_first = first_lba;
+    m_pin_count = count;
+    m_pinned = 0;
+    for (int i = 0; i < m_slot_count; i++) {
+        m_slots[i].pinned = m_slots[i].valid && inRange(m_slots[i].lba, first_lba, count) &&
+                            m_pinned < m_max_pinned;
+        if (m_slots[i].pinned) {
+            m_pinned++;
+        }
+    }
+}
+
+bool BlockCache::pinFatMetadata()
+{
+    if (m_device == nullptr) {
+        return false;
+    }
+    uint8_t sector[BLOCK_CACHE_SECTOR_SIZE];
+    uint32_t volume_start = 0;
+    if (!m_device->readBlocks(0, sector, 1) || readLE16(sector + 510) != 0xAA55) {
+        return false;
+    }
+    // A partitioned card starts with an MBR rather than a boot sector
+    bool boot_sector = memcmp(sector + 3, "EXFAT   ", 8) == 0 ||
+                       ((sector[0] == 0xEB || sector[0] == 0xE9) && readLE16(sector + 11) == BLOCK_CACHE_SECTOR_SIZE);
+    if (!boot_sector) {
+        volume_start = readLE32(sector + 0x1C6);
+        if (volume_start == 0 || !m_device->readBlocks(volume_start, sector, 1)) {
+            return false;
+        }
+    }
+
+    uint32_t fat_start;
+    uint32_t fat_size;
+    if (memcmp(sector + 3, "EXFAT   ", 8) == 0) {
+        fat_start = volume_start + readLE32(sector + 0x50);
+        fat_size = readLE32(sector + 0x54);
+    } else {
+        if (readLE16(sector + 11) != BLOCK_CACHE_SECTOR_SIZE) {
+            return false;
+        }
+        fat_start = volume_start + readLE16(sector + 14);
+        fat_size = readLE16(sector + 22);
+        if (fat_size == 0) {
+            fat_size = readLE32(sector + 36);
+        }
+    }
+    // Only the first FAT is read; the copies are just written to
+    pinRange(fat_start, fat_size);
+    CACHE_LOG("Block cache: pinning FAT at %u (%u blocks)\n", (unsigned)fat_start, (unsigned)fat_size);
+    return true;
+}
+
+int BlockCache::findSlot(uint32_t lba)
+{
+    // Linear search is plenty for a few dozen slots next to an SPI transfer
+    for (int i = 0; i < m_slot_count; i++) {
+        if (m_slots[i].valid && m_slots[i].lba == lba) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int BlockCache::victimSlot()
+{
+    // At most half the slots are pinned, so there is always a candidate
+    int victim = -1;
+    for (int i = 0; i < m_slot_count; i++) {
+        if (!m_slots[i].valid) {
+            return i;
+        }
+        if (!m_slots[i].pinned && (victim < 0 || m_slots[i].last_use < m_slots[victim].last_use)) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+void BlockCache::install(uint32_t lba, const uint8_t *data, bool speculative)
+{
+    int slot = findSlot(lba);
+    if (slot < 0) {
+        slot = victimSlot();
+    }
+    cache_slot_t *s = &m_slots[slot];
+    if (s->valid && s->pinned) {
+        m_pinned--;
+    }
+    s->lba = lba;
+    s->valid = true;
+    s->pinned = inRange(lba, m_pin_first, m_pin_count) && m_pinned < m_max_pinned;
+    if (s->pinned) {
+        m_pinned++;
+    }
+    s->read_ahead = speculative;
+    s->last_use = ++m_clock;
+    memcpy(slotData(slot), data, BLOCK_CACHE_SECTOR_SIZE);
+}
+
+bool BlockCache::read(uint32_t lba, uint8_t *buffer, uint32_t count)
+{
+    if (m_device == nullptr) {
+        return false;
+    }
+    bool sequential = lba == m_next_lba;
+    m_next_lba = lba + count;
+
+    // Streaming reads go straight through so they cannot evict metadata
+    if (count >= m_bypass_blocks) {
+        m_stats.bypassed += count;
+        m_stats.device_reads++;
+        return m_device->readBlocks(lba, buffer, count);
+    }
+
+    uint32_t i = 0;
+    while (i < count) {
+        int slot = findSlot(lba + i);
+        if (slot >= 0) {
+            cache_slot_t *s = &m_slots[slot];
+            if (s->read_ahead) {
+                m_stats.read_ahead_hits++;
+                s->read_ahead = false;
+            }
+            s->last_use = ++m_clock;
+            memcpy(buffer + i * BLOCK_CACHE_SECTOR_SIZE, slotData(slot), BLOCK_CACHE_SECTOR_SIZE);
+            m_stats.hits++;
+            i++;
+            continue;
+        }
+
+        // Fetch the rest of the request in one transaction. A single block
+        // following on from the last read also pulls in the read-ahead.
+        uint32_t first = lba + i;
+        uint32_t run = count - i;
+        uint32_t ahead = (sequential && run == 1) ? m_read_ahead : 0;
+        uint8_t *dest = buffer + i * BLOCK_CACHE_SECTOR_SIZE;
+        m_stats.device_reads++;
+        if (ahead > 0 && !m_device->readBlocks(first, m_staging, run + ahead)) {
+            // Probably ran off the end of the card, retry without read-ahead
+            ahead = 0;
+            m_stats.device_reads++;
+        }
+        if (ahead > 0) {
+            memcpy(dest, m_staging, run * BLOCK_CACHE_SECTOR_SIZE);
+        } else if (!m_device->readBlocks(first, dest, run)) {
+            return false;
+        }
+        m_stats.misses += run;
+        m_stats.read_ahead += ahead;
+
+        for (uint32_t b = 0; b < run + ahead; b++) {
+            uint8_t *block = (ahead > 0 ? m_staging : dest) + b * BLOCK_CACHE_SECTOR_SIZE;
+            install(first + b, block, b >= run);
+        }
+        break;
+    }
+    return true;
+}
+
+bool BlockCache::write(uint32_t lba, const uint8_t *buffer, uint32_t count)
+{
+    if (m_device == nullptr) {
+        return false;
+    }
+    bool ok = m_device->writeBlocks(lba, buffer, count);
+    m_stats.writes += count;
+    // Write-through: keep any resident copies identical to the card
+    for (uint32_t b = 0; b < count; b++) {
+        int slot = findSlot(lba + b);
+        if (slot < 0) {
+            continue;
+        }
+        if (ok) {
+            memcpy(slotData(slot), buffer + b * BLOCK_CACHE_SECTOR_SIZE, BLOCK_CACHE_SECTOR_SIZE);
+        } else {
+            if (m_slots[slot].pinned) {
+                m_pinned--;
+            }
+            m_slots[slot].valid = false;
+            m_slots[slot].pinned = false;
+        }
+    }
+    return ok;
+}
+
+#ifdef ARDUINO
+// FatFs disk I/O entry points, wrapped with -Wl,--wrap so every SD read
+// goes through the cache. Declared with plain types to match DRESULT /
+// DSTATUS (RES_OK == 0) without pulling in the FatFs headers.
+extern "C" int __real_ff_disk_read(uint8_t pdrv, uint8_t *buffer, uint32_t sector, unsigned int count);
+extern "C" int __real_ff_disk_write(uint8_t pdrv, const uint8_t *buffer, uint32_t sector, unsigned int count);
+extern "C" uint8_t __real_ff_disk_initialize(uint8_t pdrv);
+
+/**
+ * The card underneath FatFs, reached through the original disk functions
+ **/
+class SDBlockDevice : public BlockDevice
+{
+private:
+    uint8_t m_pdrv;
+
+public:
+    SDBlockDevice(uint8_t pdrv) : m_pdrv(pdrv) {}
+    bool readBlocks(uint32_t lba, uint8_t *buffer, uint32_t count)
+    {
+        return __real_ff_disk_read(m_pdrv, buffer, lba, count) == 0;
+    }
+    bool writeBlocks(uint32_t lba, const uint8_t *buffer, uint32_t count)
+    {
+        return __real_ff_disk_write(m_pdrv, buffer, lba, count) == 0;
+    }
+};
+
+static SDBlockDevice *s_sdRawDevice = nullptr;
+static BlockCache *s_sdCache = nullptr;
+static uint8_t s_sdPdrv = 0;
+// Serialises FatFs and raw readers on the card and the cache
+static SemaphoreHandle_t s_sdLock = nullptr;
+
+static inline void lockSD()
+{
+    if (s_sdLock) xSemaphoreTake(s_sdLock, portMAX_DELAY);
+}
+
+static inline void unlockSD()
+{
+    if (s_sdLock) xSemaphoreGive(s_sdLock);
+}
+
+/**
+ * Card access for code outside FatFs: through the cache when it is
+ * installed, and under the same lock as FatFs
+ **/
+class SharedSDBlockDevice : public BlockDevice
+{
+public:
+    bool readBlocks(uint32_t lba, uint8_t *buffer, uint32_t count)
+    {
+        lockSD();
+        bool ok = s_sdCache ? s_sdCache->read(lba, buffer, count) : s_sdRawDevice->readBlocks(lba, buffer, count);
+        unlockSD();
+        return ok;
+    }
+    bool writeBlocks(uint32_t lba, const uint8_t *buffer, uint32_t count)
+    {
+        lockSD();
+        bool ok = s_sdCache ? s_sdCache->write(lba, buffer, count) : s_sdRawDevice->writeBlocks(lba, buffer, count);
+        unlockSD();
+        return ok;
+    }
+};
+
+static SharedSDBlockDevice *s_sdSharedDevice = nullptr;
+
+// Called from setup() before any task touches the card
+static void createSDDevices(uint8_t pdrv)
+{
+    if (s_sdRawDevice == nullptr) {
+        s_sdLock = xSemaphoreCreateMutex();
+        s_sdRawDevice = new SDBlockDevice(pdrv);
+        s_sdSharedDevice = new SharedSDBlockDevice();
+        s_sdPdrv = pdrv;
+    }
+}
+
+BlockDevice *getSDBlockDevice(uint8_t pdrv)
+{
+    createSDDevices(pdrv);
+    return s_sdSharedDevice;
+}
+
+BlockCache *installSDBlockCache(uint8_t pdrv, int blocks, int read_ahead)
+{
+    if (s_sdCache != nullptr) {
+        return s_sdCache;
+    }
+    createSDDevices(pdrv);
+    BlockCache *cache = new BlockCache();
+    if (!cache->begin(s_sdRawDevice, blocks, read_ahead)) {
+        delete cache;
+        return nullptr;
+    }
+    // FatFs may already be reading the card, so the boot sector and FAT are
+    // fetched under its lock. Publish last so the hooks never see a half
+    // built cache.
+    lockSD();
+    cache->pinFatMetadata();
+    s_sdCache = cache;
+    unlockSD();
+    return cache;
+}
+
+BlockCache *getSDBlockCache()
+{
+    return s_sdCache;
+}
+
+extern "C" int __wrap_ff_disk_read(uint8_t pdrv, uint8_t *buffer, uint32_t sector, unsigned int count)
+{
+    if (s_sdRawDevice != nullptr && pdrv == s_sdPdrv) {
+        return s_sdSharedDevice->readBlocks(sector, buffer, count) ? 0 : 1;
+    }
+    return __real_ff_disk_read(pdrv, buffer, sector, count);
+}
+
+extern "C" int __wrap_ff_disk_write(uint8_t pdrv, const uint8_t *buffer, uint32_t sector, unsigned int count)
+{
+    if (s_sdRawDevice != nullptr && pdrv == s_sdPdrv) {
+        return s_sdSharedDevice->writeBlocks(sector, buffer, count) ? 0 : 1;
+    }
+    return __real_ff_disk_write(pdrv, buffer, sector, count);
+}
+
+extern "C" uint8_t __wrap_ff_disk_initialize(uint8_t pdrv)
+{
+    // A (re)mounted card may not be the one we cached
+    if (s_sdCache != nullptr && pdrv == s_sdPdrv) {
+        lockSD();
+        s_sdCache->invalidate();
+        unlockSD();
+    }
+    return __real_ff_disk_initialize(pdrv);
+}
+#else
+ImageBlockDevice::ImageBlockDevice()
+{
+    m_fd = -1;
+    reads = 0;
+}
+
+ImageBlockDevice::~ImageBlockDevice()
+{
+    close();
+}
+
+bool ImageBlockDevice::open(const char *path, bool writable)
+{
+    close();
+    m_fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+    if (m_fd < 0) {
+        CACHE_LOG("Block device: cannot open %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+void ImageBlockDevice::close()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_fd = -1;
+}
+
+bool ImageBlockDevice::readBlocks(uint32_t lba, uint8_t *buffer, uint32_t count)
+{
+    reads++;
+    ssize_t bytes = (ssize_t)count * BLOCK_CACHE_SECTOR_SIZE;
+    return m_fd >= 0 && pread(m_fd, buffer, bytes, (off_t)lba * BLOCK_CACHE_SECTOR_SIZE) == bytes;
+}
+
+bool ImageBlockDevice::writeBlocks(uint32_t lba, const uint8_t *buffer, uint32_t count)
+{
+    ssize_t bytes = (ssize_t)count * BLOCK_CACHE_SECTOR_SIZE;
+    return m_fd >= 0 && pwrite(m_fd, buffer, bytes, (off_t)lba * BLOCK_CACHE_SECTOR_SIZE) == bytes;
+}
+#endif
@@ -0,0 +1,169 @@
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+#include "BootSequencer.h"
+#include "display.h"
+#include "AssetStore.h"
+#include "FileCatalog.h"
+#include "GlyphCache.h"
+#include "Logger.h"
+#include "SDScheduler.h"
+
+extern TFT_eSPI tft; // Declared in display.cpp
+
+// Milestones in microseconds since app start, 0 until reached
+static int64_t s_firstPixelUs = 0;
+static int64_t s_sdReadyUs = 0;
+static int64_t s_playbackUs = 0;
+
+static bool s_sdOk = false;
+static bool s_diagnosticsPending = false;
+static StaticSemaphore_t s_sdDoneBuffer;
+static SemaphoreHandle_t s_sdDone = nullptr;
+// Holds the mapping the loaded font is read from
+static AssetStore s_fontAssets;
+
+static void mountCard()
+{
+    s_sdOk = initSD();
+    s_sdReadyUs = esp_timer_get_time();
+    xSemaphoreGive(s_sdDone);
+}
+
+void bootSDTask(void *param)
+{
+    mountCard();
+    vTaskDelete(NULL);
+}
+
+static int32_t indexCard(void *arg)
+{
+    return FileCatalog::begin() ? 0 : -1;
+}
+
+// Media lookups are answered from memory once the catalog is in. It reads
+// the card directly, so it runs on the SD scheduler's task when there is one.
+static void indexAndDiagnose()
+{
+    SDScheduler::call(SD_CLIENT_BACKGROUND, indexCard, nullptr);
+    runSDDiagnostics();
+}
+
+void bootDiagnosticsTask(void *param)
+{
+    indexAndDiagnose();
+    vTaskDelete(NULL);
+}
+
+static void showSplash(const char *name)
+{
+    AssetStore assets;
+    asset_t splash;
+    if (assets.begin() && assets.find(name, &splash)) {
+        tft.fillScreen(TFT_BLACK);
+        assets.pushImage(&tft, (tft.width() - splash.width) / 2, (tft.height() - splash.height) / 2, name);
+    } else {
+        // No asset partition flashed, still show that the board is alive
+        tft.fillScreen(TFT_CYAN);
+    }
+    assets.end();
+}
+
+bool BootSequencer::bringUp(const char *splash_asset)
+{
+    s_sdDone = xSemaphoreCreateBinaryStatic(&s_sdDoneBuffer);
+#if FAST_BOOT
+    // HSPI may take GPIO 4 once the panel's reset pulse is over
+    resetPanel();
+    TaskHandle_t sdTask;
+    if (xTaskCreatePinnedToCore(bootSDTask, "Boot SD", 6144, nullptr, 2, &sdTask, 0) != pdPASS) {
+        Serial.println("Boot: failed to start SD task, mounting inline");
+        mountCard();
+    }
+
+    initTFT();
+    showSplash(splash_asset);
+    s_firstPixelUs = esp_timer_get_time();
+
+    // initSD bounds its own retries
+    xSemaphoreTake(s_sdDone, portMAX_DELAY);
+    s_diagnosticsPending = s_sdOk;
+    LOG_I(LOG_CAT_SYSTEM, "Boot: first pixel %u ms, SD ready %u ms", firstPixelMs(), sdReadyMs());
+    return s_sdOk;
+#else
+    resetPanel();
+    initTFT();
+    showSplash(splash_asset);
+    s_firstPixelUs = esp_timer_get_time();
+    mountCard();
+    if (s_sdOk) {
+        indexAndDiagnose();
+    }
+    return s_sdOk;
+#endif
+}
+
+bool BootSequencer::loadFont(const char *font_asset)
+{
+    asset_t font;
+    if (!s_fontAssets.isOpen() && !s_fontAssets.begin()) {
+        return false;
+    }
+    if (!s_fontAssets.find(font_asset, &font) || font.format != ASSET_FORMAT_RAW) {
+        LOG_W(LOG_CAT_SYSTEM, "Boot: no font asset \"%s\"", font_asset);
+        return false;
+    }
+    tft.loadFont(font.data);
+    return tft.fontLoaded;
+}
+
+void BootSequencer::showStatus(const char *text)
+{
+    int width = GlyphCache::textWidth(&tft, text);
+    GlyphCache::drawString(&tft, text, (tft.width() - width) / 2, tft.height() - tft.fontHeight() - 2, TFT_WHITE,
+                           TFT_BLACK);
+}
+
+void BootSequencer::deferDiagnostics()
+{
+    if (!s_diagnosticsPending) {
+        return;
+    }
+    s_diagnosticsPending = false;
+    // Lowest priority above idle, so indexing and the listing fill gaps in
+    // playback
+    if (xTaskCreatePinnedToCore(bootDiagnosticsTask, "Boot Diag", 6144, nullptr, 1, nullptr, 0) != pdPASS) {
+        Serial.println("Boot: failed to start diagnostics task");
+    }
+}
+
+void BootSequencer::markPlayback()
+{
+    if (__atomic_load_n(&s_playbackUs, __ATOMIC_RELAXED) != 0) {
+        return;
+    }
+    int64_t expected = 0;
+    if (__atomic_compare_exchange_n(&s_playbackUs, &expected, esp_timer_get_time(), false, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+        LOGB_I(LOG_CAT_SYSTEM, "Boot: first pixel %u ms, SD ready %u ms, playback %u ms", firstPixelMs(),
+               sdReadyMs(), playbackMs());
+    }
+}
+
+uint32_t BootSequencer::firstPixelMs()
+{
+    return (uint32_t)(s_firstPixelUs / 1000);
+}
+
+uint32_t BootSequencer::sdReadyMs()
+{
+    return (uint32_t)(s_sdReadyUs / 1000);
+}
+
+uint32_t BootSequencer::playbackMs()
+{
+    return (uint32_t)(__atomic_load_n(&s_playbackUs, __ATOMIC_RELAXED) / 1000);
+}
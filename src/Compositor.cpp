@@ -0,0 +1,523 @@
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "Compositor.h"
+#include "FramePipeline.h"
+#include "MediaArena.h"
+
+typedef struct
+{
+    bool used;
+    bool visible;
+    bool keyed;
+    uint8_t format;
+    int z;
+    comp_rect_t bounds;         // on screen
+    const void *pixels;
+    uint16_t fill;              // panel byte order
+    uint16_t key;               // in the layer's own format
+    // Changed parts, in screen coordinates and within bounds
+    comp_rect_t damage[COMPOSITOR_LAYER_DAMAGE];
+    uint8_t damage_count;
+} layer_t;
+
+static layer_t s_layers[COMPOSITOR_MAX_LAYERS];
+// Layers in use, bottom first
+static int s_order[COMPOSITOR_MAX_LAYERS];
+static int s_orderCount = 0;
+// Screen damage from layers that moved, appeared or went away
+static comp_rect_t s_damage[COMPOSITOR_MAX_DAMAGE];
+static uint8_t s_damageCount = 0;
+
+static int s_width = 0;
+static int s_height = 0;
+static uint16_t s_background = 0;
+static uint16_t *s_strip = nullptr;
+static StaticSemaphore_t s_lockBuffer;
+static SemaphoreHandle_t s_lock = nullptr;
+static compositor_stats_t s_stats;
+
+static inline uint16_t swap16(uint16_t c)
+{
+    return (c >> 8) | (c << 8);
+}
+
+static inline bool isEmpty(const comp_rect_t &r)
+{
+    return r.width <= 0 || r.height <= 0;
+}
+
+static inline int32_t area(const comp_rect_t &r)
+{
+    return (int32_t)r.width * r.height;
+}
+
+static comp_rect_t intersect(const comp_rect_t &a, const comp_rect_t &b)
+{
+    int16_t x0 = max(a.x, b.x);
+    int16_t y0 = max(a.y, b.y);
+    int16_t x1 = min(a.x + a.width, b.x + b.width);
+    int16_t y1 = min(a.y + a.height, b.y + b.height);
+    comp_rect_t r = {x0, y0, (int16_t)(x1 - x0), (int16_t)(y1 - y0)};
+    return r;
+}
+
+static comp_rect_t unite(const comp_rect_t &a, const comp_rect_t &b)
+{
+    int16_t x0 = min(a.x, b.x);
+    int16_t y0 = min(a.y, b.y);
+    int16_t x1 = max(a.x + a.width, b.x + b.width);
+    int16_t y1 = max(a.y + a.height, b.y + b.height);
+    comp_rect_t r = {x0, y0, (int16_t)(x1 - x0), (int16_t)(y1 - y0)};
+    return r;
+}
+
+static inline bool contains(const comp_rect_t &outer, const comp_rect_t &inner)
+{
+    return inner.x >= outer.x && inner.y >= outer.y && inner.x + inner.width <= outer.x + outer.width &&
+           inner.y + inner.height <= outer.y + outer.height;
+}
+
+// Add r to a list of disjoint rectangles. Anything it overlaps is merged
+// into it; when the list is full it joins the rectangle it grows least.
+static void addRect(comp_rect_t *list, uint8_t *count, int capacity, comp_rect_t r)
+{
+    comp_rect_t screen = {0, 0, (int16_t)s_width, (int16_t)s_height};
+    r = intersect(r, screen);
+    if (isEmpty(r)) {
+        return;
+    }
+    for (int i = 0; i < *count;) {
+        if (!isEmpty(intersect(list[i], r))) {
+            r = unite(list[i], r);
+            list[i] = list[--*count];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    if (*count < capacity) {
+        list[(*count)++] = r;
+        return;
+    }
+    int best = 0;
+    int32_t best_growth = INT32_MAX;
+    for (int i = 0; i < *count; i++) {
+        int32_t growth = area(unite(list[i], r)) - area(list[i]);
+        if (growth < best_growth) {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    r = unite(list[best], r);
+    list[best] = list[--*count];
+    addRect(list, count, capacity, r);
+}
+
+static inline bool hasContent(const layer_t *layer)
+{
+    return layer->visible && (layer->format == LAYER_FORMAT_FILL || layer->pixels != nullptr);
+}
+
+static void sortLayers()
+{
+    // Few layers, insertion sort keeps equal z in the order they were added
+    for (int i = 1; i < s_orderCount; i++) {
+        int id = s_order[i];
+        int j = i - 1;
+        while (j >= 0 && s_layers[s_order[j]].z > s_layers[id].z) {
+            s_order[j + 1] = s_order[j];
+            j--;
+        }
+        s_order[j + 1] = id;
+    }
+}
+
+static inline bool validLayer(int layer)
+{
+    return s_lock != nullptr && layer >= 0 && layer < COMPOSITOR_MAX_LAYERS && s_layers[layer].used;
+}
+
+static inline void lock()
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+}
+
+static inline void unlock()
+{
+    xSemaphoreGive(s_lock);
+}
+
+// Copy the part r of a layer into the band, which starts at band.x, band.y
+static void blit(const layer_t *layer, const comp_rect_t &r, const comp_rect_t &band)
+{
+    int layer_width = layer->bounds.width;
+    for (int row = r.y; row < r.y + r.height; row++) {
+        uint16_t *dst = s_strip + (row - band.y) * band.width + (r.x - band.x);
+        int src_offset = (row - layer->bounds.y) * layer_width + (r.x - layer->bounds.x);
+        int n = r.width;
+
+        switch (layer->format) {
+        case LAYER_FORMAT_FILL:
+            for (int i = 0; i < n; i++) dst[i] = layer->fill;
+            break;
+        case LAYER_FORMAT_RGB565: {
+            const uint16_t *src = (const uint16_t *)layer->pixels + src_offset;
+            for (int i = 0; i < n; i++) {
+                if (!layer->keyed || src[i] != layer->key) dst[i] = swap16(src[i]);
+            }
+            break;
+        }
+        case LAYER_FORMAT_RGB565_SWAPPED: {
+            const uint16_t *src = (const uint16_t *)layer->pixels + src_offset;
+            if (!layer->keyed) {
+                memcpy(dst, src, n * sizeof(uint16_t));
+                break;
+            }
+            for (int i = 0; i < n; i++) {
+                if (src[i] != layer->key) dst[i] = src[i];
+            }
+            break;
+        }
+        case LAYER_FORMAT_RGB332: {
+            const uint8_t *src = (const uint8_t *)layer->pixels + src_offset;
+            for (int i = 0; i < n; i++) {
+                if (!layer->keyed || src[i] != layer->key) {
+                    dst[i] = swap16(PixelConvert<PixelRGB332, PixelRGB565>::convert(src[i]));
+                }
+            }
+            break;
+        }
+        }
+    }
+}
+
+static void composeBand(const comp_rect_t &band)
+{
+    // Nothing under the highest opaque layer that covers the band shows
+    int first = -1;
+    for (int i = s_orderCount - 1; i >= 0; i--) {
+        const layer_t *layer = &s_layers[s_order[i]];
+        if (hasContent(layer) && !layer->keyed && contains(layer->bounds, band)) {
+            first = i;
+            break;
+        }
+    }
+    if (first < 0) {
+        for (int i = 0; i < band.width * band.height; i++) s_strip[i] = s_background;
+        first = 0;
+    }
+    for (int i = first; i < s_orderCount; i++) {
+        const layer_t *layer = &s_layers[s_order[i]];
+        if (!hasContent(layer)) {
+            continue;
+        }
+        comp_rect_t r = intersect(layer->bounds, band);
+        if (!isEmpty(r)) {
+            blit(layer, r, band);
+            s_stats.pixels_composed += area(r);
+        }
+    }
+}
+
+bool Compositor::begin(int width, int height, uint16_t background)
+{
+    if (s_lock != nullptr) {
+        return true;
+    }
+    s_strip = (uint16_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_DISPLAY,
+                                            width * COMPOSITOR_BAND_ROWS * sizeof(uint16_t));
+    if (s_strip == nullptr) {
+        Serial.println("Compositor: no memory for the band strip");
+        return false;
+    }
+    s_width = width;
+    s_height = height;
+    s_background = swap16(background);
+    memset(s_layers, 0, sizeof(s_layers));
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_orderCount = 0;
+    s_damageCount = 0;
+    s_lock = xSemaphoreCreateMutexStatic(&s_lockBuffer);
+    return true;
+}
+
+bool Compositor::isReady()
+{
+    return s_lock != nullptr;
+}
+
+int Compositor::addLayer(int x, int y, int width, int height, LayerFormat format, int z)
+{
+    if (s_lock == nullptr || width <= 0 || height <= 0) {
+        return -1;
+    }
+    lock();
+    int id = -1;
+    for (int i = 0; i < COMPOSITOR_MAX_LAYERS; i++) {
+        if (!s_layers[i].used) {
+            id = i;
+            break;
+        }
+    }
+    if (id >= 0) {
+        layer_t *layer = &s_layers[id];
+        memset(layer, 0, sizeof(*layer));
+        layer->used = true;
+        layer->visible = true;
+        layer->format = format;
+        layer->z = z;
+        layer->bounds = {(int16_t)x, (int16_t)y, (int16_t)width, (int16_t)height};
+        s_order[s_orderCount++] = id;
+        sortLayers();
+    }
+    unlock();
+    return id;
+}
+
+void Compositor::removeLayer(int layer)
+{
+    if (!validLayer(layer)) {
+        return;
+    }
+    lock();
+    if (hasContent(&s_layers[layer])) {
+        addRect(s_damage, &s_damageCount, COMPOSITOR_MAX_DAMAGE, s_layers[layer].bounds);
+    }
+    s_layers[layer].used = false;
+    for (int i = 0; i < s_orderCount; i++) {
+        if (s_order[i] == layer) {
+            memmove(&s_order[i], &s_order[i + 1], (s_orderCount - i - 1) * sizeof(int));
+            s_orderCount--;
+            break;
+        }
+    }
+    unlock();
+}
+
+void Compositor::setPixels(int layer, const void *pixels, bool damage)
+{
+    if (!validLayer(layer)) {
+        return;
+    }
+    lock();
+    layer_t *l = &s_layers[layer];
+    l->pixels = pixels;
+    if (damage && l->visible) {
+        l->damage_count = 0;
+        addRect(l->damage, &l->damage_count, COMPOSITOR_LAYER_DAMAGE, l->bounds);
+    }
+    unlock();
+}
+
+void Compositor::setFill(int layer, uint16_t color)
+{
+    if (!validLayer(layer)) {
+        return;
+    }
+    lock();
+    layer_t *l = &s_layers[layer];
+    l->format = LAYER_FORMAT_FILL;
+    l->fill = swap16(color);
+    if (l->visible) {
+        addRect(l->damage, &l->damage_count, COMPOSITOR_LAYER_DAMAGE, l->bounds);
+    }
+    unlock();
+}
+
+void Compositor::setColorKey(int layer, uint16_t color)
+{
+    if (!validLayer(layer)) {
+        return;
+    }
+    lock();
+    layer_t *l = &s_layers[layer];
+    l->keyed = l->format != LAYER_FORMAT_FILL;
+    if (l->format == LAYER_FORMAT_RGB565_SWAPPED) {
+        l->key = swap16(color);
+    } else if (l->format == LAYER_FORMAT_RGB332) {
+        l->key = PixelConvert<PixelRGB565, PixelRGB332>::convert(color);
+    } else {
+        l->key = color;
+    }
+    addRect(l->damage, &l->damage_count, COMPOSITOR_LAYER_DAMAGE, l->bounds);
+    unlock();
+}
+
+void Compositor::clearColorKey(int layer)
+{
+    if (!validLayer(layer)) {
+        return;
+    }
+    lock();
+    layer_t *l = &s_layers[layer];
+    if (l->keyed) {
+        l->keyed = false;
+        addRect(l->damage, &l->damage_count, COMPOSITOR_LAYER_DAMAGE, l->bounds);
+    }
+    unlock();
+}
+
+void Compositor::move(int layer, int x, int y)
+{
+    if (!validLayer(layer)) {
+        return;
+    }
+    lock();
+    layer_t *l = &s_layers[layer];
+    if (l->bounds.x != x || l->bounds.y != y) {
+        if (hasContent(l)) {
+            // What was under the old position shows again
+            addRect(s_damage, &s_damageCount, COMPOSITOR_MAX_DAMAGE, l->bounds);
+        }
+        l->bounds.x = x;
+        l->bounds.y = y;
+        l->damage_count = 0;
+        if (hasContent(l)) {
+            addRect(s_damage, &s_damageCount, COMPOSITOR_MAX_DAMAGE, l->bounds);
+        }
+    }
+    unlock();
+}
+
+void Compositor::setVisible(int layer, bool visible)
+{
+    if (!validLayer(layer)) {
+        return;
+    }
+    lock();
+    layer_t *l = &s_layers[layer];
+    if (l->visible != visible) {
+        bool shown = hasContent(l);
+        l->visible = visible;
+        if (shown || hasContent(l)) {
+            addRect(s_damage, &s_damageCount, COMPOSITOR_MAX_DAMAGE, l->bounds);
+        }
+        l->damage_count = 0;
+    }
+    unlock();
+}
+
+void Compositor::setZ(int layer, int z)
+{
+    if (!validLayer(layer)) {
+        return;
+    }
+    lock();
+    layer_t *l = &s_layers[layer];
+    if (l->z != z) {
+        l->z = z;
+        sortLayers();
+        if (hasContent(l)) {
+            addRect(s_damage, &s_damageCount, COMPOSITOR_MAX_DAMAGE, l->bounds);
+        }
+    }
+    unlock();
+}
+
+void Compositor::damage(int layer, int x, int y, int width, int height)
+{
+    if (!validLayer(layer)) {
+        return;
+    }
+    lock();
+    layer_t *l = &s_layers[layer];
+    comp_rect_t r = {(int16_t)(l->bounds.x + x), (int16_t)(l->bounds.y + y), (int16_t)width, (int16_t)height};
+    r = intersect(r, l->bounds);
+    if (l->visible && !isEmpty(r)) {
+        addRect(l->damage, &l->damage_count, COMPOSITOR_LAYER_DAMAGE, r);
+    }
+    unlock();
+}
+
+void Compositor::damageAll()
+{
+    if (s_lock == nullptr) {
+        return;
+    }
+    lock();
+    s_damageCount = 0;
+    comp_rect_t screen = {0, 0, (int16_t)s_width, (int16_t)s_height};
+    addRect(s_damage, &s_damageCount, COMPOSITOR_MAX_DAMAGE, screen);
+    unlock();
+}
+
+bool Compositor::isCovered(int layer)
+{
+    if (!validLayer(layer)) {
+        return false;
+    }
+    lock();
+    bool covered = false;
+    bool above = false;
+    for (int i = 0; i < s_orderCount && !covered; i++) {
+        const layer_t *l = &s_layers[s_order[i]];
+        if (s_order[i] == layer) {
+            above = true;
+        } else if (above && hasContent(l)) {
+            covered = !isEmpty(intersect(l->bounds, s_layers[layer].bounds));
+        }
+    }
+    unlock();
+    return covered;
+}
+
+uint32_t Compositor::flush(TFT_eSPI *tft)
+{
+    if (s_lock == nullptr) {
+        return 0;
+    }
+    lock();
+    for (int i = 0; i < s_orderCount; i++) {
+        layer_t *l = &s_layers[s_order[i]];
+        for (int d = 0; d < l->damage_count; d++) {
+            addRect(s_damage, &s_damageCount, COMPOSITOR_MAX_DAMAGE, l->damage[d]);
+        }
+        l->damage_count = 0;
+    }
+
+    uint32_t pushed = 0;
+    for (int d = 0; d < s_damageCount; d++) {
+        const comp_rect_t &rect = s_damage[d];
+        for (int row = rect.y; row < rect.y + rect.height; row += COMPOSITOR_BAND_ROWS) {
+            comp_rect_t band = {rect.x, (int16_t)row, rect.width,
+                                (int16_t)min(COMPOSITOR_BAND_ROWS, rect.y + rect.height - row)};
+            composeBand(band);
+            tft->setAddrWindow(band.x, band.y, band.width, band.height);
+            // Bands are composed in panel byte order
+            tft->pushColors(s_strip, band.width * band.height, false);
+            pushed += area(band);
+        }
+    }
+    if (s_damageCount > 0) {
+        s_stats.flushes++;
+        s_stats.rects += s_damageCount;
+        s_stats.pixels_pushed += pushed;
+    }
+    s_damageCount = 0;
+    unlock();
+    return pushed;
+}
+
+void Compositor::getStats(compositor_stats_t *stats)
+{
+    if (s_lock == nullptr) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    lock();
+    *stats = s_stats;
+    unlock();
+}
+
+void Compositor::printStats()
+{
+    compositor_stats_t stats;
+    getStats(&stats);
+    uint64_t full = (uint64_t)stats.flushes * s_width * s_height;
+    Serial.printf("Compositor: %u layers, %u flushes, %u rects, %" PRIu64 " pixels pushed (%.1f%% of full frames), "
+                  "%" PRIu64 " composed\n",
+                  s_orderCount, stats.flushes, stats.rects, stats.pixels_pushed,
+                  full ? 100.0f * stats.pixels_pushed / full : 0.0f, stats.pixels_composed);
+}
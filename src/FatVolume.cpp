@@ -0,0 +1,617 @@
+#include <string.h>
+#include <ctype.h>
+#include "FatVolume.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define FAT_LOG(...) Serial.printf(__VA_ARGS__)
+#else
+#include <stdio.h>
+#define FAT_LOG(...) printf(__VA_ARGS__)
+#endif
+
+#define DIR_ENTRY_SIZE 32
+#define ENTRIES_PER_SECTOR (BLOCK_CACHE_SECTOR_SIZE / DIR_ENTRY_SIZE)
+
+// FAT directory entry attributes
+#define ATTR_VOLUME_ID 0x08
+#define ATTR_DIRECTORY 0x10
+#define ATTR_LONG_NAME 0x0F
+
+// exFAT directory entry types
+#define EXFAT_ENTRY_FILE 0x85
+#define EXFAT_ENTRY_STREAM 0xC0
+#define EXFAT_ENTRY_NAME 0xC1
+#define EXFAT_NO_FAT_CHAIN 0x02
+
+static inline uint16_t readLE16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t readLE32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+/**
+ * Holds a volume's lock for a scope. Calls nest, so a method may use the
+ * public ones and a list() callback may use the volume.
+ **/
+class VolumeLock
+{
+private:
+    FatVolume *m_volume;
+
+public:
+    VolumeLock(FatVolume *volume) : m_volume(volume)
+    {
+#ifdef ARDUINO
+        if (m_volume->m_lock) xSemaphoreTakeRecursive(m_volume->m_lock, portMAX_DELAY);
+#endif
+    }
+    ~VolumeLock()
+    {
+#ifdef ARDUINO
+        if (m_volume->m_lock) xSemaphoreGiveRecursive(m_volume->m_lock);
+#endif
+    }
+};
+
+// Checksum of an 8.3 name stored in each of its long name entries
+static uint8_t shortNameChecksum(const uint8_t *name)
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+    }
+    return sum;
+}
+
+static inline char asciiChar(uint16_t c)
+{
+    return c < 0x80 ? (char)c : '?';
+}
+
+static bool nameMatches(const char *a, size_t a_length, const char *b)
+{
+    size_t b_length = strlen(b);
+    if (a_length != b_length) {
+        return false;
+    }
+    for (size_t i = 0; i < a_length; i++) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+FatVolume::FatVolume()
+{
+    m_device = nullptr;
+    m_type = FAT_TYPE_NONE;
+    m_fat_start = 0;
+    m_data_start = 0;
+    m_root_start = 0;
+    m_root_sectors = 0;
+    m_root_cluster = 0;
+    m_cluster_count = 0;
+    m_cluster_shift = 0;
+    m_serial = 0;
+    m_fsinfo_sector = 0;
+    m_sector_lba = UINT32_MAX;
+    m_name[0] = '\0';
+#ifdef ARDUINO
+    m_lock = xSemaphoreCreateRecursiveMutex();
+#endif
+}
+
+FatVolume::~FatVolume()
+{
+#ifdef ARDUINO
+    if (m_lock) vSemaphoreDelete(m_lock);
+#endif
+}
+
+void FatVolume::invalidate()
+{
+    VolumeLock lock(this);
+    m_sector_lba = UINT32_MAX;
+}
+
+bool FatVolume::readSector(uint32_t lba)
+{
+    if (lba == m_sector_lba) {
+        return true;
+    }
+    if (!m_device->readBlocks(lba, m_sector, 1)) {
+        m_sector_lba = UINT32_MAX;
+        return false;
+    }
+    m_sector_lba = lba;
+    return true;
+}
+
+bool FatVolume::parseBootSector(uint32_t volume_start)
+{
+    const uint8_t *bs = m_sector;
+    if (memcmp(bs + 3, "EXFAT   ", 8) == 0) {
+        if (bs[108] != 9) {
+            FAT_LOG("FAT volume: exFAT sector size %d not supported\n", 1 << bs[108]);
+            return false;
+        }
+        m_type = FAT_TYPE_EXFAT;
+        m_fat_start = volume_start + readLE32(bs + 80);
+        m_data_start = volume_start + readLE32(bs + 88);
+        m_cluster_count = readLE32(bs + 92);
+        m_root_cluster = readLE32(bs + 96);
+        m_cluster_shift = bs[109];
+        m_serial = readLE32(bs + 100);
+        return true;
+    }
+
+    uint16_t bytes_per_sector = readLE16(bs + 11);
+    uint8_t sectors_per_cluster = bs[13];
+    if (bytes_per_sector != BLOCK_CACHE_SECTOR_SIZE || sectors_per_cluster == 0 ||
+        (sectors_per_cluster & (sectors_per_cluster - 1)) != 0) {
+        return false;
+    }
+    uint16_t reserved = readLE16(bs + 14);
+    uint8_t fat_count = bs[16];
+    uint16_t root_entries = readLE16(bs + 17);
+    uint32_t total_sectors = readLE16(bs + 19);
+    if (total_sectors == 0) {
+        total_sectors = readLE32(bs + 32);
+    }
+    uint32_t fat_size = readLE16(bs + 22);
+    if (fat_size == 0) {
+        fat_size = readLE32(bs + 36);
+    }
+
+    m_cluster_shift = 0;
+    while ((1u << m_cluster_shift) < sectors_per_cluster) {
+        m_cluster_shift++;
+    }
+    m_fat_start = volume_start + reserved;
+    m_root_start = m_fat_start + fat_count * fat_size;
+    m_root_sectors = (root_entries * DIR_ENTRY_SIZE + BLOCK_CACHE_SECTOR_SIZE - 1) / BLOCK_CACHE_SECTOR_SIZE;
+    m_data_start = m_root_start + m_root_sectors;
+    m_cluster_count = (total_sectors - (m_data_start - volume_start)) >> m_cluster_shift;
+
+    // The cluster count alone decides the FAT type
+    if (m_cluster_count < 4085) {
+        FAT_LOG("FAT volume: FAT12 not supported\n");
+        return false;
+    }
+    if (m_cluster_count < 65525) {
+        m_type = FAT_TYPE_FAT16;
+        m_root_cluster = 0;
+        m_serial = bs[38] == 0x29 ? readLE32(bs + 39) : 0;
+    } else {
+        m_type = FAT_TYPE_FAT32;
+        m_root_cluster = readLE32(bs + 44);
+        m_serial = bs[66] == 0x29 ? readLE32(bs + 67) : 0;
+        uint16_t fsinfo = readLE16(bs + 48);
+        m_fsinfo_sector = (fsinfo != 0 && fsinfo != 0xFFFF) ? volume_start + fsinfo : 0;
+    }
+    return true;
+}
+
+bool FatVolume::mount(BlockDevice *device)
+{
+    VolumeLock lock(this);
+    m_device = device;
+    m_type = FAT_TYPE_NONE;
+    m_serial = 0;
+    m_fsinfo_sector = 0;
+    m_sector_lba = UINT32_MAX;
+    if (device == nullptr || !readSector(0) || readLE16(m_sector + 510) != 0xAA55) {
+        FAT_LOG("FAT volume: no boot sector\n");
+        return false;
+    }
+
+    // Sector 0 is either the boot sector itself or an MBR
+    bool boot_sector = memcmp(m_sector + 3, "EXFAT   ", 8) == 0 ||
+                       ((m_sector[0] == 0xEB || m_sector[0] == 0xE9) &&
+                        readLE16(m_sector + 11) == BLOCK_CACHE_SECTOR_SIZE);
+    uint32_t volume_start = 0;
+    if (!boot_sector) {
+        volume_start = readLE32(m_sector + 0x1C6);
+        if (volume_start == 0 || !readSector(volume_start) || readLE16(m_sector + 510) != 0xAA55) {
+            FAT_LOG("FAT volume: no partition found\n");
+            return false;
+        }
+    }
+    if (!parseBootSector(volume_start)) {
+        m_type = FAT_TYPE_NONE;
+        return false;
+    }
+
+    static const char *TYPE_NAMES[] = {"none", "FAT16", "FAT32", "exFAT"};
+    FAT_LOG("FAT volume: %s, %u clusters of %u bytes\n", TYPE_NAMES[m_type],
+            (unsigned)m_cluster_count, (unsigned)bytesPerCluster());
+    return true;
+}
+
+bool FatVolume::nextCluster(uint32_t cluster, uint32_t *next)
+{
+    if (cluster < 2 || cluster - 2 >= m_cluster_count) {
+        return false;
+    }
+    VolumeLock lock(this);
+    uint32_t value;
+    if (m_type == FAT_TYPE_FAT16) {
+        if (!readSector(m_fat_start + cluster / (BLOCK_CACHE_SECTOR_SIZE / 2))) return false;
+        value = readLE16(m_sector + (cluster % (BLOCK_CACHE_SECTOR_SIZE / 2)) * 2);
+        if (value >= 0xFFF8) return false;
+    } else {
+        if (!readSector(m_fat_start + cluster / (BLOCK_CACHE_SECTOR_SIZE / 4))) return false;
+        value = readLE32(m_sector + (cluster % (BLOCK_CACHE_SECTOR_SIZE / 4)) * 4);
+        if (m_type == FAT_TYPE_FAT32) {
+            value &= 0x0FFFFFFF;
+            if (value >= 0x0FFFFFF8) return false;
+        } else if (value >= 0xFFFFFFF8) {
+            return false;
+        }
+    }
+    if (value < 2 || value - 2 >= m_cluster_count) {
+        return false;
+    }
+    *next = value;
+    return true;
+}
+
+bool FatVolume::freeClusters(uint32_t *count)
+{
+    VolumeLock lock(this);
+    if (m_fsinfo_sector == 0 || !readSector(m_fsinfo_sector)) {
+        return false;
+    }
+    if (readLE32(m_sector) != 0x41615252 || readLE32(m_sector + 484) != 0x61417272) {
+        return false;
+    }
+    uint32_t free_count = readLE32(m_sector + 488);
+    if (free_count == 0xFFFFFFFF) {
+        return false;
+    }
+    *count = free_count;
+    return true;
+}
+
+bool FatVolume::isContiguous(const fat_file_t *file)
+{
+    if (file->first_cluster == 0 || file->no_fat_chain) {
+        return true;
+    }
+    VolumeLock lock(this);
+    uint32_t clusters = (file->size + bytesPerCluster() - 1) / bytesPerCluster();
+    uint32_t cluster = file->first_cluster;
+    for (uint32_t i = 1; i < clusters; i++) {
+        uint32_t next;
+        if (!nextCluster(cluster, &next) || next != cluster + 1) {
+            return false;
+        }
+        cluster = next;
+    }
+    return true;
+}
+
+bool FatVolume::walkDirectory(const fat_file_t *dir, fat_dir_callback_t callback, void *arg)
+{
+    bool fixed_root = m_type == FAT_TYPE_FAT16 && dir->first_cluster == 0;
+    uint32_t sectors_per_cluster = 1u << m_cluster_shift;
+    uint32_t cluster = dir->first_cluster;
+    // exFAT directories without a FAT chain have a known length
+    uint32_t sector_limit = dir->no_fat_chain ? dir->size / BLOCK_CACHE_SECTOR_SIZE : UINT32_MAX;
+
+    // Names are assembled across entries (and sectors) as we go
+    int long_name_length = 0;          // FAT: LFN characters collected
+    bool long_name_valid = false;
+    int long_name_next = 0;            // sequence number the next LFN entry must have
+    uint8_t long_name_checksum = 0;    // of the 8.3 entry the LFN entries belong to
+    int exfat_secondary = 0;           // exFAT: entries left in the current set
+    int exfat_name_length = 0;
+    int exfat_collected = 0;
+    fat_file_t candidate = {};
+
+    for (uint32_t n = 0; ; n++) {
+        uint32_t lba;
+        if (fixed_root) {
+            if (n >= m_root_sectors) return true;
+            lba = m_root_start + n;
+        } else {
+            if (n >= sector_limit) return true;
+            if (n > 0 && (n & (sectors_per_cluster - 1)) == 0) {
+                if (dir->no_fat_chain) {
+                    cluster++;
+                } else if (!nextCluster(cluster, &cluster)) {
+                    return true;
+                }
+            }
+            lba = clusterToSector(cluster) + (n & (sectors_per_cluster - 1));
+        }
+
+        for (int e = 0; e < ENTRIES_PER_SECTOR; e++) {
+            // The callback may have used the sector buffer
+            if (!readSector(lba)) {
+                return false;
+            }
+            const uint8_t *entry = m_sector + e * DIR_ENTRY_SIZE;
+
+            if (m_type == FAT_TYPE_EXFAT) {
+                uint8_t entry_type = entry[0];
+                if (entry_type == 0x00) {
+                    return true;
+                }
+                if (entry_type == EXFAT_ENTRY_FILE) {
+                    exfat_secondary = entry[1];
+                    candidate = {};
+                    candidate.directory = (readLE16(entry + 4) & ATTR_DIRECTORY) != 0;
+                    candidate.modified = readLE32(entry + 12);
+                    exfat_name_length = 0;
+                    exfat_collected = 0;
+                    continue;
+                }
+                if (exfat_secondary == 0) {
+                    continue;
+                }
+                if (entry_type == EXFAT_ENTRY_STREAM) {
+                    candidate.no_fat_chain = (entry[1] & EXFAT_NO_FAT_CHAIN) != 0;
+                    exfat_name_length = entry[3];
+                    candidate.first_cluster = readLE32(entry + 20);
+                    // Sizes over 4 GB do not fit fat_file_t
+                    candidate.size = readLE32(entry + 28) ? UINT32_MAX : readLE32(entry + 24);
+                } else if (entry_type == EXFAT_ENTRY_NAME) {
+                    for (int c = 0; c < 15 && exfat_collected < exfat_name_length; c++) {
+                        m_name[exfat_collected++] = asciiChar(readLE16(entry + 2 + c * 2));
+                    }
+                }
+                if (--exfat_secondary == 0 && exfat_collected == exfat_name_length &&
+                    exfat_name_length > 0) {
+                    m_name[exfat_collected] = '\0';
+                    if (!callback(m_name, nullptr, &candidate, arg)) {
+                        return true;
+                    }
+                }
+                continue;
+            }
+
+            if (entry[0] == 0x00) {
+                return true;
+            }
+            if (entry[0] == 0xE5) {
+                long_name_valid = false;
+                continue;
+            }
+            uint8_t attributes = entry[11];
+            if ((attributes & 0x3F) == ATTR_LONG_NAME) {
+                // Long name pieces come last piece first, 13 characters each
+                int sequence = entry[0] & 0x1F;
+                if (entry[0] & 0x40) {
+                    long_name_length = sequence * 13;
+                    if (long_name_length >= (int)sizeof(m_name)) {
+                        long_name_valid = false;
+                        continue;
+                    }
+                    memset(m_name, 0, sizeof(m_name));
+                    long_name_valid = true;
+                    long_name_next = sequence;
+                    long_name_checksum = entry[13];
+                }
+                // Pieces must count down without gaps and all name the same
+                // 8.3 entry, or they are left over from a deleted file
+                if (!long_name_valid || sequence == 0 || sequence != long_name_next ||
+                    entry[13] != long_name_checksum) {
+                    long_name_valid = false;
+                    continue;
+                }
+                long_name_next--;
+                static const uint8_t OFFSETS[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+                for (int c = 0; c < 13; c++) {
+                    uint16_t ch = readLE16(entry + OFFSETS[c]);
+                    m_name[(sequence - 1) * 13 + c] = (ch == 0xFFFF) ? '\0' : asciiChar(ch);
+                }
+                continue;
+            }
+            if (attributes & ATTR_VOLUME_ID) {
+                long_name_valid = false;
+                continue;
+            }
+
+            candidate = {};
+            candidate.directory = (attributes & ATTR_DIRECTORY) != 0;
+            candidate.first_cluster = readLE16(entry + 26);
+            if (m_type == FAT_TYPE_FAT32) {
+                candidate.first_cluster |= (uint32_t)readLE16(entry + 20) << 16;
+            }
+            candidate.size = readLE32(entry + 28);
+            candidate.modified = ((uint32_t)readLE16(entry + 24) << 16) | readLE16(entry + 22);
+
+            // 8.3 name, padded with spaces
+            char short_name[13];
+            int length = 0;
+            for (int c = 0; c < 8 && entry[c] != ' '; c++) short_name[length++] = entry[c];
+            if (entry[8] != ' ') {
+                short_name[length++] = '.';
+                for (int c = 8; c < 11 && entry[c] != ' '; c++) short_name[length++] = entry[c];
+            }
+            short_name[length] = '\0';
+
+            bool has_long_name = long_name_valid && long_name_next == 0 &&
+                                 long_name_checksum == shortNameChecksum(entry);
+            long_name_valid = false;
+            // Skip the . and .. entries
+            if (short_name[0] == '.') {
+                continue;
+            }
+            if (!callback(has_long_name ? m_name : short_name, short_name, &candidate, arg)) {
+                return true;
+            }
+        }
+    }
+}
+
+typedef struct
+{
+    const char *name;
+    size_t name_length;
+    fat_file_t *file;
+    bool found;
+} find_state_t;
+
+static bool findCallback(const char *name, const char *short_name, const fat_file_t *file, void *arg)
+{
+    find_state_t *state = (find_state_t *)arg;
+    if (nameMatches(state->name, state->name_length, name) ||
+        (short_name != nullptr && nameMatches(state->name, state->name_length, short_name))) {
+        *state->file = *file;
+        state->found = true;
+        return false;
+    }
+    return true;
+}
+
+bool FatVolume::findInDirectory(const fat_file_t *dir, const char *name, size_t name_length, fat_file_t *file)
+{
+    find_state_t state = {name, name_length, file, false};
+    return walkDirectory(dir, findCallback, &state) && state.found;
+}
+
+bool FatVolume::stat(const char *path, fat_file_t *file)
+{
+    VolumeLock lock(this);
+    if (m_type == FAT_TYPE_NONE) {
+        return false;
+    }
+    fat_file_t current = {};
+    current.first_cluster = m_root_cluster;
+    current.directory = true;
+
+    while (*path) {
+        while (*path == '/') path++;
+        if (*path == '\0') break;
+        const char *end = strchr(path, '/');
+        size_t length = end ? (size_t)(end - path) : strlen(path);
+        if (!current.directory) {
+            return false;
+        }
+        fat_file_t next;
+        if (!findInDirectory(&current, path, length, &next)) {
+            return false;
+        }
+        current = next;
+        path += length;
+    }
+    *file = current;
+    return true;
+}
+
+bool FatVolume::list(const char *path, fat_dir_callback_t callback, void *arg)
+{
+    VolumeLock lock(this);
+    fat_file_t dir;
+    if (!stat(path, &dir) || !dir.directory) {
+        return false;
+    }
+    return walkDirectory(&dir, callback, arg);
+}
+
+bool FatVolume::list(const fat_file_t *dir, fat_dir_callback_t callback, void *arg)
+{
+    VolumeLock lock(this);
+    if (m_type == FAT_TYPE_NONE || !dir->directory) {
+        return false;
+    }
+    return walkDirectory(dir, callback, arg);
+}
+
+ContiguousFile::ContiguousFile()
+{
+    m_device = nullptr;
+    m_start_sector = 0;
+    m_size = 0;
+}
+
+bool ContiguousFile::open(FatVolume *volume, const char *path)
+{
+    fat_file_t file;
+    close();
+    if (volume == nullptr || !volume->stat(path, &file)) {
+        return false;
+    }
+    if (!open(volume, &file)) {
+        FAT_LOG("%s is not a contiguous file, not streaming it\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool ContiguousFile::open(FatVolume *volume, const fat_file_t *file)
+{
+    close();
+    if (volume == nullptr || file->directory || !volume->isContiguous(file)) {
+        return false;
+    }
+    m_start_sector = file->first_cluster ? volume->clusterToSector(file->first_cluster) : 0;
+    m_size = file->size;
+    m_device = volume->device();
+    return true;
+}
+
+int32_t ContiguousFile::read(uint32_t offset, uint8_t *buffer, uint32_t length)
+{
+    if (m_device == nullptr) {
+        return -1;
+    }
+    if (offset >= m_size) {
+        return 0;
+    }
+    if (length > m_size - offset) {
+        length = m_size - offset;
+    }
+
+    uint32_t done = 0;
+    uint32_t lba = m_start_sector + offset / BLOCK_CACHE_SECTOR_SIZE;
+    uint32_t skip = offset % BLOCK_CACHE_SECTOR_SIZE;
+    uint8_t bounce[BLOCK_CACHE_SECTOR_SIZE];
+
+    // Partial first sector
+    if (skip > 0) {
+        uint32_t chunk = BLOCK_CACHE_SECTOR_SIZE - skip < length ? BLOCK_CACHE_SECTOR_SIZE - skip : length;
+        if (!m_device->readBlocks(lba, bounce, 1)) return -1;
+        memcpy(buffer, bounce + skip, chunk);
+        done += chunk;
+        lba++;
+    }
+    // Whole sectors in one transfer, straight into the caller's buffer
+    uint32_t whole = (length - done) / BLOCK_CACHE_SECTOR_SIZE;
+    if (whole > 0) {
+        if (!m_device->readBlocks(lba, buffer + done, whole)) return -1;
+        done += whole * BLOCK_CACHE_SECTOR_SIZE;
+        lba += whole;
+    }
+    // Partial last sector
+    if (done < length) {
+        if (!m_device->readBlocks(lba, bounce, 1)) return -1;
+        memcpy(buffer + done, bounce, length - done);
+        done = length;
+    }
+    return (int32_t)done;
+}
+
+#ifdef ARDUINO
+static FatVolume *s_sdVolume = nullptr;
+
+bool mountSDVolume()
+{
+    if (s_sdVolume != nullptr) {
+        return true;
+    }
+    FatVolume *volume = new FatVolume();
+    if (!volume->mount(getSDBlockDevice())) {
+        delete volume;
+        return false;
+    }
+    s_sdVolume = volume;
+    return true;
+}
+
+FatVolume *getSDVolume()
+{
+    return s_sdVolume;
+}
+#endif
@@ -0,0 +1,638 @@
+#include <algorithm>
+#include <SD.h>
+#include <FS.h>
+#include <Preferences.h>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include "FileCatalog.h"
+#include "Logger.h"
+#include "SDScheduler.h"
+
+#define CATALOG_NAMESPACE "catalog"
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+static_assert(CATALOG_MAX_ENTRIES <= 65535, "entries are indexed with 16 bits");
+static_assert(sizeof(catalog_entry_t) == 20, "catalog entries are stored as they are in memory");
+
+static catalog_entry_t *s_entries = nullptr;
+static char *s_names = nullptr;
+static uint32_t s_count = 0;
+static uint32_t s_namesSize = 0;
+// Set once the tables are complete, lookups on other tasks read it first
+static bool s_loaded = false;
+
+// Allocated sizes while building, counted before the tables are filled
+static uint32_t s_entryCapacity = 0;
+static uint32_t s_nameCapacity = 0;
+
+static uint32_t hashBytes(uint32_t hash, const void *data, size_t length)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static MediaKind kindOf(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (dot == nullptr) {
+        return MEDIA_KIND_OTHER;
+    }
+    if (strcasecmp(dot, ".bin") == 0) return MEDIA_KIND_FRAME;
+    if (strcasecmp(dot, ".avi") == 0) return MEDIA_KIND_VIDEO;
+    if (strcasecmp(dot, ".wav") == 0) return MEDIA_KIND_AUDIO;
+    if (strcasecmp(dot, ".txt") == 0) return MEDIA_KIND_TEXT;
+    return MEDIA_KIND_OTHER;
+}
+
+// The tables are allocated once at their final size, in PSRAM when it is
+// fitted, so a large card does not need a big block of internal heap
+static void *allocTable(size_t size)
+{
+    void *table = psramFound() ? heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT) : nullptr;
+    return table ? table : malloc(size);
+}
+
+static void release()
+{
+    __atomic_store_n(&s_loaded, false, __ATOMIC_RELEASE);
+    free(s_entries);
+    free(s_names);
+    s_entries = nullptr;
+    s_names = nullptr;
+    s_count = 0;
+    s_namesSize = 0;
+    s_entryCapacity = 0;
+    s_nameCapacity = 0;
+}
+
+static void toFile(const catalog_entry_t *entry, catalog_file_t *file)
+{
+    bool directory = (entry->flags & CATALOG_FLAG_DIRECTORY) != 0;
+    file->name = s_names + entry->name_offset;
+    file->file.first_cluster = entry->first_cluster;
+    file->file.size = entry->size;
+    file->file.directory = directory;
+    // Contiguity was checked when the catalog was built, so opening the
+    // file as a ContiguousFile does not walk its FAT chain again
+    file->file.no_fat_chain = (entry->flags & CATALOG_FLAG_NO_FAT_CHAIN) != 0 ||
+                              (!directory && (entry->flags & CATALOG_FLAG_CONTIGUOUS) != 0);
+    file->file.modified = 0;
+    file->kind = (MediaKind)entry->kind;
+    file->contiguous = (entry->flags & CATALOG_FLAG_CONTIGUOUS) != 0;
+}
+
+typedef struct
+{
+    uint32_t hash;
+    bool root;
+} key_state_t;
+
+static bool keyCallback(const char *name, const char *short_name, const fat_file_t *file, void *arg)
+{
+    key_state_t *state = (key_state_t *)arg;
+    // The catalog's own entry changes every time it is written
+    if (state->root && strcasecmp(name, CATALOG_PATH + 1) == 0) {
+        return true;
+    }
+    state->hash = hashBytes(state->hash, name, strlen(name) + 1);
+    state->hash = hashBytes(state->hash, &file->size, sizeof(file->size));
+    state->hash = hashBytes(state->hash, &file->first_cluster, sizeof(file->first_cluster));
+    state->hash = hashBytes(state->hash, &file->modified, sizeof(file->modified));
+    return true;
+}
+
+// Summary of the card as the catalog in memory describes it: the volume
+// serial number, the FAT32 free cluster count and the entries of every
+// catalogued directory, read from the card. A file added, removed, resized
+// or moved anywhere changes one of those listings. 0 if a directory could
+// not be read, which a stale catalog can also cause.
+static uint32_t volumeKey(FatVolume *volume)
+{
+    // FatFs may have written the sector the volume has buffered
+    volume->invalidate();
+    key_state_t state = {FNV_OFFSET, true};
+    uint32_t serial = volume->serialNumber();
+    state.hash = hashBytes(state.hash, &serial, sizeof(serial));
+    uint32_t free_clusters;
+    if (volume->freeClusters(&free_clusters)) {
+        state.hash = hashBytes(state.hash, &free_clusters, sizeof(free_clusters));
+    }
+    for (uint32_t i = 0; i < s_count; i++) {
+        if (!(s_entries[i].flags & CATALOG_FLAG_DIRECTORY)) {
+            continue;
+        }
+        catalog_file_t dir;
+        toFile(&s_entries[i], &dir);
+        state.root = i == 0;
+        if (!volume->list(&dir.file, keyCallback, &state)) {
+            return 0;
+        }
+    }
+    return state.hash ? state.hash : 1;
+}
+
+static uint32_t checksum()
+{
+    uint32_t hash = hashBytes(FNV_OFFSET, s_entries, s_count * sizeof(catalog_entry_t));
+    return hashBytes(hash, s_names, s_namesSize);
+}
+
+// Case-insensitive, like FAT names: the first length characters of a
+// against b, with a before anything it is a prefix of
+static int compareName(const char *a, size_t length, const char *b)
+{
+    int cmp = strncasecmp(a, b, length);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return b[length] == '\0' ? 0 : -1;
+}
+
+static bool nameLess(const catalog_entry_t &a, const catalog_entry_t &b)
+{
+    return strcasecmp(s_names + a.name_offset, s_names + b.name_offset) < 0;
+}
+
+// Binary search of a directory's entries, -1 if the name is not there
+static int findChild(uint32_t dir, const char *name, size_t length)
+{
+    int low = s_entries[dir].first_child;
+    int high = low + s_entries[dir].child_count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = compareName(name, length, s_names + s_entries[mid].name_offset);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return -1;
+}
+
+// Entry for the first length characters of an absolute path, -1 if missing
+static int resolve(const char *path, size_t length)
+{
+    const char *end = path + length;
+    int index = 0;
+    while (path < end) {
+        while (path < end && *path == '/') path++;
+        if (path == end) break;
+        const char *slash = (const char *)memchr(path, '/', end - path);
+        size_t part = slash ? (size_t)(slash - path) : (size_t)(end - path);
+        if (!(s_entries[index].flags & CATALOG_FLAG_DIRECTORY)) {
+            return -1;
+        }
+        index = findChild(index, path, part);
+        if (index < 0) {
+            return -1;
+        }
+        path += part;
+    }
+    return index;
+}
+
+static bool appendEntry(const char *name, const fat_file_t *file, FatVolume *volume)
+{
+    // Only a card that changed since it was counted runs out of room
+    size_t length = strlen(name) + 1;
+    if (s_count >= s_entryCapacity || s_namesSize + length > s_nameCapacity) {
+        return false;
+    }
+
+    catalog_entry_t *entry = &s_entries[s_count++];
+    memset(entry, 0, sizeof(*entry));
+    memcpy(s_names + s_namesSize, name, length);
+    entry->name_offset = s_namesSize;
+    s_namesSize += length;
+    entry->size = file->size;
+    entry->first_cluster = file->first_cluster;
+    if (file->directory) {
+        entry->kind = MEDIA_KIND_DIRECTORY;
+        entry->flags |= CATALOG_FLAG_DIRECTORY;
+    } else {
+        entry->kind = kindOf(name);
+        if (volume->isContiguous(file)) {
+            entry->flags |= CATALOG_FLAG_CONTIGUOUS;
+        }
+    }
+    if (file->no_fat_chain) {
+        entry->flags |= CATALOG_FLAG_NO_FAT_CHAIN;
+    }
+    return true;
+}
+
+typedef struct
+{
+    bool root;
+    uint32_t entries;
+    uint32_t names_size;
+    // Directories still to count, the only thing that grows
+    fat_file_t *dirs;
+    uint32_t dir_count;
+    uint32_t dir_capacity;
+    bool ok;
+} count_state_t;
+
+static bool countCallback(const char *name, const char *short_name, const fat_file_t *file, void *arg)
+{
+    count_state_t *state = (count_state_t *)arg;
+    if (state->root && strcasecmp(name, CATALOG_PATH + 1) == 0) {
+        return true;
+    }
+    if (++state->entries >= CATALOG_MAX_ENTRIES) {
+        state->ok = false;
+        return false;
+    }
+    state->names_size += strlen(name) + 1;
+    if (file->directory) {
+        if (state->dir_count == state->dir_capacity) {
+            uint32_t capacity = max(state->dir_capacity * 2, (uint32_t)16);
+            fat_file_t *grown = (fat_file_t *)realloc(state->dirs, capacity * sizeof(fat_file_t));
+            if (grown == nullptr) {
+                state->ok = false;
+                return false;
+            }
+            state->dirs = grown;
+            state->dir_capacity = capacity;
+        }
+        state->dirs[state->dir_count++] = *file;
+    }
+    return true;
+}
+
+// Entries and name bytes below the root, from a walk that only reads the
+// directories, so build() can size its tables once
+static bool countEntries(FatVolume *volume, const fat_file_t *root, uint32_t *entries, uint32_t *names_size)
+{
+    count_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.ok = true;
+    bool ok = true;
+    // A copy, the array may move while the directory is listed
+    fat_file_t dir = *root;
+    for (uint32_t i = 0; ok; i++) {
+        state.root = i == 0;
+        ok = volume->list(&dir, countCallback, &state) && state.ok;
+        if (i == state.dir_count) {
+            break;
+        }
+        dir = state.dirs[i];
+    }
+    free(state.dirs);
+    if (state.entries >= CATALOG_MAX_ENTRIES) {
+        Serial.printf("File catalog: more than %d entries on the card\n", CATALOG_MAX_ENTRIES);
+    }
+    *entries = state.entries;
+    *names_size = state.names_size;
+    return ok;
+}
+
+typedef struct
+{
+    FatVolume *volume;
+    bool root;
+    bool ok;
+} build_state_t;
+
+static bool buildCallback(const char *name, const char *short_name, const fat_file_t *file, void *arg)
+{
+    build_state_t *state = (build_state_t *)arg;
+    if (state->root && strcasecmp(name, CATALOG_PATH + 1) == 0) {
+        return true;
+    }
+    state->ok = appendEntry(name, file, state->volume);
+    return state->ok;
+}
+
+// Count first, then one walk of every directory, breadth first, so each
+// directory's entries end up next to each other and can be sorted in place
+static bool build(FatVolume *volume)
+{
+    release();
+    fat_file_t root;
+    uint32_t entries;
+    uint32_t names_size;
+    if (!volume->stat("/", &root) || !countEntries(volume, &root, &entries, &names_size)) {
+        return false;
+    }
+    // Plus the root, whose name is empty
+    s_entries = (catalog_entry_t *)allocTable((entries + 1) * sizeof(catalog_entry_t));
+    s_names = (char *)allocTable(names_size + 1);
+    if (s_entries == nullptr || s_names == nullptr) {
+        Serial.printf("File catalog: no memory for %u entries\n", entries + 1);
+        return false;
+    }
+    s_entryCapacity = entries + 1;
+    s_nameCapacity = names_size + 1;
+    if (!appendEntry("", &root, volume)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < s_count; i++) {
+        if (!(s_entries[i].flags & CATALOG_FLAG_DIRECTORY)) {
+            continue;
+        }
+        catalog_file_t dir;
+        toFile(&s_entries[i], &dir);
+        build_state_t state = {volume, i == 0, true};
+        uint32_t first = s_count;
+        if (!volume->list(&dir.file, buildCallback, &state) || !state.ok) {
+            return false;
+        }
+        s_entries[i].first_child = first;
+        s_entries[i].child_count = s_count - first;
+        std::sort(s_entries + first, s_entries + s_count, nameLess);
+    }
+    return true;
+}
+
+// Indices and names of a catalog read back from the card stay in bounds
+static bool validate()
+{
+    if (s_count == 0 || s_namesSize == 0 || s_names[s_namesSize - 1] != '\0') {
+        return false;
+    }
+    for (uint32_t i = 0; i < s_count; i++) {
+        const catalog_entry_t *entry = &s_entries[i];
+        if (entry->name_offset >= s_namesSize ||
+            (uint32_t)entry->first_child + entry->child_count > s_count) {
+            return false;
+        }
+    }
+    return (s_entries[0].flags & CATALOG_FLAG_DIRECTORY) != 0;
+}
+
+// Read the stored catalog, key is what it was stored with
+static bool load(uint32_t *key)
+{
+    release();
+    File file = SD.open(CATALOG_PATH, FILE_READ);
+    if (!file) {
+        return false;
+    }
+    catalog_header_t header;
+    bool ok = file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+              memcmp(header.magic, CATALOG_MAGIC, 4) == 0 && header.version == CATALOG_VERSION &&
+              header.volume_key != 0 &&
+              file.size() == sizeof(header) + header.count * sizeof(catalog_entry_t) + header.names_size;
+    if (ok) {
+        s_count = header.count;
+        s_namesSize = header.names_size;
+        s_entries = (catalog_entry_t *)allocTable(s_count * sizeof(catalog_entry_t));
+        s_names = (char *)allocTable(s_namesSize);
+        ok = s_entries != nullptr && s_names != nullptr &&
+             file.read((uint8_t *)s_entries, s_count * sizeof(catalog_entry_t)) ==
+                 s_count * sizeof(catalog_entry_t) &&
+             file.read((uint8_t *)s_names, s_namesSize) == s_namesSize;
+    }
+    file.close();
+    if (ok && (checksum() != header.checksum || !validate())) {
+        Serial.println("File catalog: stored catalog is corrupt");
+        ok = false;
+    }
+    if (!ok) {
+        release();
+        return false;
+    }
+    *key = header.volume_key;
+    return true;
+}
+
+static bool save(FatVolume *volume)
+{
+    catalog_header_t header;
+    memcpy(header.magic, CATALOG_MAGIC, 4);
+    header.version = CATALOG_VERSION;
+    header.count = s_count;
+    header.names_size = s_namesSize;
+    header.volume_key = 0;
+    header.checksum = checksum();
+
+    File file = SD.open(CATALOG_PATH, FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+    bool ok = file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+              file.write((const uint8_t *)s_entries, s_count * sizeof(catalog_entry_t)) ==
+                  s_count * sizeof(catalog_entry_t) &&
+              file.write((const uint8_t *)s_names, s_namesSize) == s_namesSize;
+    file.close();
+    if (!ok) {
+        return false;
+    }
+
+    // Writing the file changed the free cluster count, so the key is taken
+    // now and patched in without changing the file's size
+    header.volume_key = volumeKey(volume);
+    file = SD.open(CATALOG_PATH, "r+");
+    ok = file && file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+    file.close();
+    return ok && header.volume_key != 0;
+}
+
+bool FileCatalog::begin()
+{
+    FatVolume *volume = getSDVolume();
+    if (volume == nullptr) {
+        Serial.println("File catalog: no FAT volume to index");
+        return false;
+    }
+    int64_t started = esp_timer_get_time();
+    uint32_t stored_key;
+    if (!takeRebuildRequest() && load(&stored_key)) {
+        // Every catalogued directory is read back, so a change anywhere on
+        // the card is caught before a stale entry is trusted
+        if (volumeKey(volume) == stored_key) {
+            __atomic_store_n(&s_loaded, true, __ATOMIC_RELEASE);
+            LOG_I(LOG_CAT_SD, "File catalog: %u entries loaded in %u ms", s_count,
+                  (uint32_t)((esp_timer_get_time() - started) / 1000));
+            return true;
+        }
+        LOG_I(LOG_CAT_SD, "File catalog: card changed since it was indexed");
+        release();
+    }
+    if (!build(volume)) {
+        release();
+        Serial.println("File catalog: could not index the card");
+        return false;
+    }
+    __atomic_store_n(&s_loaded, true, __ATOMIC_RELEASE);
+    uint32_t built_ms = (uint32_t)((esp_timer_get_time() - started) / 1000);
+    if (!save(volume)) {
+        Serial.println("File catalog: could not store the catalog, indexing again next boot");
+    }
+    LOG_I(LOG_CAT_SD, "File catalog: %u entries indexed in %u ms", s_count, built_ms);
+    return true;
+}
+
+bool FileCatalog::isLoaded()
+{
+    return __atomic_load_n(&s_loaded, __ATOMIC_ACQUIRE);
+}
+
+int FileCatalog::count()
+{
+    return isLoaded() ? s_count : 0;
+}
+
+bool FileCatalog::find(const char *path, catalog_file_t *file)
+{
+    if (!isLoaded()) {
+        return false;
+    }
+    int index = resolve(path, strlen(path));
+    if (index < 0) {
+        return false;
+    }
+    if (file != nullptr) {
+        toFile(&s_entries[index], file);
+    }
+    return true;
+}
+
+// On the SD scheduler's task: the FAT volume's cached directories when
+// there is one, FatFs otherwise
+static int32_t existsOnCard(void *arg)
+{
+    const char *path = (const char *)arg;
+    FatVolume *volume = getSDVolume();
+    fat_file_t file;
+    if (volume != nullptr) {
+        return volume->stat(path, &file) ? 1 : 0;
+    }
+    return SD.exists(path) ? 1 : 0;
+}
+
+bool FileCatalog::exists(const char *path)
+{
+    if (isLoaded()) {
+        return find(path, nullptr);
+    }
+    return SDScheduler::call(SD_CLIENT_BACKGROUND, existsOnCard, (void *)path) == 1;
+}
+
+int FileCatalog::list(const char *prefix, catalog_callback_t callback, void *arg)
+{
+    const char *slash = strrchr(prefix, '/');
+    if (!isLoaded() || slash == nullptr) {
+        return 0;
+    }
+    int dir = resolve(prefix, slash - prefix);
+    if (dir < 0 || !(s_entries[dir].flags & CATALOG_FLAG_DIRECTORY)) {
+        return 0;
+    }
+    const char *leaf = slash + 1;
+    size_t length = strlen(leaf);
+
+    // First entry at or after the prefix, the matches follow it
+    int low = s_entries[dir].first_child;
+    int end = low + s_entries[dir].child_count;
+    int high = end;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strncasecmp(s_names + s_entries[mid].name_offset, leaf, length) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    int listed = 0;
+    for (int i = low; i < end && strncasecmp(s_names + s_entries[i].name_offset, leaf, length) == 0; i++) {
+        catalog_file_t file;
+        toFile(&s_entries[i], &file);
+        listed++;
+        if (!callback(&file, arg)) {
+            break;
+        }
+    }
+    return listed;
+}
+
+void FileCatalog::requestRebuild()
+{
+    Preferences prefs;
+    if (prefs.begin(CATALOG_NAMESPACE, false)) {
+        prefs.putBool("rebuild", true);
+        prefs.end();
+    }
+    Serial.println("File catalog: restarting to index the card");
+    Serial.flush();
+    ESP.restart();
+}
+
+bool FileCatalog::takeRebuildRequest()
+{
+    Preferences prefs;
+    if (!prefs.begin(CATALOG_NAMESPACE, false)) {
+        return false;
+    }
+    bool requested = prefs.getBool("rebuild", false);
+    if (requested) {
+        prefs.remove("rebuild");
+    }
+    prefs.end();
+    return requested;
+}
+
+static void printIndent(int depth)
+{
+    for (int i = 0; i < depth; i++) {
+        if (i == 0) {
+            Serial.print("|");
+        }
+        Serial.print("-\t");
+    }
+}
+
+static void printEntries(uint32_t dir, int depth)
+{
+    const catalog_entry_t *parent = &s_entries[dir];
+    uint32_t files = 0;
+    uint64_t bytes = 0;
+    for (uint32_t i = parent->first_child; i < (uint32_t)parent->first_child + parent->child_count; i++) {
+        if (!(s_entries[i].flags & CATALOG_FLAG_DIRECTORY)) {
+            files++;
+            bytes += s_entries[i].size;
+        }
+    }
+    bool summarise = files > CATALOG_PRINT_MAX_FILES;
+
+    for (uint32_t i = parent->first_child; i < (uint32_t)parent->first_child + parent->child_count; i++) {
+        const catalog_entry_t *entry = &s_entries[i];
+        bool directory = (entry->flags & CATALOG_FLAG_DIRECTORY) != 0;
+        if (!directory && summarise) {
+            continue;
+        }
+        printIndent(depth);
+        Serial.print(s_names + entry->name_offset);
+        if (directory) {
+            Serial.println("/");
+            printEntries(i, depth + 1);
+        } else {
+            Serial.print("\t\t");
+            Serial.println(entry->size, DEC);
+        }
+    }
+    if (summarise) {
+        printIndent(depth);
+        Serial.printf("%u files, %llu bytes\n", files, bytes);
+    }
+}
+
+void FileCatalog::print()
+{
+    if (!isLoaded()) {
+        Serial.println("File catalog: not loaded");
+        return;
+    }
+    printEntries(0, 0);
+}
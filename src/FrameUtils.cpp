@@ -1,5 +1,37 @@
 #include "FrameUtils.h"
 #include <Arduino.h>
+#include "MediaArena.h"
+#include "JobSystem.h"
+
+// 4x4 Bayer threshold matrix (values 0-15)
+static const uint8_t BAYER_4X4[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5}
+};
+
+// Quantisation tables indexed by (channel + dither bias), so the saturating
+// add and the truncation to N bits are a single lookup. Each table is sized
+// for the largest bias of its bit depth: step * 15 / 16.
+static uint8_t s_quant6[256 + 4];   // 6-bit channel, step 4
+static uint8_t s_quant5[256 + 8];   // 5-bit channel, step 8
+static uint8_t s_quant3[256 + 32];  // 3-bit channel, step 32
+static uint8_t s_quant2[256 + 64];  // 2-bit channel, step 64
+static bool s_dither_ready = false;
+
+static void initDitherTables()
+{
+    if (s_dither_ready) return;
+    for (int v = 0; v < 256 + 64; v++) {
+        int c = v > 255 ? 255 : v;
+        if (v < (int)sizeof(s_quant6)) s_quant6[v] = c >> 2;
+        if (v < (int)sizeof(s_quant5)) s_quant5[v] = c >> 3;
+        if (v < (int)sizeof(s_quant3)) s_quant3[v] = c >> 5;
+        s_quant2[v] = c >> 6;
+    }
+    s_dither_ready = true;
+}
 
 uint16_t FrameUtils::rgb888ToRgb565(uint8_t r, uint8_t g, uint8_t b)
 {
@@ -27,6 +59,88 @@ bool FrameUtils::convertRgb888ToRgb565(uint8_t* rgb888_data, uint16_t* rgb565_da
     return true;
 }
 
+bool FrameUtils::ditherRgb888ToRgb565(const uint8_t* rgb888_data, uint16_t* rgb565_data, int width, int rows, int first_row)
+{
+    if (rgb888_data == nullptr || rgb565_data == nullptr) {
+        return false;
+    }
+    initDitherTables();
+    
+    for (int y = 0; y < rows; y++) {
+        const uint8_t* bayer = BAYER_4X4[(first_row + y) & 3];
+        for (int x = 0; x < width; x++) {
+            // Bias each channel by a fraction of its quantisation step
+            uint8_t t = bayer[x & 3];
+            uint16_t r = s_quant5[rgb888_data[0] + (t >> 1)];
+            uint16_t g = s_quant6[rgb888_data[1] + (t >> 2)];
+            uint16_t b = s_quant5[rgb888_data[2] + (t >> 1)];
+            *rgb565_data++ = (r << 11) | (g << 5) | b;
+            rgb888_data += 3;
+        }
+    }
+    
+    return true;
+}
+
+bool FrameUtils::ditherRgb888ToRgb332(const uint8_t* rgb888_data, uint8_t* rgb332_data, int width, int rows, int first_row)
+{
+    if (rgb888_data == nullptr || rgb332_data == nullptr) {
+        return false;
+    }
+    initDitherTables();
+    
+    for (int y = 0; y < rows; y++) {
+        const uint8_t* bayer = BAYER_4X4[(first_row + y) & 3];
+        for (int x = 0; x < width; x++) {
+            uint8_t t = bayer[x & 3];
+            uint8_t r = s_quant3[rgb888_data[0] + (t << 1)];
+            uint8_t g = s_quant3[rgb888_data[1] + (t << 1)];
+            uint8_t b = s_quant2[rgb888_data[2] + (t << 2)];
+            *rgb332_data++ = (r << 5) | (g << 2) | b;
+            rgb888_data += 3;
+        }
+    }
+    
+    return true;
+}
+
+typedef struct
+{
+    const uint16_t* src_pixels;
+    int src_width;
+    uint16_t* dest_pixels;
+    int dest_width;
+    uint32_t x_step;
+    uint32_t y_step;
+} scale_job_t;
+
+// One band of scaleFrame, run on either core
+static void scaleFrameBand(int first_row, int rows, void* arg)
+{
+    scale_job_t* job = (scale_job_t*)arg;
+    int last_src_y = -1;
+    
+    for (int y = first_row; y < first_row + rows; y++) {
+        int src_y = (y * job->y_step) >> 16;
+        uint16_t* dest_row = job->dest_pixels + y * job->dest_width;
+        
+        // Rows sampling the same source row are identical (within a band,
+        // the row above may belong to a band still being produced)
+        if (src_y == last_src_y) {
+            memcpy(dest_row, dest_row - job->dest_width, job->dest_width * 2);
+            continue;
+        }
+        last_src_y = src_y;
+        
+        const uint16_t* src_row = job->src_pixels + src_y * job->src_width;
+        uint32_t src_x = 0;
+        for (int x = 0; x < job->dest_width; x++) {
+            dest_row[x] = src_row[src_x >> 16];
+            src_x += job->x_step;
+        }
+    }
+}
+
 bool FrameUtils::scaleFrame(VideoFrame_t* source, VideoFrame_t* dest, int target_width, int target_height)
 {
     if (source == nullptr || dest == nullptr || source->data == nullptr) {
@@ -37,9 +151,9 @@ bool FrameUtils::scaleFrame(VideoFrame_t* source, VideoFrame_t* dest, int target
     uint32_t dest_size = target_width * target_height * 2; // 2 bytes per pixel for RGB565
     if (dest->data == nullptr || dest->size < dest_size) {
         if (dest->data != nullptr) {
-            free(dest->data);
+            MediaArena::free(dest->data);
         }
-        dest->data = (uint8_t*)malloc(dest_size);
+        dest->data = (uint8_t*)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_VIDEO, dest_size);
         if (dest->data == nullptr) {
             return false;
         }
@@ -48,33 +162,112 @@ bool FrameUtils::scaleFrame(VideoFrame_t* source, VideoFrame_t* dest, int target
     
     dest->width = target_width;
     dest->height = target_height;
+    dest->format = FRAME_FORMAT_RGB565;
     
-    uint16_t* src_pixels = (uint16_t*)source->data;
-    uint16_t* dest_pixels = (uint16_t*)dest->data;
+    // Simple nearest neighbor scaling, stepping through the source in 16.16
+    // fixed point so the ESP32 never touches the FPU in the inner loop.
+    // Bands of rows are spread over both cores.
+    scale_job_t job;
+    job.src_pixels = (const uint16_t*)source->data;
+    job.src_width = source->width;
+    job.dest_pixels = (uint16_t*)dest->data;
+    job.dest_width = target_width;
+    job.x_step = ((uint32_t)source->width << 16) / target_width;
+    job.y_step = ((uint32_t)source->height << 16) / target_height;
+    JobSystem::parallelRows(target_height, scaleFrameBand, &job, 16);
+    
+    return true;
+}
+
+void FrameUtils::rotatedSize(int width, int height, FrameRotation rotation, int* out_width, int* out_height)
+{
+    bool swap = rotation == ROTATE_90 || rotation == ROTATE_270;
+    *out_width = swap ? height : width;
+    *out_height = swap ? width : height;
+}
+
+// Edge of the square tiles the rotate kernels walk the source in. 16 pixels
+// keeps a tile of 16-bit source rows within a handful of cache lines when
+// frames live in PSRAM or mapped flash.
+#define ROTATE_TILE 16
+
+template <typename T>
+static bool rotateStrip(const T* src, int src_width, int src_height, FrameRotation rotation, bool mirror,
+                        T* strip, int first_row, int rows)
+{
+    int dst_width, dst_height;
+    FrameUtils::rotatedSize(src_width, src_height, rotation, &dst_width, &dst_height);
+    if (src == nullptr || strip == nullptr || first_row < 0 || first_row + rows > dst_height) {
+        return false;
+    }
     
-    // Simple nearest neighbor scaling
-    float x_scale = (float)source->width / target_width;
-    float y_scale = (float)source->height / target_height;
+    // Express the transform as source index = base + x * step_x + y * step_y
+    int32_t base, step_x, step_y;
+    switch (rotation) {
+        case ROTATE_90:
+            base = (src_height - 1) * src_width;
+            step_x = -src_width;
+            step_y = 1;
+            break;
+        case ROTATE_180:
+            base = src_height * src_width - 1;
+            step_x = -1;
+            step_y = -src_width;
+            break;
+        case ROTATE_270:
+            base = src_width - 1;
+            step_x = src_width;
+            step_y = -1;
+            break;
+        default:
+            base = 0;
+            step_x = 1;
+            step_y = src_width;
+            break;
+    }
+    if (mirror) {
+        base += (dst_width - 1) * step_x;
+        step_x = -step_x;
+    }
     
-    for (int y = 0; y < target_height; y++) {
-        for (int x = 0; x < target_width; x++) {
-            int src_x = (int)(x * x_scale);
-            int src_y = (int)(y * y_scale);
-            
-            // Bounds checking
-            if (src_x >= source->width) src_x = source->width - 1;
-            if (src_y >= source->height) src_y = source->height - 1;
-            
-            int src_index = src_y * source->width + src_x;
-            int dest_index = y * target_width + x;
-            
-            dest_pixels[dest_index] = src_pixels[src_index];
+    // Plain copies need no tiling
+    if (step_x == 1) {
+        for (int y = 0; y < rows; y++) {
+            memcpy(strip + y * dst_width, src + base + (first_row + y) * step_y, dst_width * sizeof(T));
         }
+        return true;
     }
     
+    int last_row = first_row + rows;
+    for (int tile_y = first_row; tile_y < last_row; tile_y += ROTATE_TILE) {
+        int tile_rows = min(ROTATE_TILE, last_row - tile_y);
+        for (int tile_x = 0; tile_x < dst_width; tile_x += ROTATE_TILE) {
+            int tile_cols = min(ROTATE_TILE, dst_width - tile_x);
+            for (int y = tile_y; y < tile_y + tile_rows; y++) {
+                const T* in = src + base + tile_x * step_x + y * step_y;
+                T* out = strip + (y - first_row) * dst_width + tile_x;
+                for (int x = 0; x < tile_cols; x++) {
+                    out[x] = *in;
+                    in += step_x;
+                }
+            }
+        }
+    }
     return true;
 }
 
+bool FrameUtils::rotateStrip8(const uint8_t* src, int src_width, int src_height, FrameRotation rotation, bool mirror,
+                              uint8_t* strip, int first_row, int rows)
+{
+    return rotateStrip(src, src_width, src_height, rotation, mirror, strip, first_row, rows);
+}
+
+bool FrameUtils::rotateStrip16(const uint16_t* src, int src_width, int src_height, FrameRotation rotation, bool mirror,
+                               uint16_t* strip, int first_row, int rows)
+{
+    return rotateStrip(src, src_width, src_height, rotation, mirror, strip, first_row, rows);
+}
+
 void FrameUtils::createTestPattern(VideoFrame_t* frame, int width, int height, uint16_t color1, uint16_t color2)
 {
     if (frame == nullptr) return;
@@ -82,9 +275,9 @@ void FrameUtils::createTestPattern(VideoFrame_t* frame, int width, int height, u
     uint32_t frame_size = width * height * 2; // 2 bytes per pixel for RGB565
     if (frame->data == nullptr || frame->size < frame_size) {
         if (frame->data != nullptr) {
-            free(frame->data);
+            MediaArena::free(frame->data);
         }
-        frame->data = (uint8_t*)malloc(frame_size);
+        frame->data = (uint8_t*)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_VIDEO, frame_size);
         if (frame->data == nullptr) {
             return;
         }
@@ -93,6 +286,7 @@ void FrameUtils::createTestPattern(VideoFrame_t* frame, int width, int height, u
     
     frame->width = width;
     frame->height = height;
+    frame->format = FRAME_FORMAT_RGB565;
     
     uint16_t* pixels = (uint16_t*)frame->data;
     
@@ -109,3 +303,195 @@ void FrameUtils::createTestPattern(VideoFrame_t* frame, int width, int height, u
         }
     }
 }
+
+// Spread an RGB565 pixel so each channel has room to be multiplied by a
+// 5-bit weight without spilling into its neighbour (----GGGGGG-----RRRRR------BBBBB)
+static inline uint32_t spread565(uint16_t c)
+{
+    return (c | ((uint32_t)c << 16)) & 0x07E0F81F;
+}
+
+static inline uint16_t pack565(uint32_t c)
+{
+    c &= 0x07E0F81F;
+    return (uint16_t)(c | (c >> 16));
+}
+
+// Blend two spread pixels, w is the weight of b in 1/32 steps
+static inline uint32_t lerp565(uint32_t a, uint32_t b, uint32_t w)
+{
+    return ((a * (32 - w) + b * w) >> 5) & 0x07E0F81F;
+}
+
+FrameScaler::FrameScaler()
+{
+    m_src_width = 0;
+    m_src_height = 0;
+    m_dst_width = 0;
+    m_dst_height = 0;
+    m_mode = SCALE_NEAREST;
+    m_x0 = nullptr;
+    m_x1 = nullptr;
+    m_wx = nullptr;
+    m_table_capacity = 0;
+    m_y_step = 0;
+}
+
+FrameScaler::~FrameScaler()
+{
+    free(m_x0);
+    free(m_x1);
+    free(m_wx);
+}
+
+bool FrameScaler::isConfigured(int src_width, int src_height, int dst_width, int dst_height, ScaleMode mode)
+{
+    return m_src_width == src_width && m_src_height == src_height &&
+           m_dst_width == dst_width && m_dst_height == dst_height && m_mode == mode;
+}
+
+bool FrameScaler::configure(int src_width, int src_height, int dst_width, int dst_height, ScaleMode mode)
+{
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0 ||
+        src_width > 0xFFFF || src_height > 0xFFFF) {
+        return false;
+    }
+    if (isConfigured(src_width, src_height, dst_width, dst_height, mode)) {
+        return true;
+    }
+
+    // Tables only ever grow, so switching between clips does not churn the heap
+    if (dst_width > m_table_capacity) {
+        free(m_x0);
+        free(m_x1);
+        free(m_wx);
+        m_x0 = (uint16_t*)malloc(dst_width * sizeof(uint16_t));
+        m_x1 = (uint16_t*)malloc(dst_width * sizeof(uint16_t));
+        m_wx = (uint8_t*)malloc(dst_width);
+        if (m_x0 == nullptr || m_x1 == nullptr || m_wx == nullptr) {
+            free(m_x0);
+            free(m_x1);
+            free(m_wx);
+            m_x0 = m_x1 = nullptr;
+            m_wx = nullptr;
+            m_table_capacity = 0;
+            m_dst_width = 0;
+            return false;
+        }
+        m_table_capacity = dst_width;
+    }
+
+    m_src_width = src_width;
+    m_src_height = src_height;
+    m_dst_width = dst_width;
+    m_dst_height = dst_height;
+    m_mode = mode;
+    m_y_step = ((uint32_t)src_height << 16) / dst_height;
+
+    uint32_t x_step = ((uint32_t)src_width << 16) / dst_width;
+    for (int x = 0; x < dst_width; x++) {
+        if (mode == SCALE_BILINEAR) {
+            // Sample at pixel centres: src = (x + 0.5) * scale - 0.5
+            int32_t pos = (int32_t)(x * x_step + (x_step >> 1)) - 0x8000;
+            if (pos < 0) pos = 0;
+            int x0 = pos >> 16;
+            m_x0[x] = x0;
+            m_x1[x] = x0 + 1 < src_width ? x0 + 1 : x0;
+            m_wx[x] = (pos >> 11) & 0x1F;
+        } else {
+            m_x0[x] = (x * x_step + (x_step >> 1)) >> 16;
+            m_x1[x] = m_x0[x];
+            m_wx[x] = 0;
+        }
+    }
+    return true;
+}
+
+void FrameScaler::sourceRow(int dst_y, int *y0, int *y1, int *wy)
+{
+    if (m_mode == SCALE_BILINEAR) {
+        int32_t pos = (int32_t)(dst_y * m_y_step + (m_y_step >> 1)) - 0x8000;
+        if (pos < 0) pos = 0;
+        *y0 = pos >> 16;
+        *y1 = *y0 + 1 < m_src_height ? *y0 + 1 : *y0;
+        *wy = (pos >> 11) & 0x1F;
+    } else {
+        *y0 = (dst_y * m_y_step + (m_y_step >> 1)) >> 16;
+        *y1 = *y0;
+        *wy = 0;
+    }
+}
+
+bool FrameScaler::scaleStrip(const uint16_t *src, uint16_t *strip, int first_row, int rows)
+{
+    if (src == nullptr || strip == nullptr || m_dst_width == 0 ||
+        first_row < 0 || first_row + rows > m_dst_height) {
+        return false;
+    }
+
+    int last_key = -1;
+    for (int row = 0; row < rows; row++) {
+        int y0, y1, wy;
+        sourceRow(first_row + row, &y0, &y1, &wy);
+        uint16_t *out = strip + row * m_dst_width;
+
+        // Upscaling repeats source rows, so copy the row we just produced
+        int key = (y0 << 5) | wy;
+        if (key == last_key) {
+            memcpy(out, out - m_dst_width, m_dst_width * sizeof(uint16_t));
+            continue;
+        }
+        last_key = key;
+
+        const uint16_t *top = src + y0 * m_src_width;
+        if (m_mode != SCALE_BILINEAR) {
+            for (int x = 0; x < m_dst_width; x++) {
+                out[x] = top[m_x0[x]];
+            }
+            continue;
+        }
+
+        const uint16_t *bottom = src + y1 * m_src_width;
+        for (int x = 0; x < m_dst_width; x++) {
+            uint32_t wx = m_wx[x];
+            uint32_t t = lerp565(spread565(top[m_x0[x]]), spread565(top[m_x1[x]]), wx);
+            if (wy == 0) {
+                out[x] = pack565(t);
+            } else {
+                uint32_t b = lerp565(spread565(bottom[m_x0[x]]), spread565(bottom[m_x1[x]]), wx);
+                out[x] = pack565(lerp565(t, b, wy));
+            }
+        }
+    }
+    return true;
+}
+
+bool FrameScaler::scaleStrip(const uint8_t *src, uint8_t *strip, int first_row, int rows)
+{
+    if (src == nullptr || strip == nullptr || m_dst_width == 0 ||
+        first_row < 0 || first_row + rows > m_dst_height) {
+        return false;
+    }
+
+    int last_y = -1;
+    for (int row = 0; row < rows; row++) {
+        int y0, y1, wy;
+        sourceRow(first_row + row, &y0, &y1, &wy);
+        uint8_t *out = strip + row * m_dst_width;
+
+        // RGB332 has too few bits per channel for blending to pay off, so
+        // bilinear tables just pick the nearer of the two neighbours
+        int y = wy < 16 ? y0 : y1;
+        if (y == last_y) {
+            memcpy(out, out - m_dst_width, m_dst_width);
+            continue;
+        }
+        last_y = y;
+
+        const uint8_t *line = src + y * m_src_width;
+        for (int x = 0; x < m_dst_width; x++) {
+            out[x] = line[m_wx[x] < 16 ? m_x0[x] : m_x1[x]];
+        }
+    }
+    return true;
+}
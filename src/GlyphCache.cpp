@@ -0,0 +1,306 @@
+#include "GlyphCache.h"
+#include "MediaArena.h"
+
+#define NO_SLOT 0xFF
+
+static_assert(GLYPH_CACHE_MAX_SLOTS < NO_SLOT, "slot indices are 8 bits with one value reserved");
+
+typedef struct
+{
+    const uint8_t *font;      // the font's array identifies it
+    uint16_t code;
+    uint16_t fg;
+    uint16_t bg;
+    uint8_t width;
+    uint8_t height;
+    uint8_t next;             // in the same bucket
+    bool used;
+    uint32_t last_used;
+} glyph_slot_t;
+
+static glyph_slot_t s_slots[GLYPH_CACHE_MAX_SLOTS];
+static uint8_t s_buckets[GLYPH_CACHE_BUCKETS];
+static int s_slotCount = 0;
+static uint16_t *s_atlas = nullptr;
+static uint16_t *s_run = nullptr;
+static uint32_t s_tick = 0;
+static glyph_cache_stats_t s_stats;
+
+static inline uint32_t bucketOf(const uint8_t *font, uint16_t code, uint16_t fg, uint16_t bg)
+{
+    uint32_t h = (uint32_t)(uintptr_t)font ^ code ^ ((uint32_t)fg << 7) ^ ((uint32_t)bg << 13);
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h % GLYPH_CACHE_BUCKETS;
+}
+
+static inline bool cacheable(TFT_eSPI *tft)
+{
+    return s_slotCount > 0 && tft->fontLoaded && tft->gFont.gArray != nullptr;
+}
+
+// Draw a width x height cell (glyph index, or -1 for a blank) at (x, y) in
+// a buffer of clip_width x clip_height pixels, clipped to it
+static void rasterise(TFT_eSPI *tft, int index, uint16_t fg, uint16_t bg, uint16_t *dst, int stride, int clip_width,
+                      int clip_height, int x, int y, int width, int height)
+{
+    int x0 = max(x, 0);
+    int x1 = min(x + width, clip_width);
+    int y0 = max(y, 0);
+    int y1 = min(y + height, clip_height);
+    for (int row = y0; row < y1; row++) {
+        for (int col = x0; col < x1; col++) {
+            dst[row * stride + col] = bg;
+        }
+    }
+    if (index < 0) {
+        return;
+    }
+
+    // Same placement as TFT_eSPI::drawGlyph, but clipped to the cell
+    const uint8_t *bitmap = tft->gFont.gArray + tft->gBitmap[index];
+    int glyph_width = tft->gWidth[index];
+    int glyph_height = tft->gHeight[index];
+    int left = x + tft->gdX[index];
+    int top = y + tft->gFont.maxAscent - tft->gdY[index];
+    for (int gy = 0; gy < glyph_height; gy++) {
+        int row = top + gy;
+        if (row < y0 || row >= y1) {
+            continue;
+        }
+        for (int gx = 0; gx < glyph_width; gx++) {
+            int col = left + gx;
+            uint8_t alpha = bitmap[gy * glyph_width + gx];
+            if (col < x0 || col >= x1 || alpha == 0) {
+                continue;
+            }
+            dst[row * stride + col] = alpha == 255 ? fg : tft->alphaBlend(alpha, fg, bg);
+        }
+    }
+}
+
+static void unlink(int slot)
+{
+    glyph_slot_t *s = &s_slots[slot];
+    uint8_t *link = &s_buckets[bucketOf(s->font, s->code, s->fg, s->bg)];
+    while (*link != NO_SLOT) {
+        if (*link == slot) {
+            *link = s->next;
+            break;
+        }
+        link = &s_slots[*link].next;
+    }
+    s->used = false;
+}
+
+// The cached cell for a glyph, rasterised into the least recently used
+// slot on a miss; nullptr if the cell does not fit a slot
+static const uint16_t *cell(TFT_eSPI *tft, int index, uint16_t code, int width, int height, uint16_t fg, uint16_t bg)
+{
+    if (width * height > GLYPH_CACHE_SLOT_PIXELS || width > 255 || height > 255) {
+        return nullptr;
+    }
+    const uint8_t *font = tft->gFont.gArray;
+    uint32_t bucket = bucketOf(font, code, fg, bg);
+    for (uint8_t i = s_buckets[bucket]; i != NO_SLOT; i = s_slots[i].next) {
+        glyph_slot_t *s = &s_slots[i];
+        if (s->code == code && s->font == font && s->fg == fg && s->bg == bg) {
+            s->last_used = ++s_tick;
+            s_stats.hits++;
+            return s_atlas + i * GLYPH_CACHE_SLOT_PIXELS;
+        }
+    }
+
+    int victim = 0;
+    for (int i = 0; i < s_slotCount; i++) {
+        if (!s_slots[i].used) {
+            victim = i;
+            break;
+        }
+        if (s_slots[i].last_used < s_slots[victim].last_used) {
+            victim = i;
+        }
+    }
+    if (s_slots[victim].used) {
+        unlink(victim);
+        s_stats.evictions++;
+    }
+
+    glyph_slot_t *s = &s_slots[victim];
+    s->font = font;
+    s->code = code;
+    s->fg = fg;
+    s->bg = bg;
+    s->width = width;
+    s->height = height;
+    s->used = true;
+    s->last_used = ++s_tick;
+    s->next = s_buckets[bucket];
+    s_buckets[bucket] = victim;
+    s_stats.misses++;
+
+    uint16_t *pixels = s_atlas + victim * GLYPH_CACHE_SLOT_PIXELS;
+    rasterise(tft, index, fg, bg, pixels, width, width, height, 0, 0, width, height);
+    return pixels;
+}
+
+static inline int advance(TFT_eSPI *tft, uint16_t code, uint16_t *index, bool *found)
+{
+    *found = tft->getUnicodeIndex(code, index);
+    return *found ? tft->gxAdvance[*index] : tft->gFont.spaceWidth;
+}
+
+// Place the cells of a line of text at (x, y) in a buffer, skipping glyphs
+// that fall outside it, and return the line's width
+static int layout(TFT_eSPI *tft, const char *text, uint16_t fg, uint16_t bg, uint16_t *dst, int stride,
+                  int dst_width, int dst_height, int x, int y)
+{
+    int height = tft->gFont.yAdvance;
+    uint16_t length = strlen(text);
+    uint16_t position = 0;
+    int cursor = x;
+    bool visible = y < dst_height && y + height > 0;
+
+    while (position < length) {
+        uint16_t code = tft->decodeUTF8((uint8_t *)text, &position, length - position);
+        uint16_t index;
+        bool found;
+        int width = advance(tft, code, &index, &found);
+        if (visible && width > 0 && cursor < dst_width && cursor + width > 0) {
+            const uint16_t *pixels = cell(tft, found ? index : -1, code, width, height, fg, bg);
+            if (pixels == nullptr) {
+                s_stats.uncached++;
+                rasterise(tft, found ? index : -1, fg, bg, dst, stride, dst_width, dst_height, cursor, y, width, height);
+            } else {
+                int x0 = max(cursor, 0);
+                int x1 = min(cursor + width, dst_width);
+                for (int row = max(y, 0); row < min(y + height, dst_height); row++) {
+                    memcpy(dst + row * stride + x0, pixels + (row - y) * width + (x0 - cursor),
+                           (x1 - x0) * sizeof(uint16_t));
+                }
+            }
+        }
+        cursor += width;
+    }
+    return cursor - x;
+}
+
+bool GlyphCache::begin(uint32_t budget_bytes)
+{
+    if (s_atlas != nullptr) {
+        return true;
+    }
+    int slots = min((uint32_t)(budget_bytes / (GLYPH_CACHE_SLOT_PIXELS * sizeof(uint16_t))),
+                    (uint32_t)GLYPH_CACHE_MAX_SLOTS);
+    if (slots == 0) {
+        return false;
+    }
+    s_atlas = (uint16_t *)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_UI,
+                                            slots * GLYPH_CACHE_SLOT_PIXELS * sizeof(uint16_t));
+    s_run = (uint16_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_UI, GLYPH_CACHE_RUN_PIXELS * sizeof(uint16_t));
+    if (s_atlas == nullptr || s_run == nullptr) {
+        Serial.println("Glyph cache: no memory for the atlas");
+        if (s_atlas) MediaArena::free(s_atlas);
+        if (s_run) MediaArena::free(s_run);
+        s_atlas = nullptr;
+        s_run = nullptr;
+        return false;
+    }
+    s_slotCount = slots;
+    clear();
+    resetStats();
+    return true;
+}
+
+bool GlyphCache::isReady()
+{
+    return s_slotCount > 0;
+}
+
+int GlyphCache::drawString(TFT_eSPI *tft, const char *text, int x, int y, uint16_t fg, uint16_t bg)
+{
+    int height = tft->gFont.yAdvance;
+    int run_width = height > 0 ? GLYPH_CACHE_RUN_PIXELS / height : 0;
+    if (!cacheable(tft) || run_width == 0) {
+        s_stats.fallbacks++;
+        tft->setTextColor(fg, bg, true);
+        return tft->drawString(text, x, y);
+    }
+
+    int total = textWidth(tft, text);
+    int x0 = max(x, 0);
+    int x1 = min(x + total, (int)tft->width());
+    int first_row = max(0, -y);
+    int last_row = min(height, tft->height() - y);
+    if (x0 >= x1 || first_row >= last_row) {
+        return total;
+    }
+    // Whole glyph cells go into the run, which is pushed once per run width
+    for (int run_x = x0; run_x < x1; run_x += run_width) {
+        int width = min(run_width, x1 - run_x);
+        layout(tft, text, fg, bg, s_run, width, width, height, x - run_x, 0);
+        tft->setAddrWindow(run_x, y + first_row, width, last_row - first_row);
+        tft->pushColors(s_run + first_row * width, width * (last_row - first_row));
+    }
+    return total;
+}
+
+int GlyphCache::renderString(TFT_eSPI *tft, const char *text, uint16_t *buffer, int buffer_width, int buffer_height,
+                             int x, int y, uint16_t fg, uint16_t bg)
+{
+    if (!cacheable(tft)) {
+        return -1;
+    }
+    return layout(tft, text, fg, bg, buffer, buffer_width, buffer_width, buffer_height, x, y);
+}
+
+int GlyphCache::textWidth(TFT_eSPI *tft, const char *text)
+{
+    if (!tft->fontLoaded) {
+        return tft->textWidth(text);
+    }
+    uint16_t length = strlen(text);
+    uint16_t position = 0;
+    int width = 0;
+    while (position < length) {
+        uint16_t code = tft->decodeUTF8((uint8_t *)text, &position, length - position);
+        uint16_t index;
+        bool found;
+        width += advance(tft, code, &index, &found);
+    }
+    return width;
+}
+
+void GlyphCache::clear()
+{
+    memset(s_slots, 0, sizeof(s_slots));
+    memset(s_buckets, NO_SLOT, sizeof(s_buckets));
+    s_tick = 0;
+}
+
+void GlyphCache::getStats(glyph_cache_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+void GlyphCache::resetStats()
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+void GlyphCache::printStats()
+{
+    if (!isReady()) {
+        return;
+    }
+    int used = 0;
+    for (int i = 0; i < s_slotCount; i++) {
+        used += s_slots[i].used;
+    }
+    uint32_t lookups = s_stats.hits + s_stats.misses;
+    Serial.printf("Glyph cache: %d/%d slots, %u hits, %u misses (%.1f%% hit rate), %u evictions, "
+                  "%u uncached, %u fallbacks\n",
+                  used, s_slotCount, s_stats.hits, s_stats.misses, lookups ? 100.0f * s_stats.hits / lookups : 0.0f,
+                  s_stats.evictions, s_stats.uncached, s_stats.fallbacks);
+}
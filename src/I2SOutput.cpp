@@ -7,6 +7,9 @@
 
 #include "SampleSource.h"
 #include "I2SOutput.h"
+#include "MediaArena.h"
+#include "PipelineStats.h"
+#include "Tracer.h"
 
 // number of frames to try and send at once (a frame is a left and right sample)
 #define NUM_FRAMES_TO_SEND 512
@@ -16,7 +19,7 @@ void i2sWriterTask(void *param)
     I2SOutput *output = (I2SOutput *)param;
     int availableBytes = 0;
     int buffer_position = 0;
-    Frame_t *frames = (Frame_t *)malloc(sizeof(Frame_t) * NUM_FRAMES_TO_SEND);
+    Frame_t *frames = (Frame_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_AUDIO, sizeof(Frame_t) * NUM_FRAMES_TO_SEND);
     while (true)
     {
         // wait for some data to be requested
@@ -25,13 +28,16 @@ void i2sWriterTask(void *param)
         {
             if (evt.type == I2S_EVENT_TX_DONE)
             {
+                TRACE_SCOPE(TRACE_AUDIO_BATCH, 0);
                 size_t bytesWritten = 0;
                 do
                 {
                     if (availableBytes == 0)
                     {
                         // get some frames from the wave file - a frame consists of a 16 bit left and right sample
+                        uint32_t started = PIPELINE_NOW();
                         output->m_sample_generator->getFrames(frames, NUM_FRAMES_TO_SEND);
+                        PIPELINE_RECORD(STAGE_AUDIO_FILL, PIPELINE_NOW() - started);
                         // how maby bytes do we now have to send
                         availableBytes = NUM_FRAMES_TO_SEND * sizeof(uint32_t);
                         // reset the buffer position back to the start
@@ -41,6 +47,7 @@ void i2sWriterTask(void *param)
                     if (availableBytes > 0)
                     {
                         // write data to the i2s peripheral
+                        PIPELINE_TIME(STAGE_I2S_WRITE);
                         i2s_write(output->m_i2sPort, buffer_position + (uint8_t *)frames,
                                   availableBytes, &bytesWritten, portMAX_DELAY);
                         availableBytes -= bytesWritten;
@@ -0,0 +1,539 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+
+#include "ImageCache.h"
+#include "FileCatalog.h"
+#include "FramePipeline.h"
+#include "FrameUtils.h"
+#include "ImageDecoder.h"
+#include "Logger.h"
+#include "MediaArena.h"
+#include "SDScheduler.h"
+
+enum EntryState
+{
+    ENTRY_FREE,
+    ENTRY_QUEUED,               // waiting for whoever gets to it first
+    ENTRY_LOADING,
+    ENTRY_READY,
+    ENTRY_FAILED                // budget returned, freed once unpinned
+};
+
+typedef struct
+{
+    VideoFrame_t image;         // first, so a handle is also its entry
+    char path[IMAGE_CACHE_PATH_LENGTH];
+    uint16_t src_width;
+    uint16_t src_height;
+    uint8_t state;
+    // Callers holding the image, and prefetches waiting on it
+    uint16_t pins;
+    uint32_t last_used;
+} image_entry_t;
+
+typedef struct
+{
+    int entry;
+    image_callback_t callback;
+    void *arg;
+} image_load_t;
+
+static image_entry_t s_entries[IMAGE_CACHE_MAX_ENTRIES];
+static uint32_t s_budget = 0;
+static uint32_t s_used = 0;
+static uint32_t s_tick = 0;
+static StaticSemaphore_t s_lockBuffer;
+static SemaphoreHandle_t s_lock = nullptr;
+static QueueHandle_t s_loadQueue = nullptr;
+static TaskHandle_t s_loaderTaskHandle = nullptr;
+static image_cache_stats_t s_stats;
+
+static inline uint32_t imageBytes(int width, int height, uint8_t format)
+{
+    return (uint32_t)width * height * (format == FRAME_FORMAT_RGB332 ? 1 : 2);
+}
+
+static int findEntry(const char *path, int width, int height, uint8_t format)
+{
+    for (int i = 0; i < IMAGE_CACHE_MAX_ENTRIES; i++) {
+        image_entry_t *e = &s_entries[i];
+        if (e->state != ENTRY_FREE && e->state != ENTRY_FAILED && e->image.width == width &&
+            e->image.height == height && e->image.format == format && strcmp(e->path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void evict(int i)
+{
+    image_entry_t *e = &s_entries[i];
+    MediaArena::free(e->image.data);
+    s_used -= e->image.size;
+    e->image.data = nullptr;
+    e->state = ENTRY_FREE;
+    s_stats.evictions++;
+}
+
+// Least recently used image nobody holds, -1 if every one is pinned
+static int evictionCandidate()
+{
+    int victim = -1;
+    for (int i = 0; i < IMAGE_CACHE_MAX_ENTRIES; i++) {
+        image_entry_t *e = &s_entries[i];
+        if (e->state == ENTRY_READY && e->pins == 0 &&
+            (victim < 0 || e->last_used < s_entries[victim].last_used)) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+// Pin the entry for an image, reserving a queued one on a miss. Caller
+// holds s_lock.
+static int claim(const char *path, int width, int height, uint8_t format, int src_width, int src_height)
+{
+    int i = findEntry(path, width, height, format);
+    if (i >= 0) {
+        if (s_entries[i].state == ENTRY_READY) {
+            s_stats.hits++;
+        }
+        s_entries[i].pins++;
+        s_entries[i].last_used = ++s_tick;
+        return i;
+    }
+
+    uint32_t bytes = imageBytes(width, height, format);
+    if (strlen(path) >= IMAGE_CACHE_PATH_LENGTH || bytes == 0 || bytes > s_budget) {
+        s_stats.rejected++;
+        return -1;
+    }
+    int slot = -1;
+    for (int j = 0; j < IMAGE_CACHE_MAX_ENTRIES && slot < 0; j++) {
+        if (s_entries[j].state == ENTRY_FREE) {
+            slot = j;
+        }
+    }
+    while (slot < 0 || s_used + bytes > s_budget) {
+        int victim = evictionCandidate();
+        if (victim < 0) {
+            s_stats.rejected++;
+            return -1;
+        }
+        evict(victim);
+        if (slot < 0) {
+            slot = victim;
+        }
+    }
+
+    image_entry_t *e = &s_entries[slot];
+    strcpy(e->path, path);
+    e->image.width = width;
+    e->image.height = height;
+    e->image.format = format;
+    e->image.size = bytes;
+    e->image.data = nullptr;
+    e->src_width = src_width > 0 ? src_width : width;
+    e->src_height = src_height > 0 ? src_height : height;
+    e->state = ENTRY_QUEUED;
+    e->pins = 1;
+    e->last_used = ++s_tick;
+    s_used += bytes;
+    return slot;
+}
+
+// Room in the budget for a load's scratch buffer, evicting as claim does.
+// False if pinned images leave no room.
+static bool reserveScratch(uint32_t bytes)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    while (s_used + bytes > s_budget) {
+        int victim = evictionCandidate();
+        if (victim < 0) {
+            s_stats.rejected++;
+            xSemaphoreGive(s_lock);
+            return false;
+        }
+        evict(victim);
+    }
+    s_used += bytes;
+    xSemaphoreGive(s_lock);
+    return true;
+}
+
+static void releaseScratch(uint32_t bytes)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_used -= bytes;
+    xSemaphoreGive(s_lock);
+}
+
+static void unpin(int i)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    image_entry_t *e = &s_entries[i];
+    if (e->pins > 0 && --e->pins == 0 && e->state == ENTRY_FAILED) {
+        e->state = ENTRY_FREE;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+// Convert pixels between formats; src and dst may be the same buffer
+static void convertPixels(const uint8_t *src, uint8_t src_format, uint8_t *dst, uint8_t dst_format, uint32_t pixels)
+{
+    if (src_format == dst_format) {
+        if (src != dst) {
+            memcpy(dst, src, imageBytes(pixels, 1, src_format));
+        }
+    } else if (dst_format == FRAME_FORMAT_RGB565) {
+        // Growing, so back to front for in place
+        uint16_t *out = (uint16_t *)dst;
+        for (int32_t i = pixels - 1; i >= 0; i--) {
+            out[i] = PixelConvert<PixelRGB332, PixelRGB565>::convert(src[i]);
+        }
+    } else {
+        const uint16_t *in = (const uint16_t *)src;
+        for (uint32_t i = 0; i < pixels; i++) {
+            dst[i] = PixelConvert<PixelRGB565, PixelRGB332>::convert(in[i]);
+        }
+    }
+}
+
+static bool isEncoded(const char *path)
+{
+    const char *extension = strrchr(path, '.');
+    return extension != nullptr && (strcasecmp(extension, ".qoi") == 0 || strcasecmp(extension, ".bmp") == 0);
+}
+
+// Read, convert and scale an entry's image, outside the lock. The entry
+// is LOADING so nothing else touches it.
+static bool loadEntry(image_entry_t *e)
+{
+    // QOI and BMP files are decoded to RGB565 and carry their own size
+    ImageDecoder decoder;
+    bool encoded = isEncoded(e->path);
+    if (encoded) {
+        if (!decoder.open(e->path)) {
+            return false;
+        }
+        e->src_width = decoder.width();
+        e->src_height = decoder.height();
+    }
+
+    int width = e->image.width;
+    int height = e->image.height;
+    uint8_t format = e->image.format;
+    uint32_t src_pixels = (uint32_t)e->src_width * e->src_height;
+    bool same_size = e->src_width == width && e->src_height == height;
+
+    // Stored size tells RGB332 from RGB565; without the catalog the read
+    // itself says how much there was
+    uint32_t stored = src_pixels * 2;
+#ifdef ARDUINO
+    catalog_file_t file;
+    if (!encoded && FileCatalog::find(e->path, &file)) {
+        if (file.file.size != src_pixels && file.file.size != src_pixels * 2) {
+            LOG_W(LOG_CAT_SD, "Image cache: %s is %u bytes, not a %dx%d image", e->path, file.file.size,
+                  e->src_width, e->src_height);
+            return false;
+        }
+        stored = file.file.size;
+    }
+#endif
+
+    uint8_t *out = (uint8_t *)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_CACHE, e->image.size);
+    if (out == nullptr) {
+        LOG_W(LOG_CAT_DISPLAY, "Image cache: no memory for %s", e->path);
+        return false;
+    }
+    // RGB332 is expanded in place, so a buffer big enough for RGB565 at the
+    // stored size can take either. It counts against the budget while the
+    // load runs, so the peak stays within it.
+    uint8_t *raw = out;
+    uint32_t scratch = 0;
+    if (!same_size || (format == FRAME_FORMAT_RGB332 && stored != e->image.size)) {
+        scratch = src_pixels * 2;
+        if (!reserveScratch(scratch)) {
+            LOG_W(LOG_CAT_DISPLAY, "Image cache: no room in the budget to decode %s", e->path);
+            MediaArena::free(out);
+            return false;
+        }
+        raw = (uint8_t *)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_CACHE, scratch);
+        if (raw == nullptr) {
+            LOG_W(LOG_CAT_DISPLAY, "Image cache: no memory to decode %s", e->path);
+            releaseScratch(scratch);
+            MediaArena::free(out);
+            return false;
+        }
+    }
+
+    bool ok = false;
+    int32_t bytes = encoded ? (decoder.decodeImage((uint16_t *)raw) ? (int32_t)stored : -1)
+                            : SDScheduler::readFile(SD_CLIENT_BACKGROUND, e->path, 0, raw, stored);
+    uint8_t src_format = bytes == (int32_t)src_pixels * 2 ? FRAME_FORMAT_RGB565 : FRAME_FORMAT_RGB332;
+    if (bytes < 0) {
+        LOG_W(LOG_CAT_SD, "Image cache: failed to read %s", e->path);
+    } else if (bytes != (int32_t)src_pixels && bytes != (int32_t)src_pixels * 2) {
+        LOG_W(LOG_CAT_SD, "Image cache: %s is %d bytes, not a %dx%d image", e->path, bytes, e->src_width,
+              e->src_height);
+    } else if (same_size) {
+        convertPixels(raw, src_format, out, format, src_pixels);
+        ok = true;
+    } else {
+        FrameScaler scaler;
+        convertPixels(raw, src_format, raw, format, src_pixels);
+        if (!scaler.configure(e->src_width, e->src_height, width, height, SCALE_BILINEAR)) {
+            LOG_W(LOG_CAT_DISPLAY, "Image cache: no memory to scale %s", e->path);
+        } else if (format == FRAME_FORMAT_RGB565) {
+            ok = scaler.scaleStrip((const uint16_t *)raw, (uint16_t *)out, 0, height);
+        } else {
+            ok = scaler.scaleStrip((const uint8_t *)raw, out, 0, height);
+        }
+    }
+
+    if (raw != out) {
+        MediaArena::free(raw);
+        releaseScratch(scratch);
+    }
+    if (!ok) {
+        MediaArena::free(out);
+        return false;
+    }
+    e->image.data = out;
+    return true;
+}
+
+// Bring a pinned entry to READY, loading it here if nobody has started
+// yet. False if it failed.
+static bool complete(int i)
+{
+    image_entry_t *e = &s_entries[i];
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (e->state == ENTRY_QUEUED) {
+        e->state = ENTRY_LOADING;
+        xSemaphoreGive(s_lock);
+
+        int64_t started = esp_timer_get_time();
+        bool ok = loadEntry(e);
+        int64_t elapsed = esp_timer_get_time() - started;
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        s_stats.misses++;
+        s_stats.load_us += elapsed;
+        if (ok) {
+            e->state = ENTRY_READY;
+        } else {
+            e->state = ENTRY_FAILED;
+            s_used -= e->image.size;
+            s_stats.failures++;
+        }
+    }
+    while (e->state == ENTRY_LOADING) {
+        xSemaphoreGive(s_lock);
+        vTaskDelay(1);
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+    }
+    bool ready = e->state == ENTRY_READY;
+    xSemaphoreGive(s_lock);
+    return ready;
+}
+
+static void finishLoad(const image_load_t *load)
+{
+    bool ready = complete(load->entry);
+    if (load->callback) {
+        load->callback(ready ? &s_entries[load->entry].image : nullptr, load->arg);
+    }
+    unpin(load->entry);
+}
+
+#ifdef ARDUINO
+static void imageLoaderTask(void *param)
+{
+    image_load_t load;
+    while (true) {
+        if (xQueueReceive(s_loadQueue, &load, portMAX_DELAY) == pdTRUE) {
+            finishLoad(&load);
+        }
+    }
+}
+#endif
+
+bool ImageCache::begin(uint32_t budget_bytes, int task_priority, int core)
+{
+    if (s_loaderTaskHandle != nullptr) {
+        return true;
+    }
+    if (s_lock == nullptr) {
+        s_lock = xSemaphoreCreateMutexStatic(&s_lockBuffer);
+    }
+    s_budget = budget_bytes;
+    resetStats();
+    // The host has no tasks, so prefetches load in the caller instead
+#ifdef ARDUINO
+    s_loadQueue = xQueueCreate(IMAGE_CACHE_QUEUE_LENGTH, sizeof(image_load_t));
+    if (s_loadQueue == nullptr) {
+        Serial.println("Image cache: failed to create queue");
+        return false;
+    }
+    if (xTaskCreatePinnedToCore(imageLoaderTask, "Image Loader", IMAGE_CACHE_TASK_STACK, nullptr, task_priority,
+                                &s_loaderTaskHandle, core) != pdPASS) {
+        Serial.println("Image cache: failed to start loader task");
+        vQueueDelete(s_loadQueue);
+        s_loadQueue = nullptr;
+        s_loaderTaskHandle = nullptr;
+        return false;
+    }
+    Serial.printf("Image cache: %u KB budget, loader on core %d\n", budget_bytes / 1024, core);
+#endif
+    return true;
+}
+
+const VideoFrame_t *ImageCache::acquire(const char *path, int width, int height, FrameFormat format, int src_width,
+                                        int src_height)
+{
+    if (s_lock == nullptr) {
+        return nullptr;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int i = claim(path, width, height, format, src_width, src_height);
+    xSemaphoreGive(s_lock);
+    if (i < 0) {
+        return nullptr;
+    }
+    if (!complete(i)) {
+        unpin(i);
+        return nullptr;
+    }
+    return &s_entries[i].image;
+}
+
+const VideoFrame_t *ImageCache::tryAcquire(const char *path, int width, int height, FrameFormat format)
+{
+    if (s_lock == nullptr) {
+        return nullptr;
+    }
+    const VideoFrame_t *image = nullptr;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int i = findEntry(path, width, height, format);
+    if (i >= 0 && s_entries[i].state == ENTRY_READY) {
+        s_entries[i].pins++;
+        s_entries[i].last_used = ++s_tick;
+        s_stats.hits++;
+        image = &s_entries[i].image;
+    }
+    xSemaphoreGive(s_lock);
+    return image;
+}
+
+void ImageCache::release(const VideoFrame_t *image)
+{
+    if (image == nullptr) {
+        return;
+    }
+    int i = (const image_entry_t *)image - s_entries;
+    if (i < 0 || i >= IMAGE_CACHE_MAX_ENTRIES) {
+        return;
+    }
+    unpin(i);
+}
+
+bool ImageCache::prefetch(const char *path, int width, int height, FrameFormat format, image_callback_t callback,
+                          void *arg, int src_width, int src_height)
+{
+    if (s_lock == nullptr) {
+        return false;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int i = claim(path, width, height, format, src_width, src_height);
+    xSemaphoreGive(s_lock);
+    if (i < 0) {
+        return false;
+    }
+    image_load_t load = {i, callback, arg};
+    // Without a loader task (on the host) the load runs here
+    if (s_loadQueue == nullptr) {
+        finishLoad(&load);
+        return true;
+    }
+    if (xQueueSend(s_loadQueue, &load, 0) != pdTRUE) {
+        LOG_W(LOG_CAT_DISPLAY, "Image cache: load queue full, dropping %s", path);
+        unpin(i);
+        return false;
+    }
+    return true;
+}
+
+void ImageCache::draw(TFT_eSPI *tft, const VideoFrame_t *image, int x, int y)
+{
+    if (image == nullptr) {
+        return;
+    }
+    if (image->format == FRAME_FORMAT_RGB332) {
+        tft->pushImage(x, y, image->width, image->height, image->data);
+    } else {
+        // Decoded pixels are native RGB565
+        bool swap = tft->getSwapBytes();
+        tft->setSwapBytes(true);
+        tft->pushImage(x, y, image->width, image->height, (uint16_t *)image->data);
+        tft->setSwapBytes(swap);
+    }
+}
+
+void ImageCache::invalidate(const char *path)
+{
+    if (s_lock == nullptr) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < IMAGE_CACHE_MAX_ENTRIES; i++) {
+        image_entry_t *e = &s_entries[i];
+        if (e->state == ENTRY_READY && e->pins == 0 && (path == nullptr || strcmp(e->path, path) == 0)) {
+            evict(i);
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void ImageCache::clear()
+{
+    invalidate(nullptr);
+}
+
+void ImageCache::getStats(image_cache_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+void ImageCache::resetStats()
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+void ImageCache::printStats()
+{
+    if (s_lock == nullptr) {
+        return;
+    }
+    int images = 0;
+    int pinned = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < IMAGE_CACHE_MAX_ENTRIES; i++) {
+        if (s_entries[i].state == ENTRY_READY) {
+            images++;
+            pinned += s_entries[i].pins > 0;
+        }
+    }
+    image_cache_stats_t stats = s_stats;
+    uint32_t used = s_used;
+    xSemaphoreGive(s_lock);
+
+    uint32_t lookups = stats.hits + stats.misses;
+    Serial.printf("Image cache: %d images (%d pinned), %u/%u KB, %u hits, %u misses (%.1f%% hit rate), "
+                  "%u evictions, %u failures, %u rejected, %.1f ms avg load\n",
+                  images, pinned, used / 1024, s_budget / 1024, stats.hits, stats.misses,
+                  lookups ? 100.0f * stats.hits / lookups : 0.0f, stats.evictions, stats.failures, stats.rejected,
+                  stats.misses ? stats.load_us / 1000.0f / stats.misses : 0.0f);
+}
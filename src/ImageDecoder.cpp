@@ -0,0 +1,529 @@
+#include "ImageDecoder.h"
+#include "FileCatalog.h"
+#include "MediaArena.h"
+#include "SDScheduler.h"
+#include "Logger.h"
+
+#define QOI_HEADER_BYTES 14
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+
+#define BMP_FILE_HEADER_BYTES 14
+#define BMP_RGB 0
+#define BMP_RLE8 1
+#define BMP_RLE4 2
+#define BMP_BITFIELDS 3
+
+static inline uint16_t rgb565(uint8_t r, uint8_t g, uint8_t b)
+{
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+static inline uint32_t le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// QOI pixels are kept packed as r | g << 8 | b << 16 | a << 24
+static inline uint32_t qoiPack(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    return r | (g << 8) | (b << 16) | ((uint32_t)a << 24);
+}
+
+ImageDecoder::ImageDecoder()
+    : m_memory(nullptr), m_chunk(nullptr), m_data(nullptr), m_pos(0), m_len(0), m_offset(0), m_size(0),
+      m_error(false), m_type(IMAGE_TYPE_NONE), m_width(0), m_height(0), m_top_down(true), m_rows_done(0)
+{
+}
+
+ImageDecoder::~ImageDecoder()
+{
+    close();
+}
+
+// Make at least wanted unread bytes available, false at the end of the
+// image or on a read error
+bool ImageDecoder::refill(uint32_t wanted)
+{
+    uint32_t unread = m_len - m_pos;
+    if (m_memory != nullptr || wanted > IMAGE_DECODER_CHUNK) {
+        return unread >= wanted;
+    }
+    memmove(m_chunk, m_chunk + m_pos, unread);
+    m_pos = 0;
+    m_len = unread;
+    while (m_len < wanted && m_offset < m_size) {
+        uint32_t length = min(IMAGE_DECODER_CHUNK - m_len, m_size - m_offset);
+        int32_t bytes = m_stream.isOpen()
+                            ? SDScheduler::readStream(SD_CLIENT_BACKGROUND, &m_stream, m_offset, m_chunk + m_len, length)
+                            : SDScheduler::read(SD_CLIENT_BACKGROUND, &m_file, m_offset, m_chunk + m_len, length);
+        if (bytes <= 0) {
+            m_error = true;
+            return false;
+        }
+        m_len += bytes;
+        m_offset += bytes;
+    }
+    return m_len >= wanted;
+}
+
+inline const uint8_t *ImageDecoder::take(uint32_t length)
+{
+    if (m_len - m_pos < length && !refill(length)) {
+        m_error = true;
+        return nullptr;
+    }
+    const uint8_t *data = m_data + m_pos;
+    m_pos += length;
+    return data;
+}
+
+inline uint8_t ImageDecoder::nextByte()
+{
+    if (m_pos >= m_len && !refill(1)) {
+        m_error = true;
+        return 0;
+    }
+    return m_data[m_pos++];
+}
+
+void ImageDecoder::seek(uint32_t offset)
+{
+    if (m_memory != nullptr) {
+        m_pos = min(offset, m_size);
+    } else {
+        m_offset = offset;
+        m_pos = 0;
+        m_len = 0;
+    }
+}
+
+typedef struct
+{
+    const char *path;
+    File *file;
+    ContiguousFile *stream;
+} image_open_t;
+
+// On the scheduler task, which owns the card: raw sectors when the file is
+// contiguous, FatFs otherwise (always on the host, which mounts no volume).
+// Returns the file size or -1.
+static int32_t openOnCard(void *arg)
+{
+    image_open_t *open = (image_open_t *)arg;
+#ifdef ARDUINO
+    FatVolume *volume = getSDVolume();
+    if (volume != nullptr) {
+        catalog_file_t entry;
+        if (FileCatalog::find(open->path, &entry)) {
+            open->stream->open(volume, &entry.file);
+        } else {
+            open->stream->open(volume, open->path);
+        }
+    }
+#endif
+    if (open->stream->isOpen()) {
+        return (int32_t)open->stream->size();
+    }
+    *open->file = SD.open(open->path, FILE_READ);
+    return *open->file ? (int32_t)open->file->size() : -1;
+}
+
+bool ImageDecoder::open(const char *path)
+{
+    close();
+    image_open_t request = {path, &m_file, &m_stream};
+    int32_t size = SDScheduler::call(SD_CLIENT_BACKGROUND, openOnCard, &request);
+    if (size < 0) {
+        LOG_W(LOG_CAT_SD, "Image decoder: failed to open %s", path);
+        return false;
+    }
+    m_size = size;
+    m_chunk = (uint8_t *)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_UI, IMAGE_DECODER_CHUNK);
+    if (m_chunk == nullptr) {
+        Serial.println("Image decoder: no memory for the read buffer");
+        close();
+        return false;
+    }
+    m_data = m_chunk;
+    if (!readHeader()) {
+        Serial.printf("Image decoder: %s is not a QOI or BMP image it can decode\n", path);
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ImageDecoder::open(const uint8_t *data, uint32_t size)
+{
+    close();
+    m_memory = data;
+    m_data = data;
+    m_size = size;
+    m_len = size;
+    if (!readHeader()) {
+        Serial.println("Image decoder: not a QOI or BMP image it can decode");
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ImageDecoder::close()
+{
+    if (m_file) {
+        m_file.close();
+    }
+    m_stream.close();
+    if (m_chunk != nullptr) {
+        MediaArena::free(m_chunk);
+    }
+    m_memory = nullptr;
+    m_chunk = nullptr;
+    m_data = nullptr;
+    m_pos = 0;
+    m_len = 0;
+    m_offset = 0;
+    m_size = 0;
+    m_error = false;
+    m_type = IMAGE_TYPE_NONE;
+    m_width = 0;
+    m_height = 0;
+    m_rows_done = 0;
+}
+
+bool ImageDecoder::readHeader()
+{
+    const uint8_t *header = take(QOI_HEADER_BYTES);
+    if (header == nullptr) {
+        return false;
+    }
+    if (memcmp(header, "qoif", 4) == 0) {
+        m_width = be32(header + 4);
+        m_height = be32(header + 8);
+        m_top_down = true;
+        memset(m_qoi_index, 0, sizeof(m_qoi_index));
+        m_qoi_pixel = qoiPack(0, 0, 0, 255);
+        m_qoi_run = 0;
+        m_type = IMAGE_TYPE_QOI;
+    } else if (header[0] == 'B' && header[1] == 'M') {
+        if (!readBmpHeader(le32(header + 10))) {
+            return false;
+        }
+        m_type = IMAGE_TYPE_BMP;
+    } else {
+        return false;
+    }
+    if (m_width <= 0 || m_height <= 0 || m_width > IMAGE_DECODER_MAX_SIZE || m_height > IMAGE_DECODER_MAX_SIZE) {
+        m_type = IMAGE_TYPE_NONE;
+        return false;
+    }
+    m_rows_done = 0;
+    return true;
+}
+
+bool ImageDecoder::readBmpHeader(uint32_t pixel_offset)
+{
+    // BITMAPINFOHEADER or a later version, which only add to the end
+    const uint8_t *size_field = take(4);
+    uint32_t info_size = size_field ? le32(size_field) : 0;
+    if (info_size < 40 || info_size > 124) {
+        return false;
+    }
+    const uint8_t *info = take(info_size - 4);
+    if (info == nullptr) {
+        return false;
+    }
+    int32_t height = (int32_t)le32(info + 4);
+    m_width = (int32_t)le32(info);
+    m_height = abs(height);
+    m_top_down = height < 0;
+    m_bpp = le16(info + 10);
+    m_compression = le32(info + 12);
+    uint32_t colors = le32(info + 28);
+
+    bool supported;
+    switch (m_compression) {
+    case BMP_RGB:
+        supported = m_bpp == 1 || m_bpp == 4 || m_bpp == 8 || m_bpp == 16 || m_bpp == 24 || m_bpp == 32;
+        break;
+    case BMP_RLE8:
+        supported = m_bpp == 8 && !m_top_down;
+        break;
+    case BMP_RLE4:
+        supported = m_bpp == 4 && !m_top_down;
+        break;
+    case BMP_BITFIELDS:
+        supported = m_bpp == 16 || m_bpp == 32;
+        break;
+    default:
+        supported = false;
+    }
+    if (!supported) {
+        return false;
+    }
+
+    // 16 bits is 555 unless the masks say 565; 32 bits must be plain BGRX
+    m_rgb565 = false;
+    if (m_compression == BMP_BITFIELDS) {
+        const uint8_t *masks = info_size >= 52 ? info + 36 : take(12);
+        if (masks == nullptr) {
+            return false;
+        }
+        uint32_t red = le32(masks);
+        uint32_t green = le32(masks + 4);
+        uint32_t blue = le32(masks + 8);
+        if (m_bpp == 16) {
+            m_rgb565 = red == 0xF800 && green == 0x07E0 && blue == 0x001F;
+            if (!m_rgb565 && !(red == 0x7C00 && green == 0x03E0 && blue == 0x001F)) {
+                return false;
+            }
+        } else if (red != 0x00FF0000 || green != 0x0000FF00 || blue != 0x000000FF) {
+            return false;
+        }
+    }
+
+    memset(m_palette, 0, sizeof(m_palette));
+    if (m_bpp <= 8) {
+        uint32_t count = colors > 0 && colors <= 256 ? colors : 1u << m_bpp;
+        const uint8_t *palette = take(count * 4);
+        if (palette == nullptr) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            m_palette[i] = rgb565(palette[i * 4 + 2], palette[i * 4 + 1], palette[i * 4]);
+        }
+    }
+
+    m_stride = (((uint32_t)m_width * m_bpp + 31) / 32) * 4;
+    if (m_compression != BMP_RLE8 && m_compression != BMP_RLE4 && m_memory == nullptr &&
+        m_stride > IMAGE_DECODER_CHUNK) {
+        return false;
+    }
+    m_rle_x = 0;
+    m_rle_row = 0;
+    m_rle_end = false;
+    seek(pixel_offset);
+    return true;
+}
+
+int ImageDecoder::decodeStrip(uint16_t *strip, int max_rows, int *first_row)
+{
+    if (m_type == IMAGE_TYPE_NONE || m_error) {
+        return -1;
+    }
+    int rows = min(max_rows, m_height - m_rows_done);
+    if (rows <= 0) {
+        return 0;
+    }
+    *first_row = m_top_down ? m_rows_done : m_height - m_rows_done - rows;
+
+    bool ok;
+    if (m_type == IMAGE_TYPE_QOI) {
+        ok = decodeQoi(strip, rows);
+    } else if (m_compression == BMP_RLE8 || m_compression == BMP_RLE4) {
+        ok = decodeRle(strip, rows);
+    } else {
+        ok = decodeBmpRows(strip, rows);
+    }
+    m_rows_done += rows;
+    return ok && !m_error ? rows : -1;
+}
+
+bool ImageDecoder::decodeImage(uint16_t *pixels)
+{
+    int first_row = m_top_down ? m_rows_done : 0;
+    int rows = m_height - m_rows_done;
+    return decodeStrip(pixels + first_row * m_width, rows, &first_row) == rows;
+}
+
+bool ImageDecoder::decodeQoi(uint16_t *strip, int rows)
+{
+    uint32_t count = (uint32_t)rows * m_width;
+    uint8_t r = m_qoi_pixel;
+    uint8_t g = m_qoi_pixel >> 8;
+    uint8_t b = m_qoi_pixel >> 16;
+    uint8_t a = m_qoi_pixel >> 24;
+    uint16_t color = rgb565(r, g, b);
+
+    uint32_t i = 0;
+    while (i < count) {
+        if (m_qoi_run > 0) {
+            uint32_t run = min((uint32_t)m_qoi_run, count - i);
+            for (uint32_t end = i + run; i < end; i++) {
+                strip[i] = color;
+            }
+            m_qoi_run -= run;
+            continue;
+        }
+
+        uint8_t op = nextByte();
+        if (op == QOI_OP_RGB) {
+            r = nextByte();
+            g = nextByte();
+            b = nextByte();
+        } else if (op == QOI_OP_RGBA) {
+            r = nextByte();
+            g = nextByte();
+            b = nextByte();
+            a = nextByte();
+        } else if ((op & 0xC0) == QOI_OP_INDEX) {
+            uint32_t pixel = m_qoi_index[op];
+            r = pixel;
+            g = pixel >> 8;
+            b = pixel >> 16;
+            a = pixel >> 24;
+        } else if ((op & 0xC0) == QOI_OP_DIFF) {
+            r += ((op >> 4) & 0x03) - 2;
+            g += ((op >> 2) & 0x03) - 2;
+            b += (op & 0x03) - 2;
+        } else if ((op & 0xC0) == QOI_OP_LUMA) {
+            uint8_t second = nextByte();
+            int dg = (op & 0x3F) - 32;
+            r += dg - 8 + ((second >> 4) & 0x0F);
+            g += dg;
+            b += dg - 8 + (second & 0x0F);
+        } else {
+            // The current pixel repeated, which the encoder never indexes
+            m_qoi_run = (op & 0x3F) + 1;
+            continue;
+        }
+        if (m_error) {
+            return false;
+        }
+        m_qoi_index[(r * 3 + g * 5 + b * 7 + a * 11) & 63] = qoiPack(r, g, b, a);
+        color = rgb565(r, g, b);
+        strip[i++] = color;
+    }
+    m_qoi_pixel = qoiPack(r, g, b, a);
+    return true;
+}
+
+bool ImageDecoder::decodeBmpRows(uint16_t *strip, int rows)
+{
+    for (int row = 0; row < rows; row++) {
+        const uint8_t *src = take(m_stride);
+        if (src == nullptr) {
+            return false;
+        }
+        uint16_t *dst = strip + (m_top_down ? row : rows - 1 - row) * m_width;
+        switch (m_bpp) {
+        case 32:
+            for (int x = 0; x < m_width; x++, src += 4) {
+                dst[x] = rgb565(src[2], src[1], src[0]);
+            }
+            break;
+        case 24:
+            for (int x = 0; x < m_width; x++, src += 3) {
+                dst[x] = rgb565(src[2], src[1], src[0]);
+            }
+            break;
+        case 16:
+            for (int x = 0; x < m_width; x++) {
+                uint16_t v = le16(src + x * 2);
+                // 555 widened to 565, the top green bit repeated below
+                dst[x] = m_rgb565 ? v : ((v & 0x7FE0) << 1) | ((v >> 4) & 0x20) | (v & 0x1F);
+            }
+            break;
+        case 8:
+            for (int x = 0; x < m_width; x++) {
+                dst[x] = m_palette[src[x]];
+            }
+            break;
+        case 4:
+            for (int x = 0; x < m_width; x++) {
+                dst[x] = m_palette[(src[x >> 1] >> (x & 1 ? 0 : 4)) & 0x0F];
+            }
+            break;
+        default:
+            for (int x = 0; x < m_width; x++) {
+                dst[x] = m_palette[(src[x >> 3] >> (7 - (x & 7))) & 0x01];
+            }
+        }
+    }
+    return true;
+}
+
+// RLE bitmaps are always bottom-up, so the strip fills from its last row.
+// Pixels skipped by a delta or an early end of line are left black.
+bool ImageDecoder::decodeRle(uint16_t *strip, int rows)
+{
+    memset(strip, 0, (uint32_t)rows * m_width * sizeof(uint16_t));
+    int start = m_rows_done;
+    bool rle8 = m_compression == BMP_RLE8;
+    while (m_rle_row < start + rows && !m_rle_end) {
+        uint8_t count = nextByte();
+        uint8_t value = nextByte();
+        if (m_error) {
+            return false;
+        }
+        uint16_t *dst = strip + (rows - 1 - (m_rle_row - start)) * m_width;
+        if (count > 0) {
+            for (int i = 0; i < count; i++, m_rle_x++) {
+                if (m_rle_x < m_width) {
+                    dst[m_rle_x] = m_palette[rle8 ? value : (i & 1 ? value & 0x0F : value >> 4)];
+                }
+            }
+        } else if (value == 0) {
+            m_rle_row++;
+            m_rle_x = 0;
+        } else if (value == 1) {
+            m_rle_end = true;
+        } else if (value == 2) {
+            m_rle_x += nextByte();
+            m_rle_row += nextByte();
+        } else {
+            // Literal pixels, padded to a 16-bit boundary
+            uint32_t bytes = rle8 ? value : (value + 1) / 2;
+            const uint8_t *src = take((bytes + 1) & ~1u);
+            if (src == nullptr) {
+                return false;
+            }
+            for (int i = 0; i < value; i++, m_rle_x++) {
+                if (m_rle_x < m_width) {
+                    dst[m_rle_x] = m_palette[rle8 ? src[i] : (src[i >> 1] >> (i & 1 ? 0 : 4)) & 0x0F];
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool ImageDecoder::draw(TFT_eSPI *tft, int x, int y)
+{
+    if (!isOpen()) {
+        return false;
+    }
+    int rows = max(1, IMAGE_DECODER_STRIP_PIXELS / m_width);
+    uint16_t *strip = (uint16_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_DISPLAY,
+                                                    (uint32_t)m_width * rows * sizeof(uint16_t));
+    if (strip == nullptr) {
+        Serial.println("Image decoder: no memory for the strip");
+        return false;
+    }
+    // Strips are native RGB565, so have TFT_eSPI swap them on the way out
+    bool swap = tft->getSwapBytes();
+    tft->setSwapBytes(true);
+    int first_row = 0;
+    int decoded;
+    while ((decoded = decodeStrip(strip, rows, &first_row)) > 0) {
+        tft->pushImage(x, y + first_row, m_width, decoded, strip);
+    }
+    tft->setSwapBytes(swap);
+    MediaArena::free(strip);
+    return decoded == 0;
+}
@@ -0,0 +1,202 @@
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "JobSystem.h"
+
+typedef struct
+{
+    job_band_fn_t fn;
+    void *arg;
+    int rows;
+    int band_rows;
+    // Bands still queued for each core: [next, end). Owners take from the
+    // front, thieves from the back.
+    int next[JOB_CORES];
+    int end[JOB_CORES];
+    int remaining;
+} job_t;
+
+static TaskHandle_t s_workers[JOB_CORES];
+static SemaphoreHandle_t s_jobMutex = nullptr;     // one job at a time
+static SemaphoreHandle_t s_doneSem = nullptr;      // given by whoever finishes the last band
+static job_t *s_job = nullptr;
+// Task that called parallelRows() for the current job and runs bands of it
+static volatile TaskHandle_t s_owner = nullptr;
+static portMUX_TYPE s_jobMux = portMUX_INITIALIZER_UNLOCKED;
+static job_stats_t s_stats;
+
+// Claim and run one band of the current job, false when none are left
+static bool runBand(int core)
+{
+    job_t *job;
+    int band = -1;
+
+    portENTER_CRITICAL(&s_jobMux);
+    job = s_job;
+    if (job != nullptr) {
+        int other = core ^ 1;
+        if (job->next[core] < job->end[core]) {
+            band = job->next[core]++;
+        } else if (job->next[other] < job->end[other]) {
+            band = --job->end[other];
+            s_stats.stolen++;
+        }
+        if (band >= 0) {
+            s_stats.bands[core]++;
+        }
+    }
+    portEXIT_CRITICAL(&s_jobMux);
+    if (band < 0) {
+        return false;
+    }
+
+    // The job stays valid until its last band is counted off below
+    int first_row = band * job->band_rows;
+    job->fn(first_row, min(job->band_rows, job->rows - first_row), job->arg);
+
+    portENTER_CRITICAL(&s_jobMux);
+    bool last = --job->remaining == 0;
+    portEXIT_CRITICAL(&s_jobMux);
+    if (last) {
+        xSemaphoreGive(s_doneSem);
+    }
+    return true;
+}
+
+void jobWorkerTask(void *param)
+{
+    int core = (int)(intptr_t)param;
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (runBand(core)) {
+        }
+    }
+}
+
+// Undo a begin() that did not finish, so parallelRows() runs jobs inline
+// instead of waking a worker that does not exist
+static void teardown()
+{
+    for (int core = 0; core < JOB_CORES; core++) {
+        if (s_workers[core] != nullptr) {
+            vTaskDelete(s_workers[core]);
+            s_workers[core] = nullptr;
+        }
+    }
+    if (s_doneSem != nullptr) {
+        vSemaphoreDelete(s_doneSem);
+        s_doneSem = nullptr;
+    }
+    if (s_jobMutex != nullptr) {
+        vSemaphoreDelete(s_jobMutex);
+        s_jobMutex = nullptr;
+    }
+}
+
+bool JobSystem::begin(int priority)
+{
+    if (s_jobMutex != nullptr) {
+        return true;
+    }
+    s_jobMutex = xSemaphoreCreateMutex();
+    s_doneSem = xSemaphoreCreateBinary();
+    if (s_jobMutex == nullptr || s_doneSem == nullptr) {
+        Serial.println("Job system: failed to create semaphores");
+        teardown();
+        return false;
+    }
+    resetStats();
+    for (int core = 0; core < JOB_CORES; core++) {
+        if (xTaskCreatePinnedToCore(jobWorkerTask, core ? "Job Worker 1" : "Job Worker 0", 4096,
+                                    (void *)(intptr_t)core, priority, &s_workers[core], core) != pdPASS) {
+            Serial.printf("Job system: failed to start worker on core %d, running jobs inline\n", core);
+            s_workers[core] = nullptr;
+            teardown();
+            return false;
+        }
+    }
+    Serial.printf("Job system started, workers at priority %d\n", priority);
+    return true;
+}
+
+void JobSystem::parallelRows(int rows, job_band_fn_t fn, void *arg, int band_rows)
+{
+    if (rows <= 0) {
+        return;
+    }
+    if (band_rows < 1) {
+        band_rows = 1;
+    }
+
+    // A band that starts a job of its own runs it inline: the workers are
+    // busy with the outer job and its caller already holds s_jobMutex
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    bool nested = self == s_workers[0] || self == s_workers[1] || self == s_owner;
+    if (s_jobMutex == nullptr || rows <= band_rows || nested) {
+        portENTER_CRITICAL(&s_jobMux);
+        s_stats.inline_jobs++;
+        portEXIT_CRITICAL(&s_jobMux);
+        fn(0, rows, arg);
+        return;
+    }
+
+    xSemaphoreTake(s_jobMutex, portMAX_DELAY);
+    s_owner = self;
+
+    int bands = (rows + band_rows - 1) / band_rows;
+    job_t job;
+    job.fn = fn;
+    job.arg = arg;
+    job.rows = rows;
+    job.band_rows = band_rows;
+    job.next[0] = 0;
+    job.end[0] = bands / 2;
+    job.next[1] = bands / 2;
+    job.end[1] = bands;
+    job.remaining = bands;
+
+    portENTER_CRITICAL(&s_jobMux);
+    s_job = &job;
+    s_stats.jobs++;
+    portEXIT_CRITICAL(&s_jobMux);
+
+    // The caller covers its own core's share, so only the other worker is
+    // woken; if the caller gets preempted that worker steals from it
+    int core = xPortGetCoreID();
+    xTaskNotifyGive(s_workers[core ^ 1]);
+    while (runBand(core)) {
+    }
+    xSemaphoreTake(s_doneSem, portMAX_DELAY);
+
+    portENTER_CRITICAL(&s_jobMux);
+    s_job = nullptr;
+    portEXIT_CRITICAL(&s_jobMux);
+
+    s_owner = nullptr;
+    xSemaphoreGive(s_jobMutex);
+}
+
+void JobSystem::getStats(job_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_jobMux);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_jobMux);
+}
+
+void JobSystem::resetStats()
+{
+    portENTER_CRITICAL(&s_jobMux);
+    memset(&s_stats, 0, sizeof(s_stats));
+    portEXIT_CRITICAL(&s_jobMux);
+}
+
+void JobSystem::printStats()
+{
+    job_stats_t stats;
+    getStats(&stats);
+    Serial.printf("Job system: %u jobs (%u inline), bands core0 %u core1 %u, stolen %u\n",
+                  stats.jobs, stats.inline_jobs, stats.bands[0], stats.bands[1], stats.stolen);
+}
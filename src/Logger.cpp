@@ -0,0 +1,200 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "Logger.h"
+
+static_assert((LOG_RING_SLOTS & (LOG_RING_SLOTS - 1)) == 0, "LOG_RING_SLOTS must be a power of two");
+
+typedef struct
+{
+    volatile uint32_t ready;    // set once the producer has filled the record
+    int64_t timestamp_us;
+    uint8_t level;
+    uint8_t category;
+    uint8_t binary;
+    uint8_t count;
+    const char *format;         // binary records only
+    union
+    {
+        char text[LOG_TEXT_BYTES];
+        uint32_t args[LOG_MAX_ARGS];
+    };
+} log_record_t;
+
+static log_record_t s_ring[LOG_RING_SLOTS];
+// Free-running indices; producers reserve at head, the drain consumes at tail
+static uint32_t s_head = 0;
+static uint32_t s_tail = 0;
+static uint32_t s_dropped = 0;
+// Held by whoever is draining, the drain task or flush()
+static bool s_draining = false;
+static TaskHandle_t s_drainTaskHandle = nullptr;
+
+static const char LEVEL_CHARS[] = "-EWIDV";
+static const char *CATEGORY_NAMES[] = {"system", "video", "audio", "sd", "display"};
+
+static const char *categoryName(uint8_t category)
+{
+    int index = category ? __builtin_ctz(category) : 0;
+    return index < (int)(sizeof(CATEGORY_NAMES) / sizeof(CATEGORY_NAMES[0])) ? CATEGORY_NAMES[index] : "?";
+}
+
+static void printLine(int64_t timestamp_us, uint8_t level, uint8_t category, const char *text)
+{
+    uint32_t ms = (uint32_t)(timestamp_us / 1000);
+    Serial.printf("[%6u.%03u] %c %-7s %s\n", ms / 1000, ms % 1000, LEVEL_CHARS[level > 5 ? 0 : level],
+                  categoryName(category), text);
+}
+
+static void formatBinary(const char *format, const uint32_t *args, char *text, size_t capacity)
+{
+    snprintf(text, capacity, format, args[0], args[1], args[2], args[3]);
+}
+
+// Claim the next record, or nullptr when the ring is full. A plain
+// compare-and-swap on the head index, so no task ever waits on another.
+static log_record_t *reserve()
+{
+    uint32_t head = __atomic_load_n(&s_head, __ATOMIC_RELAXED);
+    do {
+        if (head - __atomic_load_n(&s_tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS) {
+            __atomic_fetch_add(&s_dropped, 1, __ATOMIC_RELAXED);
+            return nullptr;
+        }
+    } while (!__atomic_compare_exchange_n(&s_head, &head, head + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return &s_ring[head & (LOG_RING_SLOTS - 1)];
+}
+
+static void publish(log_record_t *record)
+{
+    __atomic_store_n(&record->ready, 1, __ATOMIC_RELEASE);
+}
+
+// Print the oldest record, false when there is none ready yet
+static bool drainOne()
+{
+    uint32_t tail = s_tail;
+    if (tail == __atomic_load_n(&s_head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    log_record_t *record = &s_ring[tail & (LOG_RING_SLOTS - 1)];
+    if (!__atomic_load_n(&record->ready, __ATOMIC_ACQUIRE)) {
+        // Reserved but still being written
+        return false;
+    }
+
+    if (record->binary) {
+        char text[LOG_TEXT_BYTES];
+        formatBinary(record->format, record->args, text, sizeof(text));
+        printLine(record->timestamp_us, record->level, record->category, text);
+    } else {
+        printLine(record->timestamp_us, record->level, record->category, record->text);
+    }
+
+    record->ready = 0;
+    __atomic_store_n(&s_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void drainAll()
+{
+    while (__atomic_test_and_set(&s_draining, __ATOMIC_ACQUIRE)) {
+        vTaskDelay(1);
+    }
+    while (drainOne()) {
+    }
+    __atomic_clear(&s_draining, __ATOMIC_RELEASE);
+}
+
+void logDrainTask(void *param)
+{
+    uint32_t reported_drops = 0;
+    while (true)
+    {
+        drainAll();
+        uint32_t dropped = __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+        if (dropped != reported_drops) {
+            Serial.printf("[log] %u messages dropped, ring full\n", dropped - reported_drops);
+            reported_drops = dropped;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+bool Logger::begin(int task_priority, int core)
+{
+    if (s_drainTaskHandle != nullptr) {
+        return true;
+    }
+    if (xTaskCreatePinnedToCore(logDrainTask, "Log Drain", 3072, nullptr, task_priority,
+                                &s_drainTaskHandle, core) != pdPASS) {
+        Serial.println("Logger: failed to start drain task, logging synchronously");
+        s_drainTaskHandle = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void Logger::write(uint8_t level, uint8_t category, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (s_drainTaskHandle == nullptr) {
+        char text[LOG_TEXT_BYTES];
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        printLine(esp_timer_get_time(), level, category, text);
+        return;
+    }
+
+    log_record_t *record = reserve();
+    if (record != nullptr) {
+        record->timestamp_us = esp_timer_get_time();
+        record->level = level;
+        record->category = category;
+        record->binary = 0;
+        vsnprintf(record->text, LOG_TEXT_BYTES, format, args);
+        publish(record);
+    }
+    va_end(args);
+}
+
+void Logger::writeBinary(uint8_t level, uint8_t category, const char *format, const uint32_t *args, int count)
+{
+    if (s_drainTaskHandle == nullptr) {
+        uint32_t padded[LOG_MAX_ARGS] = {0};
+        memcpy(padded, args, count * sizeof(uint32_t));
+        char text[LOG_TEXT_BYTES];
+        formatBinary(format, padded, text, sizeof(text));
+        printLine(esp_timer_get_time(), level, category, text);
+        return;
+    }
+
+    log_record_t *record = reserve();
+    if (record == nullptr) {
+        return;
+    }
+    record->timestamp_us = esp_timer_get_time();
+    record->level = level;
+    record->category = category;
+    record->binary = 1;
+    record->count = count;
+    record->format = format;
+    for (int i = 0; i < LOG_MAX_ARGS; i++) {
+        record->args[i] = i < count ? args[i] : 0;
+    }
+    publish(record);
+}
+
+void Logger::flush()
+{
+    drainAll();
+}
+
+uint32_t Logger::dropped()
+{
+    return __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+}
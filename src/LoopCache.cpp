@@ -0,0 +1,218 @@
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+
+#include "LoopCache.h"
+#include "MediaArena.h"
+
+LoopCache::LoopCache()
+{
+    m_frames = nullptr;
+    m_scratch = nullptr;
+    m_frame_count = 0;
+    m_frames_stored = 0;
+    m_frame_bytes = 0;
+    m_budget = 0;
+    m_bytes_used = 0;
+    m_overflowed = false;
+    m_mutex = nullptr;
+}
+
+LoopCache::~LoopCache()
+{
+    clear();
+    if (m_mutex) vSemaphoreDelete(m_mutex);
+}
+
+bool LoopCache::begin(int frame_count, uint32_t frame_bytes, uint32_t budget_bytes)
+{
+    clear();
+    if (frame_count <= 0 || frame_bytes == 0 || budget_bytes == 0) {
+        return false;
+    }
+    if (m_mutex == nullptr) {
+        m_mutex = xSemaphoreCreateMutex();
+        if (m_mutex == nullptr) return false;
+    }
+
+    m_frames = (cached_frame_t *)calloc(frame_count, sizeof(cached_frame_t));
+    m_scratch = (uint8_t *)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_CACHE, frame_bytes);
+    if (m_frames == nullptr || m_scratch == nullptr) {
+        free(m_frames);
+        MediaArena::free(m_scratch);
+        m_frames = nullptr;
+        m_scratch = nullptr;
+        return false;
+    }
+    m_frame_count = frame_count;
+    m_frame_bytes = frame_bytes;
+    m_budget = budget_bytes;
+    Serial.printf("Loop cache: %d frames of %d bytes, budget %d bytes\n", frame_count, frame_bytes, budget_bytes);
+    return true;
+}
+
+void LoopCache::releaseFrames()
+{
+    for (int i = 0; i < m_frame_count; i++) {
+        MediaArena::free(m_frames[i].data);
+        m_frames[i].data = nullptr;
+    }
+    m_frames_stored = 0;
+    m_bytes_used = 0;
+    releaseScratch();
+}
+
+void LoopCache::releaseScratch()
+{
+    MediaArena::free(m_scratch);
+    m_scratch = nullptr;
+}
+
+uint32_t LoopCache::availableBytes()
+{
+    // A quarter of the arena's bulk region is left for image and glyph
+    // caches, and PSRAM outside it is shared half and half with the heap
+    media_pool_stats_t pool;
+    MediaArena::getPoolStats(MEDIA_POOL_BULK, &pool);
+    uint32_t bytes = pool.free_bytes / 4 * 3;
+    if (psramFound()) {
+        bytes += heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 2;
+    }
+    media_usage_t usage;
+    MediaArena::getUsage(MEDIA_SUB_CACHE, &usage);
+    if (usage.budget) {
+        uint32_t left = usage.budget > usage.bytes_in_use ? usage.budget - usage.bytes_in_use : 0;
+        bytes = min(bytes, left);
+    }
+    return bytes;
+}
+
+void LoopCache::clear()
+{
+    if (m_frames != nullptr) {
+        releaseFrames();
+        free(m_frames);
+        m_frames = nullptr;
+    }
+    m_frame_count = 0;
+    m_overflowed = false;
+}
+
+bool LoopCache::store(int frame_index, const uint8_t *data, uint32_t length)
+{
+    if (!isEnabled() || frame_index < 1 || frame_index > m_frame_count || length != m_frame_bytes) {
+        return false;
+    }
+    cached_frame_t *frame = &m_frames[frame_index - 1];
+    if (frame->data != nullptr) {
+        return true;
+    }
+
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    if (frame->data != nullptr || m_overflowed || m_scratch == nullptr) {
+        xSemaphoreGive(m_mutex);
+        return frame->data != nullptr;
+    }
+    // Compress into the scratch frame first; keep whichever form is smaller
+    uint32_t packed = packBits(data, length, m_scratch, length);
+    bool compressed = packed > 0 && packed < length;
+    uint32_t stored_length = compressed ? packed : length;
+
+    if (m_bytes_used + stored_length > m_budget) {
+        Serial.printf("Loop cache: clip does not fit in %d bytes, playing from SD\n", m_budget);
+        m_overflowed = true;
+        releaseFrames();
+        xSemaphoreGive(m_mutex);
+        return false;
+    }
+    uint8_t *copy = (uint8_t *)MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_CACHE, stored_length);
+    if (copy == nullptr) {
+        m_overflowed = true;
+        releaseFrames();
+        xSemaphoreGive(m_mutex);
+        Serial.println("Loop cache: out of memory, playing from SD");
+        return false;
+    }
+    memcpy(copy, compressed ? m_scratch : data, stored_length);
+    frame->data = copy;
+    frame->length = stored_length;
+    frame->compressed = compressed;
+    m_bytes_used += stored_length;
+    m_frames_stored++;
+    if (isComplete()) {
+        releaseScratch();
+        Serial.printf("Loop cache: clip cached in %d bytes (%d%% of raw)\n", m_bytes_used,
+                      (int)((uint64_t)m_bytes_used * 100 / ((uint64_t)m_frame_bytes * m_frame_count)));
+    }
+    xSemaphoreGive(m_mutex);
+    return true;
+}
+
+bool LoopCache::load(int frame_index, uint8_t *out, uint32_t length)
+{
+    if (!isEnabled() || !isComplete() || frame_index < 1 || frame_index > m_frame_count || length < m_frame_bytes) {
+        return false;
+    }
+    // Once complete the table is never modified, so no lock is needed here
+    cached_frame_t *frame = &m_frames[frame_index - 1];
+    if (frame->compressed) {
+        return unpackBits(frame->data, frame->length, out, m_frame_bytes);
+    }
+    memcpy(out, frame->data, frame->length);
+    return true;
+}
+
+uint32_t LoopCache::packBits(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t capacity)
+{
+    uint32_t in = 0;
+    uint32_t out = 0;
+    while (in < length) {
+        // Measure the run starting here
+        uint32_t run = 1;
+        while (in + run < length && run < 128 && src[in + run] == src[in]) {
+            run++;
+        }
+        if (run >= 2) {
+            if (out + 2 > capacity) return 0;
+            dst[out++] = (uint8_t)(1 - (int)run);
+            dst[out++] = src[in];
+            in += run;
+            continue;
+        }
+        // Literal block up to the next run of two or more
+        uint32_t literal = 1;
+        while (in + literal < length && literal < 128 &&
+               !(in + literal + 1 < length && src[in + literal] == src[in + literal + 1])) {
+            literal++;
+        }
+        if (out + 1 + literal > capacity) return 0;
+        dst[out++] = (uint8_t)(literal - 1);
+        memcpy(dst + out, src + in, literal);
+        out += literal;
+        in += literal;
+    }
+    return out;
+}
+
+bool LoopCache::unpackBits(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t capacity)
+{
+    uint32_t in = 0;
+    uint32_t out = 0;
+    while (in < length) {
+        int8_t header = (int8_t)src[in++];
+        if (header >= 0) {
+            uint32_t count = header + 1;
+            if (in + count > length || out + count > capacity) return false;
+            memcpy(dst + out, src + in, count);
+            in += count;
+            out += count;
+        } else if (header != -128) {
+            uint32_t count = 1 - header;
+            if (in >= length || out + count > capacity) return false;
+            memset(dst + out, src[in++], count);
+            out += count;
+        }
+    }
+    return out == capacity;
+}
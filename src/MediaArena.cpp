@@ -0,0 +1,287 @@
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+
+#include "MediaArena.h"
+
+#define ARENA_MAGIC 0x4D41u
+#define ARENA_ALIGN 16
+
+// Flags kept in each block header
+#define BLOCK_USED 0x01
+#define BLOCK_HEAP 0x02  // came from the system heap, not the region
+
+// Header in front of every block. Sizes include the header, and prev_size
+// lets free() merge with the block before it without walking the region.
+typedef struct
+{
+    uint32_t size;
+    uint32_t prev_size;
+    uint16_t magic;
+    uint8_t flags;
+    uint8_t pool;
+    uint8_t subsystem;
+    uint8_t reserved[3];
+} arena_block_t;
+
+typedef struct
+{
+    uint8_t *base;
+    uint32_t size;
+    uint32_t heap_caps;
+    uint32_t heap_fallbacks;
+} arena_pool_t;
+
+static arena_pool_t s_pools[MEDIA_POOL_COUNT];
+static media_usage_t s_usage[MEDIA_SUB_COUNT];
+static SemaphoreHandle_t s_arenaMutex = nullptr;
+
+static const char *POOL_NAMES[MEDIA_POOL_COUNT] = {"dma", "bulk"};
+static const char *SUBSYSTEM_NAMES[MEDIA_SUB_COUNT] = {"video", "audio", "display", "cache", "ui"};
+
+static void lockArena()
+{
+    if (s_arenaMutex) xSemaphoreTake(s_arenaMutex, portMAX_DELAY);
+}
+
+static void unlockArena()
+{
+    if (s_arenaMutex) xSemaphoreGive(s_arenaMutex);
+}
+
+static inline arena_block_t *nextBlock(arena_pool_t *pool, arena_block_t *block)
+{
+    uint8_t *next = (uint8_t *)block + block->size;
+    return next < pool->base + pool->size ? (arena_block_t *)next : nullptr;
+}
+
+static inline arena_block_t *prevBlock(arena_pool_t *pool, arena_block_t *block)
+{
+    if ((uint8_t *)block == pool->base) return nullptr;
+    return (arena_block_t *)((uint8_t *)block - block->prev_size);
+}
+
+static void initRegion(arena_pool_t *pool, uint32_t bytes, uint32_t caps)
+{
+    pool->size = bytes & ~(ARENA_ALIGN - 1);
+    pool->heap_caps = caps;
+    pool->heap_fallbacks = 0;
+    pool->base = pool->size ? (uint8_t *)heap_caps_malloc(pool->size, caps) : nullptr;
+    if (!pool->base) {
+        pool->size = 0;
+        return;
+    }
+    arena_block_t *block = (arena_block_t *)pool->base;
+    block->size = pool->size;
+    block->prev_size = 0;
+    block->magic = ARENA_MAGIC;
+    block->flags = 0;
+}
+
+bool MediaArena::begin(uint32_t dma_bytes, uint32_t bulk_bytes)
+{
+    if (s_arenaMutex == nullptr) {
+        s_arenaMutex = xSemaphoreCreateMutex();
+    }
+
+    // Internal RAM regions only take what is free above the reserve, so a
+    // board without PSRAM keeps room for WiFi, the SD driver and stacks
+    uint32_t free_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    uint32_t spare = free_internal > MEDIA_ARENA_HEAP_RESERVE ? free_internal - MEDIA_ARENA_HEAP_RESERVE : 0;
+
+    initRegion(&s_pools[MEDIA_POOL_DMA], min(dma_bytes, spare), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    spare -= s_pools[MEDIA_POOL_DMA].size;
+
+    // Bulk buffers go to PSRAM when the board has it, where there is room
+    // for a much larger region
+    if (psramFound()) {
+        uint32_t psram_bytes = bulk_bytes > MEDIA_ARENA_PSRAM_BYTES ? bulk_bytes : MEDIA_ARENA_PSRAM_BYTES;
+        psram_bytes = min(psram_bytes, (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+        initRegion(&s_pools[MEDIA_POOL_BULK], psram_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    } else {
+        initRegion(&s_pools[MEDIA_POOL_BULK], min(bulk_bytes, spare), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+
+    Serial.printf("Media arena: dma %d bytes, bulk %d bytes (%s), %d internal bytes were free\n",
+                  s_pools[MEDIA_POOL_DMA].size, s_pools[MEDIA_POOL_BULK].size,
+                  psramFound() ? "PSRAM" : "internal", free_internal);
+    return s_pools[MEDIA_POOL_DMA].base != nullptr && s_pools[MEDIA_POOL_BULK].base != nullptr;
+}
+
+void MediaArena::setBudget(MediaSubsystem subsystem, uint32_t bytes)
+{
+    lockArena();
+    s_usage[subsystem].budget = bytes;
+    unlockArena();
+}
+
+static arena_block_t *allocFromRegion(arena_pool_t *pool, uint32_t needed)
+{
+    for (arena_block_t *block = (arena_block_t *)pool->base; block != nullptr; block = nextBlock(pool, block)) {
+        if ((block->flags & BLOCK_USED) || block->size < needed) {
+            continue;
+        }
+        // Split when the remainder is big enough to hold a useful block
+        if (block->size - needed >= sizeof(arena_block_t) + ARENA_ALIGN) {
+            arena_block_t *rest = (arena_block_t *)((uint8_t *)block + needed);
+            rest->size = block->size - needed;
+            rest->prev_size = needed;
+            rest->magic = ARENA_MAGIC;
+            rest->flags = 0;
+            arena_block_t *after = nextBlock(pool, rest);
+            if (after) after->prev_size = rest->size;
+            block->size = needed;
+        }
+        block->flags = BLOCK_USED;
+        return block;
+    }
+    return nullptr;
+}
+
+void *MediaArena::alloc(MediaPool pool_id, MediaSubsystem subsystem, size_t size)
+{
+    if (size == 0 || pool_id >= MEDIA_POOL_COUNT || subsystem >= MEDIA_SUB_COUNT) {
+        return nullptr;
+    }
+    uint32_t needed = (sizeof(arena_block_t) + size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    arena_pool_t *pool = &s_pools[pool_id];
+    media_usage_t *usage = &s_usage[subsystem];
+
+    lockArena();
+    if (usage->budget && usage->bytes_in_use + needed > usage->budget) {
+        usage->failures++;
+        unlockArena();
+        Serial.printf("Media arena: %s over budget (%d + %d > %d)\n", SUBSYSTEM_NAMES[subsystem],
+                      usage->bytes_in_use, needed, usage->budget);
+        return nullptr;
+    }
+
+    arena_block_t *block = pool->base ? allocFromRegion(pool, needed) : nullptr;
+    if (block == nullptr) {
+        // Region full (or never reserved): take the same kind of memory from the heap
+        uint32_t caps = pool->heap_caps ? pool->heap_caps : MALLOC_CAP_8BIT;
+        block = (arena_block_t *)heap_caps_malloc(needed, caps);
+        if (block == nullptr) {
+            usage->failures++;
+            unlockArena();
+            return nullptr;
+        }
+        block->size = needed;
+        block->prev_size = 0;
+        block->flags = BLOCK_USED | BLOCK_HEAP;
+        pool->heap_fallbacks++;
+    }
+    block->magic = ARENA_MAGIC;
+    block->pool = pool_id;
+    block->subsystem = subsystem;
+
+    usage->bytes_in_use += block->size;
+    usage->allocations++;
+    if (usage->bytes_in_use > usage->high_water) {
+        usage->high_water = usage->bytes_in_use;
+    }
+    unlockArena();
+
+    return (uint8_t *)block + sizeof(arena_block_t);
+}
+
+void MediaArena::free(void *ptr)
+{
+    if (ptr == nullptr) return;
+    arena_block_t *block = (arena_block_t *)((uint8_t *)ptr - sizeof(arena_block_t));
+
+    // The header is only stable under the lock: a neighbouring alloc or free
+    // can be splitting or merging this block
+    lockArena();
+    if (block->magic != ARENA_MAGIC || !(block->flags & BLOCK_USED)) {
+        unlockArena();
+        Serial.println("Media arena: free of a pointer it does not own");
+        return;
+    }
+    s_usage[block->subsystem].bytes_in_use -= block->size;
+
+    if (block->flags & BLOCK_HEAP) {
+        block->magic = 0;
+        unlockArena();
+        heap_caps_free(block);
+        return;
+    }
+
+    arena_pool_t *pool = &s_pools[block->pool];
+    block->flags = 0;
+
+    // Coalesce with free neighbours so the region does not splinter
+    arena_block_t *next = nextBlock(pool, block);
+    if (next && !(next->flags & BLOCK_USED)) {
+        block->size += next->size;
+        next->magic = 0;
+    }
+    arena_block_t *prev = prevBlock(pool, block);
+    if (prev && !(prev->flags & BLOCK_USED)) {
+        prev->size += block->size;
+        block->magic = 0;
+        block = prev;
+    }
+    next = nextBlock(pool, block);
+    if (next) next->prev_size = block->size;
+    unlockArena();
+}
+
+void MediaArena::getUsage(MediaSubsystem subsystem, media_usage_t *usage)
+{
+    lockArena();
+    *usage = s_usage[subsystem];
+    unlockArena();
+}
+
+void MediaArena::getPoolStats(MediaPool pool_id, media_pool_stats_t *stats)
+{
+    arena_pool_t *pool = &s_pools[pool_id];
+    memset(stats, 0, sizeof(media_pool_stats_t));
+
+    lockArena();
+    stats->region_bytes = pool->size;
+    stats->heap_fallbacks = pool->heap_fallbacks;
+    if (pool->base) {
+        for (arena_block_t *block = (arena_block_t *)pool->base; block != nullptr; block = nextBlock(pool, block)) {
+            if (block->flags & BLOCK_USED) continue;
+            stats->free_bytes += block->size;
+            stats->free_blocks++;
+            if (block->size > stats->largest_free) {
+                stats->largest_free = block->size;
+            }
+        }
+    }
+    unlockArena();
+}
+
+float MediaArena::fragmentation(MediaPool pool)
+{
+    media_pool_stats_t stats;
+    getPoolStats(pool, &stats);
+    if (stats.free_bytes == 0) return 0.0f;
+    return 1.0f - (float)stats.largest_free / stats.free_bytes;
+}
+
+void MediaArena::printStats()
+{
+    for (int p = 0; p < MEDIA_POOL_COUNT; p++) {
+        media_pool_stats_t stats;
+        getPoolStats((MediaPool)p, &stats);
+        Serial.printf("Arena %s: %d/%d free, largest %d, %d free blocks, frag %d%%, heap fallbacks %d\n",
+                      POOL_NAMES[p], stats.free_bytes, stats.region_bytes, stats.largest_free,
+                      stats.free_blocks, (int)(fragmentation((MediaPool)p) * 100), stats.heap_fallbacks);
+    }
+    for (int s = 0; s < MEDIA_SUB_COUNT; s++) {
+        media_usage_t usage;
+        getUsage((MediaSubsystem)s, &usage);
+        if (usage.allocations == 0 && usage.failures == 0) continue;
+        Serial.printf("  %-8s in use %d, high water %d, budget %d, allocs %d, failures %d\n",
+                      SUBSYSTEM_NAMES[s], usage.bytes_in_use, usage.high_water, usage.budget,
+                      usage.allocations, usage.failures);
+    }
+    Serial.printf("  heap: free %zu, largest block %zu (internal)\n",
+                  heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                  heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+}
@@ -0,0 +1,104 @@
+#include "PipelineStats.h"
+
+static stage_histogram_t s_stages[STAGE_COUNT];
+static uint32_t s_counters[COUNTER_COUNT];
+
+static const char *STAGE_NAMES[STAGE_COUNT] = {
+    "sd_open", "sd_read", "decode", "convert", "spi_push", "wait", "i2s_write", "get_frames"
+};
+static const char *COUNTER_NAMES[COUNTER_COUNT] = {"drops", "display_underruns", "audio_underruns"};
+
+void PipelineStats::record(PipelineStage stage, uint32_t us)
+{
+    stage_histogram_t *histogram = &s_stages[stage];
+    int bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= PIPELINE_BUCKETS) {
+        bucket = PIPELINE_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->total_us, (uint64_t)us, __ATOMIC_RELAXED);
+    uint32_t max = __atomic_load_n(&histogram->max_us, __ATOMIC_RELAXED);
+    while (us > max &&
+           !__atomic_compare_exchange_n(&histogram->max_us, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void PipelineStats::count(PipelineCounter counter)
+{
+    __atomic_fetch_add(&s_counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+void PipelineStats::getHistogram(PipelineStage stage, stage_histogram_t *histogram)
+{
+    // Fields are copied one by one, so a snapshot taken while samples land
+    // can be off by those samples
+    stage_histogram_t *source = &s_stages[stage];
+    histogram->count = __atomic_load_n(&source->count, __ATOMIC_RELAXED);
+    histogram->max_us = __atomic_load_n(&source->max_us, __ATOMIC_RELAXED);
+    histogram->total_us = __atomic_load_n(&source->total_us, __ATOMIC_RELAXED);
+    for (int i = 0; i < PIPELINE_BUCKETS; i++) {
+        histogram->buckets[i] = __atomic_load_n(&source->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+uint32_t PipelineStats::percentile(const stage_histogram_t *histogram, int percent)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < PIPELINE_BUCKETS; i++) {
+        total += histogram->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)(((uint64_t)total * percent + 99) / 100);
+    uint32_t seen = 0;
+    for (int i = 0; i < PIPELINE_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            // Never report more than was actually seen
+            uint32_t upper = i == 0 ? 0 : (i >= 32 ? UINT32_MAX : (uint32_t)((1ULL << i) - 1));
+            return min(upper, histogram->max_us);
+        }
+    }
+    return histogram->max_us;
+}
+
+uint32_t PipelineStats::counter(PipelineCounter counter)
+{
+    return __atomic_load_n(&s_counters[counter], __ATOMIC_RELAXED);
+}
+
+void PipelineStats::reset()
+{
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        stage_histogram_t *histogram = &s_stages[stage];
+        __atomic_store_n(&histogram->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&histogram->max_us, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&histogram->total_us, 0, __ATOMIC_RELAXED);
+        for (int i = 0; i < PIPELINE_BUCKETS; i++) {
+            __atomic_store_n(&histogram->buckets[i], 0, __ATOMIC_RELAXED);
+        }
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        __atomic_store_n(&s_counters[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+void PipelineStats::print()
+{
+    Serial.println("stage        count    avg_us    p50_us    p99_us    max_us");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        stage_histogram_t histogram;
+        getHistogram((PipelineStage)stage, &histogram);
+        if (histogram.count == 0) {
+            continue;
+        }
+        Serial.printf("%-10s %7u %9u %9u %9u %9u\n", STAGE_NAMES[stage], histogram.count,
+                      (uint32_t)(histogram.total_us / histogram.count),
+                      percentile(&histogram, 50), percentile(&histogram, 99), histogram.max_us);
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        Serial.printf("%s=%u%s", COUNTER_NAMES[i], counter((PipelineCounter)i), i + 1 < COUNTER_COUNT ? " " : "\n");
+    }
+}
@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <SD.h>
+#include <FS.h>
+#include <Preferences.h>
+#include "esp_timer.h"
+
+#include "SDProfiler.h"
+
+#define PROFILE_NAMESPACE "sdprofile"
+#define PROFILE_MAX_READ 32768
+// Bytes read per sequential measurement, enough for a steady rate at 4 MHz
+// without making the sweep take minutes
+#define PROFILE_SEQ_BYTES (128 * 1024)
+#define PROFILE_RANDOM_READS 64
+#define PROFILE_RANDOM_BYTES 4096
+#define PROFILE_OPENS 32
+#define PROFILE_KNEE_PERCENT 90
+
+static_assert(PROFILE_SEQ_BYTES + PROFILE_MAX_READ <= SD_PROFILE_FILE_BYTES, "sequential runs must fit the probe file");
+
+// Clocks HSPI can divide 80 MHz down to exactly, slowest first
+static const uint32_t CLOCKS[] = {4000000, 10000000, 16000000, 20000000, 26666666, 40000000};
+static const uint32_t READ_SIZES[] = {512, 2048, 8192, 32768};
+// Byte offsets from a sector boundary for the alignment sweep
+static const uint32_t ALIGNMENTS[] = {0, 4, 1};
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint32_t s_samples[SD_PROFILE_SAMPLES];
+
+typedef struct
+{
+    bool ok;
+    uint32_t count;
+    uint32_t bytes;
+    uint64_t total_us;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} measurement_t;
+
+// Contents of the probe file, different in every sector so a read from the
+// wrong place is caught as well as a corrupted one
+static inline uint8_t probeByte(uint32_t offset)
+{
+    return (uint8_t)(offset + (offset >> 9) * 131);
+}
+
+static bool verify(const uint8_t *buffer, uint32_t offset, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        if (buffer[i] != probeByte(offset + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static float mbps(const measurement_t *m)
+{
+    return m->total_us ? (float)m->bytes / m->total_us : 0;
+}
+
+static void finish(measurement_t *m)
+{
+    if (m->count == 0) {
+        m->ok = false;
+        return;
+    }
+    std::sort(s_samples, s_samples + m->count);
+    m->p50_us = s_samples[(m->count - 1) / 2];
+    m->p99_us = s_samples[(m->count * 99 + 99) / 100 - 1];
+    m->max_us = s_samples[m->count - 1];
+}
+
+static void report(const char *what, uint32_t size, uint32_t align, const measurement_t *m)
+{
+    if (!m->ok) {
+        Serial.printf("  %-6s %6u B +%u  FAILED\n", what, size, align);
+        return;
+    }
+    Serial.printf("  %-6s %6u B +%u  %6.2f MB/s  p50 %6u us  p99 %6u us  max %6u us\n", what, size, align,
+                  mbps(m), m->p50_us, m->p99_us, m->max_us);
+}
+
+static bool writeProbeFile(uint8_t *buffer)
+{
+    if (SD.exists(SD_PROFILE_PATH)) {
+        File existing = SD.open(SD_PROFILE_PATH, FILE_READ);
+        bool matches = existing && existing.size() == SD_PROFILE_FILE_BYTES;
+        existing.close();
+        if (matches) {
+            return true;
+        }
+    }
+    Serial.printf("SD profile: writing %u byte probe file\n", SD_PROFILE_FILE_BYTES);
+    File file = SD.open(SD_PROFILE_PATH, FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+    bool ok = true;
+    for (uint32_t offset = 0; ok && offset < SD_PROFILE_FILE_BYTES; offset += PROFILE_MAX_READ) {
+        for (uint32_t i = 0; i < PROFILE_MAX_READ; i++) {
+            buffer[i] = probeByte(offset + i);
+        }
+        ok = file.write(buffer, PROFILE_MAX_READ) == PROFILE_MAX_READ;
+    }
+    file.close();
+    return ok;
+}
+
+static measurement_t measureOpen()
+{
+    measurement_t m = {true, 0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < PROFILE_OPENS; i++) {
+        int64_t started = esp_timer_get_time();
+        File file = SD.open(SD_PROFILE_PATH, FILE_READ);
+        bool opened = (bool)file;
+        file.close();
+        uint32_t elapsed = (uint32_t)(esp_timer_get_time() - started);
+        if (!opened) {
+            m.ok = false;
+            return m;
+        }
+        s_samples[m.count++] = elapsed;
+        m.total_us += elapsed;
+    }
+    finish(&m);
+    return m;
+}
+
+// Reads of `size` bytes starting `align` bytes past a sector boundary, one
+// after another, or at random sector offsets (plus align) when random is set
+static measurement_t measureReads(File &file, uint8_t *buffer, uint32_t size, uint32_t align, bool random)
+{
+    measurement_t m = {true, 0, 0, 0, 0, 0, 0};
+    uint32_t reads = random ? PROFILE_RANDOM_READS : PROFILE_SEQ_BYTES / size;
+    reads = min(reads, (uint32_t)SD_PROFILE_SAMPLES);
+    uint32_t offset = align;
+    uint32_t last_start = SD_PROFILE_FILE_BYTES - size - align;
+
+    for (uint32_t i = 0; i < reads; i++) {
+        if (random) {
+            offset = ((esp_random() % last_start) & ~511u) + align;
+        }
+        int64_t started = esp_timer_get_time();
+        bool ok = (random || i == 0 ? file.seek(offset) : true) && file.read(buffer, size) == size;
+        uint32_t elapsed = (uint32_t)(esp_timer_get_time() - started);
+        if (!ok || !verify(buffer, offset, size)) {
+            m.ok = false;
+            return m;
+        }
+        s_samples[m.count++] = elapsed;
+        m.total_us += elapsed;
+        m.bytes += size;
+        offset += random ? 0 : size;
+    }
+    finish(&m);
+    return m;
+}
+
+// Sweep one clock, false if the card failed at it in any way
+static bool profileClock(uint8_t *buffer, sd_profile_t *result)
+{
+    measurement_t open = measureOpen();
+    report("open", 0, 0, &open);
+    if (!open.ok) {
+        return false;
+    }
+    File file = SD.open(SD_PROFILE_PATH, FILE_READ);
+    if (!file) {
+        return false;
+    }
+
+    float rates[COUNT_OF(READ_SIZES)];
+    float peak = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < COUNT_OF(READ_SIZES); i++) {
+        measurement_t seq = measureReads(file, buffer, READ_SIZES[i], 0, false);
+        report("seq", READ_SIZES[i], 0, &seq);
+        ok = seq.ok;
+        rates[i] = mbps(&seq);
+        peak = max(peak, rates[i]);
+    }
+    for (size_t i = 1; ok && i < COUNT_OF(ALIGNMENTS); i++) {
+        measurement_t seq = measureReads(file, buffer, 4096, ALIGNMENTS[i], false);
+        report("seq", 4096, ALIGNMENTS[i], &seq);
+        ok = seq.ok;
+    }
+    measurement_t random = {false, 0, 0, 0, 0, 0, 0};
+    if (ok) {
+        random = measureReads(file, buffer, PROFILE_RANDOM_BYTES, 0, true);
+        report("random", PROFILE_RANDOM_BYTES, 0, &random);
+        ok = random.ok;
+    }
+    file.close();
+    if (!ok) {
+        return false;
+    }
+
+    // Past the knee, bigger reads only cost buffer space
+    result->knee_bytes = READ_SIZES[COUNT_OF(READ_SIZES) - 1];
+    result->seq_mbps = peak;
+    for (size_t i = 0; i < COUNT_OF(READ_SIZES); i++) {
+        if (rates[i] * 100 >= peak * PROFILE_KNEE_PERCENT) {
+            result->knee_bytes = READ_SIZES[i];
+            result->seq_mbps = rates[i];
+            break;
+        }
+    }
+    result->random_mbps = mbps(&random);
+    result->open_p99_us = open.p99_us;
+    return true;
+}
+
+bool SDProfiler::run(SPIClass &spi, int cs_pin, sd_profile_t *best)
+{
+    uint8_t *buffer = (uint8_t *)malloc(PROFILE_MAX_READ);
+    if (buffer == nullptr) {
+        Serial.println("SD profile: no memory for the read buffer");
+        return false;
+    }
+
+    bool found = false;
+    memset(best, 0, sizeof(*best));
+    SD.end();
+    if (!SD.begin(cs_pin, spi, CLOCKS[0]) || !writeProbeFile(buffer)) {
+        Serial.println("SD profile: could not prepare the probe file");
+    } else {
+        for (size_t c = 0; c < COUNT_OF(CLOCKS); c++) {
+            Serial.printf("SD profile at %u kHz:\n", CLOCKS[c] / 1000);
+            if (c > 0) {
+                SD.end();
+            }
+            sd_profile_t result;
+            result.clock_hz = CLOCKS[c];
+            if ((c > 0 && !SD.begin(cs_pin, spi, CLOCKS[c])) || !profileClock(buffer, &result)) {
+                // Faster clocks will not do better than one that already fails
+                Serial.println("  card failed at this clock, stopping the sweep");
+                break;
+            }
+            if (!found || result.seq_mbps > best->seq_mbps) {
+                *best = result;
+                found = true;
+            }
+        }
+    }
+    free(buffer);
+
+    // Leave the card mounted at the clock playback will use
+    SD.end();
+    uint32_t clock = found ? best->clock_hz : SD_DEFAULT_CLOCK_HZ;
+    if (!SD.begin(cs_pin, spi, clock)) {
+        Serial.println("SD profile: remount failed");
+        return false;
+    }
+    if (found) {
+        print(best);
+    }
+    return found;
+}
+
+bool SDProfiler::load(sd_profile_t *profile)
+{
+    Preferences prefs;
+    if (!prefs.begin(PROFILE_NAMESPACE, true)) {
+        return false;
+    }
+    profile->clock_hz = prefs.getUInt("clock", 0);
+    profile->knee_bytes = prefs.getUInt("knee", 0);
+    profile->seq_mbps = prefs.getFloat("seq", 0);
+    profile->random_mbps = prefs.getFloat("random", 0);
+    profile->open_p99_us = prefs.getUInt("open_p99", 0);
+    prefs.end();
+    return profile->clock_hz != 0;
+}
+
+bool SDProfiler::store(const sd_profile_t *profile)
+{
+    Preferences prefs;
+    if (!prefs.begin(PROFILE_NAMESPACE, false)) {
+        Serial.println("SD profile: could not open NVS");
+        return false;
+    }
+    bool ok = prefs.putUInt("clock", profile->clock_hz) > 0;
+    ok = prefs.putUInt("knee", profile->knee_bytes) > 0 && ok;
+    ok = prefs.putFloat("seq", profile->seq_mbps) > 0 && ok;
+    ok = prefs.putFloat("random", profile->random_mbps) > 0 && ok;
+    ok = prefs.putUInt("open_p99", profile->open_p99_us) > 0 && ok;
+    prefs.end();
+    return ok;
+}
+
+void SDProfiler::clear()
+{
+    Preferences prefs;
+    if (prefs.begin(PROFILE_NAMESPACE, false)) {
+        prefs.clear();
+        prefs.end();
+    }
+}
+
+void SDProfiler::requestOnNextBoot()
+{
+    Preferences prefs;
+    if (prefs.begin(PROFILE_NAMESPACE, false)) {
+        prefs.putBool("request", true);
+        prefs.end();
+    }
+    Serial.println("SD profile: restarting to profile the card");
+    Serial.flush();
+    ESP.restart();
+}
+
+bool SDProfiler::takeRequest()
+{
+    Preferences prefs;
+    if (!prefs.begin(PROFILE_NAMESPACE, false)) {
+        return false;
+    }
+    bool requested = prefs.getBool("request", false);
+    if (requested) {
+        prefs.remove("request");
+    }
+    prefs.end();
+    return requested;
+}
+
+void SDProfiler::print(const sd_profile_t *profile)
+{
+    Serial.printf("SD profile: %u kHz, knee %u B at %.2f MB/s, random 4 KB %.2f MB/s, open p99 %u us\n",
+                  profile->clock_hz / 1000, profile->knee_bytes, profile->seq_mbps, profile->random_mbps,
+                  profile->open_p99_us);
+}
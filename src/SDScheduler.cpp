@@ -0,0 +1,388 @@
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+#include "SDScheduler.h"
+#include "Logger.h"
+#include "MediaArena.h"
+#include "PipelineStats.h"
+#include "Tracer.h"
+
+static QueueHandle_t s_submitQueue = nullptr;
+static TaskHandle_t s_schedulerTaskHandle = nullptr;
+
+// Requests taken off the queue and waiting for the card, only touched by
+// the scheduler task
+static sd_request_t *s_pending[SD_SCHED_MAX_PENDING];
+static int s_pendingCount = 0;
+
+// Adjacent reads merged into one transfer land here first
+static uint8_t *s_mergeBuffer = nullptr;
+
+static sd_client_stats_t s_stats[SD_CLIENT_COUNT];
+static portMUX_TYPE s_statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *CLIENT_NAMES[SD_CLIENT_COUNT] = {"audio", "video", "background"};
+
+// Ordering: priority class, then earliest deadline, then arrival
+static bool servedBefore(sd_request_t *a, sd_request_t *b)
+{
+    if (a->client != b->client) {
+        return a->client < b->client;
+    }
+    int64_t a_deadline = a->deadline_us ? a->deadline_us : INT64_MAX;
+    int64_t b_deadline = b->deadline_us ? b->deadline_us : INT64_MAX;
+    if (a_deadline != b_deadline) {
+        return a_deadline < b_deadline;
+    }
+    return a->submit_us < b->submit_us;
+}
+
+static sd_request_t *takePending(int index)
+{
+    sd_request_t *request = s_pending[index];
+    s_pending[index] = s_pending[--s_pendingCount];
+    return request;
+}
+
+static int32_t performRead(sd_request_t *request, bool seek)
+{
+    if (request->operation != nullptr) {
+        PIPELINE_TIME(STAGE_SD_OPEN);
+        return request->operation(request->operation_arg);
+    }
+    TRACE_SCOPE(TRACE_SD_READ, request->length);
+    if (request->stream != nullptr) {
+        PIPELINE_TIME(STAGE_SD_READ);
+        return request->stream->read(request->offset, request->buffer, request->length);
+    }
+    if (request->file != nullptr) {
+        PIPELINE_TIME(STAGE_SD_READ);
+        if (seek && !request->file->seek(request->offset)) {
+            return -1;
+        }
+        return (int32_t)request->file->read(request->buffer, request->length);
+    }
+
+    uint32_t started = PIPELINE_NOW();
+    File file = SD.open(request->path, FILE_READ);
+    PIPELINE_RECORD(STAGE_SD_OPEN, PIPELINE_NOW() - started);
+    if (!file) {
+        return -1;
+    }
+    PIPELINE_TIME(STAGE_SD_READ);
+    if (request->offset > 0 && !file.seek(request->offset)) {
+        file.close();
+        return -1;
+    }
+    int32_t bytes = (int32_t)file.read(request->buffer, request->length);
+    file.close();
+    return bytes;
+}
+
+static void completeRequest(sd_request_t *request, int32_t result, int64_t started_us, int64_t finished_us,
+                            bool coalesced)
+{
+    uint32_t latency = (uint32_t)(finished_us - request->submit_us);
+
+    portENTER_CRITICAL(&s_statsMux);
+    sd_client_stats_t *stats = &s_stats[request->client];
+    stats->requests++;
+    stats->total_latency_us += latency;
+    stats->service_us += finished_us - started_us;
+    if (latency > stats->max_latency_us) {
+        stats->max_latency_us = latency;
+    }
+    // An operation's result is not a byte count
+    if (result > 0 && request->operation == nullptr) {
+        stats->bytes += result;
+    }
+    if (result < 0) {
+        stats->errors++;
+    }
+    if (coalesced) {
+        stats->coalesced++;
+    }
+    if (request->deadline_us != 0 && finished_us > request->deadline_us) {
+        stats->deadline_misses++;
+    }
+    portEXIT_CRITICAL(&s_statsMux);
+
+    // Once done is set the owner may reuse the request, so read everything
+    // needed first
+    sd_callback_t callback = request->callback;
+    void *callback_arg = request->callback_arg;
+    SemaphoreHandle_t done_sem = request->done_sem;
+    request->result = result;
+    request->done = true;
+    if (callback) {
+        callback(request, callback_arg);
+    }
+    if (done_sem) {
+        xSemaphoreGive(done_sem);
+    }
+}
+
+// Pending reads on the same file that carry on from offset, taken off the
+// pending list while they fit in bytes. Returns how many were added.
+static int takeFollowing(sd_request_t *first, uint32_t offset, uint32_t bytes, sd_request_t **chain, int max_chain)
+{
+    int count = 0;
+    bool found = true;
+    while (found && count < max_chain)
+    {
+        found = false;
+        for (int i = 0; i < s_pendingCount; i++) {
+            sd_request_t *request = s_pending[i];
+            if (request->file == first->file && request->stream == first->stream && request->offset == offset &&
+                request->length <= bytes) {
+                chain[count++] = takePending(i);
+                offset += request->length;
+                bytes -= request->length;
+                found = true;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+// Serve first together with the queued reads that continue it as one
+// transfer into the merge buffer, then copy each caller's part out.
+// Returns true when every byte asked for was read; end is the file offset
+// the transfer stopped at.
+static bool serveMerged(sd_request_t *first, bool seek, uint32_t *end)
+{
+    sd_request_t *chain[SD_SCHED_MAX_PENDING];
+    chain[0] = first;
+    int count = 1;
+    uint32_t total = first->length;
+    bool mergeable = (first->file != nullptr || first->stream != nullptr) && s_mergeBuffer != nullptr &&
+                     total < SD_SCHED_MERGE_BYTES;
+    if (mergeable) {
+        count += takeFollowing(first, first->offset + total, SD_SCHED_MERGE_BYTES - total, chain + 1,
+                               SD_SCHED_MAX_PENDING - 1);
+        for (int i = 1; i < count; i++) {
+            total += chain[i]->length;
+        }
+    }
+    *end = first->offset + total;
+
+    int64_t started = esp_timer_get_time();
+    if (count == 1) {
+        int32_t result = performRead(first, seek);
+        completeRequest(first, result, started, esp_timer_get_time(), !seek);
+        return result == (int32_t)total;
+    }
+
+    sd_request_t merged = *first;
+    merged.buffer = s_mergeBuffer;
+    merged.length = total;
+    int32_t result = performRead(&merged, seek);
+    int64_t finished = esp_timer_get_time();
+
+    // Short reads at the end of the file leave the later parts short too
+    uint32_t position = 0;
+    for (int i = 0; i < count; i++) {
+        int32_t part = -1;
+        if (result >= 0) {
+            uint32_t available = (uint32_t)result > position ? result - position : 0;
+            part = min(available, chain[i]->length);
+            memcpy(chain[i]->buffer, s_mergeBuffer + position, part);
+        }
+        position += chain[i]->length;
+        // The transfer's time is charged to the read that started it
+        completeRequest(chain[i], part, i == 0 ? started : finished, finished, i > 0 || !seek);
+    }
+    return result == (int32_t)total;
+}
+
+void sdSchedulerTask(void *param)
+{
+    while (true)
+    {
+        // Block only when there is nothing left to do
+        sd_request_t *incoming;
+        TickType_t wait = s_pendingCount > 0 ? 0 : portMAX_DELAY;
+        while (s_pendingCount < SD_SCHED_MAX_PENDING && xQueueReceive(s_submitQueue, &incoming, wait) == pdTRUE)
+        {
+            s_pending[s_pendingCount++] = incoming;
+            wait = 0;
+        }
+        if (s_pendingCount == 0) {
+            continue;
+        }
+
+        int best = 0;
+        for (int i = 1; i < s_pendingCount; i++) {
+            if (servedBefore(s_pending[i], s_pending[best])) {
+                best = i;
+            }
+        }
+        sd_request_t *request = takePending(best);
+        File *file = request->file;
+        ContiguousFile *stream = request->stream;
+        uint32_t next_offset;
+        bool chained = serveMerged(request, true, &next_offset);
+
+        // Queued reads that carry on past the merged transfer follow it
+        // without a seek, so the card still sees one long stream
+        while (chained && (file != nullptr || stream != nullptr))
+        {
+            chained = false;
+            for (int i = 0; i < s_pendingCount; i++) {
+                if (s_pending[i]->file == file && s_pending[i]->stream == stream &&
+                    s_pending[i]->offset == next_offset) {
+                    chained = serveMerged(takePending(i), false, &next_offset);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+bool SDScheduler::begin(int task_priority, int core)
+{
+    if (s_schedulerTaskHandle != nullptr) {
+        return true;
+    }
+    s_submitQueue = xQueueCreate(SD_SCHED_MAX_PENDING, sizeof(sd_request_t *));
+    if (s_submitQueue == nullptr) {
+        Serial.println("SD scheduler: failed to create queue");
+        return false;
+    }
+    resetStats();
+    s_mergeBuffer = (uint8_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_VIDEO, SD_SCHED_MERGE_BYTES);
+    if (s_mergeBuffer == nullptr) {
+        LOG_W(LOG_CAT_SD, "SD scheduler: no merge buffer, adjacent reads are served one by one");
+    }
+    // Same stack as the loaders it took over from, SD.open and FatFs are deep
+    if (xTaskCreatePinnedToCore(sdSchedulerTask, "SD Scheduler", 8192, nullptr, task_priority,
+                                &s_schedulerTaskHandle, core) != pdPASS) {
+        Serial.println("SD scheduler: failed to start task");
+        MediaArena::free(s_mergeBuffer);
+        s_mergeBuffer = nullptr;
+        vQueueDelete(s_submitQueue);
+        s_submitQueue = nullptr;
+        s_schedulerTaskHandle = nullptr;
+        return false;
+    }
+    Serial.printf("SD scheduler started on core %d, priority %d\n", core, task_priority);
+    return true;
+}
+
+bool SDScheduler::submit(sd_request_t *request)
+{
+    request->done = false;
+    request->result = -1;
+    request->submit_us = esp_timer_get_time();
+
+    if (s_submitQueue == nullptr) {
+        // No service task yet, read in the caller's context
+        int64_t started = esp_timer_get_time();
+        int32_t result = performRead(request, true);
+        completeRequest(request, result, started, esp_timer_get_time(), false);
+        return true;
+    }
+    if (xQueueSend(s_submitQueue, &request, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        LOG_W(LOG_CAT_SD, "SD scheduler: queue full, dropping %s request", CLIENT_NAMES[request->client]);
+        return false;
+    }
+    return true;
+}
+
+static int32_t blockingRead(sd_request_t *request, uint32_t deadline_ms)
+{
+    if (deadline_ms > 0) {
+        request->deadline_us = esp_timer_get_time() + (int64_t)deadline_ms * 1000;
+    }
+    // Waiting on our own semaphore leaves the task notification free for
+    // the callers, which already use it for their own handshakes
+    StaticSemaphore_t done_buffer;
+    request->done_sem = xSemaphoreCreateBinaryStatic(&done_buffer);
+    if (!SDScheduler::submit(request)) {
+        vSemaphoreDelete(request->done_sem);
+        return -1;
+    }
+    xSemaphoreTake(request->done_sem, portMAX_DELAY);
+    vSemaphoreDelete(request->done_sem);
+    return request->result;
+}
+
+int32_t SDScheduler::read(SDClient client, File *file, uint32_t offset, uint8_t *buffer, uint32_t length,
+                          uint32_t deadline_ms)
+{
+    sd_request_t request = {};
+    request.client = client;
+    request.file = file;
+    request.offset = offset;
+    request.buffer = buffer;
+    request.length = length;
+    return blockingRead(&request, deadline_ms);
+}
+
+int32_t SDScheduler::readFile(SDClient client, const char *path, uint32_t offset, uint8_t *buffer, uint32_t length,
+                              uint32_t deadline_ms)
+{
+    sd_request_t request = {};
+    request.client = client;
+    request.path = path;
+    request.offset = offset;
+    request.buffer = buffer;
+    request.length = length;
+    return blockingRead(&request, deadline_ms);
+}
+
+int32_t SDScheduler::readStream(SDClient client, ContiguousFile *stream, uint32_t offset, uint8_t *buffer,
+                                uint32_t length, uint32_t deadline_ms)
+{
+    sd_request_t request = {};
+    request.client = client;
+    request.stream = stream;
+    request.offset = offset;
+    request.buffer = buffer;
+    request.length = length;
+    return blockingRead(&request, deadline_ms);
+}
+
+int32_t SDScheduler::call(SDClient client, sd_operation_t operation, void *arg, uint32_t deadline_ms)
+{
+    sd_request_t request = {};
+    request.client = client;
+    request.operation = operation;
+    request.operation_arg = arg;
+    return blockingRead(&request, deadline_ms);
+}
+
+void SDScheduler::getStats(SDClient client, sd_client_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_statsMux);
+    *stats = s_stats[client];
+    portEXIT_CRITICAL(&s_statsMux);
+}
+
+void SDScheduler::resetStats()
+{
+    portENTER_CRITICAL(&s_statsMux);
+    memset(s_stats, 0, sizeof(s_stats));
+    portEXIT_CRITICAL(&s_statsMux);
+}
+
+void SDScheduler::printStats()
+{
+    Serial.println("SD scheduler:");
+    for (int i = 0; i < SD_CLIENT_COUNT; i++) {
+        sd_client_stats_t stats;
+        getStats((SDClient)i, &stats);
+        if (stats.requests == 0) {
+            continue;
+        }
+        uint32_t kbps = stats.service_us ? (uint32_t)((uint64_t)stats.bytes * 1000000 / stats.service_us / 1024) : 0;
+        Serial.printf("  %-10s %6u reads %8u bytes %5u KB/s  latency avg %u us max %u us  missed %u  coalesced %u  errors %u\n",
+                      CLIENT_NAMES[i], stats.requests, stats.bytes, kbps,
+                      (uint32_t)(stats.total_latency_us / stats.requests), stats.max_latency_us,
+                      stats.deadline_misses, stats.coalesced, stats.errors);
+    }
+}
@@ -1,4 +1,22 @@
 #include "SD_video.h"
+#include "FramePipeline.h"
+#include "MediaArena.h"
+#include "LoopCache.h"
+#include "SDScheduler.h"
+#include "FatVolume.h"
+#include "FileCatalog.h"
+#include "esp_timer.h"
+#include "Logger.h"
+#include "PipelineStats.h"
+#include "Tracer.h"
+#include "BootSequencer.h"
+#include "Compositor.h"
+
+// Time each frame stays on screen, also the deadline for loading the next
+#define SD_VIDEO_FRAME_MS 66
+
+// Frames on the card are RGB332, the panel takes RGB565
+typedef StaticFramePipeline<PixelRGB332, PixelRGB565, SD_VIDEO_WIDTH, SD_VIDEO_HEIGHT> SDVideoPipeline;
 
 // Global variables for watchdog management
 bool watchdogInitialized = false;
@@ -21,6 +39,7 @@ void addTaskToWatchdog(TaskHandle_t taskHandle, const char* taskName) {
 
 void feedWatchdog() {
     if (watchdogInitialized) {
+        TRACE_INSTANT(TRACE_WATCHDOG_FEED, 0);
         esp_task_wdt_reset();
     }
 }
@@ -33,12 +52,33 @@ int yDisp;
 
 uint8_t *buffer1;
 uint8_t *buffer2;
+// Frame each buffer holds, for tracing the draw that shows it
+int bufferFrame[2];
+
+// Orientation frames are drawn in, applied strip by strip while pushing
+#define ROTATE_STRIP_ROWS 16
+FrameRotation videoRotation = ROTATE_0;
+bool videoMirror = false;
+uint8_t *rotateStripBuffer = nullptr;
+uint16_t *pipelineStripBuffer = nullptr;
+// Compositor layer frames are shown in, -1 when there is no compositor
+int videoLayer = -1;
+
+// The clip's variants, richest first. Variant 0 is the pattern passed to
+// startSDVideo, the rest are added with setSDVideoVariants.
+stream_variant_t videoVariants[VARIANT_MAX];
+int videoVariantCount = 1;
+VariantController variantController;
+
+// Per variant, frames stored contiguously on the card, read from raw sectors
+ContiguousFile *frameStreams[VARIANT_MAX];
+
+// RAM copy of the clip for looping playback
+LoopCache loopCache;
+uint32_t loopCacheBudget = SD_VIDEO_LOOP_CACHE_BYTES;
 
-SemaphoreHandle_t spiMutexBuffer;
 SemaphoreHandle_t spiMutexDisp;
 
-char currentFileName[64];
-
 TaskHandle_t loadBuffer1TaskHandle;
 TaskHandle_t loadBuffer2TaskHandle;
 TaskHandle_t drawBuffer1TaskHandle;
@@ -65,19 +105,217 @@ int getNextFrameIndex() {
     return frameIndex;
 }
 
-void countAvailableFrames(const char *FRAME_FILE_PATTERN) {
-  totalFrames = 0;
+void setSDVideoLoopCache(uint32_t budget_bytes) {
+    loopCacheBudget = budget_bytes;
+}
+
+void setSDVideoVariants(const stream_variant_t *variants, int count) {
+    videoVariantCount = 1 + min(count, VARIANT_MAX - 1);
+    for (int i = 1; i < videoVariantCount; i++) {
+        videoVariants[i] = variants[i - 1];
+    }
+}
+
+void setSDVideoRotation(FrameRotation rotation, bool mirror) {
+    videoRotation = rotation;
+    videoMirror = mirror;
+}
+
+int getSDVideoLayer() {
+    return videoLayer;
+}
+
+// Push a frame buffer in the configured orientation. Caller holds spiMutexDisp,
+// which also guards the shared rotate strip.
+void pushVideoPlane(uint8_t *buffer) {
+    if ((videoRotation == ROTATE_0 && !videoMirror) || rotateStripBuffer == nullptr) {
+        if (pipelineStripBuffer != nullptr && bufferWidth == SDVideoPipeline::width &&
+            bufferHeight == SDVideoPipeline::height) {
+            SDVideoPipeline::push(&tft, xDisp, yDisp, buffer, pipelineStripBuffer);
+        } else {
+            // TFT_eSPI converts while it sends, so this is all push time
+            PIPELINE_TIME(STAGE_SPI_PUSH);
+            tft.pushImage(xDisp, yDisp, bufferWidth, bufferHeight, buffer);
+        }
+        return;
+    }
+
+    int dispWidth, dispHeight;
+    FrameUtils::rotatedSize(bufferWidth, bufferHeight, videoRotation, &dispWidth, &dispHeight);
+    uint32_t rotateUs = 0;
+    uint32_t pushUs = 0;
+    for (int row = 0; row < dispHeight; row += ROTATE_STRIP_ROWS) {
+        int rows = min(ROTATE_STRIP_ROWS, dispHeight - row);
+        uint32_t started = PIPELINE_NOW();
+        FrameUtils::rotateStrip8(buffer, bufferWidth, bufferHeight, videoRotation, videoMirror,
+                                 rotateStripBuffer, row, rows);
+        uint32_t rotated = PIPELINE_NOW();
+        tft.pushImage(xDisp, yDisp + row, dispWidth, rows, rotateStripBuffer);
+        rotateUs += rotated - started;
+        pushUs += PIPELINE_NOW() - rotated;
+    }
+    PIPELINE_RECORD(STAGE_CONVERT, rotateUs);
+    PIPELINE_RECORD(STAGE_SPI_PUSH, pushUs);
+}
+
+// Show a frame along with whatever the compositor has over it. Caller holds
+// spiMutexDisp.
+void pushVideoBuffer(uint8_t *buffer) {
+    if (videoLayer < 0) {
+        pushVideoPlane(buffer);
+        return;
+    }
+    if (Compositor::isCovered(videoLayer)) {
+        // Layers on top of the video: the whole frame is composed with them
+        Compositor::setPixels(videoLayer, buffer);
+        PIPELINE_TIME(STAGE_SPI_PUSH);
+        Compositor::flush(&tft);
+        return;
+    }
+    // Nothing over the video, it goes straight out and only changed UI
+    // elsewhere on the panel is composed
+    Compositor::setPixels(videoLayer, buffer, false);
+    pushVideoPlane(buffer);
+    Compositor::flush(&tft);
+}
+
+typedef struct {
+    const char *prefix;     // file name before the frame number
+    size_t prefixLength;
+    const char *suffix;     // and after it
+    FatVolume *volume;
+    ContiguousFile *streams;
+    int streamed;
+} frame_scan_t;
+
+static bool frameStreamCallback(const char *name, const char *short_name, const fat_file_t *file, void *arg) {
+    frame_scan_t *scan = (frame_scan_t *)arg;
+    if (strncasecmp(name, scan->prefix, scan->prefixLength) != 0) {
+        return true;
+    }
+    char *end;
+    long index = strtol(name + scan->prefixLength, &end, 10);
+    if (end == name + scan->prefixLength || strcasecmp(end, scan->suffix) != 0 || index < 1 || index > totalFrames) {
+        return true;
+    }
+    if (scan->streams[index - 1].open(scan->volume, file)) {
+        scan->streamed++;
+    }
+    return true;
+}
+
+static bool catalogFrameCallback(const catalog_file_t *file, void *arg) {
+    return frameStreamCallback(file->name, nullptr, &file->file, arg);
+}
+
+// Find every frame's sectors from the catalog, or in one pass over the
+// frame directory when there is none
+ContiguousFile *openFrameStreams(const char *FRAME_FILE_PATTERN) {
+    FatVolume *volume = getSDVolume();
+    const char *slash = strrchr(FRAME_FILE_PATTERN, '/');
+    const char *number = strstr(FRAME_FILE_PATTERN, "%d");
+    if (volume == nullptr || slash == nullptr || number == nullptr || number < slash) {
+        return nullptr;
+    }
+    char dir[64];
+    size_t dirLength = slash - FRAME_FILE_PATTERN;
+    if (dirLength >= sizeof(dir)) {
+        return nullptr;
+    }
+    memcpy(dir, FRAME_FILE_PATTERN, dirLength);
+    dir[dirLength] = '\0';
+
+    ContiguousFile *streams = new ContiguousFile[totalFrames];
+    frame_scan_t scan = {slash + 1, (size_t)(number - slash - 1), number + 2, volume, streams, 0};
+    if (FileCatalog::isLoaded()) {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%.*s", (int)(number - FRAME_FILE_PATTERN), FRAME_FILE_PATTERN);
+        FileCatalog::list(prefix, catalogFrameCallback, &scan);
+    } else {
+        volume->list(dirLength ? dir : "/", frameStreamCallback, &scan);
+    }
+    Serial.printf("%d of %d frames of %s stream from raw sectors\n", scan.streamed, totalFrames, FRAME_FILE_PATTERN);
+    return streams;
+}
+
+// Keep the variants that have every frame and get cheaper in order, and
+// start the controller when there is more than one
+void startVideoVariants() {
+    uint32_t variantBytes[VARIANT_MAX];
+    variantBytes[0] = bufferWidth * bufferHeight;
+    int count = 1;
+    for (int i = 1; i < videoVariantCount; i++) {
+        stream_variant_t *variant = &videoVariants[i];
+        uint32_t bytes = VariantController::frameBytes(variant->format, bufferWidth, bufferHeight);
+        bool oddSize = ((bufferWidth | bufferHeight) & 1) != 0;
+        if (bytes >= variantBytes[count - 1] || (variant->format == VARIANT_RGB332_HALF && oddSize) ||
+            countFrames(variant->pattern, totalFrames) < totalFrames) {
+            Serial.printf("Skipping video variant %s\n", variant->pattern);
+            continue;
+        }
+        videoVariants[count] = *variant;
+        variantBytes[count] = bytes;
+        frameStreams[count] = openFrameStreams(variant->pattern);
+        count++;
+    }
+    videoVariantCount = count;
+    if (count > 1) {
+        variantController.begin(variantBytes, count, SD_VIDEO_FRAME_MS * 1000);
+        Serial.printf("Adaptive playback over %d variants\n", count);
+    }
+}
+
+// Read one frame of the variant the controller picked, straight from its
+// sectors when it is stored contiguously. Reduced variants are expanded to
+// a full frame in place, so only a full-size result is full quality.
+int readVideoFrame(int frameIndex, char *fileName, uint8_t *buffer) {
+    int variant = videoVariantCount > 1 ? variantController.current() : 0;
+    const stream_variant_t *format = &videoVariants[variant];
+    uint32_t length = VariantController::frameBytes(format->format, bufferWidth, bufferHeight);
+    uint8_t *data = buffer + bufferWidth * bufferHeight - length;
+    ContiguousFile *stream = frameStreams[variant] != nullptr ? &frameStreams[variant][frameIndex - 1] : nullptr;
+    sprintf(fileName, format->pattern, frameIndex);
+
+    int64_t started = esp_timer_get_time();
+    int bytesRead;
+    if (stream != nullptr && stream->isOpen()) {
+        bytesRead = SDScheduler::readStream(SD_CLIENT_VIDEO, stream, 0, data, length, SD_VIDEO_FRAME_MS);
+    } else {
+        bytesRead = SDScheduler::readFile(SD_CLIENT_VIDEO, fileName, 0, data, length, SD_VIDEO_FRAME_MS);
+    }
+    if (videoVariantCount > 1 && bytesRead > 0) {
+        variantController.recordLoad(bytesRead, (uint32_t)(esp_timer_get_time() - started));
+    }
+
+    if (variant > 0) {
+        PIPELINE_TIME(STAGE_DECODE);
+        if (bytesRead != (int)length ||
+            !VariantController::expandInPlace(format->format, buffer, bufferWidth, bufferHeight)) {
+            return -1;
+        }
+    }
+    return bytesRead;
+}
+
+// Number of consecutive frames from frame 1 up to limit present on the card
+int countFrames(const char *FRAME_FILE_PATTERN, int limit) {
   char currentFramePath[64];
-  Serial.println("Counting available frames...");
-  
-  // Start from frame1 (since your logs show frame2.bin as the first frame)
-  for(int i = 1; i < 1000; i++) { // reasonable upper limit
-    sprintf(currentFramePath, FRAME_FILE_PATTERN, i);
-    if(!SD.exists(currentFramePath)) {
+  int frames = 0;
+  while (frames < limit) {
+    sprintf(currentFramePath, FRAME_FILE_PATTERN, frames + 1);
+    if(!FileCatalog::exists(currentFramePath)) {
       break;
     }
-    totalFrames++;
+    frames++;
   }
+  return frames;
+}
+
+void countAvailableFrames(const char *FRAME_FILE_PATTERN) {
+  Serial.println("Counting available frames...");
+  
+  // Start from frame1 (since your logs show frame2.bin as the first frame)
+  totalFrames = countFrames(FRAME_FILE_PATTERN, 999); // reasonable upper limit
   Serial.printf("Found %d animation frames\n", totalFrames);
 }
 
@@ -85,8 +323,8 @@ void loadBuffer1(void *pvParameters) {
     // Load the first buffer with video data
     bool active = false;
 
-    const char *FRAME_FILE_PATTERN = (const char *)pvParameters;
-    File vidFile;
+    // Frame names come from the variant being read, see readVideoFrame
+    char fileName[64];
 
     // Add this task to watchdog
     addTaskToWatchdog(xTaskGetCurrentTaskHandle(), "LoadBuffer1");
@@ -98,38 +336,43 @@ void loadBuffer1(void *pvParameters) {
         
         if (active){
             int frameIndex = getNextFrameIndex();
-            sprintf(currentFileName, FRAME_FILE_PATTERN, frameIndex);
-
-            // Use timeout for semaphore to prevent deadlock
-            if (xSemaphoreTake(spiMutexBuffer, pdMS_TO_TICKS(1000)) == pdTRUE) {
-                vidFile = SD.open(currentFileName, FILE_READ);
-                if (!vidFile) {
-                    Serial.printf("Failed to open file %s\n", currentFileName);
-                    xSemaphoreGive(spiMutexBuffer);
-                    vTaskDelay(pdMS_TO_TICKS(100)); // Wait before retrying
-                    continue;
-                }
-                
-                int bytesRead = vidFile.read(buffer1, bufferWidth * bufferHeight);
-                vidFile.close();
-                
-                Serial.printf("Loading buffer 1 for file %s\n", currentFileName);
+            bufferFrame[0] = frameIndex;
+            TRACE_SCOPE(TRACE_FRAME_LOAD, frameIndex);
+
+            // Once the whole clip is in RAM the card is not touched at all
+            if (loopCache.load(frameIndex, buffer1, bufferWidth * bufferHeight)) {
+                TRACE_INSTANT(TRACE_FRAME_HANDOFF, frameIndex);
+                xTaskNotifyGive(drawBuffer1TaskHandle);
+                active = false; // Wait for the draw task to hand the buffer back
+                continue;
+            }
 
-                xSemaphoreGive(spiMutexBuffer);
-                
-                // Wait for draw task to finish before notifying
-                xTaskNotifyGive(drawBuffer1TaskHandle); // Notify the draw task to start drawing this buffer
-            } else {
-                Serial.println("Buffer1: Failed to acquire semaphore");
-                vTaskDelay(pdMS_TO_TICKS(10));
+            // The SD scheduler arbitrates the card with audio, which always goes first
+            int bytesRead = readVideoFrame(frameIndex, fileName, buffer1);
+            if (bytesRead < 0) {
+                PIPELINE_COUNT(COUNTER_FRAME_DROPS);
+                LOG_E(LOG_CAT_VIDEO, "Failed to open file %s", fileName);
+                vTaskDelay(pdMS_TO_TICKS(100)); // Wait before retrying
                 continue;
             }
+
+            LOGB_D(LOG_CAT_VIDEO, "Loaded buffer 1 with frame %d, %d bytes", frameIndex, bytesRead);
+
+            // First pass over the clip fills the loop cache
+            if (bytesRead == bufferWidth * bufferHeight) {
+                loopCache.store(frameIndex, buffer1, bytesRead);
+            }
+            
+            // Wait for draw task to finish before notifying
+            TRACE_INSTANT(TRACE_FRAME_HANDOFF, frameIndex);
+            xTaskNotifyGive(drawBuffer1TaskHandle); // Notify the draw task to start drawing this buffer
+            active = false; // Loading resumes when the draw task hands the buffer back
         }
         else{
             // Wait for the task to be notified to start loading with timeout
             if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) > 0) {
                 active = true;
-                Serial.println("Buffer 1 loading started");
+                LOGB_V(LOG_CAT_VIDEO, "Buffer 1 loading started");
             }
         }
     }
@@ -141,8 +384,8 @@ void loadBuffer2(void *pvParameters) {
     // Load the second buffer with video data
     bool active = false;
 
-    const char *FRAME_FILE_PATTERN = (const char *)pvParameters;
-    File vidFile;
+    // Frame names come from the variant being read, see readVideoFrame
+    char fileName[64];
 
     // Add this task to watchdog
     addTaskToWatchdog(xTaskGetCurrentTaskHandle(), "LoadBuffer2");
@@ -154,38 +397,43 @@ void loadBuffer2(void *pvParameters) {
         
         if(active){
             int frameIndex = getNextFrameIndex();
-            sprintf(currentFileName, FRAME_FILE_PATTERN, frameIndex);
-
-            // Use timeout for semaphore to prevent deadlock
-            if (xSemaphoreTake(spiMutexBuffer, pdMS_TO_TICKS(1000)) == pdTRUE) {
-                vidFile = SD.open(currentFileName, FILE_READ);
-                if (!vidFile) {
-                    Serial.printf("Failed to open file %s\n", currentFileName);
-                    xSemaphoreGive(spiMutexBuffer);
-                    vTaskDelay(pdMS_TO_TICKS(100)); // Wait before retrying
-                    continue;
-                }
-                
-                int bytesRead = vidFile.read(buffer2, bufferWidth * bufferHeight);
-                vidFile.close();
-                
-                Serial.printf("Loading buffer 2 for file %s\n", currentFileName);
+            bufferFrame[1] = frameIndex;
+            TRACE_SCOPE(TRACE_FRAME_LOAD, frameIndex);
+
+            // Once the whole clip is in RAM the card is not touched at all
+            if (loopCache.load(frameIndex, buffer2, bufferWidth * bufferHeight)) {
+                TRACE_INSTANT(TRACE_FRAME_HANDOFF, frameIndex);
+                xTaskNotifyGive(drawBuffer2TaskHandle);
+                active = false; // Wait for the draw task to hand the buffer back
+                continue;
+            }
 
-                xSemaphoreGive(spiMutexBuffer);
-                
-                // Wait for draw task to finish before notifying
-                xTaskNotifyGive(drawBuffer2TaskHandle); // Notify the draw task to start drawing this buffer
-            } else {
-                Serial.println("Buffer2: Failed to acquire semaphore");
-                vTaskDelay(pdMS_TO_TICKS(10));
+            // The SD scheduler arbitrates the card with audio, which always goes first
+            int bytesRead = readVideoFrame(frameIndex, fileName, buffer2);
+            if (bytesRead < 0) {
+                PIPELINE_COUNT(COUNTER_FRAME_DROPS);
+                LOG_E(LOG_CAT_VIDEO, "Failed to open file %s", fileName);
+                vTaskDelay(pdMS_TO_TICKS(100)); // Wait before retrying
                 continue;
             }
+
+            LOGB_D(LOG_CAT_VIDEO, "Loaded buffer 2 with frame %d, %d bytes", frameIndex, bytesRead);
+
+            // First pass over the clip fills the loop cache
+            if (bytesRead == bufferWidth * bufferHeight) {
+                loopCache.store(frameIndex, buffer2, bytesRead);
+            }
+            
+            // Wait for draw task to finish before notifying
+            TRACE_INSTANT(TRACE_FRAME_HANDOFF, frameIndex);
+            xTaskNotifyGive(drawBuffer2TaskHandle); // Notify the draw task to start drawing this buffer
+            active = false; // Loading resumes when the draw task hands the buffer back
         }
         else{
             // Wait for the task to be notified to start loading with timeout
             if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) > 0) {
                 active = true;
-                Serial.println("Buffer 2 loading started");
+                LOGB_V(LOG_CAT_VIDEO, "Buffer 2 loading started");
             }
         }
     }
@@ -196,6 +444,7 @@ void loadBuffer2(void *pvParameters) {
 void drawBuffer1(void *pvParameters) {
     // Draw the first buffer to the display
     bool active = false;
+    uint32_t waitStarted = PIPELINE_NOW();
 
     // Add this task to watchdog
     addTaskToWatchdog(xTaskGetCurrentTaskHandle(), "DrawBuffer1");
@@ -207,19 +456,26 @@ void drawBuffer1(void *pvParameters) {
         
         if (active){
             // Use timeout for semaphore to prevent deadlock
-            if (xSemaphoreTake(spiMutexDisp, pdMS_TO_TICKS(1000)) == pdTRUE) {
-                tft.pushImage(xDisp, yDisp, bufferWidth, bufferHeight, buffer1);
+            TRACE_BEGIN(TRACE_MUTEX_WAIT, bufferFrame[0]);
+            BaseType_t taken = xSemaphoreTake(spiMutexDisp, pdMS_TO_TICKS(1000));
+            TRACE_END(TRACE_MUTEX_WAIT, bufferFrame[0]);
+            if (taken == pdTRUE) {
+                TRACE_BEGIN(TRACE_FRAME_DRAW, bufferFrame[0]);
+                pushVideoBuffer(buffer1);
                 xSemaphoreGive(spiMutexDisp);
-                Serial.println("Drawing buffer 1 to display");
+                BootSequencer::markPlayback();
+                TRACE_END(TRACE_FRAME_DRAW, bufferFrame[0]);
+                LOGB_D(LOG_CAT_VIDEO, "Drew buffer 1 to display");
                 
                 // Add frame rate control delay
-                vTaskDelay(pdMS_TO_TICKS(66)); // ~15 FPS (more stable)
+                vTaskDelay(pdMS_TO_TICKS(SD_VIDEO_FRAME_MS)); // ~15 FPS (more stable)
                 
                 // Trigger next load after drawing and delay
                 xTaskNotifyGive(loadBuffer1TaskHandle); // Notify the load task to start loading the next frame
                 active = false; // Reset state to wait for next notification
+                waitStarted = PIPELINE_NOW();
             } else {
-                Serial.println("DrawBuffer1: Failed to acquire display semaphore");
+                LOGB_W(LOG_CAT_VIDEO, "DrawBuffer1: Failed to acquire display semaphore");
                 vTaskDelay(pdMS_TO_TICKS(10));
             }
         }
@@ -227,7 +483,8 @@ void drawBuffer1(void *pvParameters) {
             // Wait for the task to be notified to start drawing with timeout
             if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) > 0) {
                 active = true;
-                Serial.println("Buffer 1 drawing started");
+                PIPELINE_RECORD(STAGE_FRAME_WAIT, PIPELINE_NOW() - waitStarted);
+                LOGB_V(LOG_CAT_VIDEO, "Buffer 1 drawing started");
             }
         }
     }
@@ -237,6 +494,7 @@ void drawBuffer1(void *pvParameters) {
 void drawBuffer2(void *pvParameters) {
     // Draw the second buffer to the display
     bool active = false;
+    uint32_t waitStarted = PIPELINE_NOW();
     
     // Add this task to watchdog
     addTaskToWatchdog(xTaskGetCurrentTaskHandle(), "DrawBuffer2");
@@ -248,19 +506,26 @@ void drawBuffer2(void *pvParameters) {
         
         if (active){
             // Use timeout for semaphore to prevent deadlock
-            if (xSemaphoreTake(spiMutexDisp, pdMS_TO_TICKS(1000)) == pdTRUE) {
-                tft.pushImage(xDisp, yDisp, bufferWidth, bufferHeight, buffer2);
+            TRACE_BEGIN(TRACE_MUTEX_WAIT, bufferFrame[1]);
+            BaseType_t taken = xSemaphoreTake(spiMutexDisp, pdMS_TO_TICKS(1000));
+            TRACE_END(TRACE_MUTEX_WAIT, bufferFrame[1]);
+            if (taken == pdTRUE) {
+                TRACE_BEGIN(TRACE_FRAME_DRAW, bufferFrame[1]);
+                pushVideoBuffer(buffer2);
                 xSemaphoreGive(spiMutexDisp);
-                Serial.println("Drawing buffer 2 to display");
+                BootSequencer::markPlayback();
+                TRACE_END(TRACE_FRAME_DRAW, bufferFrame[1]);
+                LOGB_D(LOG_CAT_VIDEO, "Drew buffer 2 to display");
                 
                 // Add frame rate control delay
-                vTaskDelay(pdMS_TO_TICKS(66)); // ~15 FPS (more stable)
+                vTaskDelay(pdMS_TO_TICKS(SD_VIDEO_FRAME_MS)); // ~15 FPS (more stable)
                 
                 // Trigger next load after drawing and delay
                 xTaskNotifyGive(loadBuffer2TaskHandle); // Notify the load task to start loading the next frame
                 active = false; // Reset state to wait for next notification
+                waitStarted = PIPELINE_NOW();
             } else {
-                Serial.println("DrawBuffer2: Failed to acquire display semaphore");
+                LOGB_W(LOG_CAT_VIDEO, "DrawBuffer2: Failed to acquire display semaphore");
                 vTaskDelay(pdMS_TO_TICKS(10));
             }
         }
@@ -268,13 +533,37 @@ void drawBuffer2(void *pvParameters) {
             // Wait for the task to be notified to start drawing with timeout
             if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) > 0) {
                 active = true;
-                Serial.println("Buffer 2 drawing started");
+                PIPELINE_RECORD(STAGE_FRAME_WAIT, PIPELINE_NOW() - waitStarted);
+                LOGB_V(LOG_CAT_VIDEO, "Buffer 2 drawing started");
             }
         }
     }
     vTaskDelete(NULL);
 }
 
+// Undo whatever startSDVideo set up before it failed
+void releaseVideoResources() {
+    for (int i = 0; i < VARIANT_MAX; i++) {
+        delete[] frameStreams[i];
+        frameStreams[i] = nullptr;
+    }
+    if (frameIndexMutex) {
+        vSemaphoreDelete(frameIndexMutex);
+        frameIndexMutex = nullptr;
+    }
+    if (buffer1) MediaArena::free(buffer1);
+    if (buffer2) MediaArena::free(buffer2);
+    if (pipelineStripBuffer) MediaArena::free(pipelineStripBuffer);
+    if (rotateStripBuffer) MediaArena::free(rotateStripBuffer);
+    buffer1 = nullptr;
+    buffer2 = nullptr;
+    pipelineStripBuffer = nullptr;
+    rotateStripBuffer = nullptr;
+    loopCache.clear();
+    Compositor::removeLayer(videoLayer);
+    videoLayer = -1;
+}
+
 void startSDVideo(const char *file_name, int x, int y, int width, int height){
 
     // Initialize watchdog first
@@ -292,30 +581,55 @@ void startSDVideo(const char *file_name, int x, int y, int width, int height){
         Serial.println("Not enough frames found for video playback");
         return;
     }
+    videoVariants[0].pattern = file_name;
+    videoVariants[0].format = VARIANT_RGB332;
+    frameStreams[0] = openFrameStreams(file_name);
+    startVideoVariants();
 
     // Initialize frame management
     currentFrameIndex = 1;
     frameIndexMutex = xSemaphoreCreateMutex();
     if (!frameIndexMutex) {
         Serial.println("Failed to create frame index mutex");
+        releaseVideoResources();
         return;
     }
 
-    buffer1 = (uint8_t *)heap_caps_malloc(width*height*sizeof(uint8_t), MALLOC_CAP_DMA);
-    buffer2 = (uint8_t *)heap_caps_malloc(width*height*sizeof(uint8_t), MALLOC_CAP_DMA);
-    if (!buffer1 || !buffer2) {
+    buffer1 = (uint8_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_VIDEO, width*height*sizeof(uint8_t));
+    buffer2 = (uint8_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_VIDEO, width*height*sizeof(uint8_t));
+    // Frames of the build-time size are converted by SDVideoPipeline
+    bool usePipeline = width == SDVideoPipeline::width && height == SDVideoPipeline::height;
+    pipelineStripBuffer = nullptr;
+    if (usePipeline) {
+        pipelineStripBuffer = (uint16_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_VIDEO, SDVideoPipeline::strip_pixels * sizeof(uint16_t));
+    }
+    if (!buffer1 || !buffer2 || (usePipeline && !pipelineStripBuffer)) {
         Serial.println("Failed to allocate memory for video buffers");
-        if (buffer1) heap_caps_free(buffer1);
-        if (buffer2) heap_caps_free(buffer2);
+        releaseVideoResources();
         return;
     }
 
-    spiMutexBuffer = xSemaphoreCreateMutex();
+    // Short clips are kept in RAM after the first pass when they fit
+    if (loopCacheBudget > 0) {
+        uint32_t budget = loopCacheBudget == SD_VIDEO_LOOP_CACHE_AUTO ? LoopCache::availableBytes() : loopCacheBudget;
+        loopCache.begin(totalFrames, width * height, budget);
+    }
+
+    // Strip for rotated drawing, wide enough for either orientation
+    rotateStripBuffer = (uint8_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_VIDEO, max(width, height) * ROTATE_STRIP_ROWS);
+    if (!rotateStripBuffer) {
+        Serial.println("Failed to allocate rotate strip, frames will be drawn unrotated");
+    }
+
+    // Rotated frames do not match the plane's geometry and are drawn straight
+    if (videoRotation == ROTATE_0 && !videoMirror) {
+        videoLayer = Compositor::addLayer(x, y, width, height, LAYER_FORMAT_RGB332, LAYER_Z_VIDEO);
+    }
+
     spiMutexDisp = xSemaphoreCreateMutex();
-    if (!spiMutexBuffer || !spiMutexDisp) {
+    if (!spiMutexDisp) {
         Serial.println("Failed to create semaphores for video buffers");
-        heap_caps_free(buffer1);
-        heap_caps_free(buffer2);
+        releaseVideoResources();
         return;
     }
 
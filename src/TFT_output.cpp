@@ -4,91 +4,223 @@
 
 #include "FrameSource.h"
 #include "TFT_output.h"
+#include "MediaArena.h"
+#include "JobSystem.h"
+#include "Logger.h"
+#include "PipelineStats.h"
+#include "BootSequencer.h"
+#include "soc/soc_memory_layout.h"
 
 // Event types for TFT display queue
 #define TFT_EVENT_DISPLAY_FRAME 1
 
+// Number of display rows scaled and pushed at a time
+#define TFT_SCALE_STRIP_ROWS 16
+// Rows of a strip scaled per job band
+#define TFT_SCALE_BAND_ROWS 4
+
 typedef struct {
     int type;
+    VideoFrame_t *frame;
 } tft_event_t;
 
+// Frame clock, runs in the esp_timer task
+void tftFrameClock(void *arg)
+{
+    TFT_Output *output = (TFT_Output *)arg;
+    xTaskNotifyGive(output->m_tftDisplayTaskHandle);
+}
+
 void tftDisplayTask(void *param)
 {
     TFT_Output *output = (TFT_Output *)param;
-    VideoFrame_t current_frame;
-    current_frame.data = nullptr;
-    current_frame.size = 0;
-    
-    unsigned long frame_interval = 1000 / output->m_frame_generator->frameRate(); // ms per frame
-    unsigned long last_frame_time = millis();
     
-    Serial.printf("TFT Display Task started. Frame rate: %d FPS, interval: %d ms\n", 
-                  output->m_frame_generator->frameRate(), frame_interval);
+    Serial.printf("TFT Display Task started. Frame interval: %u us\n", output->m_frame_interval_us);
     
-    while (true)
+    while (output->m_running)
     {
-        unsigned long current_time = millis();
+        // Sleep until the frame clock ticks, the CPU is free in between
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!output->m_running) {
+            break;
+        }
         
-        // Check if it's time for the next frame
-        if (current_time - last_frame_time >= frame_interval)
-        {
-            // Get the next frame from the source
-            if (output->m_frame_generator->getNextFrame(&current_frame))
-            {
-                // Display the frame on TFT
-                if (current_frame.data != nullptr && current_frame.size > 0)
-                {
-                    // For now, assume the frame data is in RGB565 format
-                    // Push the frame data directly to the TFT display
-                    output->m_tft->setAddrWindow(output->m_display_x, output->m_display_y, 
-                                               output->m_display_width, output->m_display_height);
-                    
-                    // Calculate expected frame size in RGB565 format (2 bytes per pixel)
-                    uint32_t expected_size = output->m_display_width * output->m_display_height * 2;
-                    
-                    if (current_frame.size >= expected_size)
-                    {
-                        // Push RGB565 data directly to display
-                        output->m_tft->pushColors((uint16_t*)current_frame.data, 
-                                                output->m_display_width * output->m_display_height);
-                    }
-                    else
-                    {
-                        // Handle smaller frame or different format
-                        Serial.printf("Frame size mismatch: expected %d, got %d\n", expected_size, current_frame.size);
-                        
-                        // Fill with a test pattern or scale the available data
-                        uint16_t test_color = random(0xFFFF);
-                        output->m_tft->fillRect(output->m_display_x, output->m_display_y,
-                                              output->m_display_width, output->m_display_height, test_color);
-                    }
-                }
-                last_frame_time = current_time;
-            }
-            else
-            {
-                // Failed to get frame, maybe rewind and try again
-                Serial.println("Failed to get next frame, rewinding...");
-                output->m_frame_generator->rewind();
-                delay(100); // Small delay before retry
-            }
+        tft_event_t event;
+        if (xQueueReceive(output->m_tftQueue, &event, 0) != pdTRUE) {
+            // Decoding fell behind, the last frame stays on screen
+            output->m_late_ticks++;
+            PIPELINE_COUNT(COUNTER_DISPLAY_UNDERRUNS);
+            continue;
         }
-        else
-        {
-            // Wait for the next frame time
-            delay(1);
+        if (event.type == TFT_EVENT_DISPLAY_FRAME) {
+            output->displayFrame(event.frame);
+            BootSequencer::markPlayback();
+            output->m_frames_shown++;
+            xQueueSend(output->m_freeQueue, &event.frame, 0);
         }
+    }
+    
+    xSemaphoreGive(output->m_stoppedSem);
+    vTaskDelete(NULL);
+}
+
+void tftDecodeTask(void *param)
+{
+    TFT_Output *output = (TFT_Output *)param;
+    
+    while (output->m_running)
+    {
+        // Wait for a slot the display has finished with
+        VideoFrame_t *frame;
+        if (xQueueReceive(output->m_freeQueue, &frame, portMAX_DELAY) != pdTRUE || frame == nullptr) {
+            continue;
+        }
+        
+        if (!output->m_frame_generator->getNextFrame(frame)) {
+            // Failed to get frame, maybe rewind and try again
+            LOGB_W(LOG_CAT_DISPLAY, "Failed to get next frame, rewinding");
+            output->m_frame_generator->rewind();
+            xQueueSend(output->m_freeQueue, &frame, 0);
+            vTaskDelay(pdMS_TO_TICKS(100)); // Small delay before retry
+            continue;
+        }
+        
+        tft_event_t event = {TFT_EVENT_DISPLAY_FRAME, frame};
+        xQueueSend(output->m_tftQueue, &event, portMAX_DELAY);
+    }
+    
+    xSemaphoreGive(output->m_stoppedSem);
+    vTaskDelete(NULL);
+}
+
+void TFT_Output::displayFrame(VideoFrame_t *frame)
+{
+    if (frame->data == nullptr || frame->size == 0) {
+        return;
+    }
+    
+    // Calculate expected frame size (2 bytes per pixel for RGB565, 1 for RGB332)
+    bool rgb332 = frame->format == FRAME_FORMAT_RGB332;
+    uint32_t expected_size = m_display_width * m_display_height * (rgb332 ? 1 : 2);
+    bool native_size = frame->width == m_display_width && frame->height == m_display_height;
+    
+    if (native_size && frame->size >= expected_size && rgb332)
+    {
+        PIPELINE_TIME(STAGE_SPI_PUSH);
+        // TFT_eSPI expands RGB332 as it sends, so frames can come
+        // straight out of flash without a RAM copy
+        m_tft->pushImage(m_display_x, m_display_y, m_display_width, m_display_height, frame->data, true);
+    }
+    else if (native_size && frame->size >= expected_size)
+    {
+        PIPELINE_TIME(STAGE_SPI_PUSH);
+        // Push RGB565 data directly to display
+        m_tft->setAddrWindow(m_display_x, m_display_y, m_display_width, m_display_height);
+        m_tft->pushColors((uint16_t*)frame->data, m_display_width * m_display_height);
+    }
+    else if (!native_size && pushScaledFrame(frame))
+    {
+        // Frame was resized to the window strip by strip
+    }
+    else
+    {
+        // Handle smaller frame or different format
+        LOGB_W(LOG_CAT_DISPLAY, "Frame size mismatch: expected %u, got %u", expected_size, frame->size);
         
-        // Yield to other tasks occasionally
-        if (current_time % 100 == 0) {
-            vTaskDelay(1);
+        // Fill with a test pattern or scale the available data
+        uint16_t test_color = random(0xFFFF);
+        m_tft->fillRect(m_display_x, m_display_y, m_display_width, m_display_height, test_color);
+    }
+}
+
+typedef struct {
+    FrameScaler *scaler;
+    const uint8_t *src;
+    uint8_t *strip;
+    int first_row;
+    int width;
+    bool rgb332;
+} scale_strip_job_t;
+
+// Scale part of a strip, the strip's bands run on both cores
+static void scaleStripBand(int first_row, int rows, void *arg)
+{
+    scale_strip_job_t *job = (scale_strip_job_t *)arg;
+    if (job->rgb332) {
+        job->scaler->scaleStrip(job->src, job->strip + first_row * job->width, job->first_row + first_row, rows);
+    } else {
+        job->scaler->scaleStrip((const uint16_t *)job->src, (uint16_t *)job->strip + first_row * job->width,
+                                job->first_row + first_row, rows);
+    }
+}
+
+bool TFT_Output::pushScaledFrame(VideoFrame_t *frame)
+{
+    bool rgb332 = frame->format == FRAME_FORMAT_RGB332;
+    if (frame->width == 0 || frame->height == 0 ||
+        frame->size < (uint32_t)frame->width * frame->height * (rgb332 ? 1 : 2)) {
+        return false;
+    }
+    
+    // Tables are only rebuilt when the source geometry or mode changes
+    if (!m_scaler.configure(frame->width, frame->height, m_display_width, m_display_height, m_scale_mode)) {
+        return false;
+    }
+    
+    if (m_strip == nullptr) {
+        m_strip_rows = min(TFT_SCALE_STRIP_ROWS, m_display_height);
+        m_strip = (uint16_t*)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_DISPLAY,
+                                               m_display_width * m_strip_rows * sizeof(uint16_t));
+        if (m_strip == nullptr) {
+            return false;
         }
     }
     
-    // Cleanup
-    if (current_frame.data != nullptr) {
-        free(current_frame.data);
+    scale_strip_job_t job;
+    job.scaler = &m_scaler;
+    job.src = frame->data;
+    job.strip = (uint8_t*)m_strip;
+    job.width = m_display_width;
+    job.rgb332 = rgb332;
+    
+    uint32_t scale_us = 0;
+    uint32_t started = PIPELINE_NOW();
+    for (int row = 0; row < m_display_height; row += m_strip_rows) {
+        int rows = min(m_strip_rows, m_display_height - row);
+        job.first_row = row;
+        uint32_t scale_started = PIPELINE_NOW();
+        JobSystem::parallelRows(rows, scaleStripBand, &job, TFT_SCALE_BAND_ROWS);
+        scale_us += PIPELINE_NOW() - scale_started;
+        if (rgb332) {
+            // 8-bit frames are resampled nearest-neighbour into the same strip
+            m_tft->pushImage(m_display_x, m_display_y + row, m_display_width, rows, (uint8_t*)m_strip, true);
+            continue;
+        }
+        m_tft->setAddrWindow(m_display_x, m_display_y + row, m_display_width, rows);
+        m_tft->pushColors(m_strip, m_display_width * rows);
     }
+    PIPELINE_RECORD(STAGE_CONVERT, scale_us);
+    PIPELINE_RECORD(STAGE_SPI_PUSH, PIPELINE_NOW() - started - scale_us);
+    return true;
+}
+
+TFT_Output::TFT_Output()
+{
+    m_tftDisplayTaskHandle = nullptr;
+    m_decodeTaskHandle = nullptr;
+    m_tftQueue = nullptr;
+    m_freeQueue = nullptr;
+    m_stoppedSem = nullptr;
+    m_frame_timer = nullptr;
+    m_frame_interval_us = 0;
+    m_running = false;
+    m_paused = false;
+    m_frames_shown = 0;
+    m_late_ticks = 0;
+    m_scale_mode = SCALE_NEAREST;
+    m_strip = nullptr;
+    m_strip_rows = 0;
+    memset(m_frames, 0, sizeof(m_frames));
 }
 
 void TFT_Output::start(TFT_eSPI *tft, FrameSource *frame_generator, int x, int y, int width, int height)
@@ -99,32 +231,123 @@ void TFT_Output::start(TFT_eSPI *tft, FrameSource *frame_generator, int x, int y
     m_display_y = y;
     m_display_width = width;
     m_display_height = height;
-    m_last_frame_time = millis();
+    m_frames_shown = 0;
+    m_late_ticks = 0;
+    m_paused = false;
     
-    // Calculate frame interval in milliseconds
-    m_frame_interval_ms = 1000 / m_frame_generator->frameRate();
+    // Frame period in microseconds, exact for fractional rates
+    m_frame_interval_us = m_frame_generator->frameIntervalUs();
+    if (m_frame_interval_us == 0) {
+        m_frame_interval_us = 1000000 / 15;
+    }
     
-    Serial.printf("Starting TFT Output: %dx%d at (%d,%d), %d FPS\n", 
-                  width, height, x, y, m_frame_generator->frameRate());
+    Serial.printf("Starting TFT Output: %dx%d at (%d,%d), %u us per frame\n", 
+                  width, height, x, y, m_frame_interval_us);
     
-    // Create TFT display queue (not strictly needed for this implementation but following I2S pattern)
-    m_tftQueue = xQueueCreate(4, sizeof(tft_event_t));
+    // Decoded frames go display-wards through m_tftQueue, emptied slots
+    // come back through m_freeQueue
+    m_tftQueue = xQueueCreate(TFT_FRAME_SLOTS, sizeof(tft_event_t));
+    m_freeQueue = xQueueCreate(TFT_FRAME_SLOTS + 1, sizeof(VideoFrame_t *));
+    m_stoppedSem = xSemaphoreCreateCounting(2, 0);
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = tftFrameClock;
+    timer_args.arg = this;
+    timer_args.name = "tft_frame";
+    if (m_tftQueue == nullptr || m_freeQueue == nullptr || m_stoppedSem == nullptr ||
+        esp_timer_create(&timer_args, &m_frame_timer) != ESP_OK) {
+        Serial.println("TFT Output: failed to create queues or frame clock");
+        stop();
+        return;
+    }
+    for (int i = 0; i < TFT_FRAME_SLOTS; i++) {
+        VideoFrame_t *frame = &m_frames[i];
+        xQueueSend(m_freeQueue, &frame, 0);
+    }
     
     // Clear the display area
     m_tft->fillRect(m_display_x, m_display_y, m_display_width, m_display_height, TFT_BLACK);
     
-    // Start a task to display frames on the TFT
-    xTaskCreate(tftDisplayTask, "TFT Display Task", 8192, this, 2, &m_tftDisplayTaskHandle);
+    // Start a task to display frames on the TFT, ahead of the decoder so
+    // a tick is never late because decoding holds the CPU
+    m_running = true;
+    xTaskCreate(tftDisplayTask, "TFT Display Task", 8192, this, 3, &m_tftDisplayTaskHandle);
+    xTaskCreate(tftDecodeTask, "TFT Decode Task", 8192, this, 2, &m_decodeTaskHandle);
+    startClock();
     
     Serial.println("TFT Output started successfully");
 }
 
+void TFT_Output::startClock()
+{
+    if (m_frame_timer != nullptr && !m_paused) {
+        esp_timer_stop(m_frame_timer);
+        esp_timer_start_periodic(m_frame_timer, m_frame_interval_us);
+    }
+}
+
+void TFT_Output::pause()
+{
+    m_paused = true;
+    if (m_frame_timer != nullptr) {
+        esp_timer_stop(m_frame_timer);
+    }
+}
+
+void TFT_Output::resume()
+{
+    m_paused = false;
+    startClock();
+}
+
+void TFT_Output::setFrameRate(float fps)
+{
+    if (fps > 0) {
+        setFrameInterval((uint32_t)(1000000.0f / fps + 0.5f));
+    }
+}
+
+void TFT_Output::setFrameInterval(uint32_t interval_us)
+{
+    if (interval_us == 0) {
+        return;
+    }
+    m_frame_interval_us = interval_us;
+    startClock();
+}
+
 void TFT_Output::stop()
 {
-    if (m_tftDisplayTaskHandle != nullptr)
+    if (m_frame_timer != nullptr)
+    {
+        esp_timer_stop(m_frame_timer);
+        esp_timer_delete(m_frame_timer);
+        m_frame_timer = nullptr;
+    }
+    
+    // Wake both tasks and let them finish the frame they are on
+    if (m_running)
     {
-        vTaskDelete(m_tftDisplayTaskHandle);
+        m_running = false;
+        VideoFrame_t *wake = nullptr;
+        xTaskNotifyGive(m_tftDisplayTaskHandle);
+        xQueueSend(m_freeQueue, &wake, 0);
+        xQueueReset(m_tftQueue);
+        // The tasks use the queues, semaphore and slots below until they
+        // give m_stoppedSem, so nothing is freed before both have. A task
+        // can be held up by a slow card read, so keep waiting and say so.
+        int stopped = 0;
+        while (stopped < 2) {
+            if (xSemaphoreTake(m_stoppedSem, pdMS_TO_TICKS(1000)) == pdTRUE) {
+                stopped++;
+                continue;
+            }
+            Serial.println("TFT Output: still waiting for a task to stop");
+            // In case the decode task has since blocked on either queue
+            xQueueSend(m_freeQueue, &wake, 0);
+            xQueueReset(m_tftQueue);
+        }
         m_tftDisplayTaskHandle = nullptr;
+        m_decodeTaskHandle = nullptr;
     }
     
     if (m_tftQueue != nullptr)
@@ -132,6 +355,33 @@ void TFT_Output::stop()
         vQueueDelete(m_tftQueue);
         m_tftQueue = nullptr;
     }
+    if (m_freeQueue != nullptr)
+    {
+        vQueueDelete(m_freeQueue);
+        m_freeQueue = nullptr;
+    }
+    if (m_stoppedSem != nullptr)
+    {
+        vSemaphoreDelete(m_stoppedSem);
+        m_stoppedSem = nullptr;
+    }
+    
+    // Slots the source filled with its own buffers; frames that point into
+    // mapped flash were never allocated
+    for (int i = 0; i < TFT_FRAME_SLOTS; i++)
+    {
+        if (m_frames[i].data != nullptr && !esp_ptr_in_drom(m_frames[i].data)) {
+            MediaArena::free(m_frames[i].data);
+        }
+        m_frames[i].data = nullptr;
+        m_frames[i].size = 0;
+    }
+    
+    if (m_strip != nullptr)
+    {
+        MediaArena::free(m_strip);
+        m_strip = nullptr;
+    }
     
     Serial.println("TFT Output stopped");
 }
@@ -0,0 +1,187 @@
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "Tracer.h"
+
+// Tasks named in one dump; the pipeline has far fewer
+#define TRACE_MAX_TASKS 16
+
+static_assert(sizeof(trace_event_t) == 16, "trace records are dumped as 16 bytes");
+
+static trace_event_t s_events[TRACE_CAPACITY];
+static uint32_t s_next = 0;
+static bool s_armed = false;
+// Trace points between checking s_armed and finishing their store
+static uint32_t s_writers = 0;
+// esp_timer rather than the cycle counter, which is separate on each core
+static int64_t s_start_us = 0;
+// Names copied by each task on its first event, since a task can be deleted
+// before the dump and its handle must not be dereferenced then
+static uint32_t s_taskHandles[TRACE_MAX_TASKS];
+static char s_taskNames[TRACE_MAX_TASKS][configMAX_TASK_NAME_LEN];
+static uint32_t s_taskSlots = 0;
+
+static const char *EVENT_NAMES[TRACE_EVENT_COUNT] = {
+    "load", "handoff", "draw", "mutex_wait", "audio_batch", "sd_read", "wdt_feed"
+};
+static const char PHASE_CHARS[] = "BEi";
+
+void Tracer::start()
+{
+    stop();
+    s_next = 0;
+    s_taskSlots = 0;
+    memset(s_taskHandles, 0, sizeof(s_taskHandles));
+    s_start_us = esp_timer_get_time();
+    __atomic_store_n(&s_armed, true, __ATOMIC_RELEASE);
+}
+
+void Tracer::stop()
+{
+    __atomic_store_n(&s_armed, false, __ATOMIC_RELEASE);
+    // Let trace points that saw the capture armed finish their record
+    while (__atomic_load_n(&s_writers, __ATOMIC_ACQUIRE) != 0) {
+        vTaskDelay(1);
+    }
+}
+
+bool Tracer::recording()
+{
+    return __atomic_load_n(&s_armed, __ATOMIC_RELAXED);
+}
+
+// Only the task itself registers its handle, so it can never be added twice
+static void noteTask(uint32_t task)
+{
+    uint32_t slots = min(__atomic_load_n(&s_taskSlots, __ATOMIC_ACQUIRE), (uint32_t)TRACE_MAX_TASKS);
+    for (uint32_t i = 0; i < slots; i++) {
+        if (__atomic_load_n(&s_taskHandles[i], __ATOMIC_ACQUIRE) == task) {
+            return;
+        }
+    }
+    uint32_t slot = __atomic_fetch_add(&s_taskSlots, 1, __ATOMIC_ACQ_REL);
+    if (slot < TRACE_MAX_TASKS) {
+        strncpy(s_taskNames[slot], pcTaskGetTaskName(nullptr), configMAX_TASK_NAME_LEN - 1);
+        s_taskNames[slot][configMAX_TASK_NAME_LEN - 1] = '\0';
+        __atomic_store_n(&s_taskHandles[slot], task, __ATOMIC_RELEASE);
+    }
+}
+
+void Tracer::record(TraceEvent event, TracePhase phase, uint32_t arg)
+{
+    if (!__atomic_load_n(&s_armed, __ATOMIC_RELAXED)) {
+        return;
+    }
+    __atomic_fetch_add(&s_writers, 1, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s_armed, __ATOMIC_ACQUIRE)) {
+        uint32_t index = __atomic_fetch_add(&s_next, 1, __ATOMIC_RELAXED);
+        if (index < TRACE_CAPACITY) {
+            trace_event_t *record = &s_events[index];
+            uint32_t task = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+            noteTask(task);
+            record->time_us = (uint32_t)(esp_timer_get_time() - s_start_us);
+            record->task = task;
+            record->arg = arg;
+            record->event = event;
+            record->phase = phase;
+            record->core = xPortGetCoreID();
+            record->reserved = 0;
+        } else {
+            // Full, the capture ends here
+            __atomic_store_n(&s_armed, false, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_sub(&s_writers, 1, __ATOMIC_RELEASE);
+}
+
+const char *Tracer::eventName(TraceEvent event)
+{
+    return event < TRACE_EVENT_COUNT ? EVENT_NAMES[event] : "?";
+}
+
+static uint32_t capturedEvents()
+{
+    return min(s_next, (uint32_t)TRACE_CAPACITY);
+}
+
+// Distinct tasks in the capture, in order of first appearance
+static int collectTasks(uint32_t *tasks)
+{
+    int count = 0;
+    uint32_t events = capturedEvents();
+    for (uint32_t i = 0; i < events; i++) {
+        int t = 0;
+        while (t < count && tasks[t] != s_events[i].task) {
+            t++;
+        }
+        if (t == count && count < TRACE_MAX_TASKS) {
+            tasks[count++] = s_events[i].task;
+        }
+    }
+    return count;
+}
+
+// From the names copied during the capture; called once it has stopped
+static const char *taskName(uint32_t task)
+{
+    uint32_t slots = min(s_taskSlots, (uint32_t)TRACE_MAX_TASKS);
+    for (uint32_t i = 0; i < slots; i++) {
+        if (s_taskHandles[i] == task) {
+            return s_taskNames[i];
+        }
+    }
+    return "?";
+}
+
+void Tracer::dumpJson(Print &out)
+{
+    stop();
+    uint32_t tasks[TRACE_MAX_TASKS];
+    int task_count = collectTasks(tasks);
+    uint32_t events = capturedEvents();
+
+    out.print("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int t = 0; t < task_count; t++) {
+        out.printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n",
+                   tasks[t], taskName(tasks[t]));
+    }
+    for (uint32_t i = 0; i < events; i++) {
+        const trace_event_t *record = &s_events[i];
+        out.printf("{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":1,\"tid\":%u,%s\"args\":{\"arg\":%u,\"core\":%u}}%s\n",
+                   eventName((TraceEvent)record->event), PHASE_CHARS[record->phase > 2 ? 2 : record->phase],
+                   record->time_us, record->task, record->phase == TRACE_PHASE_INSTANT ? "\"s\":\"t\"," : "",
+                   record->arg, record->core, i + 1 < events ? "," : "");
+    }
+    out.print("]}\n");
+}
+
+void Tracer::dumpBinary(Print &out)
+{
+    stop();
+    uint32_t tasks[TRACE_MAX_TASKS];
+    int task_count = collectTasks(tasks);
+    uint32_t events = capturedEvents();
+
+    // Line oriented so it survives being captured from a serial monitor
+    // along with log output; every record line starts with "T "
+    out.printf("trace: begin %u %u\n", events, TRACE_CAPACITY);
+    for (int t = 0; t < task_count; t++) {
+        out.printf("trace: task %08x %s\n", tasks[t], taskName(tasks[t]));
+    }
+    for (uint32_t i = 0; i < events; i++) {
+        const uint8_t *bytes = (const uint8_t *)&s_events[i];
+        char line[2 + 2 * sizeof(trace_event_t) + 1];
+        line[0] = 'T';
+        line[1] = ' ';
+        for (size_t b = 0; b < sizeof(trace_event_t); b++) {
+            static const char HEX_DIGITS[] = "0123456789abcdef";
+            line[2 + 2 * b] = HEX_DIGITS[bytes[b] >> 4];
+            line[3 + 2 * b] = HEX_DIGITS[bytes[b] & 0x0F];
+        }
+        line[sizeof(line) - 1] = '\0';
+        out.println(line);
+    }
+    out.println("trace: end");
+}
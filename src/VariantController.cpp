@@ -0,0 +1,176 @@
+#include "VariantController.h"
+#include "Logger.h"
+
+VariantController::VariantController()
+{
+    m_count = 0;
+    m_current = 0;
+    m_budget_us = 0;
+    m_ns_per_byte = 0;
+    m_down_votes = 0;
+    m_up_votes = 0;
+    m_switches = 0;
+    m_mux = portMUX_INITIALIZER_UNLOCKED;
+}
+
+bool VariantController::begin(const uint32_t *frame_bytes, int count, uint32_t budget_us)
+{
+    if (count < 1 || count > VARIANT_MAX) {
+        Serial.printf("Variant controller: %d variants, at most %d supported\n", count, VARIANT_MAX);
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        if (frame_bytes[i] == 0 || (i > 0 && frame_bytes[i] >= frame_bytes[i - 1])) {
+            Serial.println("Variant controller: variants must get cheaper in order");
+            return false;
+        }
+    }
+    portENTER_CRITICAL(&m_mux);
+    memcpy(m_frame_bytes, frame_bytes, count * sizeof(uint32_t));
+    m_count = count;
+    m_current = 0;
+    m_budget_us = budget_us;
+    m_ns_per_byte = 0;
+    m_down_votes = 0;
+    m_up_votes = 0;
+    m_switches = 0;
+    portEXIT_CRITICAL(&m_mux);
+    return true;
+}
+
+int VariantController::current()
+{
+    portENTER_CRITICAL(&m_mux);
+    int variant = m_current;
+    portEXIT_CRITICAL(&m_mux);
+    return variant;
+}
+
+uint32_t VariantController::predictLocked(int variant)
+{
+    return (uint32_t)((uint64_t)m_frame_bytes[variant] * m_ns_per_byte / 1000);
+}
+
+uint32_t VariantController::predictedUs(int variant)
+{
+    if (variant < 0 || variant >= m_count) {
+        return 0;
+    }
+    portENTER_CRITICAL(&m_mux);
+    uint32_t predicted = predictLocked(variant);
+    portEXIT_CRITICAL(&m_mux);
+    return predicted;
+}
+
+int VariantController::recordLoad(uint32_t bytes, uint32_t elapsed_us)
+{
+    if (m_count == 0 || bytes == 0) {
+        return 0;
+    }
+    // Per-request overhead is folded into the cost per byte, which makes
+    // estimates taken on a small variant pessimistic for larger ones, so
+    // stepping back up errs on the safe side
+    uint32_t sample = (uint32_t)min((uint64_t)elapsed_us * 1000 / bytes, (uint64_t)UINT32_MAX);
+    int from, to;
+
+    portENTER_CRITICAL(&m_mux);
+    if (m_ns_per_byte == 0) {
+        m_ns_per_byte = sample;
+    } else {
+        m_ns_per_byte = (uint32_t)((int32_t)m_ns_per_byte + (((int32_t)sample - (int32_t)m_ns_per_byte) >> VARIANT_EWMA_SHIFT));
+    }
+
+    from = m_current;
+    uint64_t down_limit = (uint64_t)m_budget_us * VARIANT_DOWN_PERCENT / 100;
+    uint64_t up_limit = (uint64_t)m_budget_us * VARIANT_UP_PERCENT / 100;
+    if (predictLocked(m_current) > down_limit) {
+        m_up_votes = 0;
+        if (m_current < m_count - 1 && ++m_down_votes >= VARIANT_DOWN_FRAMES) {
+            m_current++;
+            m_down_votes = 0;
+        }
+    } else if (m_current > 0 && predictLocked(m_current - 1) < up_limit) {
+        m_down_votes = 0;
+        if (++m_up_votes >= VARIANT_UP_FRAMES) {
+            m_current--;
+            m_up_votes = 0;
+        }
+    } else {
+        m_down_votes = 0;
+        m_up_votes = 0;
+    }
+    to = m_current;
+    if (to != from) {
+        m_switches++;
+    }
+    uint32_t ns_per_byte = m_ns_per_byte;
+    portEXIT_CRITICAL(&m_mux);
+
+    if (to != from) {
+        LOGB_I(LOG_CAT_VIDEO, "Variant %d -> %d (%u ns/byte, budget %u us)", from, to, ns_per_byte, m_budget_us);
+    }
+    return to;
+}
+
+uint32_t VariantController::frameBytes(VariantFormat format, int width, int height)
+{
+    switch (format) {
+    case VARIANT_INDEXED4:
+        return 16 + (width * height + 1) / 2;
+    case VARIANT_RGB332_HALF:
+        return (width / 2) * (height / 2);
+    default:
+        return width * height;
+    }
+}
+
+bool VariantController::expandInPlace(VariantFormat format, uint8_t *buffer, int width, int height)
+{
+    uint32_t frame_bytes = width * height;
+    const uint8_t *src = buffer + frame_bytes - frameBytes(format, width, height);
+
+    switch (format) {
+    case VARIANT_RGB332:
+        return true;
+
+    case VARIANT_INDEXED4: {
+        // The palette sits where the first pixels land, copy it out first.
+        // Pixel i is written no later than index byte i / 2 is read, so the
+        // forward pass never overwrites data it still needs.
+        uint8_t palette[16];
+        memcpy(palette, src, sizeof(palette));
+        const uint8_t *indices = src + sizeof(palette);
+        uint32_t pairs = frame_bytes / 2;
+        for (uint32_t i = 0; i < pairs; i++) {
+            uint8_t packed = indices[i];
+            buffer[2 * i] = palette[packed >> 4];
+            buffer[2 * i + 1] = palette[packed & 0x0F];
+        }
+        if (frame_bytes & 1) {
+            buffer[frame_bytes - 1] = palette[indices[pairs] >> 4];
+        }
+        return true;
+    }
+
+    case VARIANT_RGB332_HALF: {
+        if ((width | height) & 1) {
+            return false;
+        }
+        // Output rows 2y and 2y + 1 end before source row y + 1 starts, so
+        // expanding top to bottom is safe
+        int half_width = width / 2;
+        for (int y = 0; y < height / 2; y++) {
+            const uint8_t *src_row = src + y * half_width;
+            uint8_t *dst_row = buffer + 2 * y * width;
+            for (int x = 0; x < half_width; x++) {
+                uint8_t c = src_row[x];
+                dst_row[2 * x] = c;
+                dst_row[2 * x + 1] = c;
+            }
+            memcpy(dst_row + width, dst_row, width);
+        }
+        return true;
+    }
+    }
+    return false;
+}
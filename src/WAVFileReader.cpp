@@ -1,6 +1,12 @@
 #include <SD.h>
 #include <FS.h>
 #include "WAVFileReader.h"
+#include "SDScheduler.h"
+#include "FatVolume.h"
+#include "PipelineStats.h"
+
+// A getFrames() call is a few milliseconds of audio, the card has to keep up
+#define WAV_READ_DEADLINE_MS 10
 
 
 void WAVFileReader::PrintData(const char* Data,uint8_t NumBytes)
@@ -101,6 +107,11 @@ void WAVFileReader::DumpWAVHeader(wav_header_t* Wav)
 
 WAVFileReader::WAVFileReader(const char *file_name)
 {
+    m_num_channels = 1;
+    m_sample_rate = 0;
+    m_data_start = 0;
+    m_data_end = 0;
+    m_position = 0;
     if (!SD.exists(file_name))
     {
         Serial.println("****** Failed to open file! Have you uploaed the file system?");
@@ -169,6 +180,19 @@ WAVFileReader::WAVFileReader(const char *file_name)
 
     m_num_channels = wav_header.num_channels;
     m_sample_rate = wav_header.sample_rate;
+
+    // Samples run from here to the end of the data chunk
+    m_data_start = m_file.position();
+    m_data_end = m_data_start + wav_header.data_bytes;
+    if (wav_header.data_bytes == 0 || m_data_end > m_file.size()) {
+        m_data_end = m_file.size();
+    }
+    m_position = m_data_start;
+
+    // Stream straight from the card's sectors when the file is contiguous
+    if (m_stream.open(getSDVolume(), file_name)) {
+        Serial.printf("Streaming %s from sector %u\n", file_name, m_stream.startSector());
+    }
 }
 
 WAVFileReader::~WAVFileReader()
@@ -178,25 +202,54 @@ WAVFileReader::~WAVFileReader()
 
 void WAVFileReader::getFrames(Frame_t *frames, int number_frames)
 {
-    // fill the buffer with data from the file wrapping around if necessary
-    for (int i = 0; i < number_frames; i++)
+    // Read the samples in bulk through the SD scheduler, which serves audio
+    // ahead of video. Stereo samples land directly in frames, mono samples
+    // are read into the back half of the buffer and spread out below.
+    uint32_t bytes_per_frame = m_num_channels * sizeof(int16_t);
+    uint32_t wanted = number_frames * bytes_per_frame;
+    uint8_t *raw = (uint8_t *)frames + number_frames * sizeof(Frame_t) - wanted;
+    uint32_t filled = 0;
+
+    while (filled < wanted)
     {
-        // if we've reached the end of the file then seek back to the beginning (after the header)
-        if (m_file.available() == 0)
+        // if we've reached the end of the data then go back to the beginning (after the header)
+        if (m_position >= m_data_end)
+        {
+            m_position = m_data_start;
+        }
+        if (m_data_end <= m_data_start)
         {
-            m_file.seek(44);
+            break;
         }
-        // read in the next sample to the left channel
-        m_file.read((uint8_t *)(&frames[i].left), sizeof(int16_t));
-        // if we only have one channel duplicate the sample for the right channel
-        if (m_num_channels == 1)
+        uint32_t chunk = min(wanted - filled, m_data_end - m_position);
+        int32_t bytes = m_stream.isOpen()
+                             ? SDScheduler::readStream(SD_CLIENT_AUDIO, &m_stream, m_position, raw + filled, chunk,
+                                                       WAV_READ_DEADLINE_MS)
+                             : SDScheduler::read(SD_CLIENT_AUDIO, &m_file, m_position, raw + filled, chunk,
+                                                 WAV_READ_DEADLINE_MS);
+        if (bytes <= 0)
         {
-            frames[i].right = frames[i].left;
+            break;
         }
-        else
+        filled += bytes;
+        m_position += bytes;
+    }
+    // play silence rather than stale samples if the card failed us
+    if (filled < wanted)
+    {
+        PIPELINE_COUNT(COUNTER_AUDIO_UNDERRUNS);
+        memset(raw + filled, 0, wanted - filled);
+    }
+
+    // if we only have one channel duplicate the sample for the right channel
+    if (m_num_channels == 1)
+    {
+        const int16_t *samples = (const int16_t *)raw;
+        for (int i = 0; i < number_frames; i++)
         {
-            // otherwise read in the right channel sample
-            m_file.read((uint8_t *)(&frames[i].right), sizeof(int16_t));
+            int16_t sample = samples[i];
+            frames[i].left = sample;
+            frames[i].right = sample;
         }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include "esp_timer.h"
+
+#include "Bench.h"
+
+static uint32_t s_samples[BENCH_MAX_SAMPLES];
+
+static uint32_t percentileOf(const uint32_t *sorted, int count, int percent)
+{
+    int index = (count * percent + 99) / 100 - 1;
+    return sorted[index < 0 ? 0 : min(index, count - 1)];
+}
+
+bool Bench::run(const char *name, uint32_t bytes_per_op, bench_fn_t fn, void *arg, int iterations,
+                bench_result_t *result)
+{
+    iterations = max(1, min(iterations, BENCH_MAX_SAMPLES));
+    if (!fn(arg)) {
+        Serial.printf("BENCH {\"name\":\"%s\",\"error\":\"failed\"}\n", name);
+        return false;
+    }
+
+    uint64_t total_us = 0;
+    for (int i = 0; i < iterations; i++) {
+        int64_t started = esp_timer_get_time();
+        bool ok = fn(arg);
+        s_samples[i] = (uint32_t)(esp_timer_get_time() - started);
+        if (!ok) {
+            Serial.printf("BENCH {\"name\":\"%s\",\"error\":\"failed at iteration %d\"}\n", name, i);
+            return false;
+        }
+        total_us += s_samples[i];
+        // Long cases would otherwise starve the idle task's watchdog
+        if ((i & 7) == 7) {
+            vTaskDelay(1);
+        }
+    }
+    std::sort(s_samples, s_samples + iterations);
+
+    bench_result_t r;
+    r.iterations = iterations;
+    r.mean_us = (uint32_t)(total_us / iterations);
+    r.p50_us = percentileOf(s_samples, iterations, 50);
+    r.p90_us = percentileOf(s_samples, iterations, 90);
+    r.p99_us = percentileOf(s_samples, iterations, 99);
+    r.max_us = s_samples[iterations - 1];
+    r.mbps = bytes_per_op && total_us ? (float)bytes_per_op * iterations / total_us : 0;
+
+    Serial.printf("BENCH {\"name\":\"%s\",\"bytes\":%u,\"iters\":%u,\"mean_us\":%u,\"p50_us\":%u,"
+                  "\"p90_us\":%u,\"p99_us\":%u,\"max_us\":%u,\"mbps\":%.3f}\n",
+                  name, bytes_per_op, r.iterations, r.mean_us, r.p50_us, r.p90_us, r.p99_us, r.max_us, r.mbps);
+    if (result != nullptr) {
+        *result = r;
+    }
+    return true;
+}
+
+void Bench::printConfig(const char *config)
+{
+    Serial.printf("BENCH {\"config\":\"%s\",\"cpu_mhz\":%u,\"psram\":%s}\n", config, getCpuFrequencyMhz(),
+                  psramFound() ? "true" : "false");
+}
@@ -0,0 +1,41 @@
+#ifndef __bench_h__
+#define __bench_h__
+
+#include <Arduino.h>
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 50
+#endif
+#define BENCH_MAX_SAMPLES 256
+
+// One operation under test, false when it failed
+typedef bool (*bench_fn_t)(void *arg);
+
+typedef struct
+{
+    uint32_t iterations;
+    uint32_t mean_us;
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    float mbps;         // bytes_per_op over the mean, 0 when not a byte stream
+} bench_result_t;
+
+/**
+ * Times a benchmark case: one untimed warm-up call, then each iteration on
+ * its own so the latency spread is kept, not just the total. Results are
+ * printed as one JSON object per line, prefixed "BENCH ", for
+ * Python Scripts/Bench/bench_compare.py to record and compare.
+ **/
+class Bench
+{
+public:
+    static bool run(const char *name, uint32_t bytes_per_op, bench_fn_t fn, void *arg,
+                    int iterations = BENCH_ITERATIONS, bench_result_t *result = nullptr);
+    // Header line naming the build, so baselines from different boards or
+    // dataset sizes are not compared with each other
+    static void printConfig(const char *config);
+};
+
+#endif
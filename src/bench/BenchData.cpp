@@ -0,0 +1,427 @@
+#include <SD.h>
+#include <FS.h>
+
+#include "BenchData.h"
+#include "BenchKernels.h"
+#include "AVIFileReader.h"
+#include "WAVFileReader.h"
+
+#define BENCH_WRITE_CHUNK 4096
+#define BENCH_SAMPLE_RATE 44100
+
+// Shared scratch for generating data, kept off the loop task's stack
+static uint8_t s_chunk[BENCH_WRITE_CHUNK];
+
+// Regenerating a dataset is slow, skip it when the file is already there
+static bool upToDate(const char *path, uint32_t size)
+{
+    if (!SD.exists(path)) {
+        return false;
+    }
+    File file = SD.open(path, FILE_READ);
+    bool matches = file && file.size() == size;
+    file.close();
+    return matches;
+}
+
+static File createFile(const char *path)
+{
+    // Make the parent directories
+    char dir[64];
+    strncpy(dir, path, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+    for (char *slash = strchr(dir + 1, '/'); slash != nullptr; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (!SD.exists(dir)) {
+            SD.mkdir(dir);
+        }
+        *slash = '/';
+    }
+    File file = SD.open(path, FILE_WRITE);
+    if (!file) {
+        Serial.printf("Bench: failed to create %s\n", path);
+    }
+    return file;
+}
+
+static bool writeAll(File &file, const void *data, uint32_t bytes)
+{
+    return file.write((const uint8_t *)data, bytes) == bytes;
+}
+
+bool writeBenchWav(const char *path, int seconds)
+{
+    uint32_t frames = (uint32_t)BENCH_SAMPLE_RATE * seconds;
+    uint32_t data_bytes = frames * 4;
+    if (upToDate(path, sizeof(wav_header_t) + data_bytes)) {
+        return true;
+    }
+
+    wav_header_t header;
+    memcpy(header.riff_header, "RIFF", 4);
+    header.wav_size = sizeof(wav_header_t) - 8 + data_bytes;
+    memcpy(header.wave_header, "WAVE", 4);
+    memcpy(header.fmt_header, "fmt ", 4);
+    header.fmt_chunk_size = 16;
+    header.audio_format = 1;
+    header.num_channels = 2;
+    header.sample_rate = BENCH_SAMPLE_RATE;
+    header.byte_rate = BENCH_SAMPLE_RATE * 4;
+    header.sample_alignment = 4;
+    header.bit_depth = 16;
+    memcpy(header.data_header, "data", 4);
+    header.data_bytes = data_bytes;
+
+    File file = createFile(path);
+    if (!file) {
+        return false;
+    }
+    bool ok = writeAll(file, &header, sizeof(header));
+
+    // Triangle sweep, cheap to generate and never silent
+    int16_t *samples = (int16_t *)s_chunk;
+    uint32_t phase = 0;
+    uint32_t written = 0;
+    while (ok && written < frames) {
+        uint32_t count = min(frames - written, (uint32_t)(BENCH_WRITE_CHUNK / 4));
+        for (uint32_t i = 0; i < count; i++) {
+            phase += 0x20000 + ((written + i) >> 4);
+            int32_t tri = (int32_t)(phase >> 16);
+            tri = tri < 0x8000 ? tri : 0xFFFF - tri;
+            samples[2 * i] = (int16_t)(tri - 0x4000);
+            samples[2 * i + 1] = (int16_t)(0x4000 - tri);
+        }
+        ok = writeAll(file, samples, count * 4);
+        written += count;
+    }
+    file.close();
+    return ok;
+}
+
+bool writeBenchAvi(const char *path, int width, int height, int frames)
+{
+    uint32_t frame_bytes = (uint32_t)width * height * 2;
+    uint32_t movi_bytes = 4 + frames * (8 + frame_bytes);
+    uint32_t total = sizeof(avi_header_t) + 8 + movi_bytes;
+    if (upToDate(path, total)) {
+        return true;
+    }
+
+    // RIFF header, an hdrl list holding only avih, then the movi list
+    avi_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.riff_header, "RIFF", 4);
+    header.file_size = total - 8;
+    memcpy(header.file_type, "AVI ", 4);
+    memcpy(header.list_header, "LIST", 4);
+    header.list_size = 4 + 8 + 56;
+    memcpy(header.list_type, "hdrl", 4);
+    memcpy(header.avih_header, "avih", 4);
+    header.avih_size = 56;
+    header.micro_sec_per_frame = 66666;
+    header.max_bytes_per_sec = frame_bytes * 15;
+    header.total_frames = frames;
+    header.streams = 1;
+    header.suggested_buffer_size = frame_bytes;
+    header.width = width;
+    header.height = height;
+
+    File file = createFile(path);
+    if (!file) {
+        return false;
+    }
+    bool ok = writeAll(file, &header, sizeof(header));
+    ok = ok && writeAll(file, "LIST", 4) && writeAll(file, &movi_bytes, 4) && writeAll(file, "movi", 4);
+
+    for (int f = 0; ok && f < frames; f++) {
+        ok = writeAll(file, "00db", 4) && writeAll(file, &frame_bytes, 4);
+        for (uint32_t done = 0; ok && done < frame_bytes; done += sizeof(s_chunk)) {
+            uint32_t bytes = min(frame_bytes - done, (uint32_t)sizeof(s_chunk));
+            fillBenchPattern(s_chunk, bytes, f + done);
+            ok = writeAll(file, s_chunk, bytes);
+        }
+    }
+    file.close();
+    return ok;
+}
+
+bool writeBenchFrames(const char *pattern, int width, int height, int frames)
+{
+    uint32_t frame_bytes = (uint32_t)width * height;
+    char path[64];
+    for (int f = 1; f <= frames; f++) {
+        snprintf(path, sizeof(path), pattern, f);
+        if (upToDate(path, frame_bytes)) {
+            continue;
+        }
+        File file = createFile(path);
+        if (!file) {
+            return false;
+        }
+        bool ok = true;
+        for (uint32_t done = 0; ok && done < frame_bytes; done += sizeof(s_chunk)) {
+            uint32_t bytes = min(frame_bytes - done, (uint32_t)sizeof(s_chunk));
+            fillBenchPattern(s_chunk, bytes, f + done);
+            ok = writeAll(file, s_chunk, bytes);
+        }
+        file.close();
+        if (!ok) {
+            Serial.printf("Bench: failed writing %s\n", path);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Image encoders, run twice: once without a file to size the output for
+// upToDate(), then again to write it through s_chunk
+typedef struct
+{
+    File *file;
+    uint32_t used;
+    uint32_t total;
+    bool ok;
+} image_writer_t;
+
+static void put(image_writer_t *writer, uint8_t byte)
+{
+    writer->total++;
+    if (writer->file == nullptr) {
+        return;
+    }
+    s_chunk[writer->used++] = byte;
+    if (writer->used == sizeof(s_chunk)) {
+        writer->ok = writer->ok && writeAll(*writer->file, s_chunk, writer->used);
+        writer->used = 0;
+    }
+}
+
+static void put16(image_writer_t *writer, uint16_t value)
+{
+    put(writer, value);
+    put(writer, value >> 8);
+}
+
+static void put32(image_writer_t *writer, uint32_t value)
+{
+    put16(writer, value);
+    put16(writer, value >> 16);
+}
+
+static void put32BigEndian(image_writer_t *writer, uint32_t value)
+{
+    put(writer, value >> 24);
+    put(writer, value >> 16);
+    put(writer, value >> 8);
+    put(writer, value);
+}
+
+// Every format draws from one 256-colour palette so they hold the same picture
+static uint8_t benchImageIndex(int x, int y)
+{
+    if (y < 16) {
+        return 10;
+    }
+    uint32_t noise = ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u) * 0x9E3779B1u;
+    uint8_t index = (x >> 3) + (y >> 2);
+    return (noise >> 28) == 0 ? index ^ 1 : index;
+}
+
+static void benchImageColor(uint8_t index, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    *r = index;
+    *g = index * 3;
+    *b = 255 - index;
+}
+
+static void encodeRaw565(image_writer_t *writer, int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t r, g, b;
+            benchImageColor(benchImageIndex(x, y), &r, &g, &b);
+            put16(writer, ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3));
+        }
+    }
+}
+
+static void encodeQoi(image_writer_t *writer, int width, int height)
+{
+    for (const char *magic = "qoif"; *magic; magic++) {
+        put(writer, *magic);
+    }
+    put32BigEndian(writer, width);
+    put32BigEndian(writer, height);
+    put(writer, 3);
+    put(writer, 0);
+
+    uint32_t index[64];
+    memset(index, 0, sizeof(index));
+    uint8_t pr = 0, pg = 0, pb = 0;
+    int run = 0;
+    uint32_t last = (uint32_t)width * height - 1;
+    for (uint32_t i = 0; i <= last; i++) {
+        uint8_t r, g, b;
+        benchImageColor(benchImageIndex(i % width, i / width), &r, &g, &b);
+        if (r == pr && g == pg && b == pb) {
+            run++;
+            if (run == 62 || i == last) {
+                put(writer, 0xC0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            put(writer, 0xC0 | (run - 1));
+            run = 0;
+        }
+        uint32_t pixel = r | (g << 8) | (b << 16) | 0xFF000000u;
+        int slot = (r * 3 + g * 5 + b * 7 + 255 * 11) & 63;
+        if (index[slot] == pixel) {
+            put(writer, slot);
+        } else {
+            index[slot] = pixel;
+            int8_t dr = r - pr;
+            int8_t dg = g - pg;
+            int8_t db = b - pb;
+            int8_t dr_dg = dr - dg;
+            int8_t db_dg = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                put(writer, 0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+            } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                put(writer, 0x80 | (dg + 32));
+                put(writer, ((dr_dg + 8) << 4) | (db_dg + 8));
+            } else {
+                put(writer, 0xFE);
+                put(writer, r);
+                put(writer, g);
+                put(writer, b);
+            }
+        }
+        pr = r;
+        pg = g;
+        pb = b;
+    }
+    for (int i = 0; i < 7; i++) {
+        put(writer, 0);
+    }
+    put(writer, 1);
+}
+
+static void putBmpHeader(image_writer_t *writer, int width, int height, int bpp, int compression,
+                         uint32_t colors, uint32_t pixel_bytes)
+{
+    uint32_t pixel_offset = 14 + 40 + colors * 4;
+    put(writer, 'B');
+    put(writer, 'M');
+    put32(writer, pixel_offset + pixel_bytes);
+    put32(writer, 0);
+    put32(writer, pixel_offset);
+    put32(writer, 40);
+    put32(writer, width);
+    put32(writer, height);
+    put16(writer, 1);
+    put16(writer, bpp);
+    put32(writer, compression);
+    put32(writer, pixel_bytes);
+    put32(writer, 2835);
+    put32(writer, 2835);
+    put32(writer, colors);
+    put32(writer, 0);
+    for (uint32_t i = 0; i < colors; i++) {
+        uint8_t r, g, b;
+        benchImageColor(i, &r, &g, &b);
+        put(writer, b);
+        put(writer, g);
+        put(writer, r);
+        put(writer, 0);
+    }
+}
+
+// One row of palette indices, s_chunk is busy with the output
+static uint8_t s_row[BENCH_WRITE_CHUNK];
+
+static void benchImageRow(int width, int y, uint8_t *row)
+{
+    for (int x = 0; x < width; x++) {
+        row[x] = benchImageIndex(x, y);
+    }
+}
+
+static void encodeBmp24(image_writer_t *writer, int width, int height)
+{
+    uint32_t stride = (width * 3 + 3) & ~3u;
+    putBmpHeader(writer, width, height, 24, 0, 0, stride * height);
+    for (int y = height - 1; y >= 0; y--) {
+        benchImageRow(width, y, s_row);
+        for (int x = 0; x < width; x++) {
+            uint8_t r, g, b;
+            benchImageColor(s_row[x], &r, &g, &b);
+            put(writer, b);
+            put(writer, g);
+            put(writer, r);
+        }
+        for (uint32_t pad = width * 3; pad < stride; pad++) {
+            put(writer, 0);
+        }
+    }
+}
+
+// Runs only, the picture has few lone pixels worth a literal
+static void encodeRle8(image_writer_t *writer, int width, int height, uint32_t pixel_bytes)
+{
+    putBmpHeader(writer, width, height, 8, 1, 256, pixel_bytes);
+    for (int y = height - 1; y >= 0; y--) {
+        benchImageRow(width, y, s_row);
+        for (int x = 0; x < width;) {
+            int count = 1;
+            while (x + count < width && count < 255 && s_row[x + count] == s_row[x]) {
+                count++;
+            }
+            put(writer, count);
+            put(writer, s_row[x]);
+            x += count;
+        }
+        put16(writer, 0x0000);
+    }
+    put16(writer, 0x0100);
+}
+
+typedef void (*image_encoder_t)(image_writer_t *writer, int width, int height);
+
+static bool writeImage(const char *path, image_encoder_t encode, int width, int height)
+{
+    image_writer_t writer = {nullptr, 0, 0, true};
+    encode(&writer, width, height);
+    if (upToDate(path, writer.total)) {
+        return true;
+    }
+    File file = createFile(path);
+    if (!file) {
+        return false;
+    }
+    writer = {&file, 0, 0, true};
+    encode(&writer, width, height);
+    bool ok = writer.ok && (writer.used == 0 || writeAll(file, s_chunk, writer.used));
+    file.close();
+    return ok;
+}
+
+static void encodeRle8Sized(image_writer_t *writer, int width, int height)
+{
+    // The header holds the pixel data size, so measure that part first
+    image_writer_t sizing = {nullptr, 0, 0, true};
+    encodeRle8(&sizing, width, height, 0);
+    encodeRle8(writer, width, height, sizing.total - (14 + 40 + 256 * 4));
+}
+
+bool writeBenchImages(int width, int height)
+{
+    if (width > BENCH_WRITE_CHUNK) {
+        return false;
+    }
+    return writeImage(BENCH_IMAGE_RAW_PATH, encodeRaw565, width, height) &&
+           writeImage(BENCH_IMAGE_QOI_PATH, encodeQoi, width, height) &&
+           writeImage(BENCH_IMAGE_BMP_PATH, encodeBmp24, width, height) &&
+           writeImage(BENCH_IMAGE_RLE_PATH, encodeRle8Sized, width, height);
+}
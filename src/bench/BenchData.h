@@ -0,0 +1,41 @@
+#ifndef __bench_data_h__
+#define __bench_data_h__
+
+#include <Arduino.h>
+
+// Synthetic datasets for the benchmark build, written to the card once and
+// reused while their size still matches. Sizes come from build flags.
+#ifndef BENCH_WIDTH
+#define BENCH_WIDTH 160
+#endif
+#ifndef BENCH_HEIGHT
+#define BENCH_HEIGHT 128
+#endif
+#ifndef BENCH_FRAMES
+#define BENCH_FRAMES 60
+#endif
+#ifndef BENCH_WAV_SECONDS
+#define BENCH_WAV_SECONDS 10
+#endif
+
+#define BENCH_DIR "/bench"
+#define BENCH_WAV_PATH BENCH_DIR "/tone.wav"
+#define BENCH_AVI_PATH BENCH_DIR "/clip.avi"
+#define BENCH_FRAME_PATTERN BENCH_DIR "/frames/frame%d.bin"
+#define BENCH_IMAGE_RAW_PATH BENCH_DIR "/image.raw"
+#define BENCH_IMAGE_QOI_PATH BENCH_DIR "/image.qoi"
+#define BENCH_IMAGE_BMP_PATH BENCH_DIR "/image.bmp"
+#define BENCH_IMAGE_RLE_PATH BENCH_DIR "/image_rle.bmp"
+
+// 16 bit stereo 44.1kHz sweep
+bool writeBenchWav(const char *path, int seconds);
+// Uncompressed RGB565 AVI in the layout AVIFileReader expects
+bool writeBenchAvi(const char *path, int width, int height, int frames);
+// frame1.bin .. frameN.bin of RGB332 gradients, as the SD video player reads
+bool writeBenchFrames(const char *pattern, int width, int height, int frames);
+
+// The same UI-like picture (flat bar, banded gradient, a little noise) as
+// raw RGB565, QOI, 24-bit BMP and RLE8 BMP, for the image decoder cases
+bool writeBenchImages(int width, int height);
+
+#endif
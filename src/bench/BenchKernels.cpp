@@ -0,0 +1,130 @@
+#include "Bench.h"
+#include "BenchKernels.h"
+#include "MediaArena.h"
+
+void *benchAlloc(size_t size)
+{
+    void *data = MediaArena::alloc(MEDIA_POOL_BULK, MEDIA_SUB_VIDEO, size);
+    if (data == nullptr) {
+        Serial.printf("Bench: could not allocate %u bytes\n", (unsigned)size);
+    }
+    return data;
+}
+
+void fillBenchPattern(uint8_t *data, uint32_t bytes, int seed)
+{
+    uint32_t state = 0x9E3779B9u * (seed + 1);
+    for (uint32_t i = 0; i < bytes; i++) {
+        // Mostly smooth with a little noise, like decoded video
+        state = state * 1664525u + 1013904223u;
+        data[i] = (uint8_t)(i + seed * 3 + ((state >> 28) & 0x3));
+    }
+}
+
+// Each case covers a whole frame
+
+static bool convert888(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    return FrameUtils::convertRgb888ToRgb565(c->src, (uint16_t *)c->dst, PIXELS);
+}
+
+static bool dither565(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    return FrameUtils::ditherRgb888ToRgb565(c->src, (uint16_t *)c->dst, BENCH_WIDTH, BENCH_HEIGHT);
+}
+
+static bool dither332(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    return FrameUtils::ditherRgb888ToRgb332(c->src, c->dst, BENCH_WIDTH, BENCH_HEIGHT);
+}
+
+static bool scaleWholeFrame(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    return FrameUtils::scaleFrame(&c->source, &c->dest, BENCH_SCALED_WIDTH, BENCH_SCALED_HEIGHT);
+}
+
+static bool scalerStrip16(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    return c->scaler->scaleStrip((const uint16_t *)c->src, (uint16_t *)c->dst, 0, BENCH_SCALED_HEIGHT);
+}
+
+static bool scalerStrip8(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    return c->scaler->scaleStrip((const uint8_t *)c->src, c->dst, 0, BENCH_SCALED_HEIGHT);
+}
+
+static bool rotate16(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    int width, height;
+    FrameUtils::rotatedSize(BENCH_WIDTH, BENCH_HEIGHT, c->rotation, &width, &height);
+    return FrameUtils::rotateStrip16((const uint16_t *)c->src, BENCH_WIDTH, BENCH_HEIGHT, c->rotation, false,
+                                     (uint16_t *)c->dst, 0, height);
+}
+
+static bool rotate8(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    int width, height;
+    FrameUtils::rotatedSize(BENCH_WIDTH, BENCH_HEIGHT, c->rotation, &width, &height);
+    return FrameUtils::rotateStrip8(c->src, BENCH_WIDTH, BENCH_HEIGHT, c->rotation, false, c->dst, 0, height);
+}
+
+void benchKernels()
+{
+    kernel_case_t c;
+    memset(&c, 0, sizeof(c));
+
+    // RGB888 sources
+    c.src = (uint8_t *)benchAlloc(PIXELS * 3);
+    c.dst = (uint8_t *)benchAlloc(PIXELS * 2);
+    if (c.src != nullptr && c.dst != nullptr) {
+        fillBenchPattern(c.src, PIXELS * 3, 1);
+        Bench::run("frameutils.rgb888_to_rgb565", PIXELS * 3, convert888, &c);
+        Bench::run("frameutils.dither_rgb565", PIXELS * 3, dither565, &c);
+        Bench::run("frameutils.dither_rgb332", PIXELS * 3, dither332, &c);
+    }
+    MediaArena::free(c.src);
+    c.src = nullptr;
+
+    // RGB565 sources, c.dst holds a whole RGB565 frame
+    c.src = (uint8_t *)benchAlloc(PIXELS * 2);
+    FrameScaler scaler;
+    c.scaler = &scaler;
+    if (c.src != nullptr && c.dst != nullptr) {
+        fillBenchPattern(c.src, PIXELS * 2, 2);
+        c.source.width = BENCH_WIDTH;
+        c.source.height = BENCH_HEIGHT;
+        c.source.data = c.src;
+        c.source.size = PIXELS * 2;
+        c.source.format = FRAME_FORMAT_RGB565;
+        Bench::run("frameutils.scale_frame", PIXELS * 2, scaleWholeFrame, &c);
+        MediaArena::free(c.dest.data);
+
+        if (scaler.configure(BENCH_WIDTH, BENCH_HEIGHT, BENCH_SCALED_WIDTH, BENCH_SCALED_HEIGHT, SCALE_NEAREST)) {
+            Bench::run("frameutils.scaler_nearest16", PIXELS * 2, scalerStrip16, &c);
+        }
+        if (scaler.configure(BENCH_WIDTH, BENCH_HEIGHT, BENCH_SCALED_WIDTH, BENCH_SCALED_HEIGHT, SCALE_BILINEAR)) {
+            Bench::run("frameutils.scaler_bilinear16", PIXELS * 2, scalerStrip16, &c);
+        }
+        c.rotation = ROTATE_90;
+        Bench::run("frameutils.rotate16_90", PIXELS * 2, rotate16, &c);
+        c.rotation = ROTATE_180;
+        Bench::run("frameutils.rotate16_180", PIXELS * 2, rotate16, &c);
+
+        // RGB332, reusing the same buffers
+        c.rotation = ROTATE_90;
+        Bench::run("frameutils.rotate8_90", PIXELS, rotate8, &c);
+        if (scaler.configure(BENCH_WIDTH, BENCH_HEIGHT, BENCH_SCALED_WIDTH, BENCH_SCALED_HEIGHT, SCALE_NEAREST)) {
+            Bench::run("frameutils.scaler_nearest8", PIXELS, scalerStrip8, &c);
+        }
+    }
+    MediaArena::free(c.src);
+    MediaArena::free(c.dst);
+}
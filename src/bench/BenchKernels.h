@@ -0,0 +1,38 @@
+#ifndef __bench_kernels_h__
+#define __bench_kernels_h__
+
+#include <Arduino.h>
+#include "BenchData.h"
+#include "FrameUtils.h"
+#include "FramePipeline.h"
+
+// Scaled output size for the scaler cases, as when a clip is shrunk to fit
+#define BENCH_SCALED_WIDTH (BENCH_WIDTH * 3 / 4)
+#define BENCH_SCALED_HEIGHT (BENCH_HEIGHT * 3 / 4)
+
+typedef StaticFramePipeline<PixelRGB332, PixelRGB565, BENCH_WIDTH, BENCH_HEIGHT> BenchPipeline;
+
+static const uint32_t PIXELS = (uint32_t)BENCH_WIDTH * BENCH_HEIGHT;
+
+typedef struct
+{
+    uint8_t *src;
+    uint8_t *dst;
+    FrameScaler *scaler;
+    FrameRotation rotation;
+    VideoFrame_t source;
+    VideoFrame_t dest;
+    int frame;
+} kernel_case_t;
+
+// From the bulk pool, reported when it fails
+void *benchAlloc(size_t size);
+
+// Fill a buffer with a moving gradient, so conversions see varied pixels
+void fillBenchPattern(uint8_t *data, uint32_t bytes, int seed);
+
+// The FrameUtils cases, which need no card or panel and run in both the
+// board and the host bench
+void benchKernels();
+
+#endif
@@ -0,0 +1,236 @@
+// Entry point of the bench environment (pio run -e bench -t upload), which
+// builds this instead of main.cpp. Generates synthetic media on the card,
+// runs every case once and prints the results as BENCH lines.
+
+#include <Arduino.h>
+#include <SD.h>
+#include <TFT_eSPI.h>
+
+#include "Bench.h"
+#include "BenchData.h"
+#include "BenchKernels.h"
+#include "WAVFileReader.h"
+#include "AVIFileReader.h"
+#include "FrameUtils.h"
+#include "FramePipeline.h"
+#include "ImageDecoder.h"
+#include "MediaArena.h"
+#include "SDScheduler.h"
+#include "JobSystem.h"
+#include "Logger.h"
+#include "display.h"
+
+extern TFT_eSPI tft; // Declared in display.cpp
+
+#define BENCH_AUDIO_FRAMES 512
+
+// Media readers
+
+static bool wavGetFrames(void *arg)
+{
+    static Frame_t frames[BENCH_AUDIO_FRAMES];
+    ((WAVFileReader *)arg)->getFrames(frames, BENCH_AUDIO_FRAMES);
+    return true;
+}
+
+static bool aviGetNextFrame(void *arg)
+{
+    static VideoFrame_t frame = {0, 0, nullptr, 0, 0};
+    return ((AVIFileReader *)arg)->getNextFrame(&frame);
+}
+
+static void benchReaders()
+{
+    WAVFileReader wav(BENCH_WAV_PATH);
+    if (wav.sampleRate() > 0) {
+        Bench::run("wav.get_frames", BENCH_AUDIO_FRAMES * sizeof(Frame_t), wavGetFrames, &wav, BENCH_MAX_SAMPLES);
+    }
+    AVIFileReader avi(BENCH_AVI_PATH);
+    if (avi.frameWidth() > 0) {
+        Bench::run("avi.get_next_frame", PIXELS * 2, aviGetNextFrame, &avi);
+    }
+}
+
+// SD to TFT, the path the SD video player takes for every frame
+
+static bool readFrame(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    char path[64];
+    c->frame = c->frame % BENCH_FRAMES + 1;
+    snprintf(path, sizeof(path), BENCH_FRAME_PATTERN, c->frame);
+    return SDScheduler::readFile(SD_CLIENT_VIDEO, path, 0, c->src, PIXELS) == (int32_t)PIXELS;
+}
+
+static bool pushFrame(void *arg)
+{
+    kernel_case_t *c = (kernel_case_t *)arg;
+    BenchPipeline::push(&tft, 0, 0, c->src, (uint16_t *)c->dst);
+    return true;
+}
+
+static bool sdToTft(void *arg)
+{
+    return readFrame(arg) && pushFrame(arg);
+}
+
+static void benchPipeline()
+{
+    kernel_case_t c;
+    memset(&c, 0, sizeof(c));
+    c.src = (uint8_t *)benchAlloc(PIXELS);
+    c.dst = (uint8_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_DISPLAY, BenchPipeline::strip_pixels * 2);
+    if (c.src != nullptr && c.dst != nullptr) {
+        Bench::run("pipeline.sd_read_frame", PIXELS, readFrame, &c);
+        Bench::run("pipeline.tft_push", PIXELS, pushFrame, &c);
+        Bench::run("pipeline.sd_to_tft", PIXELS, sdToTft, &c);
+    }
+    MediaArena::free(c.src);
+    MediaArena::free(c.dst);
+}
+
+// Still images, the same picture read raw and decoded strip by strip
+
+typedef struct
+{
+    const char *path;
+    uint16_t *strip;
+    int rows;
+    uint8_t *encoded;       // a whole file in memory, for decode-only timing
+    uint32_t encoded_size;
+} image_case_t;
+
+static bool readRawImage(void *arg)
+{
+    image_case_t *c = (image_case_t *)arg;
+    File file = SD.open(BENCH_IMAGE_RAW_PATH, FILE_READ);
+    bool ok = file;
+    uint32_t strip_bytes = (uint32_t)BENCH_WIDTH * c->rows * 2;
+    for (uint32_t offset = 0; ok && offset < PIXELS * 2; offset += strip_bytes) {
+        uint32_t bytes = min(strip_bytes, PIXELS * 2 - offset);
+        ok = SDScheduler::read(SD_CLIENT_BACKGROUND, &file, offset, (uint8_t *)c->strip, bytes) == (int32_t)bytes;
+    }
+    file.close();
+    return ok;
+}
+
+static bool drawRawImage(void *arg)
+{
+    image_case_t *c = (image_case_t *)arg;
+    File file = SD.open(BENCH_IMAGE_RAW_PATH, FILE_READ);
+    bool ok = file;
+    // Stored as native RGB565, like the decoder's strips
+    bool swap = tft.getSwapBytes();
+    tft.setSwapBytes(true);
+    for (int row = 0; ok && row < BENCH_HEIGHT; row += c->rows) {
+        int rows = min(c->rows, BENCH_HEIGHT - row);
+        uint32_t bytes = (uint32_t)BENCH_WIDTH * rows * 2;
+        ok = SDScheduler::read(SD_CLIENT_BACKGROUND, &file, (uint32_t)row * BENCH_WIDTH * 2, (uint8_t *)c->strip,
+                               bytes) == (int32_t)bytes;
+        tft.pushImage(0, row, BENCH_WIDTH, rows, c->strip);
+    }
+    tft.setSwapBytes(swap);
+    file.close();
+    return ok;
+}
+
+static bool decodeStrips(ImageDecoder *decoder, image_case_t *c)
+{
+    int first_row;
+    int rows;
+    int total = 0;
+    while ((rows = decoder->decodeStrip(c->strip, c->rows, &first_row)) > 0) {
+        total += rows;
+    }
+    return rows == 0 && total == BENCH_HEIGHT;
+}
+
+static bool decodeImage(void *arg)
+{
+    image_case_t *c = (image_case_t *)arg;
+    ImageDecoder decoder;
+    return decoder.open(c->path) && decodeStrips(&decoder, c);
+}
+
+static bool decodeImageInMemory(void *arg)
+{
+    image_case_t *c = (image_case_t *)arg;
+    ImageDecoder decoder;
+    return decoder.open(c->encoded, c->encoded_size) && decodeStrips(&decoder, c);
+}
+
+static bool drawImage(void *arg)
+{
+    image_case_t *c = (image_case_t *)arg;
+    ImageDecoder decoder;
+    return decoder.open(c->path) && decoder.draw(&tft, 0, 0);
+}
+
+static void benchImages()
+{
+    image_case_t c;
+    memset(&c, 0, sizeof(c));
+    c.rows = max(1, IMAGE_DECODER_STRIP_PIXELS / BENCH_WIDTH);
+    c.strip = (uint16_t *)MediaArena::alloc(MEDIA_POOL_DMA, MEDIA_SUB_DISPLAY, (uint32_t)BENCH_WIDTH * c.rows * 2);
+    if (c.strip == nullptr) {
+        return;
+    }
+    Bench::run("image.raw565_read", PIXELS * 2, readRawImage, &c);
+    c.path = BENCH_IMAGE_QOI_PATH;
+    Bench::run("image.qoi_decode", PIXELS * 2, decodeImage, &c);
+    c.path = BENCH_IMAGE_BMP_PATH;
+    Bench::run("image.bmp24_decode", PIXELS * 2, decodeImage, &c);
+    c.path = BENCH_IMAGE_RLE_PATH;
+    Bench::run("image.bmp_rle8_decode", PIXELS * 2, decodeImage, &c);
+
+    // Decode cost alone, with the QOI file already in memory
+    File file = SD.open(BENCH_IMAGE_QOI_PATH, FILE_READ);
+    c.encoded_size = file ? file.size() : 0;
+    c.encoded = c.encoded_size ? (uint8_t *)benchAlloc(c.encoded_size) : nullptr;
+    if (c.encoded != nullptr &&
+        SDScheduler::read(SD_CLIENT_BACKGROUND, &file, 0, c.encoded, c.encoded_size) == (int32_t)c.encoded_size) {
+        Bench::run("image.qoi_decode_memory", PIXELS * 2, decodeImageInMemory, &c);
+    }
+    file.close();
+    MediaArena::free(c.encoded);
+
+    Bench::run("image.raw565_draw", PIXELS * 2, drawRawImage, &c);
+    c.path = BENCH_IMAGE_QOI_PATH;
+    Bench::run("image.qoi_draw", PIXELS * 2, drawImage, &c);
+    MediaArena::free(c.strip);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(1000);
+    Logger::begin();
+    MediaArena::begin();
+    JobSystem::begin();
+    initDisplay();
+
+    // Datasets are written before the scheduler owns the card
+    Serial.println("Bench: preparing datasets");
+    if (!writeBenchWav(BENCH_WAV_PATH, BENCH_WAV_SECONDS) ||
+        !writeBenchAvi(BENCH_AVI_PATH, BENCH_WIDTH, BENCH_HEIGHT, BENCH_FRAMES) ||
+        !writeBenchFrames(BENCH_FRAME_PATTERN, BENCH_WIDTH, BENCH_HEIGHT, BENCH_FRAMES) ||
+        !writeBenchImages(BENCH_WIDTH, BENCH_HEIGHT)) {
+        Serial.println("Bench: could not write the datasets, is a card inserted?");
+    }
+    SDScheduler::begin();
+
+    char config[64];
+    snprintf(config, sizeof(config), "%dx%d_f%d_w%d", BENCH_WIDTH, BENCH_HEIGHT, BENCH_FRAMES, BENCH_WAV_SECONDS);
+    Bench::printConfig(config);
+    benchReaders();
+    benchKernels();
+    benchPipeline();
+    benchImages();
+    Serial.println("BENCH {\"done\":true}");
+    Logger::flush();
+}
+
+void loop()
+{
+    delay(1000);
+}
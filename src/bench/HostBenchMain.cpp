@@ -0,0 +1,155 @@
+// Entry point of the native environment's bench (pio run -e native -t exec).
+// Runs the FrameUtils cases and the frame pipeline against a FAT image read
+// through BlockCache and the stub TFT_eSPI, and prints the same BENCH lines
+// as the board, so bench_compare.py can diff host runs in CI. One traced
+// pass over the clip is then written out as Chrome trace JSON.
+
+#if !defined(ARDUINO) && !defined(PIO_UNIT_TESTING)
+
+#include <Arduino.h>
+#include <SD.h>
+#include <TFT_eSPI.h>
+
+#include "Bench.h"
+#include "BenchData.h"
+#include "BenchKernels.h"
+#include "BlockCache.h"
+#include "FatVolume.h"
+#include "FatImage.h"
+#include "MediaArena.h"
+#include "Tracer.h"
+
+#define HOST_BENCH_IMAGE "host_bench.img"
+#define HOST_BENCH_TRACE "/host_trace.json"
+
+/**
+ * The card as FatVolume sees it on the board: every read goes through
+ * the block cache
+ **/
+class CachedBlockDevice : public BlockDevice
+{
+private:
+    BlockCache *m_cache;
+
+public:
+    CachedBlockDevice(BlockCache *cache) : m_cache(cache) {}
+    bool readBlocks(uint32_t lba, uint8_t *buffer, uint32_t count) { return m_cache->read(lba, buffer, count); }
+    bool writeBlocks(uint32_t lba, const uint8_t *buffer, uint32_t count) { return m_cache->write(lba, buffer, count); }
+};
+
+typedef struct
+{
+    FatVolume *volume;
+    TFT_eSPI *tft;
+    uint8_t *src;
+    uint16_t *strip;
+    int frame;
+} host_case_t;
+
+// The frames the SD video player reads, laid out as writeBenchFrames would
+static bool writeHostImage()
+{
+    FatImage image(FAT_TYPE_FAT16);
+    std::vector<uint8_t> frame(PIXELS);
+    char path[64];
+    for (int f = 1; f <= BENCH_FRAMES; f++) {
+        fillBenchPattern(frame.data(), PIXELS, f);
+        snprintf(path, sizeof(path), BENCH_FRAME_PATTERN, f);
+        image.addFile(path, frame);
+    }
+    image.build();
+    return image.save(HOST_BENCH_IMAGE);
+}
+
+static bool readFrame(void *arg)
+{
+    host_case_t *c = (host_case_t *)arg;
+    char path[64];
+    c->frame = c->frame % BENCH_FRAMES + 1;
+    TRACE_SCOPE(TRACE_FRAME_LOAD, c->frame);
+    snprintf(path, sizeof(path), BENCH_FRAME_PATTERN, c->frame);
+    ContiguousFile file;
+    return file.open(c->volume, path) && file.read(0, c->src, PIXELS) == (int32_t)PIXELS;
+}
+
+static bool pushFrame(void *arg)
+{
+    host_case_t *c = (host_case_t *)arg;
+    TRACE_SCOPE(TRACE_FRAME_DRAW, c->frame);
+    BenchPipeline::push(c->tft, 0, 0, c->src, c->strip);
+    return true;
+}
+
+static bool cacheToTft(void *arg)
+{
+    if (!readFrame(arg)) {
+        return false;
+    }
+    TRACE_INSTANT(TRACE_FRAME_HANDOFF, ((host_case_t *)arg)->frame);
+    return pushFrame(arg);
+}
+
+// Outside the timed runs, so the trace points only cost their atomic load
+// there; chrome://tracing or Perfetto open the file
+static void traceClip(host_case_t *c)
+{
+    Tracer::start();
+    for (int f = 0; f < BENCH_FRAMES; f++) {
+        cacheToTft(c);
+    }
+    Tracer::stop();
+    File trace = SD.open(HOST_BENCH_TRACE, FILE_WRITE);
+    if (!trace) {
+        Serial.println("Bench: could not write " HOST_BENCH_TRACE);
+        return;
+    }
+    Tracer::dumpJson(trace);
+    trace.close();
+    Serial.printf("Bench: trace written to %s\n", HOST_BENCH_TRACE + 1);
+}
+
+static void benchPipeline()
+{
+    ImageBlockDevice device;
+    BlockCache cache;
+    CachedBlockDevice cached(&cache);
+    FatVolume volume;
+    if (!writeHostImage() || !device.open(HOST_BENCH_IMAGE) || !cache.begin(&device) || !cache.pinFatMetadata() ||
+        !volume.mount(&cached)) {
+        Serial.println("Bench: could not mount the host image");
+        return;
+    }
+
+    TFT_eSPI tft(BENCH_WIDTH, BENCH_HEIGHT);
+    host_case_t c;
+    memset(&c, 0, sizeof(c));
+    c.volume = &volume;
+    c.tft = &tft;
+    c.src = (uint8_t *)benchAlloc(PIXELS);
+    c.strip = (uint16_t *)benchAlloc(BenchPipeline::strip_pixels * 2);
+    if (c.src != nullptr && c.strip != nullptr) {
+        Bench::run("pipeline.cache_read_frame", PIXELS, readFrame, &c);
+        Bench::run("pipeline.tft_push", PIXELS, pushFrame, &c);
+        Bench::run("pipeline.cache_to_tft", PIXELS, cacheToTft, &c);
+        cache.printStats();
+        traceClip(&c);
+    }
+    MediaArena::free(c.src);
+    MediaArena::free(c.strip);
+    remove(HOST_BENCH_IMAGE);
+}
+
+int main()
+{
+    MediaArena::begin();
+
+    char config[64];
+    snprintf(config, sizeof(config), "host_%dx%d_f%d", BENCH_WIDTH, BENCH_HEIGHT, BENCH_FRAMES);
+    Bench::printConfig(config);
+    benchKernels();
+    benchPipeline();
+    Serial.println("BENCH {\"done\":true}");
+    return 0;
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include "display.h"
+#include "SDProfiler.h"
+#include "FileCatalog.h"
+#include "SDScheduler.h"
 
 void sanity_check();
 
@@ -19,19 +22,34 @@ void rotateColors(){
   colorIndex++;
 }
 
-void initDisplay(){
+// GPIO 4 is both the panel's reset line and the SD card's MOSI. Pulse
+// reset by hand (TFT_RST is -1, so TFT_eSPI only sends a software reset)
+// and HSPI can take the pin while the panel is still initialising.
+void resetPanel(){
     pinMode(5, OUTPUT);
     pinMode(15, OUTPUT);
     digitalWrite(5, HIGH); 
     digitalWrite(15, HIGH); 
 
+    pinMode(4, OUTPUT);
+    digitalWrite(4, LOW);
+    delay(1);
+    digitalWrite(4, HIGH);
+}
+
+void initTFT(){
     tft.begin();
     tft.setRotation(1);
+}
 
-    tft.fillScreen(TFT_CYAN);
-
+bool initSD(){
     hspi.begin(14, 12, 4, 5); // SCK, MISO, MOSI, CS
 
+    // Mount at the clock measured for this card, if it has been profiled
+    sd_profile_t profile;
+    bool profiled = SDProfiler::load(&profile);
+    uint32_t sdClock = profiled ? profile.clock_hz : SD_DEFAULT_CLOCK_HZ;
+
     // Try SD card initialization with retries
     int sdRetries = 5;
     bool sdInitialized = false;
@@ -39,29 +57,32 @@ void initDisplay(){
     while (sdRetries > 0 && !sdInitialized) {
         Serial.printf("Attempting SD card initialization... (attempt %d)\n", 6 - sdRetries);
         
-        // Add delay to allow SD card to stabilize
-        delay(100);
-        
-        if (SD.begin(5, hspi)) {
+        if (SD.begin(5, hspi, sdClock)) {
             sdInitialized = true;
             Serial.println("SD card initialized successfully");
         } else {
             Serial.printf("SD card initialization failed, retries left: %d\n", sdRetries - 1);
             sdRetries--;
-            delay(500); // Wait before retry
+            // A different card may be in; fall back to the safe clock
+            if (sdClock != SD_DEFAULT_CLOCK_HZ) {
+                Serial.println("Dropping to the default SD clock");
+                sdClock = SD_DEFAULT_CLOCK_HZ;
+                profiled = false;
+            }
+            delay(500); // Wait before retry, giving the card time to stabilise
         }
     }
     
     if (!sdInitialized) {
         Serial.println("SD card failed after all retries");
-        return;
+        return false;
     }
 
     uint8_t cardType = SD.cardType();
   
     if (cardType == CARD_NONE) {
       Serial.println("No SD card attached");
-      return;
+      return false;
     }
   
     Serial.print("SD Card Type: ");
@@ -78,71 +99,93 @@ void initDisplay(){
     uint64_t cardSize = SD.cardSize() / (1024 * 1024);
     Serial.printf("SD Card Size: %lluMB\n", cardSize);
 
+    // Sweep the card before anything else uses it, on request or every boot
+    if (SD_PROFILE_ON_BOOT || SDProfiler::takeRequest()) {
+        if (SDProfiler::run(hspi, 5, &profile)) {
+            SDProfiler::store(&profile);
+            profiled = true;
+        }
+    } else if (profiled) {
+        SDProfiler::print(&profile);
+    }
+
+    // Cache FAT and directory sectors under every File user. Small
+    // sequential reads are stretched towards the card's knee size.
+    int readAhead = BLOCK_CACHE_READ_AHEAD;
+    if (profiled && profile.knee_bytes > BLOCK_CACHE_SECTOR_SIZE) {
+        readAhead = constrain((int)(profile.knee_bytes / BLOCK_CACHE_SECTOR_SIZE) - 1, 1, BLOCK_CACHE_BLOCKS / 4);
+    }
+    installSDBlockCache(0, BLOCK_CACHE_BLOCKS, readAhead);
+
+    // Raw readers share one parsed view of the volume from here on
+    if (!mountSDVolume()) {
+        Serial.println("No FAT volume found, files will be read through SD only");
+    }
+
     Serial.println("Initialization done.");
+    return true;
+}
 
+// On the SD scheduler's task, which owns the card once it has started
+static int32_t printCard(void *arg){
     File root = SD.open("/");
-    if (root) {
-        Serial.printf("Printing SD file system\n");
+    if (!root) {
+        return -1;
+    }
+    Serial.printf("Printing SD file system\n");
+    Serial.printf("###############################################\n");
+    printDirectory(root, 0);
+    Serial.printf("###############################################\n");
+    root.close();
+    return 0;
+}
+
+void runSDDiagnostics(){
+    if (FileCatalog::isLoaded()) {
+        Serial.printf("SD file system (%d entries catalogued)\n", FileCatalog::count());
         Serial.printf("###############################################\n");
-        printDirectory(root, 0);
+        FileCatalog::print();
         Serial.printf("###############################################\n");
-        root.close();
+    } else {
+        SDScheduler::call(SD_CLIENT_BACKGROUND, printCard, nullptr);
     }
 
     Serial.println("Sanity check:");
     sanity_check();
 }
 
-//longtext anothtext sanitycheck
-void sanity_check(){
-  uint8_t *buffer = (uint8_t *)malloc(100*sizeof(uint8_t));
-  if(!SD.exists("/anothtext.txt")){
-    Serial.println("Sanity check fail");
-    return;
-  }
-  File sanityFile = SD.open("/anothtext.txt", FILE_READ);
-  if (!sanityFile) {
-    Serial.println("Failed to open sanity check file");
-    return;
-  }
-  Serial.println("Sanity check file opened successfully");
-
-  // while (sanityFile.available()) {
-  //   Serial.print((char)sanityFile.read());
-  // }
-  size_t bytesRead = sanityFile.read(buffer, 44);
-  for (size_t i = 0; i < bytesRead; i++) {
-    Serial.printf("%c", buffer[i]);
-  }
-  Serial.println("\nSanity check file read successfully");
-  Serial.printf("Bytes read: %d\n", bytesRead);
-  sanityFile.close();
+void initDisplay(){
+    resetPanel();
+    initTFT();
+    tft.fillScreen(TFT_CYAN);
 
+    if (initSD()) {
+        runSDDiagnostics();
+    }
+}
 
-  ///////////////////////////////////////////////////////////
-  free(buffer);
-  buffer = (uint8_t *)malloc(100*sizeof(uint8_t));
-  if(!SD.exists("/sanitycheck.txt")){
+// Read the start of a test file through the scheduler, false if it is missing
+static bool checkFile(const char *path){
+  uint8_t buffer[44];
+  int32_t bytesRead = SDScheduler::readFile(SD_CLIENT_BACKGROUND, path, 0, buffer, sizeof(buffer));
+  if (bytesRead < 0) {
     Serial.println("Sanity check fail");
-    return;
-  }
-  sanityFile = SD.open("/sanitycheck.txt", FILE_READ);
-  if (!sanityFile) {
-    Serial.println("Failed to open sanity check file");
-    return;
+    return false;
   }
   Serial.println("Sanity check file opened successfully");
-
-  // while (sanityFile.available()) {
-  //   Serial.print((char)sanityFile.read());
-  // }
-  bytesRead = sanityFile.read(buffer, 44);
-  for (size_t i = 0; i < bytesRead; i++) {
+  for (int32_t i = 0; i < bytesRead; i++) {
     Serial.printf("%c", buffer[i]);
   }
   Serial.println("\nSanity check file read successfully");
-  Serial.printf("Bytes read: %d\n", bytesRead);
-  sanityFile.close();
+  Serial.printf("Bytes read: %d\n", (int)bytesRead);
+  return true;
+}
+
+//longtext anothtext sanitycheck
+void sanity_check(){
+  if (checkFile("/anothtext.txt")) {
+    checkFile("/sanitycheck.txt");
+  }
 }
 
 void printDirectory(File dir, int numTabs) {
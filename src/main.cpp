@@ -6,6 +6,19 @@
 #include "TFT_output.h"
 #include "display.h"
 #include "SD_video.h"
+#include "MediaArena.h"
+#include "BlockCache.h"
+#include "SDScheduler.h"
+#include "JobSystem.h"
+#include "Logger.h"
+#include "PipelineStats.h"
+#include "Tracer.h"
+#include "SDProfiler.h"
+#include "BootSequencer.h"
+#include "FileCatalog.h"
+#include "Compositor.h"
+#include "GlyphCache.h"
+#include "ImageCache.h"
 
 i2s_pin_config_t i2sPins = {
     .bck_io_num = GPIO_NUM_27,
@@ -22,11 +35,16 @@ FrameSource *videoSource;
 extern TFT_eSPI tft; // Declared in display.cpp
 
 const char *FRAME_FILE_PATTERN = "/output_frame/frame%d.bin";
+// Cheaper copies of the clip, used only if they are on the card
+const stream_variant_t FRAME_VARIANTS[] = {
+  {"/output_frame/idx4/frame%d.bin", VARIANT_INDEXED4},
+  {"/output_frame/half/frame%d.bin", VARIANT_RGB332_HALF},
+};
 
 // Function to demonstrate AVIFileReader and TFT_Output usage
 void setupVideoPlayback() {
   // Example setup for video playback - similar to audio setup
-  if (SD.exists("/video.avi")) {
+  if (FileCatalog::exists("/video.avi")) {
     Serial.println("Found video.avi file, setting up video playback...");
     
     // Create video source (AVI file reader)
@@ -48,7 +66,7 @@ void setupVideoPlayback() {
 // Function to demonstrate WAVFileReader and I2SOutput usage  
 void setupAudioPlayback() {
   // Example setup for audio playback
-  if (SD.exists("/5052.wav")) {
+  if (FileCatalog::exists("/5052.wav")) {
     Serial.println("Found audio file, setting up audio playback...");
     
     // Create audio source (WAV file reader)
@@ -66,23 +84,65 @@ void setupAudioPlayback() {
   }
 }
 
+bool printCatalogEntry(const catalog_file_t *file, void *arg) {
+  if (file->file.directory) {
+    Serial.printf("%s/\n", file->name);
+  } else {
+    Serial.printf("%s\t\t%u%s\n", file->name, file->file.size, file->contiguous ? "" : "\t(fragmented)");
+  }
+  return true;
+}
+
 void setup() {
   Serial.begin(115200);
+#if !FAST_BOOT
   delay(1000); 
+#endif
+
+  // Log messages are drained to Serial in the background from here on
+  Logger::begin();
 
   Serial.println("=== ESP32 Video Player Starting ===");
   Serial.printf("Free heap: %d bytes\n", ESP.getFreeHeap());
   Serial.printf("PSRAM available: %s\n", psramFound() ? "Yes" : "No");
 
+  // Reserve media memory before anything else can fragment the heap
+  MediaArena::begin();
+
+  // Per-frame CPU work is split across both cores from here on
+  JobSystem::begin();
+
+  // Panel and splash on this core while the card mounts on the other
   Serial.println("Initializing display and SD card...");
-  initDisplay();
+  bool sdOk = BootSequencer::bringUp();
+
+  // UI text is drawn through the glyph cache once the font is in
+  if (BootSequencer::loadFont()) {
+    GlyphCache::begin();
+  }
+  BootSequencer::showStatus(sdOk ? "Starting video" : "No SD card");
+
+  // Video, UI and overlays share the panel through layers from here on
+  Compositor::begin(tft.width(), tft.height());
+
+  // All card reads from here on are arbitrated by the SD scheduler
+  SDScheduler::begin();
+
+  // Decoded UI images, loaded behind the scheduler's other clients
+  ImageCache::begin();
 
+#if !FAST_BOOT
   // Add delay to ensure SD card is fully initialized
   delay(500);
+#endif
 
   Serial.println("Starting VID");
+  setSDVideoVariants(FRAME_VARIANTS, sizeof(FRAME_VARIANTS) / sizeof(FRAME_VARIANTS[0]));
   startSDVideo(FRAME_FILE_PATTERN, 0, 0, 160, 128);
 
+  // File catalog, card listing and test reads, behind playback instead of before it
+  BootSequencer::deferDiagnostics();
+
   Serial.printf("Setup complete. Free heap: %d bytes\n", ESP.getFreeHeap());
 
   // Uncomment one of these functions to enable playback:
@@ -115,5 +175,52 @@ void loop() {
     Serial.printf("Free heap: %d bytes\n", ESP.getFreeHeap());
     lastHeapCheck = millis();
   }
+  static unsigned long lastArenaStats = 0;
+  if (millis() - lastArenaStats > 60000) { // Every minute
+    MediaArena::printStats();
+    if (getSDBlockCache()) getSDBlockCache()->printStats();
+    SDScheduler::printStats();
+    JobSystem::printStats();
+    Compositor::printStats();
+    GlyphCache::printStats();
+    ImageCache::printStats();
+    lastArenaStats = millis();
+  }
+
+  // Serial commands: "stats" prints the pipeline timings, "reset" clears them,
+  // "trace" starts a capture, "trace json" and "trace dump" print it,
+  // "sdprofile" restarts and measures the card, "sdprofile clear" forgets it,
+  // "ls <prefix>" lists catalogued files, "catalog rebuild" restarts and re-indexes
+  if (Serial.available()) {
+    String command = Serial.readStringUntil('\n');
+    command.trim();
+    if (command == "stats") {
+      PipelineStats::print();
+    } else if (command == "reset") {
+      PipelineStats::reset();
+      Serial.println("Pipeline stats reset");
+    } else if (command == "trace") {
+      Tracer::start();
+      Serial.printf("Tracing up to %d events\n", TRACE_CAPACITY);
+    } else if (command == "trace json") {
+      Logger::flush();
+      Tracer::dumpJson(Serial);
+    } else if (command == "trace dump") {
+      Logger::flush();
+      Tracer::dumpBinary(Serial);
+    } else if (command == "sdprofile") {
+      SDProfiler::requestOnNextBoot();
+    } else if (command == "sdprofile clear") {
+      SDProfiler::clear();
+      Serial.println("SD profile cleared, default clock from next boot");
+    } else if (command == "ls" || command.startsWith("ls ")) {
+      String prefix = command.length() > 3 ? command.substring(3) : String("/");
+      if (FileCatalog::list(prefix.c_str(), printCatalogEntry, nullptr) == 0) {
+        Serial.printf("Nothing catalogued under %s\n", prefix.c_str());
+      }
+    } else if (command == "catalog rebuild") {
+      FileCatalog::requestRebuild();
+    }
+  }
   delay(100);
 }
\ No newline at end of file
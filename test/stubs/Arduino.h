@@ -0,0 +1,95 @@
+#ifndef __host_arduino_h__
+#define __host_arduino_h__
+
+// Host stand-in for the parts of the ESP32 Arduino core used by the code
+// built in env:native. Single threaded: there is one task and one core, and
+// times come from the host's steady clock.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+// The ESP32 core brings these in too, so both sides need matching types
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+#define PROGMEM
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+    virtual size_t write(const uint8_t *data, size_t length) { return fwrite(data, 1, length, stdout); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char line[512];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        if (length < 0) {
+            return 0;
+        }
+        return write((const uint8_t *)line, min((size_t)length, sizeof(line) - 1));
+    }
+    size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long value, int base = DEC) { return printf(base == HEX ? "%lx" : "%ld", value); }
+    size_t print(unsigned long value, int base = DEC) { return printf(base == HEX ? "%lx" : "%lu", value); }
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t println(const char *text = "") { return print(text) + print('\n'); }
+    size_t println(long value, int base = DEC) { return print(value, base) + print('\n'); }
+    size_t println(unsigned long value, int base = DEC) { return print(value, base) + print('\n'); }
+    size_t println(int value, int base = DEC) { return print(value, base) + print('\n'); }
+    size_t println(unsigned value, int base = DEC) { return print(value, base) + print('\n'); }
+};
+
+class HardwareSerial : public Print
+{
+public:
+    void begin(unsigned long baud) {}
+    void flush() { fflush(stdout); }
+    int available() { return 0; }
+};
+
+inline HardwareSerial Serial;
+
+class EspClass
+{
+public:
+    uint32_t getFreeHeap() { return heap_caps_get_free_size(MALLOC_CAP_8BIT); }
+    uint32_t getPsramSize() { return 0; }
+    void restart() { exit(0); }
+};
+
+inline EspClass ESP;
+
+inline unsigned long micros() { return (unsigned long)esp_timer_get_time(); }
+inline unsigned long millis() { return (unsigned long)(esp_timer_get_time() / 1000); }
+inline void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void yield() {}
+inline bool psramFound() { return false; }
+// Not a real clock rate; BENCH configs from the host report 0
+inline uint32_t getCpuFrequencyMhz() { return 0; }
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef __host_fs_h__
+#define __host_fs_h__
+
+#include <Arduino.h>
+#include <string>
+#include <sys/stat.h>
+
+// Host stand-in for the ESP32 core's FS: files are plain host files under
+// a root directory, which is the card's "/"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+enum SeekMode
+{
+    SeekSet = SEEK_SET,
+    SeekCur = SEEK_CUR,
+    SeekEnd = SEEK_END
+};
+
+class File : public Print
+{
+private:
+    FILE *m_file;
+    size_t m_size;
+
+public:
+    File(FILE *file = nullptr) : m_file(file), m_size(0)
+    {
+        if (m_file != nullptr) {
+            long position = ftell(m_file);
+            fseek(m_file, 0, SEEK_END);
+            m_size = ftell(m_file);
+            fseek(m_file, position, SEEK_SET);
+        }
+    }
+
+    // Copies share the host file, as copies of an ESP32 File share its handle
+    operator bool() const { return m_file != nullptr; }
+    size_t size() const { return m_file != nullptr ? max(m_size, (size_t)ftell(m_file)) : 0; }
+    size_t position() const { return m_file != nullptr ? ftell(m_file) : 0; }
+    bool seek(uint32_t position, SeekMode mode = SeekSet)
+    {
+        return m_file != nullptr && fseek(m_file, position, mode) == 0;
+    }
+    int available() { return (int)(size() - position()); }
+    int read() { return m_file != nullptr ? fgetc(m_file) : -1; }
+    size_t read(uint8_t *buffer, size_t length) { return m_file != nullptr ? fread(buffer, 1, length, m_file) : 0; }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t length)
+    {
+        return m_file != nullptr ? fwrite(data, 1, length, m_file) : 0;
+    }
+    void flush()
+    {
+        if (m_file != nullptr) {
+            fflush(m_file);
+        }
+    }
+    void close()
+    {
+        if (m_file != nullptr) {
+            fclose(m_file);
+        }
+        m_file = nullptr;
+    }
+};
+
+class FS
+{
+private:
+    std::string m_root;
+
+    std::string hostPath(const char *path) { return m_root + (path[0] == '/' ? "" : "/") + path; }
+
+public:
+    FS() : m_root(".") {}
+
+    // Host only: the directory that stands for the card
+    void setRoot(const char *root) { m_root = root; }
+
+    File open(const char *path, const char *mode = FILE_READ, bool create = false)
+    {
+        // "w" on the board also allows reading back, as "w+" does here
+        std::string host_mode = strcmp(mode, FILE_WRITE) == 0 ? "w+b" : std::string(mode) + "b";
+        return File(fopen(hostPath(path).c_str(), host_mode.c_str()));
+    }
+    bool exists(const char *path)
+    {
+        struct stat info;
+        return stat(hostPath(path).c_str(), &info) == 0;
+    }
+    bool remove(const char *path) { return ::remove(hostPath(path).c_str()) == 0; }
+    bool mkdir(const char *path) { return ::mkdir(hostPath(path).c_str(), 0755) == 0; }
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif
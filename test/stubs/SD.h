@@ -0,0 +1,23 @@
+#ifndef __host_sd_h__
+#define __host_sd_h__
+
+#include "FS.h"
+
+// Host stand-in for the SD library: always mounted, over the host
+// directory set with SD.setRoot() (the working directory by default)
+
+namespace fs
+{
+
+class SDFS : public FS
+{
+public:
+    bool begin() { return true; }
+    void end() {}
+};
+
+} // namespace fs
+
+inline fs::SDFS SD;
+
+#endif
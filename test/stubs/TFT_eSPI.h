@@ -0,0 +1,179 @@
+#ifndef __host_tft_espi_h__
+#define __host_tft_espi_h__
+
+#include <Arduino.h>
+#include <vector>
+
+// Host stand-in for TFT_eSPI: the panel is a framebuffer of RGB565 pixels
+// as the display would show them, written with the same window, byte order
+// and clipping rules as the real driver, and counted so tests can check
+// how much was sent
+
+#ifndef TFT_WIDTH
+#define TFT_WIDTH 128
+#endif
+#ifndef TFT_HEIGHT
+#define TFT_HEIGHT 160
+#endif
+
+#define TFT_BLACK 0x0000
+#define TFT_NAVY 0x000F
+#define TFT_BLUE 0x001F
+#define TFT_GREEN 0x07E0
+#define TFT_CYAN 0x07FF
+#define TFT_RED 0xF800
+#define TFT_MAGENTA 0xF81F
+#define TFT_YELLOW 0xFFE0
+#define TFT_WHITE 0xFFFF
+
+class TFT_eSPI : public Print
+{
+private:
+    int32_t m_width;
+    int32_t m_height;
+    bool m_swap_bytes;
+    // Window set by setAddrWindow and where the next pixel goes in it
+    int32_t m_window_x;
+    int32_t m_window_y;
+    int32_t m_window_width;
+    int32_t m_window_height;
+    int32_t m_cursor;
+
+    static uint16_t swap(uint16_t c) { return (uint16_t)((c << 8) | (c >> 8)); }
+
+    void writeWindow(uint16_t color)
+    {
+        if (m_window_width <= 0 || m_window_height <= 0) {
+            return;
+        }
+        int32_t x = m_window_x + m_cursor % m_window_width;
+        int32_t y = m_window_y + (m_cursor / m_window_width) % m_window_height;
+        m_cursor++;
+        if (x >= 0 && x < m_width && y >= 0 && y < m_height) {
+            pixels[y * m_width + x] = color;
+        }
+    }
+
+public:
+    // Row-major, width() x height()
+    std::vector<uint16_t> pixels;
+    uint32_t pushed_pixels;
+    uint32_t windows;
+
+    TFT_eSPI(int16_t width = TFT_WIDTH, int16_t height = TFT_HEIGHT)
+        : m_width(width), m_height(height), m_swap_bytes(false), m_window_x(0), m_window_y(0), m_window_width(0),
+          m_window_height(0), m_cursor(0), pixels((size_t)width * height, 0), pushed_pixels(0), windows(0)
+    {
+    }
+
+    void begin() {}
+    void init() {}
+    void setRotation(uint8_t rotation)
+    {
+        bool landscape = (rotation & 1) != 0;
+        m_width = landscape ? TFT_HEIGHT : TFT_WIDTH;
+        m_height = landscape ? TFT_WIDTH : TFT_HEIGHT;
+        pixels.assign((size_t)m_width * m_height, 0);
+    }
+    int16_t width() { return m_width; }
+    int16_t height() { return m_height; }
+
+    void setSwapBytes(bool swap) { m_swap_bytes = swap; }
+    bool getSwapBytes() { return m_swap_bytes; }
+    void startWrite() {}
+    void endWrite() {}
+    bool dmaBusy() { return false; }
+
+    uint16_t readPixel(int32_t x, int32_t y)
+    {
+        return x >= 0 && x < m_width && y >= 0 && y < m_height ? pixels[y * m_width + x] : 0;
+    }
+
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+    {
+        for (int32_t row = max(y, (int32_t)0); row < min(y + h, m_height); row++) {
+            for (int32_t col = max(x, (int32_t)0); col < min(x + w, m_width); col++) {
+                pixels[row * m_width + col] = (uint16_t)color;
+            }
+        }
+    }
+    void fillScreen(uint32_t color) { fillRect(0, 0, m_width, m_height, color); }
+
+    // Pixels pushed next fill this window row by row, wrapping like the
+    // controller's address counter
+    void setAddrWindow(int32_t x, int32_t y, int32_t w, int32_t h)
+    {
+        m_window_x = x;
+        m_window_y = y;
+        m_window_width = w;
+        m_window_height = h;
+        m_cursor = 0;
+        windows++;
+    }
+
+    // swap: data is native RGB565 and is byte swapped on the way out;
+    // otherwise it is already in panel byte order
+    void pushColors(uint16_t *data, uint32_t length, bool swap_bytes = true)
+    {
+        for (uint32_t i = 0; i < length; i++) {
+            writeWindow(swap_bytes ? data[i] : swap(data[i]));
+        }
+        pushed_pixels += length;
+    }
+
+    void pushPixels(const void *data, uint32_t length)
+    {
+        const uint16_t *colors = (const uint16_t *)data;
+        for (uint32_t i = 0; i < length; i++) {
+            writeWindow(m_swap_bytes ? colors[i] : swap(colors[i]));
+        }
+        pushed_pixels += length;
+    }
+
+    // Clipped to the panel; 16-bit data is byte swapped only with
+    // setSwapBytes(true), as in TFT_eSPI
+    void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t *data)
+    {
+        for (int32_t row = 0; row < h; row++) {
+            for (int32_t col = 0; col < w; col++) {
+                uint16_t c = data[row * w + col];
+                if (x + col >= 0 && x + col < m_width && y + row >= 0 && y + row < m_height) {
+                    pixels[(y + row) * m_width + x + col] = m_swap_bytes ? c : swap(c);
+                }
+            }
+        }
+        pushed_pixels += w * h;
+    }
+    void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data)
+    {
+        pushImage(x, y, w, h, (const uint16_t *)data);
+    }
+
+    // 8-bit images are RGB332, expanded with color8to16
+    void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint8_t *data, bool bpp8 = true,
+                   uint16_t *cmap = nullptr)
+    {
+        for (int32_t row = 0; row < h; row++) {
+            for (int32_t col = 0; col < w; col++) {
+                if (x + col >= 0 && x + col < m_width && y + row >= 0 && y + row < m_height) {
+                    pixels[(y + row) * m_width + x + col] = color8to16(data[row * w + col]);
+                }
+            }
+        }
+        pushed_pixels += w * h;
+    }
+    void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, uint8_t *data, bool bpp8 = true,
+                   uint16_t *cmap = nullptr)
+    {
+        pushImage(x, y, w, h, (const uint8_t *)data, bpp8, cmap);
+    }
+
+    uint16_t color8to16(uint8_t c)
+    {
+        static const uint8_t blue[] = {0, 11, 21, 31};
+        return (uint16_t)(((c & 0xE0) << 8) | ((c & 0xC0) << 5) | ((c & 0x1C) << 6) | ((c & 0x1C) << 3) |
+                          blue[c & 0x03]);
+    }
+};
+
+#endif
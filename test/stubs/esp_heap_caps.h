@@ -0,0 +1,47 @@
+#ifndef __host_esp_heap_caps_h__
+#define __host_esp_heap_caps_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+// Free memory as an ESP32 without PSRAM reports it after boot, so pools
+// are sized as they would be on the board
+#ifndef HOST_INTERNAL_FREE
+#define HOST_INTERNAL_FREE (280 * 1024)
+#endif
+#ifndef HOST_INTERNAL_LARGEST_BLOCK
+#define HOST_INTERNAL_LARGEST_BLOCK (110 * 1024)
+#endif
+
+inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return (caps & MALLOC_CAP_SPIRAM) ? nullptr : malloc(size);
+}
+
+inline void *heap_caps_calloc(size_t count, size_t size, uint32_t caps)
+{
+    return (caps & MALLOC_CAP_SPIRAM) ? nullptr : calloc(count, size);
+}
+
+inline void heap_caps_free(void *data)
+{
+    free(data);
+}
+
+inline size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return (caps & MALLOC_CAP_SPIRAM) ? 0 : HOST_INTERNAL_FREE;
+}
+
+inline size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return (caps & MALLOC_CAP_SPIRAM) ? 0 : HOST_INTERNAL_LARGEST_BLOCK;
+}
+
+#endif
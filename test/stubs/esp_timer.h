@@ -0,0 +1,14 @@
+#ifndef __host_esp_timer_h__
+#define __host_esp_timer_h__
+
+#include <stdint.h>
+#include <chrono>
+
+// Microseconds since the first call, like esp_timer's time since boot
+inline int64_t esp_timer_get_time()
+{
+    static const auto started = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __host_freertos_h__
+#define __host_freertos_h__
+
+#include <stdint.h>
+
+// Host stand-in for FreeRTOS: one task on one core, so critical sections
+// are no-ops and nothing ever has to wait for another task
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configMAX_TASK_NAME_LEN 16
+
+typedef struct
+{
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+inline BaseType_t xPortGetCoreID()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __host_freertos_queue_h__
+#define __host_freertos_queue_h__
+
+#include <string.h>
+#include <vector>
+#include "FreeRTOS.h"
+
+// A ring of fixed size items. With one task, a send to a full queue or a
+// receive from an empty one can never be satisfied, so it fails at once.
+typedef struct
+{
+    std::vector<uint8_t> items;
+    UBaseType_t item_size;
+    UBaseType_t length;
+    UBaseType_t head;
+    UBaseType_t count;
+} host_queue_t;
+
+typedef host_queue_t *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    host_queue_t *queue = new host_queue_t;
+    queue->items.resize((size_t)length * item_size);
+    queue->item_size = item_size;
+    queue->length = length;
+    queue->head = 0;
+    queue->count = 0;
+    return queue;
+}
+
+inline void vQueueDelete(QueueHandle_t queue)
+{
+    delete queue;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    if (queue->count == queue->length) {
+        return pdFALSE;
+    }
+    UBaseType_t slot = (queue->head + queue->count) % queue->length;
+    memcpy(&queue->items[(size_t)slot * queue->item_size], item, queue->item_size);
+    queue->count++;
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    if (queue->count == 0) {
+        return pdFALSE;
+    }
+    memcpy(item, &queue->items[(size_t)queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef __host_freertos_semphr_h__
+#define __host_freertos_semphr_h__
+
+#include "FreeRTOS.h"
+
+// Counting semaphore underneath every kind. With one task, a take that
+// would block can never be satisfied, so it fails at once instead.
+typedef struct
+{
+    UBaseType_t count;
+    UBaseType_t max;
+    bool allocated;
+} StaticSemaphore_t;
+
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t hostSemaphoreInit(StaticSemaphore_t *semaphore, UBaseType_t count, UBaseType_t max,
+                                           bool allocated)
+{
+    semaphore->count = count;
+    semaphore->max = max;
+    semaphore->allocated = allocated;
+    return semaphore;
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return hostSemaphoreInit(new StaticSemaphore_t, 1, 1, true);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+    return hostSemaphoreInit(buffer, 1, 1, false);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+    return hostSemaphoreInit(new StaticSemaphore_t, 0, 0xFFFFFFFFu, true);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return hostSemaphoreInit(new StaticSemaphore_t, 0, 1, true);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer)
+{
+    return hostSemaphoreInit(buffer, 0, 1, false);
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    if (semaphore->count == 0) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    if (semaphore->count >= semaphore->max) {
+        return pdFALSE;
+    }
+    semaphore->count++;
+    return pdTRUE;
+}
+
+// The only task always owns a recursive mutex; count is the nesting depth
+inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    semaphore->count++;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore)
+{
+    if (semaphore->count == 0) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    if (semaphore->allocated) {
+        delete semaphore;
+    }
+}
+
+#endif
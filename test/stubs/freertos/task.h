@@ -0,0 +1,59 @@
+#ifndef __host_freertos_task_h__
+#define __host_freertos_task_h__
+
+#include <chrono>
+#include <thread>
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+// There are no other tasks: creating one fails, so code that can run
+// without its task (JobSystem runs bands inline) does, and the rest
+// reports the failure as it would on the board
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack, void *param,
+                                          UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    if (handle != nullptr) {
+        *handle = nullptr;
+    }
+    return pdFAIL;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack, void *param,
+                              UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(function, name, stack, param, priority, handle, 0);
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    static int main_task;
+    return &main_task;
+}
+
+inline char *pcTaskGetTaskName(TaskHandle_t task)
+{
+    static char name[] = "main";
+    return name;
+}
+
+inline void vTaskDelete(TaskHandle_t task) {}
+
+inline void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+// Notifications only come from other tasks, so there are never any pending
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+    return 0;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+#endif
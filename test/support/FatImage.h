@@ -0,0 +1,441 @@
+#ifndef __fat_image_h__
+#define __fat_image_h__
+
+// Builds small FAT16, FAT32 and exFAT disk images for the host tests, to be
+// read back through ImageBlockDevice. Files are laid out in the order they
+// are added, each in consecutive clusters unless asked to be fragmented.
+// exFAT files and directories in consecutive clusters are marked NoFatChain
+// and left out of the FAT, as exFAT drivers write them.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "FatVolume.h"
+
+class FatImage
+{
+private:
+    typedef struct
+    {
+        std::string name;
+        std::string short_name;     // 11 characters, space padded
+        bool directory;
+        bool fragmented;
+        bool no_fat_chain;          // exFAT: not in the FAT
+        std::vector<uint8_t> data;
+        std::vector<int> children;  // directories only
+        int parent;
+        uint32_t first_cluster;
+        uint32_t entry_offset;      // of the 8.3 (exFAT: file) entry in the image
+    } node_t;
+
+    FatType m_type;
+    bool m_partitioned;
+    uint32_t m_volume_start;
+    uint32_t m_total_sectors;
+    uint32_t m_fat_sectors;
+    uint32_t m_root_start;          // FAT16 fixed root
+    uint32_t m_root_sectors;
+    uint32_t m_data_start;
+    uint32_t m_next_cluster;
+    uint32_t m_bitmap_cluster;      // exFAT allocation bitmap
+    uint32_t m_short_names;
+    std::vector<node_t> m_nodes;
+    std::vector<uint8_t> m_image;
+
+    static constexpr uint32_t SECTOR = BLOCK_CACHE_SECTOR_SIZE;
+    static constexpr uint32_t RESERVED = 32;
+
+    static void put16(uint8_t *p, uint32_t v)
+    {
+        p[0] = v;
+        p[1] = v >> 8;
+    }
+    static void put32(uint8_t *p, uint32_t v)
+    {
+        put16(p, v);
+        put16(p + 2, v >> 16);
+    }
+
+    uint32_t clusterSector(uint32_t cluster) { return m_data_start + (cluster - 2); }
+    uint8_t *sector(uint32_t lba) { return &m_image[(size_t)lba * SECTOR]; }
+
+    int child(int dir, const std::string &name)
+    {
+        for (int c : m_nodes[dir].children) {
+            if (m_nodes[c].name == name) return c;
+        }
+        return -1;
+    }
+
+    int addNode(int parent, const std::string &name, bool directory)
+    {
+        node_t node = {};
+        node.name = name;
+        node.directory = directory;
+        node.parent = parent;
+        // Generated 8.3 names keep the extension so short names look real
+        char base[9];
+        snprintf(base, sizeof(base), "F%07u", (unsigned)++m_short_names);
+        std::string short_name = std::string(base);
+        size_t dot = name.rfind('.');
+        std::string extension = dot == std::string::npos ? "" : name.substr(dot + 1, 3);
+        for (char &c : extension) c = toupper((unsigned char)c);
+        node.short_name = short_name + extension + std::string(3 - extension.size(), ' ');
+        m_nodes.push_back(node);
+        m_nodes[parent].children.push_back(m_nodes.size() - 1);
+        return m_nodes.size() - 1;
+    }
+
+    uint32_t entryCount(int dir)
+    {
+        if (m_type == FAT_TYPE_EXFAT) {
+            uint32_t count = dir == 0 ? 1 : 0;  // the bitmap
+            for (int c : m_nodes[dir].children) {
+                count += 2 + (m_nodes[c].name.size() + 14) / 15;
+            }
+            return count;
+        }
+        uint32_t count = dir == 0 ? 0 : 2;  // . and ..
+        for (int c : m_nodes[dir].children) {
+            count += 1 + (m_nodes[c].name.size() + 12) / 13;
+        }
+        return count;
+    }
+
+    uint32_t clustersFor(uint32_t bytes) { return (bytes + SECTOR - 1) / SECTOR; }
+
+    void setFat(uint32_t cluster, uint32_t value)
+    {
+        for (int copy = 0; copy < (m_type == FAT_TYPE_EXFAT ? 1 : 2); copy++) {
+            uint32_t fat = m_volume_start + RESERVED + copy * m_fat_sectors;
+            if (m_type == FAT_TYPE_FAT16) {
+                put16(sector(fat) + cluster * 2, value & 0xFFFF);
+            } else {
+                put32(sector(fat) + cluster * 4, value);
+            }
+        }
+    }
+
+    // Clusters for bytes, chained in the FAT unless no_fat_chain; fragmented
+    // chains skip one free cluster after each one they use
+    uint32_t allocate(uint32_t bytes, bool fragmented, bool no_fat_chain = false)
+    {
+        uint32_t count = clustersFor(bytes);
+        if (count == 0) return 0;
+        uint32_t first = m_next_cluster;
+        uint32_t cluster = first;
+        uint32_t end = m_type == FAT_TYPE_EXFAT ? 0xFFFFFFFF : 0x0FFFFFFF;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t next = cluster + (fragmented ? 2 : 1);
+            if (!no_fat_chain) setFat(cluster, i + 1 < count ? next : end);
+            if (m_type == FAT_TYPE_EXFAT) {
+                uint32_t bit = cluster - 2;
+                sector(clusterSector(m_bitmap_cluster))[bit / 8] |= 1 << (bit % 8);
+            }
+            cluster = next;
+        }
+        m_next_cluster = cluster;
+        return first;
+    }
+
+    void layout(int index)
+    {
+        node_t &node = m_nodes[index];
+        // The exFAT root has no directory entry to carry the flag
+        node.no_fat_chain = m_type == FAT_TYPE_EXFAT && index != 0 && !node.fragmented;
+        if (node.directory) {
+            if (index != 0 || m_type != FAT_TYPE_FAT16) {
+                node.first_cluster = allocate(entryCount(index) * 32, false, node.no_fat_chain);
+            }
+            for (int c : std::vector<int>(node.children)) {
+                layout(c);
+            }
+        } else {
+            node.first_cluster = allocate(node.data.size(), node.fragmented, node.no_fat_chain);
+            uint32_t cluster = node.first_cluster;
+            for (uint32_t done = 0; done < node.data.size(); done += SECTOR) {
+                uint32_t length = std::min<uint32_t>(SECTOR, node.data.size() - done);
+                memcpy(sector(clusterSector(cluster)), node.data.data() + done, length);
+                cluster += node.fragmented ? 2 : 1;
+            }
+        }
+    }
+
+    void shortEntry(uint8_t *entry, const char *name, uint8_t attributes, uint32_t cluster, uint32_t size)
+    {
+        memcpy(entry, name, 11);
+        entry[11] = attributes;
+        put16(entry + 20, cluster >> 16);
+        put16(entry + 22, 0x6000);  // 12:00
+        put16(entry + 24, 0x5A21);  // 2025-01-01
+        put16(entry + 26, cluster & 0xFFFF);
+        put32(entry + 28, size);
+    }
+
+    void writeDirectory(int index)
+    {
+        node_t &node = m_nodes[index];
+        bool fixed_root = index == 0 && m_type == FAT_TYPE_FAT16;
+        uint32_t base = fixed_root ? m_root_start : clusterSector(node.first_cluster);
+        uint32_t slot = 0;
+        auto next = [&]() { uint8_t *e = sector(base) + slot * 32; slot++; return e; };
+
+        if (index != 0) {
+            uint32_t parent_cluster = node.parent == 0 ? 0 : m_nodes[node.parent].first_cluster;
+            shortEntry(next(), ".          ", ATTR_DIR, node.first_cluster, 0);
+            shortEntry(next(), "..         ", ATTR_DIR, parent_cluster, 0);
+        }
+        for (int c : node.children) {
+            node_t &entry = m_nodes[c];
+            uint8_t checksum = 0;
+            for (int i = 0; i < 11; i++) {
+                checksum = ((checksum & 1) << 7) + (checksum >> 1) + (uint8_t)entry.short_name[i];
+            }
+            int pieces = (entry.name.size() + 12) / 13;
+            for (int piece = pieces; piece >= 1; piece--) {
+                static const uint8_t OFFSETS[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+                uint8_t *lfn = next();
+                lfn[0] = piece | (piece == pieces ? 0x40 : 0);
+                lfn[11] = 0x0F;
+                lfn[13] = checksum;
+                for (int i = 0; i < 13; i++) {
+                    size_t at = (piece - 1) * 13 + i;
+                    uint16_t ch = at < entry.name.size() ? (uint8_t)entry.name[at] : at == entry.name.size() ? 0 : 0xFFFF;
+                    put16(lfn + OFFSETS[i], ch);
+                }
+            }
+            uint8_t *short_entry = next();
+            entry.entry_offset = short_entry - m_image.data();
+            shortEntry(short_entry, entry.short_name.c_str(), entry.directory ? ATTR_DIR : 0x20, entry.first_cluster,
+                       entry.directory ? 0 : entry.data.size());
+        }
+        for (int c : node.children) {
+            if (m_nodes[c].directory) writeDirectory(c);
+        }
+    }
+
+    // exFAT checksums and name hashes rotate right and add each byte
+    static uint16_t rotateAdd(uint16_t sum, uint8_t byte) { return ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + byte; }
+
+    // A file entry, its stream extension and name entries; no . and .. here
+    void writeExfatDirectory(int index)
+    {
+        node_t &node = m_nodes[index];
+        uint8_t *base = sector(clusterSector(node.first_cluster));
+        uint32_t slot = 0;
+        if (index == 0) {
+            uint8_t *bitmap = base + slot++ * 32;
+            bitmap[0] = 0x81;
+            put32(bitmap + 20, m_bitmap_cluster);
+            put32(bitmap + 24, (m_total_sectors - m_data_start + m_volume_start + 7) / 8);
+        }
+        for (int c : node.children) {
+            node_t &entry = m_nodes[c];
+            int names = (entry.name.size() + 14) / 15;
+            uint8_t *set = base + slot * 32;
+            slot += 2 + names;
+            entry.entry_offset = set - m_image.data();
+
+            set[0] = 0x85;
+            set[1] = 1 + names;
+            put16(set + 4, entry.directory ? ATTR_DIR : 0x20);
+            for (int t = 8; t <= 16; t += 4) put32(set + t, 0x5A216000);  // 2025-01-01 12:00
+
+            uint32_t size = entry.directory ? clustersFor(entryCount(c) * 32) * SECTOR : entry.data.size();
+            uint8_t *stream = set + 32;
+            stream[0] = 0xC0;
+            stream[1] = 0x01 | (entry.no_fat_chain ? 0x02 : 0);
+            stream[3] = entry.name.size();
+            uint16_t hash = 0;
+            for (char ch : entry.name) {
+                hash = rotateAdd(rotateAdd(hash, toupper((unsigned char)ch)), 0);
+            }
+            put16(stream + 4, hash);
+            put32(stream + 8, size);
+            put32(stream + 20, entry.first_cluster);
+            put32(stream + 24, size);
+
+            for (int n = 0; n < names; n++) {
+                uint8_t *name = set + (2 + n) * 32;
+                name[0] = 0xC1;
+                for (int i = 0; i < 15 && n * 15 + i < (int)entry.name.size(); i++) {
+                    put16(name + 2 + i * 2, (uint8_t)entry.name[n * 15 + i]);
+                }
+            }
+
+            uint16_t checksum = 0;
+            for (int i = 0; i < (2 + names) * 32; i++) {
+                if (i != 2 && i != 3) checksum = rotateAdd(checksum, set[i]);
+            }
+            put16(set + 2, checksum);
+        }
+        for (int c : node.children) {
+            if (m_nodes[c].directory) writeExfatDirectory(c);
+        }
+    }
+
+    // The bitmap takes the first clusters, the root directory follows
+    void buildExfat(uint8_t *bs, uint32_t clusters)
+    {
+        bs[0] = 0xEB;
+        bs[1] = 0x76;
+        bs[2] = 0x90;
+        memcpy(bs + 3, "EXFAT   ", 8);
+        put32(bs + 64, m_volume_start);
+        put32(bs + 72, m_total_sectors);
+        put32(bs + 80, RESERVED);
+        put32(bs + 84, m_fat_sectors);
+        put32(bs + 88, m_data_start - m_volume_start);
+        put32(bs + 92, clusters);
+        put32(bs + 100, 0x1234ABCD);
+        put16(bs + 104, 0x0100);
+        bs[108] = 9;    // 512 byte sectors
+        bs[109] = 0;    // one sector clusters
+        bs[110] = 1;
+        bs[111] = 0x80;
+        put16(bs + 510, 0xAA55);
+
+        setFat(0, 0xFFFFFFF8);
+        setFat(1, 0xFFFFFFFF);
+        m_bitmap_cluster = 2;
+        allocate((clusters + 7) / 8, false);
+        layout(0);
+        put32(bs + 96, m_nodes[0].first_cluster);
+        writeExfatDirectory(0);
+    }
+
+    static constexpr uint8_t ATTR_DIR = 0x10;
+
+public:
+    // FAT32 needs at least 65525 clusters, so its images are about 33 MB;
+    // they are written sparse. exFAT images use one FAT and 8192 clusters
+    FatImage(FatType type = FAT_TYPE_FAT16, bool partitioned = false)
+        : m_type(type), m_partitioned(partitioned), m_bitmap_cluster(0), m_short_names(0)
+    {
+        node_t root = {};
+        root.directory = true;
+        root.parent = -1;
+        m_nodes.push_back(root);
+    }
+
+    // Parent directories are created as needed
+    void addFile(const char *path, const std::vector<uint8_t> &data, bool fragmented = false)
+    {
+        int dir = 0;
+        std::string rest = path[0] == '/' ? path + 1 : path;
+        size_t slash;
+        while ((slash = rest.find('/')) != std::string::npos) {
+            std::string part = rest.substr(0, slash);
+            int found = child(dir, part);
+            dir = found >= 0 ? found : addNode(dir, part, true);
+            rest = rest.substr(slash + 1);
+        }
+        int file = addNode(dir, rest, false);
+        m_nodes[file].data = data;
+        m_nodes[file].fragmented = fragmented;
+    }
+
+    // Lay everything out in memory; bytes() and entryOffset() are valid after
+    void build()
+    {
+        bool exfat = m_type == FAT_TYPE_EXFAT;
+        uint32_t clusters = m_type == FAT_TYPE_FAT32 ? 66000 : 8192;
+        m_volume_start = m_partitioned ? 64 : 0;
+        uint32_t entry_bytes = m_type == FAT_TYPE_FAT16 ? 2 : 4;
+        m_fat_sectors = (clusters + 2) * entry_bytes / SECTOR + 1;
+        m_root_sectors = m_type == FAT_TYPE_FAT16 ? 512 * 32 / SECTOR : 0;
+        m_root_start = m_volume_start + RESERVED + (exfat ? 1 : 2) * m_fat_sectors;
+        m_data_start = m_root_start + m_root_sectors;
+        m_total_sectors = m_data_start - m_volume_start + clusters;
+        m_image.assign((size_t)(m_volume_start + m_total_sectors) * SECTOR, 0);
+        m_next_cluster = 2;
+
+        if (m_partitioned) {
+            static const uint8_t PARTITION_TYPES[] = {0, 0x06, 0x0C, 0x07};
+            uint8_t *mbr = sector(0);
+            mbr[0x1C2] = PARTITION_TYPES[m_type];
+            put32(mbr + 0x1C6, m_volume_start);
+            put32(mbr + 0x1CA, m_total_sectors);
+            put16(mbr + 510, 0xAA55);
+        }
+
+        uint8_t *bs = sector(m_volume_start);
+        if (exfat) {
+            buildExfat(bs, clusters);
+            return;
+        }
+        bs[0] = 0xEB;
+        bs[1] = 0x58;
+        bs[2] = 0x90;
+        memcpy(bs + 3, "MSWIN4.1", 8);
+        put16(bs + 11, SECTOR);
+        bs[13] = 1;
+        put16(bs + 14, RESERVED);
+        bs[16] = 2;
+        put16(bs + 17, m_type == FAT_TYPE_FAT16 ? 512 : 0);
+        bs[21] = 0xF8;
+        put32(bs + 32, m_total_sectors);
+        if (m_type == FAT_TYPE_FAT16) {
+            put16(bs + 22, m_fat_sectors);
+            bs[38] = 0x29;
+            put32(bs + 39, 0x1234ABCD);
+        } else {
+            put32(bs + 36, m_fat_sectors);
+            put32(bs + 44, 2);
+            put16(bs + 48, 1);
+            bs[66] = 0x29;
+            put32(bs + 67, 0x1234ABCD);
+            uint8_t *fsinfo = sector(m_volume_start + 1);
+            put32(fsinfo, 0x41615252);
+            put32(fsinfo + 484, 0x61417272);
+            put32(fsinfo + 488, 0xFFFFFFFF);
+            put16(fsinfo + 510, 0xAA55);
+        }
+        put16(bs + 510, 0xAA55);
+
+        setFat(0, 0x0FFFFFF8);
+        setFat(1, 0x0FFFFFFF);
+        layout(0);
+        writeDirectory(0);
+    }
+
+    std::vector<uint8_t> &bytes() { return m_image; }
+
+    // Byte offset of a file's 8.3 (exFAT: file) entry, for tests that damage it
+    uint32_t entryOffset(const char *path)
+    {
+        int node = 0;
+        std::string rest = path[0] == '/' ? path + 1 : path;
+        while (!rest.empty() && node >= 0) {
+            size_t slash = rest.find('/');
+            node = child(node, rest.substr(0, slash));
+            rest = slash == std::string::npos ? "" : rest.substr(slash + 1);
+        }
+        return node > 0 ? m_nodes[node].entry_offset : 0;
+    }
+
+    // Write the image out, skipping all-zero sectors so large ones stay sparse
+    bool save(const char *path)
+    {
+        int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        bool ok = ftruncate(fd, m_image.size()) == 0;
+        static const uint8_t zero[SECTOR] = {};
+        for (size_t offset = 0; ok && offset < m_image.size(); offset += SECTOR) {
+            if (memcmp(&m_image[offset], zero, SECTOR) != 0) {
+                ok = pwrite(fd, &m_image[offset], SECTOR, offset) == SECTOR;
+            }
+        }
+        ::close(fd);
+        return ok;
+    }
+};
+
+#endif
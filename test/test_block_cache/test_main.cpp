@@ -0,0 +1,232 @@
+// BlockCache over ImageBlockDevice: hits and misses, read-ahead, the
+// streaming bypass, write-through and keeping the FAT resident
+
+#include <unity.h>
+#include <Arduino.h>
+
+#include "BlockCache.h"
+#include "FatImage.h"
+
+#define TEST_IMAGE "test_block_cache.img"
+#define SECTOR BLOCK_CACHE_SECTOR_SIZE
+#define CACHE_BLOCKS 32
+#define READ_AHEAD 4
+
+// Well past the FAT and root directory, in the data area
+#define DATA_LBA 1000
+
+static ImageBlockDevice s_device;
+static BlockCache s_cache;
+// What the card should hold, updated alongside every write
+static std::vector<uint8_t> s_reference;
+
+static void buildImage(bool partitioned)
+{
+    FatImage image(FAT_TYPE_FAT16, partitioned);
+    std::vector<uint8_t> data(64 * SECTOR);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 31 + i / SECTOR);
+    }
+    image.addFile("/data.bin", data);
+    image.build();
+    // Give every sector distinct contents so a wrong block is always caught
+    s_reference = image.bytes();
+    uint32_t sectors = s_reference.size() / SECTOR;
+    for (uint32_t lba = DATA_LBA; lba < sectors; lba++) {
+        memcpy(&s_reference[(size_t)lba * SECTOR], &lba, sizeof(lba));
+    }
+    image.bytes() = s_reference;
+    TEST_ASSERT_TRUE(image.save(TEST_IMAGE));
+    TEST_ASSERT_TRUE(s_device.open(TEST_IMAGE, true));
+    TEST_ASSERT_TRUE(s_cache.begin(&s_device, CACHE_BLOCKS, READ_AHEAD));
+    s_device.reads = 0;
+}
+
+static void checkBlocks(uint32_t lba, uint32_t count)
+{
+    std::vector<uint8_t> data(count * SECTOR);
+    TEST_ASSERT_TRUE(s_cache.read(lba, data.data(), count));
+    TEST_ASSERT_EQUAL_MEMORY(&s_reference[(size_t)lba * SECTOR], data.data(), data.size());
+}
+
+void setUp(void)
+{
+    buildImage(false);
+}
+
+void tearDown(void)
+{
+    s_cache.end();
+    s_device.close();
+    remove(TEST_IMAGE);
+}
+
+static void test_hit_and_miss(void)
+{
+    checkBlocks(DATA_LBA, 1);
+    block_cache_stats_t stats = s_cache.getStats();
+    TEST_ASSERT_EQUAL_UINT32(0, stats.hits);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.misses);
+    TEST_ASSERT_EQUAL_UINT32(1, s_device.reads);
+
+    checkBlocks(DATA_LBA, 1);
+    stats = s_cache.getStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.hits);
+    TEST_ASSERT_EQUAL_UINT32(1, s_device.reads);
+
+    // Partly resident: the cached block is copied, the rest is one read
+    checkBlocks(DATA_LBA, 3);
+    stats = s_cache.getStats();
+    TEST_ASSERT_EQUAL_UINT32(2, stats.hits);
+    TEST_ASSERT_EQUAL_UINT32(3, stats.misses);
+    TEST_ASSERT_EQUAL_UINT32(2, s_device.reads);
+}
+
+static void test_read_ahead(void)
+{
+    checkBlocks(DATA_LBA, 1);
+    // Following on from the last read pulls in READ_AHEAD more blocks
+    checkBlocks(DATA_LBA + 1, 1);
+    block_cache_stats_t stats = s_cache.getStats();
+    TEST_ASSERT_EQUAL_UINT32(READ_AHEAD, stats.read_ahead);
+    TEST_ASSERT_EQUAL_UINT32(2, s_device.reads);
+
+    for (uint32_t b = 0; b < READ_AHEAD; b++) {
+        checkBlocks(DATA_LBA + 2 + b, 1);
+    }
+    stats = s_cache.getStats();
+    TEST_ASSERT_EQUAL_UINT32(READ_AHEAD, stats.read_ahead_hits);
+    TEST_ASSERT_EQUAL_UINT32(READ_AHEAD, stats.hits);
+    TEST_ASSERT_EQUAL_UINT32(2, s_device.reads);
+
+    // A jump elsewhere does not read ahead
+    checkBlocks(DATA_LBA + 100, 1);
+    TEST_ASSERT_EQUAL_UINT32(READ_AHEAD, s_cache.getStats().read_ahead);
+}
+
+static void test_read_ahead_at_end(void)
+{
+    // Read-ahead past the last sector fails and is retried without it
+    uint32_t last = s_reference.size() / SECTOR - 1;
+    checkBlocks(last - 1, 1);
+    checkBlocks(last, 1);
+    TEST_ASSERT_EQUAL_UINT32(0, s_cache.getStats().read_ahead);
+}
+
+static void test_bypass(void)
+{
+    s_cache.setBypassThreshold(8);
+    checkBlocks(DATA_LBA, 8);
+    block_cache_stats_t stats = s_cache.getStats();
+    TEST_ASSERT_EQUAL_UINT32(8, stats.bypassed);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.misses);
+
+    // Nothing from the bypassed read was kept
+    checkBlocks(DATA_LBA + 4, 1);
+    TEST_ASSERT_EQUAL_UINT32(1, s_cache.getStats().misses);
+}
+
+static void test_write_through(void)
+{
+    checkBlocks(DATA_LBA, 4);
+    uint32_t reads = s_device.reads;
+
+    std::vector<uint8_t> data(2 * SECTOR, 0xA5);
+    TEST_ASSERT_TRUE(s_cache.write(DATA_LBA + 1, data.data(), 2));
+    memcpy(&s_reference[(size_t)(DATA_LBA + 1) * SECTOR], data.data(), data.size());
+    TEST_ASSERT_EQUAL_UINT32(2, s_cache.getStats().writes);
+
+    // Resident copies were updated, not dropped
+    checkBlocks(DATA_LBA, 4);
+    TEST_ASSERT_EQUAL_UINT32(reads, s_device.reads);
+
+    // And the card itself has the new data
+    ImageBlockDevice card;
+    TEST_ASSERT_TRUE(card.open(TEST_IMAGE));
+    std::vector<uint8_t> stored(2 * SECTOR);
+    TEST_ASSERT_TRUE(card.readBlocks(DATA_LBA + 1, stored.data(), 2));
+    TEST_ASSERT_EQUAL_MEMORY(data.data(), stored.data(), stored.size());
+
+    // Blocks that were not resident are written without being cached
+    TEST_ASSERT_TRUE(s_cache.write(DATA_LBA + 50, data.data(), 1));
+    memcpy(&s_reference[(size_t)(DATA_LBA + 50) * SECTOR], data.data(), SECTOR);
+    checkBlocks(DATA_LBA + 50, 1);
+    TEST_ASSERT_EQUAL_UINT32(reads + 1, s_device.reads);
+}
+
+static void checkFatPinned(uint32_t fat_start)
+{
+    TEST_ASSERT_TRUE(s_cache.pinFatMetadata());
+    // The first half of the cache holds the FAT
+    for (uint32_t b = 0; b < CACHE_BLOCKS / 2; b++) {
+        checkBlocks(fat_start + b * 2, 1);
+    }
+    // Scattered data reads cycle through the rest
+    for (uint32_t b = 0; b < CACHE_BLOCKS * 4; b++) {
+        checkBlocks(DATA_LBA + b * 3, 1);
+    }
+    s_cache.resetStats();
+    for (uint32_t b = 0; b < CACHE_BLOCKS / 2; b++) {
+        checkBlocks(fat_start + b * 2, 1);
+    }
+    TEST_ASSERT_EQUAL_UINT32(CACHE_BLOCKS / 2, s_cache.getStats().hits);
+    TEST_ASSERT_EQUAL_UINT32(0, s_cache.getStats().misses);
+}
+
+static void test_pin_fat_metadata(void)
+{
+    // FatImage puts the FAT right after its 32 reserved sectors
+    checkFatPinned(32);
+}
+
+static void test_pin_fat_metadata_partitioned(void)
+{
+    tearDown();
+    buildImage(true);
+    checkFatPinned(64 + 32);
+}
+
+// Random mixed reads and writes must always match the reference copy
+static void test_random_against_reference(void)
+{
+    TEST_ASSERT_TRUE(s_cache.pinFatMetadata());
+    uint32_t sectors = s_reference.size() / SECTOR;
+    std::vector<uint8_t> data(16 * SECTOR);
+    srand(1);
+    for (int i = 0; i < 20000; i++) {
+        int op = rand() % 10;
+        uint32_t count = 1 + rand() % (rand() % 4 == 0 ? 12 : 2);
+        uint32_t lba;
+        if (op < 4) {
+            lba = 32 + rand() % 100;
+        } else if (op < 6) {
+            lba = DATA_LBA + rand() % 20;
+        } else {
+            lba = rand() % (sectors - 16);
+        }
+        if (op == 9) {
+            for (uint32_t b = 0; b < count * SECTOR; b++) {
+                data[b] = (uint8_t)rand();
+            }
+            TEST_ASSERT_TRUE(s_cache.write(lba, data.data(), count));
+            memcpy(&s_reference[(size_t)lba * SECTOR], data.data(), count * SECTOR);
+        } else {
+            checkBlocks(lba, count);
+        }
+    }
+    TEST_ASSERT_GREATER_THAN(0, s_cache.getStats().hits);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_hit_and_miss);
+    RUN_TEST(test_read_ahead);
+    RUN_TEST(test_read_ahead_at_end);
+    RUN_TEST(test_bypass);
+    RUN_TEST(test_write_through);
+    RUN_TEST(test_pin_fat_metadata);
+    RUN_TEST(test_pin_fat_metadata_partitioned);
+    RUN_TEST(test_random_against_reference);
+    return UNITY_END();
+}
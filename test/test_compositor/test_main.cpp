@@ -0,0 +1,190 @@
+// Compositor against a reference composition of the same layers, checking
+// both the panel contents and how many pixels each flush pushed
+
+#include <unity.h>
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+
+#include "Compositor.h"
+#include "FramePipeline.h"
+
+#define PANEL_WIDTH 160
+#define PANEL_HEIGHT 128
+#define BACKGROUND 0x1234
+#define BAR_HEIGHT 12
+#define KEY_COLOR TFT_MAGENTA
+#define OVERLAY_WIDTH 30
+#define OVERLAY_HEIGHT 20
+
+static TFT_eSPI s_tft(PANEL_WIDTH, PANEL_HEIGHT);
+static uint8_t s_video[PANEL_WIDTH * PANEL_HEIGHT];
+static uint16_t s_bar[PANEL_WIDTH * BAR_HEIGHT];
+static int s_videoLayer;
+static int s_barLayer;
+static int s_overlayLayer;
+// Where the reference expects the white overlay, off screen when hidden
+static int s_overlayX;
+static int s_overlayY;
+
+// A video frame with a status bar along the bottom, keyed so every fifth
+// pixel shows the video, and a white box overlapping the top left corner
+void setUp(void)
+{
+    TEST_ASSERT_TRUE(Compositor::begin(PANEL_WIDTH, PANEL_HEIGHT, BACKGROUND));
+    for (int i = 0; i < PANEL_WIDTH * PANEL_HEIGHT; i++) {
+        s_video[i] = (uint8_t)(i * 7);
+    }
+    for (int i = 0; i < PANEL_WIDTH * BAR_HEIGHT; i++) {
+        s_bar[i] = i % 5 == 0 ? KEY_COLOR : TFT_GREEN;
+    }
+    s_overlayX = -10;
+    s_overlayY = -5;
+
+    s_videoLayer = Compositor::addLayer(0, 0, PANEL_WIDTH, PANEL_HEIGHT, LAYER_FORMAT_RGB332, LAYER_Z_VIDEO);
+    s_barLayer = Compositor::addLayer(0, PANEL_HEIGHT - BAR_HEIGHT, PANEL_WIDTH, BAR_HEIGHT, LAYER_FORMAT_RGB565,
+                                      LAYER_Z_UI);
+    s_overlayLayer = Compositor::addLayer(s_overlayX, s_overlayY, OVERLAY_WIDTH, OVERLAY_HEIGHT, LAYER_FORMAT_FILL,
+                                          LAYER_Z_OVERLAY);
+    TEST_ASSERT_TRUE(s_videoLayer >= 0 && s_barLayer >= 0 && s_overlayLayer >= 0);
+    Compositor::setPixels(s_videoLayer, s_video);
+    Compositor::setPixels(s_barLayer, s_bar);
+    Compositor::setColorKey(s_barLayer, KEY_COLOR);
+    Compositor::setFill(s_overlayLayer, TFT_WHITE);
+
+    s_tft.fillScreen(TFT_BLACK);
+    s_tft.pushed_pixels = 0;
+}
+
+void tearDown(void)
+{
+    Compositor::removeLayer(s_videoLayer);
+    Compositor::removeLayer(s_barLayer);
+    Compositor::removeLayer(s_overlayLayer);
+    // Drop the damage the removals left behind
+    Compositor::flush(&s_tft);
+}
+
+static uint16_t expected(int x, int y)
+{
+    if (x >= s_overlayX && x < s_overlayX + OVERLAY_WIDTH && y >= s_overlayY && y < s_overlayY + OVERLAY_HEIGHT) {
+        return TFT_WHITE;
+    }
+    if (y >= PANEL_HEIGHT - BAR_HEIGHT) {
+        uint16_t bar = s_bar[(y - PANEL_HEIGHT + BAR_HEIGHT) * PANEL_WIDTH + x];
+        if (bar != KEY_COLOR) {
+            return bar;
+        }
+    }
+    return PixelConvert<PixelRGB332, PixelRGB565>::convert(s_video[y * PANEL_WIDTH + x]);
+}
+
+static void checkPanel()
+{
+    for (int y = 0; y < PANEL_HEIGHT; y++) {
+        for (int x = 0; x < PANEL_WIDTH; x++) {
+            TEST_ASSERT_EQUAL_HEX16(expected(x, y), s_tft.readPixel(x, y));
+        }
+    }
+}
+
+// Pushes exactly the pixels flush() reports, and returns them
+static uint32_t flush()
+{
+    uint32_t before = s_tft.pushed_pixels;
+    uint32_t pushed = Compositor::flush(&s_tft);
+    TEST_ASSERT_EQUAL_UINT32(pushed, s_tft.pushed_pixels - before);
+    return pushed;
+}
+
+static void test_first_flush(void)
+{
+    TEST_ASSERT_EQUAL_UINT32(PANEL_WIDTH * PANEL_HEIGHT, flush());
+    checkPanel();
+    TEST_ASSERT_EQUAL_UINT32(0, flush());
+}
+
+static void test_small_damage(void)
+{
+    flush();
+    s_bar[PANEL_WIDTH * 3 + 50] = TFT_BLUE;
+    Compositor::damage(s_barLayer, 48, 2, 4, 3);
+    TEST_ASSERT_EQUAL_UINT32(4 * 3, flush());
+    checkPanel();
+}
+
+static void test_scattered_damage(void)
+{
+    flush();
+    // More marks than a layer keeps are merged, still well under a full panel
+    for (int i = 0; i < 20; i++) {
+        s_bar[(i % BAR_HEIGHT) * PANEL_WIDTH + i * 8] = TFT_RED;
+        Compositor::damage(s_barLayer, i * 8, i % BAR_HEIGHT, 2, 1);
+    }
+    uint32_t pushed = flush();
+    TEST_ASSERT_GREATER_OR_EQUAL(20 * 2, pushed);
+    TEST_ASSERT_LESS_OR_EQUAL(PANEL_WIDTH * BAR_HEIGHT, pushed);
+    checkPanel();
+}
+
+static void test_move(void)
+{
+    flush();
+    Compositor::move(s_overlayLayer, 100, 50);
+    s_overlayX = 100;
+    s_overlayY = 50;
+    // The visible part of the old position and the whole new one
+    uint32_t pushed = flush();
+    TEST_ASSERT_LESS_OR_EQUAL((OVERLAY_WIDTH - 10) * (OVERLAY_HEIGHT - 5) + OVERLAY_WIDTH * OVERLAY_HEIGHT, pushed);
+    checkPanel();
+}
+
+static void test_hide(void)
+{
+    flush();
+    Compositor::setVisible(s_overlayLayer, false);
+    s_overlayX = PANEL_WIDTH;
+    TEST_ASSERT_EQUAL_UINT32((OVERLAY_WIDTH - 10) * (OVERLAY_HEIGHT - 5), flush());
+    checkPanel();
+}
+
+static void test_swapped_layer(void)
+{
+    flush();
+    // The same bar in panel byte order looks the same
+    static uint16_t swapped[PANEL_WIDTH * BAR_HEIGHT];
+    for (int i = 0; i < PANEL_WIDTH * BAR_HEIGHT; i++) {
+        swapped[i] = (uint16_t)((s_bar[i] << 8) | (s_bar[i] >> 8));
+    }
+    Compositor::removeLayer(s_barLayer);
+    s_barLayer = Compositor::addLayer(0, PANEL_HEIGHT - BAR_HEIGHT, PANEL_WIDTH, BAR_HEIGHT,
+                                      LAYER_FORMAT_RGB565_SWAPPED, LAYER_Z_UI);
+    Compositor::setPixels(s_barLayer, swapped);
+    Compositor::setColorKey(s_barLayer, KEY_COLOR);
+    TEST_ASSERT_EQUAL_UINT32(PANEL_WIDTH * BAR_HEIGHT, flush());
+    checkPanel();
+}
+
+static void test_is_covered(void)
+{
+    TEST_ASSERT_TRUE(Compositor::isCovered(s_videoLayer));
+    TEST_ASSERT_FALSE(Compositor::isCovered(s_barLayer));
+    TEST_ASSERT_FALSE(Compositor::isCovered(s_overlayLayer));
+    // Moved over the bar, then hidden
+    Compositor::move(s_overlayLayer, 0, PANEL_HEIGHT - 5);
+    TEST_ASSERT_TRUE(Compositor::isCovered(s_barLayer));
+    Compositor::setVisible(s_overlayLayer, false);
+    TEST_ASSERT_FALSE(Compositor::isCovered(s_barLayer));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_first_flush);
+    RUN_TEST(test_small_damage);
+    RUN_TEST(test_scattered_damage);
+    RUN_TEST(test_move);
+    RUN_TEST(test_hide);
+    RUN_TEST(test_swapped_layer);
+    RUN_TEST(test_is_covered);
+    return UNITY_END();
+}
@@ -0,0 +1,200 @@
+// FatVolume and ContiguousFile against FAT16, FAT32 and exFAT images, with
+// and without a partition table, read back through ImageBlockDevice
+
+#include <unity.h>
+#include <Arduino.h>
+
+#include "FatImage.h"
+#include "FatVolume.h"
+
+#define TEST_IMAGE "test_fat_volume.img"
+
+static std::vector<uint8_t> s_frame1;
+static std::vector<uint8_t> s_frame2;
+
+static std::vector<uint8_t> pattern(uint32_t bytes, int step)
+{
+    std::vector<uint8_t> data(bytes);
+    for (uint32_t i = 0; i < bytes; i++) {
+        data[i] = (uint8_t)(i * step + 1);
+    }
+    return data;
+}
+
+// A contiguous and a fragmented frame, a directory of long names and an
+// empty file in the root
+static void addTestFiles(FatImage *image)
+{
+    image->addFile("/output_frame/frame1.bin", s_frame1);
+    image->addFile("/output_frame/frame2.bin", s_frame2, true);
+    char path[64];
+    for (int i = 0; i < 30; i++) {
+        snprintf(path, sizeof(path), "/many/a_rather_long_file_name_number_%d.txt", i);
+        image->addFile(path, s_frame2);
+    }
+    image->addFile("/Readme.TXT", std::vector<uint8_t>());
+}
+
+static bool countEntry(const char *name, const char *short_name, const fat_file_t *file, void *arg)
+{
+    (*(int *)arg)++;
+    return true;
+}
+
+static void checkVolume(FatType type, bool partitioned)
+{
+    FatImage image(type, partitioned);
+    addTestFiles(&image);
+    image.build();
+    TEST_ASSERT_TRUE(image.save(TEST_IMAGE));
+
+    ImageBlockDevice device;
+    TEST_ASSERT_TRUE(device.open(TEST_IMAGE));
+    FatVolume volume;
+    TEST_ASSERT_TRUE(volume.mount(&device));
+    TEST_ASSERT_EQUAL(type, volume.type());
+
+    fat_file_t file;
+    TEST_ASSERT_TRUE(volume.stat("/output_frame/frame1.bin", &file));
+    TEST_ASSERT_EQUAL_UINT32(s_frame1.size(), file.size);
+    TEST_ASSERT_FALSE(file.directory);
+    TEST_ASSERT_EQUAL(type == FAT_TYPE_EXFAT, file.no_fat_chain);
+    TEST_ASSERT_TRUE(volume.isContiguous(&file));
+
+    // Names match case-insensitively
+    TEST_ASSERT_TRUE(volume.stat("/OUTPUT_FRAME/FRAME2.BIN", &file));
+    TEST_ASSERT_FALSE(volume.isContiguous(&file));
+    TEST_ASSERT_TRUE(volume.stat("/many/a_rather_long_file_name_number_29.txt", &file));
+    TEST_ASSERT_EQUAL_UINT32(s_frame2.size(), file.size);
+    TEST_ASSERT_TRUE(volume.stat("/readme.txt", &file));
+    TEST_ASSERT_EQUAL_UINT32(0, file.size);
+    TEST_ASSERT_TRUE(volume.stat("/many", &file));
+    TEST_ASSERT_TRUE(file.directory);
+    TEST_ASSERT_FALSE(volume.stat("/many/missing.txt", &file));
+    TEST_ASSERT_FALSE(volume.stat("/readme.txt/frame1.bin", &file));
+
+    int entries = 0;
+    TEST_ASSERT_TRUE(volume.list("/many", countEntry, &entries));
+    TEST_ASSERT_EQUAL_INT(30, entries);
+}
+
+void setUp(void)
+{
+    s_frame1 = pattern(5000, 13);
+    s_frame2 = pattern(3000, 7);
+}
+
+void tearDown(void)
+{
+    remove(TEST_IMAGE);
+}
+
+static void test_fat16(void)
+{
+    checkVolume(FAT_TYPE_FAT16, false);
+}
+
+static void test_fat16_partitioned(void)
+{
+    checkVolume(FAT_TYPE_FAT16, true);
+}
+
+static void test_fat32(void)
+{
+    checkVolume(FAT_TYPE_FAT32, false);
+}
+
+static void test_fat32_partitioned(void)
+{
+    checkVolume(FAT_TYPE_FAT32, true);
+}
+
+static void test_exfat(void)
+{
+    checkVolume(FAT_TYPE_EXFAT, false);
+}
+
+static void test_exfat_partitioned(void)
+{
+    checkVolume(FAT_TYPE_EXFAT, true);
+}
+
+static void checkContiguousRead(FatType type)
+{
+    FatImage image(type);
+    addTestFiles(&image);
+    image.build();
+    TEST_ASSERT_TRUE(image.save(TEST_IMAGE));
+    ImageBlockDevice device;
+    TEST_ASSERT_TRUE(device.open(TEST_IMAGE));
+    FatVolume volume;
+    TEST_ASSERT_TRUE(volume.mount(&device));
+
+    ContiguousFile file;
+    TEST_ASSERT_TRUE(file.open(&volume, "/output_frame/frame1.bin"));
+    TEST_ASSERT_EQUAL_UINT32(s_frame1.size(), file.size());
+    std::vector<uint8_t> data(s_frame1.size());
+    TEST_ASSERT_EQUAL_INT32(s_frame1.size(), file.read(0, data.data(), data.size()));
+    TEST_ASSERT_EQUAL_MEMORY(s_frame1.data(), data.data(), data.size());
+
+    // Unaligned start and end go through the bounce buffer
+    TEST_ASSERT_EQUAL_INT32(1000, file.read(777, data.data(), 1000));
+    TEST_ASSERT_EQUAL_MEMORY(&s_frame1[777], data.data(), 1000);
+    // Short at the end of the file
+    TEST_ASSERT_EQUAL_INT32(100, file.read(4900, data.data(), 1000));
+    TEST_ASSERT_EQUAL_MEMORY(&s_frame1[4900], data.data(), 100);
+
+    // Fragmented files, directories and missing files are refused
+    TEST_ASSERT_FALSE(file.open(&volume, "/output_frame/frame2.bin"));
+    TEST_ASSERT_FALSE(file.open(&volume, "/many"));
+    TEST_ASSERT_FALSE(file.open(&volume, "/output_frame/frame3.bin"));
+    TEST_ASSERT_FALSE(file.open(nullptr, "/output_frame/frame1.bin"));
+}
+
+static void test_contiguous_read(void)
+{
+    checkContiguousRead(FAT_TYPE_FAT16);
+}
+
+// exFAT marks the file NoFatChain, so nothing of it is in the FAT
+static void test_exfat_contiguous_read(void)
+{
+    checkContiguousRead(FAT_TYPE_EXFAT);
+}
+
+// A long name whose 8.3 entry was changed behind its back (its checksum
+// no longer matches) must not be used
+static void test_orphaned_long_name(void)
+{
+    FatImage image(FAT_TYPE_FAT32);
+    addTestFiles(&image);
+    image.build();
+    image.bytes()[image.entryOffset("/output_frame/frame1.bin")] = 'X';
+    TEST_ASSERT_TRUE(image.save(TEST_IMAGE));
+    ImageBlockDevice device;
+    TEST_ASSERT_TRUE(device.open(TEST_IMAGE));
+    FatVolume volume;
+    TEST_ASSERT_TRUE(volume.mount(&device));
+
+    fat_file_t file;
+    TEST_ASSERT_FALSE(volume.stat("/output_frame/frame1.bin", &file));
+    TEST_ASSERT_TRUE(volume.stat("/output_frame/frame2.bin", &file));
+    int entries = 0;
+    TEST_ASSERT_TRUE(volume.list("/output_frame", countEntry, &entries));
+    TEST_ASSERT_EQUAL_INT(2, entries);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_fat16);
+    RUN_TEST(test_fat16_partitioned);
+    RUN_TEST(test_fat32);
+    RUN_TEST(test_fat32_partitioned);
+    RUN_TEST(test_exfat);
+    RUN_TEST(test_exfat_partitioned);
+    RUN_TEST(test_contiguous_read);
+    RUN_TEST(test_exfat_contiguous_read);
+    RUN_TEST(test_orphaned_long_name);
+    return UNITY_END();
+}
@@ -0,0 +1,312 @@
+// ImageCache over host files: hits and misses, LRU eviction, pinning,
+// the byte budget (scratch buffers included), prefetch, decoding and
+// drawing
+
+#include <unity.h>
+#include <Arduino.h>
+#include <SD.h>
+#include <TFT_eSPI.h>
+#include <vector>
+
+#include "ImageCache.h"
+#include "FramePipeline.h"
+
+#define SIDE 8
+#define IMAGE_BYTES (SIDE * SIDE * 2)
+
+static const char *s_files[] = {"/cache_a.raw", "/cache_b.raw", "/cache_c.raw", "/cache_d.raw",
+                                "/cache_e.raw", "/cache_big.raw", "/cache_small.raw", "/cache_icon.qoi"};
+
+// Native RGB565, different for every file and pixel
+static uint16_t pixelOf(int file, int i)
+{
+    return (uint16_t)(file * 0x1111 + i * 37);
+}
+
+static void writeFile(const char *path, const void *data, size_t size)
+{
+    File file = SD.open(path, FILE_WRITE);
+    TEST_ASSERT_TRUE(file);
+    TEST_ASSERT_EQUAL_UINT32(size, file.write((const uint8_t *)data, size));
+    file.close();
+}
+
+static void writeRgb565(int file, int width, int height)
+{
+    std::vector<uint16_t> pixels(width * height);
+    for (int i = 0; i < width * height; i++) {
+        pixels[i] = pixelOf(file, i);
+    }
+    writeFile(s_files[file], pixels.data(), pixels.size() * 2);
+}
+
+static void checkPixels(int file, const VideoFrame_t *image)
+{
+    TEST_ASSERT_NOT_NULL(image);
+    TEST_ASSERT_EQUAL_UINT8(FRAME_FORMAT_RGB565, image->format);
+    const uint16_t *pixels = (const uint16_t *)image->data;
+    for (int i = 0; i < image->width * image->height; i++) {
+        TEST_ASSERT_EQUAL_HEX16(pixelOf(file, i), pixels[i]);
+    }
+}
+
+static const VideoFrame_t *acquire(int file)
+{
+    return ImageCache::acquire(s_files[file], SIDE, SIDE);
+}
+
+static image_cache_stats_t stats()
+{
+    image_cache_stats_t stats;
+    ImageCache::getStats(&stats);
+    return stats;
+}
+
+void setUp(void)
+{
+    for (int f = 0; f < 5; f++) {
+        writeRgb565(f, SIDE, SIDE);
+    }
+    TEST_ASSERT_TRUE(ImageCache::begin(3 * IMAGE_BYTES));
+}
+
+void tearDown(void)
+{
+    ImageCache::clear();
+    for (size_t f = 0; f < sizeof(s_files) / sizeof(s_files[0]); f++) {
+        SD.remove(s_files[f]);
+    }
+}
+
+static void test_hit_and_miss(void)
+{
+    const VideoFrame_t *image = acquire(0);
+    checkPixels(0, image);
+    ImageCache::release(image);
+    TEST_ASSERT_EQUAL_UINT32(0, stats().hits);
+    TEST_ASSERT_EQUAL_UINT32(1, stats().misses);
+
+    // Decoded once, then served from memory
+    const VideoFrame_t *again = acquire(0);
+    TEST_ASSERT_EQUAL_PTR(image, again);
+    TEST_ASSERT_EQUAL_PTR(image, ImageCache::tryAcquire(s_files[0], SIDE, SIDE));
+    ImageCache::release(again);
+    ImageCache::release(again);
+    TEST_ASSERT_EQUAL_UINT32(2, stats().hits);
+    TEST_ASSERT_EQUAL_UINT32(1, stats().misses);
+
+    // A different size or format is a different image
+    TEST_ASSERT_NULL(ImageCache::tryAcquire(s_files[0], SIDE, SIDE, FRAME_FORMAT_RGB332));
+    TEST_ASSERT_NULL(ImageCache::tryAcquire(s_files[1], SIDE, SIDE));
+    ImageCache::release(nullptr);
+}
+
+static void test_lru_eviction(void)
+{
+    for (int f = 0; f < 3; f++) {
+        ImageCache::release(acquire(f));
+    }
+    // Using the first again leaves the second as the oldest
+    ImageCache::release(acquire(0));
+    ImageCache::release(acquire(3));
+    TEST_ASSERT_EQUAL_UINT32(1, stats().evictions);
+
+    const VideoFrame_t *image = ImageCache::tryAcquire(s_files[1], SIDE, SIDE);
+    TEST_ASSERT_NULL(image);
+    for (int f : {0, 2, 3}) {
+        image = ImageCache::tryAcquire(s_files[f], SIDE, SIDE);
+        checkPixels(f, image);
+        ImageCache::release(image);
+    }
+}
+
+static void test_pinned_images_stay(void)
+{
+    const VideoFrame_t *held[3];
+    for (int f = 0; f < 3; f++) {
+        held[f] = acquire(f);
+        TEST_ASSERT_NOT_NULL(held[f]);
+    }
+    // Nothing can be evicted, so the fourth does not fit
+    TEST_ASSERT_NULL(acquire(3));
+    TEST_ASSERT_EQUAL_UINT32(1, stats().rejected);
+    TEST_ASSERT_EQUAL_UINT32(0, stats().evictions);
+
+    ImageCache::clear();
+    for (int f = 0; f < 3; f++) {
+        checkPixels(f, held[f]);
+        ImageCache::release(held[f]);
+    }
+    ImageCache::release(acquire(3));
+    TEST_ASSERT_EQUAL_UINT32(1, stats().evictions);
+}
+
+static void test_failures(void)
+{
+    TEST_ASSERT_NULL(ImageCache::acquire("/cache_missing.raw", SIDE, SIDE));
+    // Neither SIDE x SIDE RGB565 nor RGB332
+    uint8_t odd[IMAGE_BYTES - 5] = {};
+    writeFile(s_files[4], odd, sizeof(odd));
+    TEST_ASSERT_NULL(acquire(4));
+    TEST_ASSERT_EQUAL_UINT32(2, stats().failures);
+
+    // Failed loads gave their bytes back
+    const VideoFrame_t *held[3];
+    for (int f = 0; f < 3; f++) {
+        held[f] = acquire(f);
+        TEST_ASSERT_NOT_NULL(held[f]);
+    }
+    for (int f = 0; f < 3; f++) {
+        ImageCache::release(held[f]);
+    }
+}
+
+static void test_formats(void)
+{
+    // RGB565 on the card, kept as RGB332
+    const VideoFrame_t *image = ImageCache::acquire(s_files[0], SIDE, SIDE, FRAME_FORMAT_RGB332);
+    TEST_ASSERT_NOT_NULL(image);
+    TEST_ASSERT_EQUAL_UINT32(SIDE * SIDE, image->size);
+    for (int i = 0; i < SIDE * SIDE; i++) {
+        TEST_ASSERT_EQUAL_HEX8((PixelConvert<PixelRGB565, PixelRGB332>::convert(pixelOf(0, i))), image->data[i]);
+    }
+    ImageCache::release(image);
+
+    // RGB332 on the card, told apart by its size and expanded
+    std::vector<uint8_t> small(SIDE * SIDE);
+    for (int i = 0; i < SIDE * SIDE; i++) {
+        small[i] = (uint8_t)(i * 7);
+    }
+    writeFile(s_files[6], small.data(), small.size());
+    image = ImageCache::acquire(s_files[6], SIDE, SIDE);
+    TEST_ASSERT_NOT_NULL(image);
+    const uint16_t *pixels = (const uint16_t *)image->data;
+    for (int i = 0; i < SIDE * SIDE; i++) {
+        TEST_ASSERT_EQUAL_HEX16((PixelConvert<PixelRGB332, PixelRGB565>::convert(small[i])), pixels[i]);
+    }
+    ImageCache::release(image);
+}
+
+// A 16x16 file scaled to 8x8 needs a 512 byte scratch buffer beside the
+// 128 byte image, and both count against the budget while it loads
+static void test_scratch_in_budget(void)
+{
+    std::vector<uint16_t> big(4 * SIDE * SIDE, 0x1234);
+    writeFile(s_files[5], big.data(), big.size() * 2);
+
+    TEST_ASSERT_TRUE(ImageCache::begin(5 * IMAGE_BYTES));
+    const VideoFrame_t *held = acquire(0);
+    TEST_ASSERT_NOT_NULL(held);
+    TEST_ASSERT_NULL(ImageCache::acquire(s_files[5], SIDE, SIDE, FRAME_FORMAT_RGB565, 2 * SIDE, 2 * SIDE));
+    TEST_ASSERT_EQUAL_UINT32(1, stats().rejected);
+    TEST_ASSERT_EQUAL_UINT32(1, stats().failures);
+
+    // With the other image unpinned it is evicted to make room
+    ImageCache::release(held);
+    const VideoFrame_t *image =
+        ImageCache::acquire(s_files[5], SIDE, SIDE, FRAME_FORMAT_RGB565, 2 * SIDE, 2 * SIDE);
+    TEST_ASSERT_NOT_NULL(image);
+    TEST_ASSERT_EQUAL_UINT32(1, stats().evictions);
+    const uint16_t *pixels = (const uint16_t *)image->data;
+    for (int i = 0; i < SIDE * SIDE; i++) {
+        TEST_ASSERT_EQUAL_HEX16(0x1234, pixels[i]);
+    }
+
+    // And the scratch buffer was given back: four more fit beside it
+    const VideoFrame_t *more[4];
+    for (int f = 0; f < 4; f++) {
+        more[f] = acquire(f);
+        TEST_ASSERT_NOT_NULL(more[f]);
+    }
+    for (int f = 0; f < 4; f++) {
+        ImageCache::release(more[f]);
+    }
+    ImageCache::release(image);
+}
+
+// Encoded files are decoded to RGB565 and scaled from their own size
+static void test_encoded(void)
+{
+    // 16x16 QOI of one colour, as a single pixel and a run
+    uint8_t qoi[] = {'q', 'o', 'i', 'f', 0, 0, 0, 16, 0, 0, 0, 16, 3, 0,
+                     0xFE, 0x10, 0x80, 0xF0, 0xC0 | 61, 0xC0 | 61, 0xC0 | 61, 0xC0 | 61, 0xC0 | 6,
+                     0, 0, 0, 0, 0, 0, 0, 1};
+    writeFile(s_files[7], qoi, sizeof(qoi));
+    TEST_ASSERT_TRUE(ImageCache::begin(5 * IMAGE_BYTES));
+    const VideoFrame_t *image = ImageCache::acquire(s_files[7], SIDE, SIDE);
+    TEST_ASSERT_NOT_NULL(image);
+    uint16_t expected = ((0x10 & 0xF8) << 8) | ((0x80 & 0xFC) << 3) | (0xF0 >> 3);
+    const uint16_t *pixels = (const uint16_t *)image->data;
+    for (int i = 0; i < SIDE * SIDE; i++) {
+        TEST_ASSERT_EQUAL_HEX16(expected, pixels[i]);
+    }
+    ImageCache::release(image);
+}
+
+static const VideoFrame_t *s_loaded;
+static int s_callbacks;
+
+static void onLoaded(const VideoFrame_t *image, void *arg)
+{
+    s_loaded = image;
+    s_callbacks++;
+    TEST_ASSERT_EQUAL_PTR(&s_callbacks, arg);
+}
+
+static void test_prefetch(void)
+{
+    s_loaded = nullptr;
+    s_callbacks = 0;
+    TEST_ASSERT_TRUE(ImageCache::prefetch(s_files[2], SIDE, SIDE, FRAME_FORMAT_RGB565, onLoaded, &s_callbacks));
+    TEST_ASSERT_EQUAL_INT(1, s_callbacks);
+    checkPixels(2, s_loaded);
+
+    // Unpinned once the callback returned, and a hit from now on
+    const VideoFrame_t *image = ImageCache::tryAcquire(s_files[2], SIDE, SIDE);
+    TEST_ASSERT_EQUAL_PTR(s_loaded, image);
+    ImageCache::release(image);
+    ImageCache::clear();
+    TEST_ASSERT_NULL(ImageCache::tryAcquire(s_files[2], SIDE, SIDE));
+
+    TEST_ASSERT_TRUE(ImageCache::prefetch("/cache_missing.raw", SIDE, SIDE, FRAME_FORMAT_RGB565, onLoaded,
+                                          &s_callbacks));
+    TEST_ASSERT_EQUAL_INT(2, s_callbacks);
+    TEST_ASSERT_NULL(s_loaded);
+}
+
+// Cached pixels are native RGB565 and must reach the panel as such,
+// leaving the caller's byte order setting alone
+static void test_draw(void)
+{
+    TFT_eSPI tft;
+    tft.fillScreen(TFT_BLACK);
+    const VideoFrame_t *image = acquire(1);
+    TEST_ASSERT_NOT_NULL(image);
+    ImageCache::draw(&tft, image, 4, 5);
+    TEST_ASSERT_FALSE(tft.getSwapBytes());
+    for (int i = 0; i < SIDE * SIDE; i++) {
+        TEST_ASSERT_EQUAL_HEX16(pixelOf(1, i), tft.readPixel(4 + i % SIDE, 5 + i / SIDE));
+    }
+    TEST_ASSERT_EQUAL_HEX16(TFT_BLACK, tft.readPixel(3, 5));
+
+    tft.setSwapBytes(true);
+    ImageCache::draw(&tft, image, 40, 5);
+    TEST_ASSERT_TRUE(tft.getSwapBytes());
+    TEST_ASSERT_EQUAL_HEX16(pixelOf(1, 0), tft.readPixel(40, 5));
+    ImageCache::release(image);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_hit_and_miss);
+    RUN_TEST(test_lru_eviction);
+    RUN_TEST(test_pinned_images_stay);
+    RUN_TEST(test_failures);
+    RUN_TEST(test_formats);
+    RUN_TEST(test_scratch_in_budget);
+    RUN_TEST(test_encoded);
+    RUN_TEST(test_prefetch);
+    RUN_TEST(test_draw);
+    return UNITY_END();
+}
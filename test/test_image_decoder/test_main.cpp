@@ -0,0 +1,361 @@
+// ImageDecoder on QOI and BMP images encoded here from known pixels,
+// decoded from memory, from a file and drawn on the stub panel
+
+#include <unity.h>
+#include <Arduino.h>
+#include <SD.h>
+#include <TFT_eSPI.h>
+#include <vector>
+
+#include "ImageDecoder.h"
+
+// Odd width, so BMP rows need padding
+#define IMAGE_WIDTH 13
+#define IMAGE_HEIGHT 7
+#define IMAGE_PIXELS (IMAGE_WIDTH * IMAGE_HEIGHT)
+#define TEST_FILE "/test_image_decoder.qoi"
+
+typedef struct
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} rgb_t;
+
+static std::vector<rgb_t> s_pixels;
+// Palette indices for the RLE8 image and its 16 colours
+static std::vector<uint8_t> s_indices;
+static rgb_t s_palette[16];
+
+static uint16_t rgb565(const rgb_t &c)
+{
+    return ((c.r & 0xF8) << 8) | ((c.g & 0xFC) << 3) | (c.b >> 3);
+}
+
+static void put16(std::vector<uint8_t> *out, uint32_t v)
+{
+    out->push_back(v);
+    out->push_back(v >> 8);
+}
+
+static void put32(std::vector<uint8_t> *out, uint32_t v)
+{
+    put16(out, v);
+    put16(out, v >> 16);
+}
+
+static void put32BigEndian(std::vector<uint8_t> *out, uint32_t v)
+{
+    out->push_back(v >> 24);
+    out->push_back(v >> 16);
+    out->push_back(v >> 8);
+    out->push_back(v);
+}
+
+// Uses every QOI op: runs, index hits, small and luma differences and
+// full RGB values
+static std::vector<uint8_t> encodeQoi()
+{
+    std::vector<uint8_t> out = {'q', 'o', 'i', 'f'};
+    put32BigEndian(&out, IMAGE_WIDTH);
+    put32BigEndian(&out, IMAGE_HEIGHT);
+    out.push_back(3);
+    out.push_back(0);
+
+    rgb_t index[64] = {};
+    rgb_t previous = {0, 0, 0};
+    int run = 0;
+    for (int i = 0; i < IMAGE_PIXELS; i++) {
+        const rgb_t &p = s_pixels[i];
+        if (p.r == previous.r && p.g == previous.g && p.b == previous.b) {
+            if (++run == 62 || i == IMAGE_PIXELS - 1) {
+                out.push_back(0xC0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back(0xC0 | (run - 1));
+            run = 0;
+        }
+        int hash = (p.r * 3 + p.g * 5 + p.b * 7 + 255 * 11) % 64;
+        int dr = (int8_t)(p.r - previous.r);
+        int dg = (int8_t)(p.g - previous.g);
+        int db = (int8_t)(p.b - previous.b);
+        if (index[hash].r == p.r && index[hash].g == p.g && index[hash].b == p.b) {
+            out.push_back(hash);
+        } else if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+            out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+        } else if (dg >= -32 && dg <= 31 && dr - dg >= -8 && dr - dg <= 7 && db - dg >= -8 && db - dg <= 7) {
+            out.push_back(0x80 | (dg + 32));
+            out.push_back((dr - dg + 8) << 4 | (db - dg + 8));
+        } else {
+            out.push_back(0xFE);
+            out.push_back(p.r);
+            out.push_back(p.g);
+            out.push_back(p.b);
+        }
+        index[hash] = p;
+        previous = p;
+    }
+    for (int i = 0; i < 7; i++) {
+        out.push_back(0);
+    }
+    out.push_back(1);
+    return out;
+}
+
+static void bmpHeaders(std::vector<uint8_t> *out, uint32_t pixel_bytes, int bpp, int height, uint32_t compression,
+                       int colors)
+{
+    uint32_t pixel_offset = 14 + 40 + colors * 4;
+    out->push_back('B');
+    out->push_back('M');
+    put32(out, pixel_offset + pixel_bytes);
+    put32(out, 0);
+    put32(out, pixel_offset);
+    put32(out, 40);
+    put32(out, IMAGE_WIDTH);
+    put32(out, (uint32_t)height);
+    put16(out, 1);
+    put16(out, bpp);
+    put32(out, compression);
+    put32(out, pixel_bytes);
+    put32(out, 2835);
+    put32(out, 2835);
+    put32(out, colors);
+    put32(out, 0);
+}
+
+// Negative height for top-down rows, positive for the usual bottom-up
+static std::vector<uint8_t> encodeBmp24(bool top_down)
+{
+    uint32_t stride = (IMAGE_WIDTH * 3 + 3) & ~3u;
+    std::vector<uint8_t> out;
+    bmpHeaders(&out, stride * IMAGE_HEIGHT, 24, top_down ? -IMAGE_HEIGHT : IMAGE_HEIGHT, 0, 0);
+    for (int row = 0; row < IMAGE_HEIGHT; row++) {
+        int y = top_down ? row : IMAGE_HEIGHT - 1 - row;
+        for (int x = 0; x < IMAGE_WIDTH; x++) {
+            const rgb_t &p = s_pixels[y * IMAGE_WIDTH + x];
+            out.push_back(p.b);
+            out.push_back(p.g);
+            out.push_back(p.r);
+        }
+        for (uint32_t pad = IMAGE_WIDTH * 3; pad < stride; pad++) {
+            out.push_back(0);
+        }
+    }
+    return out;
+}
+
+// Bottom-up RLE8 with encoded runs and an absolute run on every row
+static std::vector<uint8_t> encodeRle8()
+{
+    std::vector<uint8_t> data;
+    for (int row = IMAGE_HEIGHT - 1; row >= 0; row--) {
+        const uint8_t *line = &s_indices[row * IMAGE_WIDTH];
+        int x = 0;
+        while (x < IMAGE_WIDTH) {
+            int run = 1;
+            while (x + run < IMAGE_WIDTH && line[x + run] == line[x]) {
+                run++;
+            }
+            if (run >= 2) {
+                data.push_back(run);
+                data.push_back(line[x]);
+                x += run;
+                continue;
+            }
+            // Absolute runs are at least three pixels and padded to a word
+            int literal = min(3, IMAGE_WIDTH - x);
+            if (literal < 3) {
+                data.push_back(1);
+                data.push_back(line[x]);
+                x++;
+                continue;
+            }
+            data.push_back(0);
+            data.push_back(literal);
+            for (int i = 0; i < literal; i++) {
+                data.push_back(line[x + i]);
+            }
+            data.push_back(0);
+            x += literal;
+        }
+        data.push_back(0);
+        data.push_back(0);
+    }
+    data.push_back(0);
+    data.push_back(1);
+
+    std::vector<uint8_t> out;
+    bmpHeaders(&out, data.size(), 8, IMAGE_HEIGHT, 1, 16);
+    for (int i = 0; i < 16; i++) {
+        out.push_back(s_palette[i].b);
+        out.push_back(s_palette[i].g);
+        out.push_back(s_palette[i].r);
+        out.push_back(0);
+    }
+    out.insert(out.end(), data.begin(), data.end());
+    return out;
+}
+
+static std::vector<uint16_t> expectedTrueColor()
+{
+    std::vector<uint16_t> expected(IMAGE_PIXELS);
+    for (int i = 0; i < IMAGE_PIXELS; i++) {
+        expected[i] = rgb565(s_pixels[i]);
+    }
+    return expected;
+}
+
+static std::vector<uint16_t> expectedPalette()
+{
+    std::vector<uint16_t> expected(IMAGE_PIXELS);
+    for (int i = 0; i < IMAGE_PIXELS; i++) {
+        expected[i] = rgb565(s_palette[s_indices[i]]);
+    }
+    return expected;
+}
+
+// Flat bands with a gradient and noise, so runs, index hits and
+// differences all turn up
+void setUp(void)
+{
+    s_pixels.resize(IMAGE_PIXELS);
+    s_indices.resize(IMAGE_PIXELS);
+    uint32_t state = 12345;
+    for (int y = 0; y < IMAGE_HEIGHT; y++) {
+        for (int x = 0; x < IMAGE_WIDTH; x++) {
+            state = state * 1664525u + 1013904223u;
+            rgb_t *p = &s_pixels[y * IMAGE_WIDTH + x];
+            if (y < 2) {
+                *p = {200, 40, 90};
+            } else if (y < 5) {
+                *p = {(uint8_t)(x * 9), (uint8_t)(100 + x), (uint8_t)(y * 30)};
+            } else {
+                *p = {(uint8_t)(state >> 24), (uint8_t)(state >> 16), (uint8_t)(state >> 8)};
+            }
+            s_indices[y * IMAGE_WIDTH + x] = x < 4 ? y % 16 : (x * 7 + y) % 16;
+        }
+    }
+    for (int i = 0; i < 16; i++) {
+        s_palette[i] = {(uint8_t)(i * 16), (uint8_t)(255 - i * 9), (uint8_t)(i * 40)};
+    }
+}
+
+void tearDown(void)
+{
+    SD.remove(TEST_FILE);
+}
+
+static void checkDecode(const std::vector<uint8_t> &file, ImageType type, const std::vector<uint16_t> &expected)
+{
+    ImageDecoder decoder;
+    TEST_ASSERT_TRUE(decoder.open(file.data(), file.size()));
+    TEST_ASSERT_EQUAL(type, decoder.type());
+    TEST_ASSERT_EQUAL_INT(IMAGE_WIDTH, decoder.width());
+    TEST_ASSERT_EQUAL_INT(IMAGE_HEIGHT, decoder.height());
+    std::vector<uint16_t> pixels(IMAGE_PIXELS);
+    TEST_ASSERT_TRUE(decoder.decodeImage(pixels.data()));
+    TEST_ASSERT_EQUAL_HEX16_ARRAY(expected.data(), pixels.data(), IMAGE_PIXELS);
+}
+
+// draw() must show the same colours on the panel, byte order included,
+// and leave the caller's swap setting alone
+static void checkDraw(const std::vector<uint8_t> &file, const std::vector<uint16_t> &expected)
+{
+    TFT_eSPI tft;
+    tft.fillScreen(TFT_BLACK);
+    ImageDecoder decoder;
+    TEST_ASSERT_TRUE(decoder.open(file.data(), file.size()));
+    TEST_ASSERT_TRUE(decoder.draw(&tft, 3, 2));
+    TEST_ASSERT_FALSE(tft.getSwapBytes());
+    TEST_ASSERT_EQUAL_UINT32(IMAGE_PIXELS, tft.pushed_pixels);
+    for (int i = 0; i < IMAGE_PIXELS; i++) {
+        TEST_ASSERT_EQUAL_HEX16(expected[i], tft.readPixel(3 + i % IMAGE_WIDTH, 2 + i / IMAGE_WIDTH));
+    }
+    TEST_ASSERT_EQUAL_HEX16(TFT_BLACK, tft.readPixel(2, 2));
+    TEST_ASSERT_EQUAL_HEX16(TFT_BLACK, tft.readPixel(3, 2 + IMAGE_HEIGHT));
+}
+
+static void test_qoi(void)
+{
+    std::vector<uint8_t> file = encodeQoi();
+    checkDecode(file, IMAGE_TYPE_QOI, expectedTrueColor());
+    checkDraw(file, expectedTrueColor());
+}
+
+static void test_bmp24_top_down(void)
+{
+    std::vector<uint8_t> file = encodeBmp24(true);
+    checkDecode(file, IMAGE_TYPE_BMP, expectedTrueColor());
+    checkDraw(file, expectedTrueColor());
+}
+
+static void test_bmp24_bottom_up(void)
+{
+    std::vector<uint8_t> file = encodeBmp24(false);
+    checkDecode(file, IMAGE_TYPE_BMP, expectedTrueColor());
+    checkDraw(file, expectedTrueColor());
+
+    // Strips come out last row first and say where they go
+    ImageDecoder decoder;
+    TEST_ASSERT_TRUE(decoder.open(file.data(), file.size()));
+    uint16_t strip[IMAGE_WIDTH * 2];
+    int first_row = -1;
+    TEST_ASSERT_EQUAL_INT(2, decoder.decodeStrip(strip, 2, &first_row));
+    TEST_ASSERT_EQUAL_INT(IMAGE_HEIGHT - 2, first_row);
+    std::vector<uint16_t> expected = expectedTrueColor();
+    TEST_ASSERT_EQUAL_HEX16_ARRAY(&expected[(IMAGE_HEIGHT - 2) * IMAGE_WIDTH], strip, IMAGE_WIDTH * 2);
+}
+
+static void test_bmp_rle8(void)
+{
+    std::vector<uint8_t> file = encodeRle8();
+    checkDecode(file, IMAGE_TYPE_BMP, expectedPalette());
+    checkDraw(file, expectedPalette());
+}
+
+static void test_truncated(void)
+{
+    std::vector<uint8_t> file = encodeQoi();
+    file.resize(file.size() / 2);
+    ImageDecoder decoder;
+    TEST_ASSERT_TRUE(decoder.open(file.data(), file.size()));
+    std::vector<uint16_t> pixels(IMAGE_PIXELS);
+    TEST_ASSERT_FALSE(decoder.decodeImage(pixels.data()));
+
+    uint8_t junk[64] = {'B', 'M'};
+    TEST_ASSERT_FALSE(decoder.open(junk, sizeof(junk)));
+}
+
+// Through the SD scheduler, which reads in the caller's context here
+static void test_open_file(void)
+{
+    std::vector<uint8_t> data = encodeQoi();
+    File file = SD.open(TEST_FILE, FILE_WRITE);
+    TEST_ASSERT_TRUE(file);
+    TEST_ASSERT_EQUAL_UINT32(data.size(), file.write(data.data(), data.size()));
+    file.close();
+
+    ImageDecoder decoder;
+    TEST_ASSERT_TRUE(decoder.open(TEST_FILE));
+    std::vector<uint16_t> pixels(IMAGE_PIXELS);
+    TEST_ASSERT_TRUE(decoder.decodeImage(pixels.data()));
+    std::vector<uint16_t> expected = expectedTrueColor();
+    TEST_ASSERT_EQUAL_HEX16_ARRAY(expected.data(), pixels.data(), IMAGE_PIXELS);
+    TEST_ASSERT_FALSE(decoder.open("/missing.qoi"));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_qoi);
+    RUN_TEST(test_bmp24_top_down);
+    RUN_TEST(test_bmp24_bottom_up);
+    RUN_TEST(test_bmp_rle8);
+    RUN_TEST(test_truncated);
+    RUN_TEST(test_open_file);
+    return UNITY_END();
+}
@@ -0,0 +1,138 @@
+// Frames read from a FAT image with ContiguousFile and pushed through
+// StaticFramePipeline to the stub panel, checked pixel by pixel
+
+#include <unity.h>
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+
+#include "FatImage.h"
+#include "FatVolume.h"
+#include "FramePipeline.h"
+
+#define TEST_IMAGE "test_pipeline.img"
+
+// Height is not a multiple of the strip, so the tail strip is covered too
+#define FRAME_WIDTH 40
+#define FRAME_HEIGHT 21
+#define FRAME_PIXELS (FRAME_WIDTH * FRAME_HEIGHT)
+#define FRAME_X 7
+#define FRAME_Y 5
+#define BACKGROUND 0x1234
+
+typedef StaticFramePipeline<PixelRGB332, PixelRGB565, FRAME_WIDTH, FRAME_HEIGHT> Pipeline332;
+typedef StaticFramePipeline<PixelRGB565, PixelRGB565, FRAME_WIDTH, FRAME_HEIGHT> Pipeline565;
+
+static ImageBlockDevice s_device;
+static FatVolume s_volume;
+static std::vector<uint8_t> s_frame332;
+static std::vector<uint8_t> s_frame565;
+
+// Native RGB565 in memory, as the video player stores it
+static uint16_t pixel565(int i)
+{
+    return (uint16_t)(i * 0x9E37 + 0x55);
+}
+
+void setUp(void)
+{
+    s_frame332.resize(FRAME_PIXELS);
+    s_frame565.resize(FRAME_PIXELS * 2);
+    for (int i = 0; i < FRAME_PIXELS; i++) {
+        s_frame332[i] = (uint8_t)(i * 37 + 11);
+        uint16_t c = pixel565(i);
+        memcpy(&s_frame565[i * 2], &c, 2);
+    }
+    FatImage image(FAT_TYPE_FAT16);
+    image.addFile("/output_frame/frame1.bin", s_frame332);
+    image.addFile("/output_frame/frame2.bin", s_frame565);
+    image.build();
+    TEST_ASSERT_TRUE(image.save(TEST_IMAGE));
+    TEST_ASSERT_TRUE(s_device.open(TEST_IMAGE));
+    TEST_ASSERT_TRUE(s_volume.mount(&s_device));
+}
+
+void tearDown(void)
+{
+    s_device.close();
+    remove(TEST_IMAGE);
+}
+
+static std::vector<uint8_t> readFrame(const char *path, uint32_t bytes)
+{
+    ContiguousFile file;
+    std::vector<uint8_t> data(bytes);
+    TEST_ASSERT_TRUE(file.open(&s_volume, path));
+    TEST_ASSERT_EQUAL_UINT32(bytes, file.size());
+    TEST_ASSERT_EQUAL_INT32(bytes, file.read(0, data.data(), bytes));
+    return data;
+}
+
+// Outside the frame the panel must be untouched
+static void checkBackground(TFT_eSPI *tft)
+{
+    for (int y = 0; y < tft->height(); y++) {
+        for (int x = 0; x < tft->width(); x++) {
+            bool inside = x >= FRAME_X && x < FRAME_X + FRAME_WIDTH && y >= FRAME_Y && y < FRAME_Y + FRAME_HEIGHT;
+            if (!inside) {
+                TEST_ASSERT_EQUAL_HEX16(BACKGROUND, tft->readPixel(x, y));
+            }
+        }
+    }
+}
+
+static void test_convert_matches_tft(void)
+{
+    TFT_eSPI tft;
+    for (int c = 0; c < 256; c++) {
+        TEST_ASSERT_EQUAL_HEX16(tft.color8to16(c), (PixelConvert<PixelRGB332, PixelRGB565>::convert(c)));
+        // RGB332 survives the round trip
+        uint16_t wide = PixelConvert<PixelRGB332, PixelRGB565>::convert(c);
+        TEST_ASSERT_EQUAL_HEX8(c, (PixelConvert<PixelRGB565, PixelRGB332>::convert(wide)));
+    }
+}
+
+static void test_push_rgb332(void)
+{
+    std::vector<uint8_t> frame = readFrame("/output_frame/frame1.bin", FRAME_PIXELS);
+    TEST_ASSERT_EQUAL_MEMORY(s_frame332.data(), frame.data(), FRAME_PIXELS);
+
+    TFT_eSPI tft;
+    tft.fillScreen(BACKGROUND);
+    uint16_t strip[Pipeline332::strip_pixels];
+    Pipeline332::push(&tft, FRAME_X, FRAME_Y, frame.data(), strip);
+
+    TEST_ASSERT_EQUAL_UINT32(FRAME_PIXELS, tft.pushed_pixels);
+    // One window per strip, the last one short
+    TEST_ASSERT_EQUAL_UINT32((FRAME_HEIGHT + Pipeline332::strip_rows - 1) / Pipeline332::strip_rows, tft.windows);
+    for (int i = 0; i < FRAME_PIXELS; i++) {
+        uint16_t shown = tft.readPixel(FRAME_X + i % FRAME_WIDTH, FRAME_Y + i / FRAME_WIDTH);
+        TEST_ASSERT_EQUAL_HEX16(tft.color8to16(s_frame332[i]), shown);
+    }
+    checkBackground(&tft);
+}
+
+static void test_push_rgb565(void)
+{
+    std::vector<uint8_t> frame = readFrame("/output_frame/frame2.bin", FRAME_PIXELS * 2);
+
+    TFT_eSPI tft;
+    tft.fillScreen(BACKGROUND);
+    Pipeline565::push(&tft, FRAME_X, FRAME_Y, frame.data(), nullptr);
+
+    // Matching formats go out in one window with no conversion strip
+    TEST_ASSERT_EQUAL_UINT32(FRAME_PIXELS, tft.pushed_pixels);
+    TEST_ASSERT_EQUAL_UINT32(1, tft.windows);
+    for (int i = 0; i < FRAME_PIXELS; i++) {
+        TEST_ASSERT_EQUAL_HEX16(pixel565(i), tft.readPixel(FRAME_X + i % FRAME_WIDTH, FRAME_Y + i / FRAME_WIDTH));
+    }
+    checkBackground(&tft);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_convert_matches_tft);
+    RUN_TEST(test_push_rgb332);
+    RUN_TEST(test_push_rgb565);
+    return UNITY_END();
+}